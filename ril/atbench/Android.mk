@@ -0,0 +1,46 @@
+# Copyright 2006 The Android Open Source Project
+
+LOCAL_PATH:= $(call my-dir)
+
+# For atbench binary, times the libril-at line handling on an AT trace
+# ====================================================================
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    atbench.c \
+    ../libril-at/at_scan.c \
+    ../libril-at/at_tok.c
+
+LOCAL_CFLAGS := -D_GNU_SOURCE
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libril-at
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_LDLIBS += -lrt
+
+LOCAL_MODULE:= atbench
+LOCAL_MODULE_TAGS := debug
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    atbench.c \
+    ../libril-at/at_scan.c \
+    ../libril-at/at_tok.c
+
+LOCAL_CFLAGS := -D_GNU_SOURCE
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libril-at
+LOCAL_SHARED_LIBRARIES := liblog
+
+# same NEON scanner as libril-at-cyit
+ifeq ($(TARGET_ARCH),arm)
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+  LOCAL_CFLAGS += -DAT_SCAN_HAVE_NEON
+  LOCAL_STATIC_LIBRARIES += libril-at-scan-neon
+endif
+endif
+
+LOCAL_MODULE:= atbench
+LOCAL_MODULE_TAGS := debug
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,636 @@
+/* //device/system/reference-ril/atbench.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Offline benchmark of the libril-at line handling on a recorded AT
+ * trace ring (see at_trace.h). The received bytes of the trace are
+ * loaded once and run through each implementation many times:
+ *
+ *   scan   end of line search of the reader: byte loop, word at a time
+ *          and the NEON or SSE2 version picked by at_scan_init(); the
+ *          at_tok delimiter search likewise; and line classification,
+ *          strStartsWith over the final response tables against the
+ *          prefix matcher
+ *   parse  the +CLCC, ^DSCI, +CGACT and +CGDCONT lines of the trace
+ *          through the at_tok_parse() layouts atparser uses, against the
+ *          at_tok_next*() call sequences they replaced
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "at_trace.h"
+#include "at_scan.h"
+#include "at_tok.h"
+
+#define DEF_ROUNDS      200
+#define MAX_LINE        1024
+
+typedef struct {
+    const char *data;
+    int len;
+} Chunk;
+
+static Chunk *s_chunks;
+static int s_chunkCount;
+static long s_chunkBytes;
+
+/* received lines, nul terminated, empty ones dropped as in readline() */
+static char **s_lines;
+static int s_lineCount;
+static long s_lineBytes;
+
+static int s_rounds = DEF_ROUNDS;
+static volatile long s_sink;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-m mode] [-n rounds] [trace file]\n"
+            "    -m mode      scan or parse, default scan\n"
+            "    -n rounds    passes over the trace, default %d\n"
+            "    trace file   defaults to %s\n",
+            name, DEF_ROUNDS, AT_TRACE_FILE);
+}
+
+static double nowUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void addLine(const char *s, int len)
+{
+    char *line;
+
+    if (len == 0) return;
+    if (len >= MAX_LINE) len = MAX_LINE - 1;
+
+    line = (char *)malloc(len + 1);
+    memcpy(line, s, len);
+    line[len] = '\0';
+    s_lines[s_lineCount++] = line;
+    s_lineBytes += len;
+}
+
+/* keeps the received records of the ring and splits them into lines */
+static int loadTrace(const char *path)
+{
+    ATTraceHeader hdr;
+    unsigned char *ring;
+    unsigned int pos, left;
+    int i;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+            || hdr.magic != AT_TRACE_MAGIC
+            || hdr.version != AT_TRACE_VERSION
+            || hdr.used > hdr.size || hdr.tail >= hdr.size || hdr.head >= hdr.size) {
+        fprintf(stderr, "%s: not an AT trace file\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    ring = (unsigned char *)malloc(hdr.size);
+    fseek(fp, hdr.hdrSize, SEEK_SET);
+    if (ring == NULL || fread(ring, 1, hdr.size, fp) != hdr.size) {
+        fprintf(stderr, "%s: truncated trace\n", path);
+        free(ring);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    // at most one chunk per record header //
+    s_chunks = (Chunk *)malloc(sizeof(Chunk) * (hdr.used / sizeof(ATTraceRecord) + 1));
+
+    // walk from oldest record, same rules as attrace //
+    pos = hdr.tail;
+    left = hdr.used;
+    while (left > 0) {
+        const ATTraceRecord *rec;
+        unsigned int recsize;
+
+        if (hdr.size - pos < sizeof(ATTraceRecord)) {
+            left -= hdr.size - pos;
+            pos = 0;
+            continue;
+        }
+
+        rec = (const ATTraceRecord *)(ring + pos);
+        if (rec->len == AT_TRACE_PAD_LEN) {
+            left -= hdr.size - pos;
+            pos = 0;
+            continue;
+        }
+
+        recsize = AT_TRACE_ALIGN(sizeof(ATTraceRecord) + rec->len);
+        if (recsize > left || pos + recsize > hdr.size) {
+            fprintf(stderr, "corrupted record at %u\n", pos);
+            break;
+        }
+
+        if (rec->dir == AT_TRACE_DIR_RX && rec->len > 0) {
+            s_chunks[s_chunkCount].data = (const char *)(rec + 1);
+            s_chunks[s_chunkCount].len = rec->len;
+            s_chunkCount++;
+            s_chunkBytes += rec->len;
+        }
+
+        left -= recsize;
+        pos += recsize;
+        if (pos >= hdr.size) pos = 0;
+    }
+
+    // a line per record at most, records are whole lines on the mux //
+    s_lines = (char **)malloc(sizeof(char *) * (s_chunkBytes / 2 + 1));
+    for (i = 0; i < s_chunkCount; i++) {
+        const char *p = s_chunks[i].data;
+        const char *end = p + s_chunks[i].len;
+        const char *start = p;
+
+        for (; p < end; p++) {
+            if (*p == '\r' || *p == '\n') {
+                addLine(start, (int)(p - start));
+                start = p + 1;
+            }
+        }
+        addLine(start, (int)(end - start));
+    }
+
+    if (s_chunkCount == 0) {
+        fprintf(stderr, "%s: no received data\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* scan mode                                                          */
+/* ------------------------------------------------------------------ */
+
+/* readline() before at_scan */
+static int scanEolByte(const char *buf, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] == '\r' || buf[i] == '\n') break;
+    }
+    return i;
+}
+
+static const char * scanDelimByte(const char *s)
+{
+    while (*s != ',' && *s != '"' && *s != '\0') s++;
+    return s;
+}
+
+static double benchEol(int (*scan)(const char *buf, int len))
+{
+    double t = nowUs();
+    long sum = 0;
+    int r, i;
+
+    for (r = 0; r < s_rounds; r++) {
+        for (i = 0; i < s_chunkCount; i++) {
+            const char *buf = s_chunks[i].data;
+            int len = s_chunks[i].len;
+            int pos = 0;
+
+            while (pos < len) {
+                int n = scan(buf + pos, len - pos);
+
+                sum += n;
+                pos += n + 1;
+            }
+        }
+    }
+    s_sink = sum;
+
+    return nowUs() - t;
+}
+
+static double benchDelim(const char * (*scan)(const char *s))
+{
+    double t = nowUs();
+    long sum = 0;
+    int r, i;
+
+    for (r = 0; r < s_rounds; r++) {
+        for (i = 0; i < s_lineCount; i++) {
+            const char *p = s_lines[i];
+
+            for (;;) {
+                p = scan(p);
+                if (*p == '\0') break;
+                p++;
+                sum++;
+            }
+        }
+    }
+    s_sink = sum;
+
+    return nowUs() - t;
+}
+
+/* same tables and order as the strStartsWith chain atchannel had */
+static const char * s_finalError[] = { "ERROR", "+CMS ERROR:", "+CME ERROR:" };
+static const char * s_finalSuccess[] = { "OK", "CONNECT" };
+static const char * s_smsUnsol[] = { "+CMT:", "+CDS:", "+CBM:" };
+
+#define NUM_ELEMS(x) (sizeof(x) / sizeof((x)[0]))
+
+static int strStartsWith(const char *line, const char *prefix)
+{
+    for ( ; *line != '\0' && *prefix != '\0' ; line++, prefix++) {
+        if (*line != *prefix) {
+            return 0;
+        }
+    }
+
+    return *prefix == '\0';
+}
+
+static int classifyChain(const char *line)
+{
+    size_t i;
+
+    for (i = 0; i < NUM_ELEMS(s_finalSuccess); i++) {
+        if (strStartsWith(line, s_finalSuccess[i])) return 1;
+    }
+    for (i = 0; i < NUM_ELEMS(s_finalError); i++) {
+        if (strStartsWith(line, s_finalError[i])) return 2;
+    }
+    for (i = 0; i < NUM_ELEMS(s_smsUnsol); i++) {
+        if (strStartsWith(line, s_smsUnsol[i])) return 3;
+    }
+    return 0;
+}
+
+static ATPrefixMatcher s_matcher;
+
+static int classifyMatcher(const char *line)
+{
+    return at_prefix_match(&s_matcher, line);
+}
+
+static double benchClassify(int (*classify)(const char *line))
+{
+    double t = nowUs();
+    long sum = 0;
+    int r, i;
+
+    for (r = 0; r < s_rounds; r++) {
+        for (i = 0; i < s_lineCount; i++) {
+            sum += classify(s_lines[i]);
+        }
+    }
+    s_sink = sum;
+
+    return nowUs() - t;
+}
+
+static void report(const char *what, const char *impl, double us, long units,
+        const char *unit, double base)
+{
+    printf("%-9s %-6s %9.1f ms %8.2f ns/%s  x%.2f\n", what, impl, us / 1000,
+            us * 1000 / ((double)units * s_rounds), unit, base / us);
+}
+
+static void runScan(void)
+{
+    ATPrefixEntry entries[NUM_ELEMS(s_finalError) + NUM_ELEMS(s_finalSuccess)
+            + NUM_ELEMS(s_smsUnsol)];
+    int (*eolWord)(const char *buf, int len) = at_scan_eol;
+    const char * (*delimWord)(const char *s) = at_scan_delim;
+    double byteUs, us;
+    size_t i;
+    int n = 0;
+
+    // the pointers start on the word versions, init picks the vector ones //
+    at_scan_init();
+
+    byteUs = benchEol(scanEolByte);
+    report("eol", "byte", byteUs, s_chunkBytes, "byte", byteUs);
+    report("eol", "word", benchEol(eolWord), s_chunkBytes, "byte", byteUs);
+    report("eol", at_scan_impl_name(), benchEol(at_scan_eol), s_chunkBytes, "byte", byteUs);
+
+    byteUs = benchDelim(scanDelimByte);
+    report("delim", "byte", byteUs, s_lineBytes, "byte", byteUs);
+    report("delim", "word", benchDelim(delimWord), s_lineBytes, "byte", byteUs);
+    report("delim", at_scan_impl_name(), benchDelim(at_scan_delim), s_lineBytes, "byte", byteUs);
+
+    for (i = 0; i < NUM_ELEMS(s_finalError); i++) {
+        entries[n].prefix = s_finalError[i];
+        entries[n++].cls = 2;
+    }
+    for (i = 0; i < NUM_ELEMS(s_finalSuccess); i++) {
+        entries[n].prefix = s_finalSuccess[i];
+        entries[n++].cls = 1;
+    }
+    for (i = 0; i < NUM_ELEMS(s_smsUnsol); i++) {
+        entries[n].prefix = s_smsUnsol[i];
+        entries[n++].cls = 3;
+    }
+    at_prefix_matcher_build(&s_matcher, entries, n);
+
+    // both must agree before their times mean anything //
+    for (n = 0; n < s_lineCount; n++) {
+        if (classifyChain(s_lines[n]) != classifyMatcher(s_lines[n])) {
+            fprintf(stderr, "classify differs on \"%s\"\n", s_lines[n]);
+            return;
+        }
+    }
+
+    us = benchClassify(classifyChain);
+    report("classify", "chain", us, s_lineCount, "line", us);
+    report("classify", "match", benchClassify(classifyMatcher), s_lineCount, "line", us);
+}
+
+/* ------------------------------------------------------------------ */
+/* parse mode                                                         */
+/* ------------------------------------------------------------------ */
+
+/* one struct for all kinds, only the fields of the kind are set */
+typedef struct {
+    int index;
+    char isMT;
+    int state;
+    int mode;
+    char isMpty;
+    char *number;
+    int toa;
+    char *type;
+    char *address;
+} ParsedLine;
+
+/* the layouts of atparser.c */
+static const ATField s_clccFields[] = {
+    AT_FIELD(AT_FIELD_INT, ParsedLine, index),
+    AT_FIELD(AT_FIELD_BOOL, ParsedLine, isMT),
+    AT_FIELD(AT_FIELD_INT, ParsedLine, state),
+    AT_FIELD(AT_FIELD_INT, ParsedLine, mode),
+    AT_FIELD(AT_FIELD_BOOL, ParsedLine, isMpty),
+    AT_FIELD(AT_FIELD_STR | AT_FIELD_OPTIONAL, ParsedLine, number),
+    AT_FIELD(AT_FIELD_INT, ParsedLine, toa),
+};
+
+static const ATField s_dsciFields[] = {
+    AT_FIELD(AT_FIELD_INT, ParsedLine, index),
+    AT_FIELD(AT_FIELD_BOOL, ParsedLine, isMT),
+    AT_FIELD(AT_FIELD_INT, ParsedLine, state),
+    AT_FIELD(AT_FIELD_INT, ParsedLine, mode),
+    AT_FIELD(AT_FIELD_BOOL | AT_FIELD_OPTIONAL, ParsedLine, isMpty),
+    AT_FIELD(AT_FIELD_STR | AT_FIELD_OPTIONAL, ParsedLine, number),
+    AT_FIELD(AT_FIELD_INT | AT_FIELD_OPTIONAL, ParsedLine, toa),
+};
+
+static const ATField s_cgactFields[] = {
+    AT_FIELD(AT_FIELD_INT, ParsedLine, index),
+    AT_FIELD(AT_FIELD_INT, ParsedLine, state),
+};
+
+static const ATField s_cgdcontFields[] = {
+    AT_FIELD(AT_FIELD_INT, ParsedLine, index),
+    AT_FIELD(AT_FIELD_STR, ParsedLine, type),
+    AT_FIELD_SKIPPED,
+    AT_FIELD(AT_FIELD_STR, ParsedLine, address),
+};
+
+/* the call sequences of atparser.c before the layouts */
+static int tokCall(char *line, ParsedLine *out, int shortForm)
+{
+    if (at_tok_start(&line) < 0) return -1;
+    if (at_tok_nextint(&line, &out->index) < 0) return -1;
+    if (at_tok_nextbool(&line, &out->isMT) < 0) return -1;
+    if (at_tok_nextint(&line, &out->state) < 0) return -1;
+    if (at_tok_nextint(&line, &out->mode) < 0) return -1;
+    if (shortForm && !at_tok_hasmore(&line)) return 0;
+    if (at_tok_nextbool(&line, &out->isMpty) < 0) return -1;
+    if (at_tok_hasmore(&line)) {
+        if (at_tok_nextstr(&line, &out->number) < 0) return 0;
+        if (shortForm && !at_tok_hasmore(&line)) return 0;
+        if (at_tok_nextint(&line, &out->toa) < 0) return -1;
+    }
+    return 0;
+}
+
+static int tokClcc(char *line, ParsedLine *out)
+{
+    return tokCall(line, out, 0);
+}
+
+static int tokDsci(char *line, ParsedLine *out)
+{
+    return tokCall(line, out, 1);
+}
+
+static int tokCgact(char *line, ParsedLine *out)
+{
+    if (at_tok_start(&line) < 0) return -1;
+    if (at_tok_nextint(&line, &out->index) < 0) return -1;
+    if (at_tok_nextint(&line, &out->state) < 0) return -1;
+    return 0;
+}
+
+static int tokCgdcont(char *line, ParsedLine *out)
+{
+    char *apn;
+
+    if (at_tok_start(&line) < 0) return -1;
+    if (at_tok_nextint(&line, &out->index) < 0) return -1;
+    if (at_tok_nextstr(&line, &out->type) < 0) return -1;
+    if (at_tok_nextstr(&line, &apn) < 0) return -1;
+    if (at_tok_nextstr(&line, &out->address) < 0) return -1;
+    return 0;
+}
+
+typedef struct {
+    const char *prefix;
+    ATLayout layout;
+    int (*tok)(char *line, ParsedLine *out);
+} ParseKind;
+
+static const ParseKind s_kinds[] = {
+    { "+CLCC:", AT_LAYOUT(s_clccFields), tokClcc },
+    { "^DSCI:", AT_LAYOUT(s_dsciFields), tokDsci },
+    { "+CGACT:", AT_LAYOUT(s_cgactFields), tokCgact },
+    { "+CGDCONT:", AT_LAYOUT(s_cgdcontFields), tokCgdcont },
+};
+
+typedef struct {
+    const char *line;
+    int len;
+    const ParseKind *kind;
+} ParseItem;
+
+static ParseItem *s_items;
+static int s_itemCount;
+
+#define PARSE_COPY  0
+#define PARSE_TOK   1
+#define PARSE_LAYOUT 2
+
+/* both parsers modify the line, every pass starts from a copy */
+static int parseOne(const ParseItem *item, int how, char *buf, ParsedLine *out)
+{
+    ATTokError tokErr;
+
+    memcpy(buf, item->line, item->len + 1);
+    memset(out, 0, sizeof(ParsedLine));
+
+    if (how == PARSE_TOK) return item->kind->tok(buf, out);
+    if (how == PARSE_LAYOUT) {
+        return at_tok_parse(buf, &item->kind->layout, out, &tokErr) < 0 ? -1 : 0;
+    }
+    return 0;
+}
+
+static int sameStr(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL) return a == b;
+    return strcmp(a, b) == 0;
+}
+
+static double benchParse(int how)
+{
+    char buf[MAX_LINE];
+    ParsedLine out;
+    double t = nowUs();
+    long sum = 0;
+    int r, i;
+
+    for (r = 0; r < s_rounds; r++) {
+        for (i = 0; i < s_itemCount; i++) {
+            sum += parseOne(&s_items[i], how, buf, &out) + out.index;
+        }
+    }
+    s_sink = sum;
+
+    return nowUs() - t;
+}
+
+static void runParse(void)
+{
+    char bufTok[MAX_LINE], bufLayout[MAX_LINE];
+    ParsedLine tok, layout;
+    double copyUs, tokUs, layoutUs;
+    int counts[NUM_ELEMS(s_kinds)];
+    size_t k;
+    int i;
+
+    at_scan_init();
+
+    memset(counts, 0, sizeof(counts));
+    s_items = (ParseItem *)malloc(sizeof(ParseItem) * (s_lineCount + 1));
+    for (i = 0; i < s_lineCount; i++) {
+        for (k = 0; k < NUM_ELEMS(s_kinds); k++) {
+            if (strncmp(s_lines[i], s_kinds[k].prefix, strlen(s_kinds[k].prefix)) == 0) {
+                s_items[s_itemCount].line = s_lines[i];
+                s_items[s_itemCount].len = (int)strlen(s_lines[i]);
+                s_items[s_itemCount].kind = &s_kinds[k];
+                s_itemCount++;
+                counts[k]++;
+                break;
+            }
+        }
+    }
+
+    for (k = 0; k < NUM_ELEMS(s_kinds); k++) {
+        printf("%-10s %d lines\n", s_kinds[k].prefix, counts[k]);
+    }
+    if (s_itemCount == 0) {
+        fprintf(stderr, "no line to parse in the trace\n");
+        return;
+    }
+
+    // both must agree before their times mean anything //
+    for (i = 0; i < s_itemCount; i++) {
+        int errTok = parseOne(&s_items[i], PARSE_TOK, bufTok, &tok);
+        int errLayout = parseOne(&s_items[i], PARSE_LAYOUT, bufLayout, &layout);
+
+        if (errTok != errLayout || tok.index != layout.index
+                || tok.isMT != layout.isMT || tok.state != layout.state
+                || tok.mode != layout.mode || tok.isMpty != layout.isMpty
+                || tok.toa != layout.toa || !sameStr(tok.number, layout.number)
+                || !sameStr(tok.type, layout.type)
+                || !sameStr(tok.address, layout.address)) {
+            fprintf(stderr, "parse differs on \"%s\"\n", s_items[i].line);
+            return;
+        }
+    }
+
+    copyUs = benchParse(PARSE_COPY);
+    tokUs = benchParse(PARSE_TOK) - copyUs;
+    layoutUs = benchParse(PARSE_LAYOUT) - copyUs;
+
+    printf("line copy %9.1f ms, not counted below\n", copyUs / 1000);
+    report("parse", "tok", tokUs, s_itemCount, "line", tokUs);
+    report("parse", "layout", layoutUs, s_itemCount, "line", tokUs);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = AT_TRACE_FILE;
+    const char *mode = "scan";
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "m:n:h"))) {
+        switch (opt) {
+            case 'm':
+                mode = optarg;
+                break;
+            case 'n':
+                s_rounds = atoi(optarg);
+                if (s_rounds <= 0) s_rounds = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind < argc) path = argv[optind];
+
+    if (loadTrace(path) < 0) return -1;
+
+    printf("%s: %d records, %ld bytes, %d lines, %d rounds\n",
+            path, s_chunkCount, s_chunkBytes, s_lineCount, s_rounds);
+
+    if (strcmp(mode, "scan") == 0) {
+        runScan();
+    } else if (strcmp(mode, "parse") == 0) {
+        runParse();
+    } else {
+        usage(argv[0]);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,21 @@
+# Copyright 2006 The Android Open Source Project
+
+LOCAL_PATH:= $(call my-dir)
+
+# For attokcheck binary, at_tok against the old tokenizer on a fixed corpus
+# =========================================================================
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    attokcheck.c \
+    ../libril-at/at_tok.c \
+    ../libril-at/at_scan.c
+
+LOCAL_CFLAGS := -D_GNU_SOURCE -DAT_TOK_DIFF_CHECK
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libril-at
+LOCAL_STATIC_LIBRARIES := liblog
+
+LOCAL_MODULE:= attokcheck
+LOCAL_MODULE_TAGS := debug
+
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,160 @@
+/* //device/system/reference-ril/attokcheck.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Host test of the scanner based at_tok against the tokenizer it
+ * replaced. at_tok.c is built with AT_TOK_DIFF_CHECK, so every
+ * at_tok_next*() call below also runs the old code on a copy of the
+ * line; any difference in result, output or position fails the run.
+ *
+ * Each corpus line is walked with its own call sequence, as atparser
+ * does, and then once more per call type until the line runs out, so
+ * every field is also seen by the "wrong" call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "at_tok.h"
+#include "at_scan.h"
+
+#define MAX_LINE    512
+#define MAX_CALLS   40
+
+typedef struct {
+    const char *line;
+    /* i nextint, x nexthexint, s nextstr, b nextbool, m hasmore */
+    const char *calls;
+} TokCase;
+
+static const TokCase s_corpus[] = {
+    // plain numbers and strings //
+    { "+CSQ: 20,99",                                        "ii" },
+    { "+CREG: 2,1,\"2533\",\"0F0B5A31\",2",                 "iissi" },
+    { "+CGREG: 2,1,\"2533\",\"0F0B5A31\",2,\"01\"",         "iixxix" },
+    { "+COPS: 0,2,\"46000\",2",                             "iisi" },
+    { "+COPS: 0,0,\"CHINA MOBILE\",2",                      "iisi" },
+    { "+CGACT: 1,1",                                        "ii" },
+    { "+CPIN: READY",                                       "s" },
+    { "^SCKS: 1",                                           "b" },
+    { "+CMTI: \"SM\",12",                                   "si" },
+    { "+CMGS: 201",                                         "i" },
+    { "+CCLK: \"13/05/20,10:21:33+32\"",                    "s" },
+    // quoted commas //
+    { "+COPS: (2,\"CMCC\",\"CMCC\",\"46000\",2),,(0-4),(0-2)", "ssssssss" },
+    { "+CUSD: 0,\"Balance: 12,50 CNY, valid\",15",          "isi" },
+    { "+CPBR: 1,\"13800138000\",129,\"Wang, Lei\"",         "isis" },
+    { "+CMGL: 1,\"REC READ\",\"+8613800138000\",,\"13/05/20,10:21:33+32\"", "isssss" },
+    { "^DSCI: 1,0,0,0,\"10086\",129,,\"a,\"b\",c\"",        "iiiisiis" },
+    { "+CLCC: 1,0,0,0,0,\"+8613800138000\",145,\"Li, \"Xiao\"\"", "iiiiisis" },
+    // empty fields //
+    { "+CLCC: 1,1,0,0,0,\"\",128",                          "iiiiisi" },
+    { "+CGDCONT: 1,\"IP\",\"cmnet\",\"\",0,0",              "issssii" },
+    { "+CREG: 1,,,",                                        "iiii" },
+    { "+CGREG: ,,\"\",\"\"",                                "iiss" },
+    { "+CSCA: \"\",",                                       "si" },
+    { "^SYSINFO: ,,,,",                                     "iiiii" },
+    { "+CMGR: 0,,23",                                       "isi" },
+    { "+XX:",                                               "isx" },
+    { "+XX: ",                                              "sm" },
+    // hex fields //
+    { "+CGREG: 2,1,\"24E3\",\"0F0B5A31\"",                  "iixx" },
+    { "+CRSM: 144,0,\"62178202412183026F07A5038001718A01058B036F0602\"", "iis" },
+    { "^SCID: 0xFF,0x1a,FFFFFFFF,7fffffff,80000000",        "xxxxx" },
+    { "^CELL: 1a2b,C,-,  fF, 123456789,ffffffffff",         "xxxxxx" },
+    { "+CIMI: 460001234567890",                             "ix" },
+    // signs, white space, overflow //
+    { "+CSQ:  -1, +7,\t3 ,99x, 4294967296",                 "iiiii" },
+    { "+XX: 2147483648,-2147483649,9999999999,0000000001",  "iiii" },
+    { "+XX: \" spaced \", \"late\" , x\"y\",\"unterminated", "ssss" },
+    { "+XX: \"\"\"\",\"a\"b\"c\",\"",                        "sss" },
+};
+
+static const char s_callTypes[] = "ixsb";
+
+/* runs one call, returns 1 when the line has no token left */
+static int runCall(char c, char **p_cur)
+{
+    int v;
+    char b;
+    char *s;
+
+    switch (c) {
+        case 'i':
+            at_tok_nextint(p_cur, &v);
+            break;
+        case 'x':
+            at_tok_nexthexint(p_cur, &v);
+            break;
+        case 's':
+            at_tok_nextstr(p_cur, &s);
+            break;
+        case 'b':
+            at_tok_nextbool(p_cur, &b);
+            break;
+        case 'm':
+            at_tok_hasmore(p_cur);
+            break;
+    }
+
+    return *p_cur == NULL;
+}
+
+static void walk(const char *line, const char *calls, int repeat)
+{
+    char buf[MAX_LINE];
+    char *cur = buf;
+    int n;
+
+    strncpy(buf, line, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    if (at_tok_start(&cur) < 0) return;
+
+    for (n = 0; n < MAX_CALLS; n++) {
+        char c = repeat ? calls[0] : calls[n];
+
+        if (c == '\0' || runCall(c, &cur)) break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int i, calls, mismatches;
+    int verbose = (argc > 1 && strcmp(argv[1], "-v") == 0);
+
+    // the SIMD delimiter scanner where the host has it, as on the phone //
+    at_scan_init();
+
+    for (i = 0; i < sizeof(s_corpus) / sizeof(s_corpus[0]); i++) {
+        const char *t;
+
+        walk(s_corpus[i].line, s_corpus[i].calls, 0);
+        for (t = s_callTypes; *t != '\0'; t++) {
+            walk(s_corpus[i].line, t, 1);
+        }
+        if (verbose) printf("%s\n", s_corpus[i].line);
+    }
+
+    at_tok_diff_stats(&calls, &mismatches);
+    printf("attokcheck: %u lines, %u calls, %u differences (%s scanner)\n",
+            (unsigned int)(sizeof(s_corpus) / sizeof(s_corpus[0])),
+            calls, mismatches, at_scan_impl_name());
+
+    return (calls == 0 || mismatches != 0) ? 1 : 0;
+}
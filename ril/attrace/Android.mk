@@ -0,0 +1,29 @@
+# Copyright 2006 The Android Open Source Project
+
+LOCAL_PATH:= $(call my-dir)
+
+# For attrace binary, dumps the AT trace ring of libril-at-cyit
+# =============================================================
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    attrace.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libril-at
+
+LOCAL_MODULE:= attrace
+LOCAL_MODULE_TAGS := debug
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    attrace.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libril-at
+
+LOCAL_MODULE:= attrace
+LOCAL_MODULE_TAGS := debug
+
+include $(BUILD_EXECUTABLE)
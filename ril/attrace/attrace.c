@@ -0,0 +1,183 @@
+/* //device/system/reference-ril/attrace.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Offline dumper for the binary AT trace ring written by libril-at
+ * (see at_trace.h). Reads a copy of the ring file and renders every
+ * record as hex and printable text, oldest record first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "at_trace.h"
+
+#define BYTES_PER_ROW 16
+
+static int s_channel = -1;
+static int s_textOnly = 0;
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c channel] [-t] [trace file]\n"
+            "    -c channel   only dump records of this 0 based channel\n"
+            "    -t           print AT text only, no hex\n"
+            "    trace file   defaults to %s\n",
+            name, AT_TRACE_FILE);
+}
+
+static void printRecord(const ATTraceRecord *rec, const unsigned char *data)
+{
+    char stamp[32];
+    time_t sec = rec->sec;
+    struct tm *tm = localtime(&sec);
+    int i, j;
+
+    strftime(stamp, sizeof(stamp), "%m-%d %H:%M:%S", tm);
+
+    if (rec->channel == 0xFF) {
+        printf("%s.%06u ch*  %s %u bytes\n", stamp, rec->usec,
+                rec->dir == AT_TRACE_DIR_TX ? ">>" : "<<", rec->len);
+    } else {
+        printf("%s.%06u ch%-2u %s %u bytes\n", stamp, rec->usec, rec->channel,
+                rec->dir == AT_TRACE_DIR_TX ? ">>" : "<<", rec->len);
+    }
+
+    if (s_textOnly) {
+        printf("    ");
+        for (i = 0; i < rec->len; i++) {
+            if (data[i] == '\r') printf("\\r");
+            else if (data[i] == '\n') printf("\\n");
+            else if (data[i] >= 0x20 && data[i] < 0x7F) putchar(data[i]);
+            else printf("\\x%02x", data[i]);
+        }
+        putchar('\n');
+        return;
+    }
+
+    for (i = 0; i < rec->len; i += BYTES_PER_ROW) {
+        printf("    ");
+        for (j = 0; j < BYTES_PER_ROW; j++) {
+            if (i + j < rec->len) printf("%02x ", data[i + j]);
+            else printf("   ");
+        }
+        printf(" |");
+        for (j = 0; j < BYTES_PER_ROW && i + j < rec->len; j++) {
+            unsigned char c = data[i + j];
+            putchar((c >= 0x20 && c < 0x7F) ? c : '.');
+        }
+        printf("|\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = AT_TRACE_FILE;
+    ATTraceHeader hdr;
+    unsigned char *ring;
+    unsigned int pos, left, count = 0;
+    FILE *fp;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "c:th"))) {
+        switch (opt) {
+            case 'c':
+                s_channel = atoi(optarg);
+                break;
+            case 't':
+                s_textOnly = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind < argc) path = argv[optind];
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+            || hdr.magic != AT_TRACE_MAGIC
+            || hdr.version != AT_TRACE_VERSION) {
+        fprintf(stderr, "%s: not an AT trace file\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    if (hdr.used > hdr.size || hdr.tail >= hdr.size || hdr.head >= hdr.size) {
+        fprintf(stderr, "%s: corrupted header\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    ring = (unsigned char *)malloc(hdr.size);
+    fseek(fp, hdr.hdrSize, SEEK_SET);
+    if (ring == NULL || fread(ring, 1, hdr.size, fp) != hdr.size) {
+        fprintf(stderr, "%s: truncated trace\n", path);
+        free(ring);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    // walk from oldest record, same rules as at_trace_record() //
+    pos = hdr.tail;
+    left = hdr.used;
+    while (left > 0) {
+        const ATTraceRecord *rec;
+        unsigned int recsize;
+
+        if (hdr.size - pos < sizeof(ATTraceRecord)) {
+            left -= hdr.size - pos;
+            pos = 0;
+            continue;
+        }
+
+        rec = (const ATTraceRecord *)(ring + pos);
+        if (rec->len == AT_TRACE_PAD_LEN) {
+            left -= hdr.size - pos;
+            pos = 0;
+            continue;
+        }
+
+        recsize = AT_TRACE_ALIGN(sizeof(ATTraceRecord) + rec->len);
+        if (recsize > left || pos + recsize > hdr.size) {
+            fprintf(stderr, "corrupted record at %u\n", pos);
+            break;
+        }
+
+        if (s_channel < 0 || s_channel == rec->channel) {
+            printRecord(rec, (const unsigned char *)(rec + 1));
+            count++;
+        }
+
+        left -= recsize;
+        pos += recsize;
+        if (pos >= hdr.size) pos = 0;
+    }
+
+    fprintf(stderr, "%u records, %u dropped by ring wrap\n", count, hdr.lost);
+    free(ring);
+    return 0;
+}
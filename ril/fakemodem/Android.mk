@@ -0,0 +1,33 @@
+# Copyright 2006 The Android Open Source Project
+
+LOCAL_PATH:= $(call my-dir)
+
+# For fakemodem binary, a scriptable modem on ptys to drive libril-at
+# ===================================================================
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    fakemodem.c
+
+LOCAL_CFLAGS := -D_GNU_SOURCE
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libril-at
+LOCAL_LDLIBS += -lpthread -lm
+
+LOCAL_MODULE:= fakemodem
+LOCAL_MODULE_TAGS := debug
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+    fakemodem.c
+
+LOCAL_CFLAGS := -D_GNU_SOURCE
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../libril-at
+LOCAL_SHARED_LIBRARIES := libm
+
+LOCAL_MODULE:= fakemodem
+LOCAL_MODULE_TAGS := debug
+
+include $(BUILD_EXECUTABLE)
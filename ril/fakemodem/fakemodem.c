@@ -0,0 +1,1194 @@
+/* //device/system/reference-ril/fakemodem.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Scriptable stand-in for the CYIT modem, to drive libril-at without
+ * hardware.
+ *
+ * Mux mode (default) opens one pty per channel, like the gsm0710 mux
+ * devices, and can link them to a path pattern for the
+ * gsm0710mux.channel<N> properties. Flag mode (-f) opens one pty for
+ * the USE_MULT_AT_CHAN framing: every command and every answer starts
+ * with the 1 based channel byte read by getATFlag(). Existing devices,
+ * e.g. a mux loopback, can be given instead of ptys.
+ *
+ * Rules, from -s script or the built in set below, one per line:
+ *
+ *     <command> | <latency> | <step> | <step> ...
+ *
+ *   command   exact command, or a prefix when it ends with '*'
+ *   latency   before the first step: "10" ms, "5-40" uniform,
+ *             "exp:20" exponential mean, "norm:20,5" normal
+ *   step      a line to answer ("%c" is replaced by the rule's hit count,
+ *             "%a" by what follows '=' in the command)
+ *             ">"        "> " prompt, then wait for the PDU up to ^Z
+ *             ">!"       "> " prompt only (CYIT acks the PDU with one)
+ *             "@<lat>"   sleep, same latency syntax
+ *             "eng:<hex>" ^ENG: binary answer echoing the function code
+ *
+ *     urc <per second> [<channel>] <line>     "\n" splits lines
+ *
+ * Unmatched commands get OK. SIGINT prints the counters and exits.
+ *
+ * Replay (-r) answers from an AT trace ring recorded by libril-at in
+ * mux mode (persist.ril.at.trace, see at_trace.h) instead:
+ *
+ *   - every command the RIL writes is matched against the next commands
+ *     traced on its channel, skipping a few if the RIL took another
+ *     path; the bytes traced after it come back with their original
+ *     spacing
+ *   - bytes the modem sent on its own, the URC channel and anything
+ *     before a channel's first command, are sent on the traced
+ *     timeline, which starts with the first command of the replay
+ *   - -x scales time: 1 original speed, 2 twice as fast, 0 no waits
+ *   - a command that matches nothing falls back to the rules
+ *
+ * With the AT statistics of the RIL (radiooptions 11) this gives
+ * repeatable parser and dispatcher numbers for a boot or a field log.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+
+#include "at_trace.h"
+
+#define MAX_CHANNELS    10
+#define URC_CHANNEL     9       /* 1 based, RIL_CHANNEL_URC */
+#define MAX_RULES       256
+#define MAX_STEPS       16
+#define MAX_URCS        32
+#define MAX_LINE        4096
+#define REPLAY_LOOKAHEAD 8
+
+/* same as atchannel.h */
+#define M_EGPREFIX      "^ENG:"
+#define M_EGPREFIX_LEN  5
+
+enum {
+    LAT_FIXED = 0,
+    LAT_UNIFORM,
+    LAT_EXP,
+    LAT_NORMAL
+};
+
+typedef struct {
+    int kind;
+    double a;
+    double b;
+} Latency;
+
+enum {
+    STEP_LINE = 0,
+    STEP_PROMPT,        /* prompt and wait for the PDU */
+    STEP_PROMPT_ONLY,
+    STEP_DELAY,
+    STEP_ENG
+};
+
+typedef struct {
+    int kind;
+    char *text;
+    Latency delay;
+    unsigned char *eng;
+    int engLen;
+} Step;
+
+typedef struct {
+    char *pattern;
+    int prefix;
+    Latency latency;
+    int nsteps;
+    Step steps[MAX_STEPS];
+    unsigned int hits;
+} Rule;
+
+typedef struct {
+    double perSec;
+    int channel;
+    char *text;
+    unsigned int sent;
+} Urc;
+
+typedef struct {
+    int id;             /* 1 based */
+    int inFd;           /* pty, device, or pipe fed by the flag mode reader */
+    int outFd;
+    pthread_t tid;
+    unsigned int commands;
+    unsigned int pdus;
+} Channel;
+
+static const char * s_defaultRules[] = {
+    "AT | 1 | OK",
+    "ATE0 | 1 | OK",
+    "AT+CSQ | 5-20 | +CSQ: 20,99 | OK",
+    "AT+CREG? | 5-20 | +CREG: 2,1,\"2540\",\"0C3F\",2 | OK",
+    "AT+CGREG? | 5-20 | +CGREG: 2,1,\"2540\",\"0C3F\",2 | OK",
+    "AT+COPS? | 10-30 | +COPS: 0,2,\"46000\",2 | OK",
+    "AT+CGSN | 5 | 861234567890123 | OK",
+    "AT+CIMI | 5 | 460001234567890 | OK",
+    "AT+CGMR | 5 | FAKE_MODEM_1.0 | OK",
+    "AT+CFUN? | 5 | +CFUN: 1 | OK",
+    "AT+CPIN? | 5 | +CPIN: READY | OK",
+    "AT+CGATT? | 5 | +CGATT: 1 | OK",
+    "AT^SUTEST=* | 2 | ^SUTEST: %a | OK",
+    "AT+CMGS=* | 5 | > | >! | @exp:800 | +CMGS: %c | OK",
+    "AT+CMGW=* | 5 | > | >! | @20 | +CMGW: %c | OK",
+    "AT* | 3 | eng:02 | OK",
+};
+
+static Rule s_rules[MAX_RULES];
+static int s_ruleCount = 0;
+static Urc s_urcs[MAX_URCS];
+static int s_urcCount = 0;
+static Channel s_channels[MAX_CHANNELS];
+static int s_channelCount = MAX_CHANNELS;
+static int s_flagMode = 0;
+static int s_sharedFd = -1;
+static int s_verbose = 0;
+static pthread_mutex_t s_writeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t s_ruleMutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int s_quit = 0;
+
+/* replay, times in msec since the first traced command */
+typedef struct {
+    double t;
+    int channel;        /* 0 based */
+    int len;
+    unsigned char *data;
+} Chunk;
+
+typedef struct {
+    double t;
+    int len;            /* command without <CR> */
+    unsigned char *cmd;
+    int first;          /* chunks answering it */
+    int count;
+} Exchange;
+
+typedef struct {
+    Exchange *ex;
+    int nex;
+    int next;
+    Chunk *chunks;
+    int nchunks;
+    unsigned int matched;
+    unsigned int skipped;
+    unsigned int unmatched;
+} ReplayChannel;
+
+static ReplayChannel s_replay[MAX_CHANNELS];
+static Chunk *s_timeline = NULL;
+static int s_timelineCount = 0;
+static int s_replayOn = 0;
+static double s_speed = 1.0;
+static double s_tracedMsec = 0;
+static double s_replayStart = 0;
+static pthread_mutex_t s_replayMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double nowMsec(void);
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-f] [-n channels] [-l link] [-s script] [-r trace [-x speed]]"
+            " [-v] [device...]\n"
+            "    -f           flag mode, one port with the channel byte framing\n"
+            "    -n channels  number of mux channels, default %d\n"
+            "    -l link      symlink the ptys to <link><N>, N 1 based\n"
+            "    -s script    rule file, see fakemodem.c; built in rules otherwise\n"
+            "    -r trace     answer from an AT trace ring, mux mode only\n"
+            "    -x speed     replay time scale, 0 for no waits, default 1\n"
+            "    -v           log every command\n"
+            "    device       use these instead of ptys, one per channel\n",
+            name, MAX_CHANNELS);
+}
+
+static char * trim(char *s)
+{
+    char *e;
+
+    while (isspace((unsigned char)*s)) s++;
+    e = s + strlen(s);
+    while (e > s && isspace((unsigned char)e[-1])) *--e = '\0';
+
+    return s;
+}
+
+static int parseLatency(const char *s, Latency *lat)
+{
+    memset(lat, 0, sizeof(Latency));
+
+    if (strncmp(s, "exp:", 4) == 0) {
+        lat->kind = LAT_EXP;
+        lat->a = atof(s + 4);
+    } else if (strncmp(s, "norm:", 5) == 0) {
+        lat->kind = LAT_NORMAL;
+        if (sscanf(s + 5, "%lf,%lf", &lat->a, &lat->b) != 2) return -1;
+    } else if (strchr(s, '-') != NULL) {
+        lat->kind = LAT_UNIFORM;
+        if (sscanf(s, "%lf-%lf", &lat->a, &lat->b) != 2) return -1;
+    } else if (isdigit((unsigned char)s[0])) {
+        lat->kind = LAT_FIXED;
+        lat->a = atof(s);
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+static double drawLatency(const Latency *lat, unsigned int *seed)
+{
+    double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    double v, ms;
+
+    switch (lat->kind) {
+        case LAT_UNIFORM:
+            ms = lat->a + (lat->b - lat->a) * u;
+            break;
+        case LAT_EXP:
+            ms = -lat->a * log(u);
+            break;
+        case LAT_NORMAL:
+            v = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+            ms = lat->a + lat->b * sqrt(-2.0 * log(u)) * cos(2 * M_PI * v);
+            break;
+        default:
+            ms = lat->a;
+            break;
+    }
+
+    return ms < 0 ? 0 : ms;
+}
+
+static void sleepMsec(double ms)
+{
+    struct timespec ts;
+
+    if (ms <= 0) return;
+    ts.tv_sec = (time_t)(ms / 1000);
+    ts.tv_nsec = (long)((ms - ts.tv_sec * 1000.0) * 1000000);
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR && !s_quit);
+}
+
+static int parseHex(const char *s, unsigned char **out)
+{
+    int n = strlen(s) / 2, i;
+    unsigned int b;
+
+    *out = (unsigned char *)malloc(n + 1);
+    for (i = 0; i < n; i++) {
+        if (sscanf(s + 2 * i, "%2x", &b) != 1) {
+            free(*out);
+            *out = NULL;
+            return -1;
+        }
+        (*out)[i] = (unsigned char)b;
+    }
+
+    return n;
+}
+
+static int parseRule(char *line, int lineNo)
+{
+    Rule *r;
+    char *field, *save = NULL;
+    int n = 0;
+
+    if (s_ruleCount >= MAX_RULES) {
+        fprintf(stderr, "line %d: too many rules\n", lineNo);
+        return -1;
+    }
+    r = &s_rules[s_ruleCount];
+    memset(r, 0, sizeof(Rule));
+
+    for (field = strtok_r(line, "|", &save); field != NULL;
+            field = strtok_r(NULL, "|", &save), n++) {
+        field = trim(field);
+
+        if (n == 0) {
+            size_t len = strlen(field);
+            r->prefix = (len > 0 && field[len - 1] == '*' && len > 3);
+            if (r->prefix) field[len - 1] = '\0';
+            // "AT*" is the ^ENG: binary command itself //
+            if (strcmp(field, "AT*") == 0) r->prefix = 1;
+            r->pattern = strdup(field);
+        } else if (n == 1) {
+            if (parseLatency(field, &r->latency) < 0) goto bad;
+        } else {
+            Step *st;
+
+            if (r->nsteps >= MAX_STEPS) goto bad;
+            st = &r->steps[r->nsteps++];
+            if (strcmp(field, ">") == 0) {
+                st->kind = STEP_PROMPT;
+            } else if (strcmp(field, ">!") == 0) {
+                st->kind = STEP_PROMPT_ONLY;
+            } else if (field[0] == '@') {
+                st->kind = STEP_DELAY;
+                if (parseLatency(field + 1, &st->delay) < 0) goto bad;
+            } else if (strncmp(field, "eng:", 4) == 0) {
+                st->kind = STEP_ENG;
+                st->engLen = parseHex(field + 4, &st->eng);
+                if (st->engLen < 0) goto bad;
+            } else {
+                st->kind = STEP_LINE;
+                st->text = strdup(field);
+            }
+        }
+    }
+    if (n < 2) goto bad;
+
+    s_ruleCount++;
+    return 0;
+
+bad:
+    fprintf(stderr, "line %d: bad rule\n", lineNo);
+    return -1;
+}
+
+static int parseUrc(char *line, int lineNo)
+{
+    Urc *u;
+    char *p = line + 3;
+    char *end;
+
+    if (s_urcCount >= MAX_URCS) {
+        fprintf(stderr, "line %d: too many urcs\n", lineNo);
+        return -1;
+    }
+    u = &s_urcs[s_urcCount];
+    memset(u, 0, sizeof(Urc));
+    u->channel = URC_CHANNEL;
+
+    u->perSec = strtod(p, &end);
+    if (end == p || u->perSec <= 0) goto bad;
+    p = trim(end);
+
+    if (isdigit((unsigned char)p[0])) {
+        u->channel = strtol(p, &end, 10);
+        if (!isspace((unsigned char)*end)) goto bad;
+        p = trim(end);
+    }
+    if (*p == '\0' || u->channel < 1 || u->channel > MAX_CHANNELS) goto bad;
+
+    u->text = strdup(p);
+    s_urcCount++;
+    return 0;
+
+bad:
+    fprintf(stderr, "line %d: bad urc\n", lineNo);
+    return -1;
+}
+
+static int parseScriptLine(char *line, int lineNo)
+{
+    line = trim(line);
+    if (line[0] == '\0' || line[0] == '#') return 0;
+
+    if (strncmp(line, "urc", 3) == 0 && isspace((unsigned char)line[3])) {
+        return parseUrc(line, lineNo);
+    }
+
+    return parseRule(line, lineNo);
+}
+
+static int loadScript(const char *path)
+{
+    char line[MAX_LINE];
+    int lineNo = 0;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (parseScriptLine(line, ++lineNo) < 0) {
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+static void writeAll(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        p += n;
+        len -= n;
+    }
+}
+
+/* one framed write, flag mode puts the channel byte in front */
+static void sendRaw(Channel *ch, const void *buf, size_t len)
+{
+    pthread_mutex_lock(&s_writeMutex);
+    if (s_flagMode) {
+        unsigned char flag = (unsigned char)ch->id;
+        writeAll(ch->outFd, &flag, 1);
+    }
+    writeAll(ch->outFd, buf, len);
+    pthread_mutex_unlock(&s_writeMutex);
+}
+
+/* "\r\n<text>\r\n" for every '\n' separated part of text */
+static void sendLines(Channel *ch, const char *text, unsigned int counter,
+        const char *arg)
+{
+    char buf[MAX_LINE];
+    int len = 0;
+    const char *p;
+
+    for (p = text; *p != '\0' && len < MAX_LINE - 32; ) {
+        if (len == 0 || buf[len - 1] == '\n') {
+            buf[len++] = '\r';
+            buf[len++] = '\n';
+        }
+        if (p[0] == '\\' && p[1] == 'n') {
+            buf[len++] = '\r';
+            buf[len++] = '\n';
+            p += 2;
+        } else if (p[0] == '%' && p[1] == 'c') {
+            len += snprintf(buf + len, MAX_LINE - len, "%u", counter);
+            p += 2;
+        } else if (p[0] == '%' && p[1] == 'a') {
+            len += snprintf(buf + len, MAX_LINE - len, "%.64s", arg ? arg : "");
+            p += 2;
+        } else {
+            buf[len++] = *p++;
+        }
+    }
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+
+    sendRaw(ch, buf, len);
+}
+
+/* ^ENG: + fc + data length + data, no <CR><LF> */
+static void sendEng(Channel *ch, const unsigned char *cmd, int cmdlen, const Step *st)
+{
+    unsigned char buf[MAX_LINE];
+    unsigned short fc = 0, datalen = (unsigned short)st->engLen;
+    int crnum, len = 0;
+
+    // "AT*" + number of <cr> + their positions + fc... //
+    if (cmdlen > 4) {
+        crnum = cmd[3] == 0xFB ? 0x0D : cmd[3];
+        if (4 + crnum + 2 <= cmdlen) {
+            memcpy(&fc, cmd + 4 + crnum, 2);
+        }
+    }
+    if (M_EGPREFIX_LEN + 4 + st->engLen > (int)sizeof(buf)) return;
+
+    memcpy(buf, M_EGPREFIX, M_EGPREFIX_LEN);
+    len = M_EGPREFIX_LEN;
+    memcpy(buf + len, &fc, 2);
+    len += 2;
+    memcpy(buf + len, &datalen, 2);
+    len += 2;
+    memcpy(buf + len, st->eng, st->engLen);
+    len += st->engLen;
+
+    sendRaw(ch, buf, len);
+}
+
+static Rule * findRule(const char *cmd, int cmdlen)
+{
+    int i;
+
+    for (i = 0; i < s_ruleCount; i++) {
+        Rule *r = &s_rules[i];
+        int plen = strlen(r->pattern);
+
+        if (r->prefix) {
+            if (cmdlen >= plen && memcmp(cmd, r->pattern, plen) == 0) return r;
+        } else if (cmdlen == plen && strncasecmp(cmd, r->pattern, plen) == 0) {
+            return r;
+        }
+    }
+
+    return NULL;
+}
+
+/* reads from the channel until one of the terminators, returns the length */
+static int readUntil(Channel *ch, char *buf, int size, const char *terms, char *hit)
+{
+    int len = 0;
+
+    while (len < size - 1 && !s_quit) {
+        char c;
+        ssize_t n = read(ch->inFd, &c, 1);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        if (memchr(terms, c, strlen(terms) + 1) != NULL && c != '\0') {
+            if (hit) *hit = c;
+            buf[len] = '\0';
+            return len;
+        }
+        // leading <LF> or <CR> of a previous line //
+        if (len == 0 && (c == '\n' || c == '\r')) continue;
+        buf[len++] = c;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+static void runRule(Channel *ch, Rule *r, const char *cmd, int cmdlen, unsigned int *seed)
+{
+    char pdu[MAX_LINE];
+    const char *arg;
+    unsigned int counter;
+    int i;
+
+    pthread_mutex_lock(&s_ruleMutex);
+    counter = ++r->hits;
+    pthread_mutex_unlock(&s_ruleMutex);
+
+    sleepMsec(drawLatency(&r->latency, seed));
+
+    for (i = 0; i < r->nsteps && !s_quit; i++) {
+        const Step *st = &r->steps[i];
+        char term = 0;
+
+        switch (st->kind) {
+            case STEP_LINE:
+                arg = strchr(cmd, '=');
+                sendLines(ch, st->text, counter, arg ? arg + 1 : NULL);
+                break;
+            case STEP_PROMPT_ONLY:
+                sendLines(ch, "> ", counter, NULL);
+                break;
+            case STEP_PROMPT:
+                sendLines(ch, "> ", counter, NULL);
+                if (readUntil(ch, pdu, sizeof(pdu), "\032\033", &term) < 0) return;
+                ch->pdus++;
+                if (term == '\033') {
+                    // ESC cancels the 2 step command //
+                    sendLines(ch, "OK", counter, NULL);
+                    return;
+                }
+                break;
+            case STEP_DELAY:
+                sleepMsec(drawLatency(&st->delay, seed));
+                break;
+            case STEP_ENG:
+                sendEng(ch, (const unsigned char *)cmd, cmdlen, st);
+                break;
+        }
+    }
+}
+
+/* a command ends with <CR>, a PDU, which never starts with "AT", also with ^Z or ESC */
+static int readCommand(Channel *ch, char *buf, int size)
+{
+    int len = 0;
+
+    while (len < size - 1 && !s_quit) {
+        char c;
+        ssize_t n = read(ch->inFd, &c, 1);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        if (c == '\r' || ((c == '\032' || c == '\033')
+                && !(len >= 2 && (buf[0] == 'A' || buf[0] == 'a')
+                    && (buf[1] == 'T' || buf[1] == 't')))) {
+            buf[len] = '\0';
+            return len;
+        }
+        if (len == 0 && c == '\n') continue;
+        buf[len++] = c;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+static void * grow(void *array, int count, size_t size)
+{
+    // doubles at every power of 2 //
+    if (count == 0 || (count & (count - 1)) == 0) {
+        array = realloc(array, (count == 0 ? 16 : count * 2) * size);
+        if (array == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(-1);
+        }
+    }
+
+    return array;
+}
+
+static void addChunk(Chunk **chunks, int *count, double t, int channel,
+        const unsigned char *data, int len)
+{
+    Chunk *c;
+
+    *chunks = (Chunk *)grow(*chunks, *count, sizeof(Chunk));
+    c = &(*chunks)[(*count)++];
+    c->t = t;
+    c->channel = channel;
+    c->len = len;
+    c->data = (unsigned char *)malloc(len);
+    memcpy(c->data, data, len);
+}
+
+static void addRecord(const ATTraceRecord *rec, const unsigned char *data, double *t0)
+{
+    double t = rec->sec * 1000.0 + rec->usec / 1000.0;
+    int ch = rec->channel;
+    ReplayChannel *rc;
+    int len = rec->len;
+
+    if (ch >= MAX_CHANNELS) return;
+    rc = &s_replay[ch];
+
+    if (rec->dir == AT_TRACE_DIR_TX) {
+        Exchange *e;
+
+        if (*t0 == 0) *t0 = t;
+        // channel byte of USE_MULT_AT_CHAN, then <CR> or ^Z //
+        if (len > 1 && data[0] < 0x20) {
+            data++;
+            len--;
+        }
+        if (len > 0 && (data[len - 1] == '\r' || data[len - 1] == '\032'
+                    || data[len - 1] == '\033')) len--;
+
+        rc->ex = (Exchange *)grow(rc->ex, rc->nex, sizeof(Exchange));
+        e = &rc->ex[rc->nex++];
+        e->t = t - *t0;
+        e->len = len;
+        e->cmd = (unsigned char *)malloc(len + 1);
+        memcpy(e->cmd, data, len);
+        e->first = rc->nchunks;
+        e->count = 0;
+    } else if (rc->nex == 0 || ch == URC_CHANNEL - 1) {
+        addChunk(&s_timeline, &s_timelineCount, *t0 == 0 ? 0 : t - *t0, ch, data, len);
+    } else {
+        addChunk(&rc->chunks, &rc->nchunks, t - *t0, ch, data, len);
+        rc->ex[rc->nex - 1].count++;
+    }
+
+    if (*t0 != 0 && t - *t0 > s_tracedMsec) s_tracedMsec = t - *t0;
+}
+
+static int loadTrace(const char *path)
+{
+    ATTraceHeader hdr;
+    unsigned char *ring;
+    unsigned int pos, left, count = 0, foreign = 0;
+    double t0 = 0;
+    FILE *fp;
+    int i, total = 0;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+            || hdr.magic != AT_TRACE_MAGIC || hdr.version != AT_TRACE_VERSION
+            || hdr.used > hdr.size || hdr.tail >= hdr.size) {
+        fprintf(stderr, "%s: not an AT trace file\n", path);
+        fclose(fp);
+        return -1;
+    }
+    ring = (unsigned char *)malloc(hdr.size);
+    fseek(fp, hdr.hdrSize, SEEK_SET);
+    if (ring == NULL || fread(ring, 1, hdr.size, fp) != hdr.size) {
+        fprintf(stderr, "%s: truncated trace\n", path);
+        free(ring);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    // same walk as attrace //
+    pos = hdr.tail;
+    left = hdr.used;
+    while (left > 0) {
+        const ATTraceRecord *rec;
+        unsigned int recsize;
+
+        if (hdr.size - pos < sizeof(ATTraceRecord)) {
+            left -= hdr.size - pos;
+            pos = 0;
+            continue;
+        }
+        rec = (const ATTraceRecord *)(ring + pos);
+        if (rec->len == AT_TRACE_PAD_LEN) {
+            left -= hdr.size - pos;
+            pos = 0;
+            continue;
+        }
+        recsize = AT_TRACE_ALIGN(sizeof(ATTraceRecord) + rec->len);
+        if (recsize > left || pos + recsize > hdr.size) {
+            fprintf(stderr, "corrupted record at %u\n", pos);
+            break;
+        }
+
+        if (rec->channel == 0xFF) {
+            foreign++;
+        } else {
+            addRecord(rec, (const unsigned char *)(rec + 1), &t0);
+        }
+        count++;
+
+        left -= recsize;
+        pos += recsize;
+        if (pos >= hdr.size) pos = 0;
+    }
+    free(ring);
+
+    for (i = 0; i < MAX_CHANNELS; i++) total += s_replay[i].nex;
+    printf("replay %s: %u records, %d commands, %d modem initiated chunks, %.1f s traced\n",
+            path, count, total, s_timelineCount, s_tracedMsec / 1000);
+    if (foreign > 0) {
+        fprintf(stderr, "%u records without channel skipped, trace a mux mode RIL\n", foreign);
+    }
+    if (hdr.lost > 0) {
+        fprintf(stderr, "%u records lost by ring wrap, the session start is missing\n", hdr.lost);
+    }
+
+    return total > 0 ? 0 : -1;
+}
+
+static void sleepUntil(double when)
+{
+    sleepMsec(when - nowMsec());
+}
+
+/* returns 1 if the trace answered cmd */
+static int replayAnswer(Channel *ch, const char *cmd, int len)
+{
+    ReplayChannel *rc = &s_replay[ch->id - 1];
+    double arrive = nowMsec();
+    Exchange *e = NULL;
+    int k, end;
+
+    pthread_mutex_lock(&s_replayMutex);
+    if (s_replayStart == 0) s_replayStart = arrive;
+
+    end = rc->next + REPLAY_LOOKAHEAD;
+    if (end > rc->nex) end = rc->nex;
+    for (k = rc->next; k < end; k++) {
+        if (rc->ex[k].len == len && memcmp(rc->ex[k].cmd, cmd, len) == 0) {
+            e = &rc->ex[k];
+            rc->skipped += k - rc->next;
+            rc->next = k + 1;
+            rc->matched++;
+            break;
+        }
+    }
+    if (e == NULL) rc->unmatched++;
+    pthread_mutex_unlock(&s_replayMutex);
+
+    if (e == NULL) return 0;
+
+    for (k = e->first; k < e->first + e->count && !s_quit; k++) {
+        const Chunk *c = &rc->chunks[k];
+
+        if (s_speed > 0) sleepUntil(arrive + (c->t - e->t) / s_speed);
+        sendRaw(ch, c->data, c->len);
+    }
+
+    return 1;
+}
+
+/* modem initiated bytes, on the traced timeline from the first command */
+static void * timelineLoop(void *arg)
+{
+    int i;
+
+    while (!s_quit && s_replayStart == 0) sleepMsec(10);
+
+    for (i = 0; i < s_timelineCount && !s_quit; i++) {
+        const Chunk *c = &s_timeline[i];
+
+        if (c->channel >= s_channelCount) continue;
+        if (s_speed > 0) sleepUntil(s_replayStart + c->t / s_speed);
+        sendRaw(&s_channels[c->channel], c->data, c->len);
+    }
+
+    return NULL;
+}
+
+static void * channelLoop(void *arg)
+{
+    Channel *ch = (Channel *)arg;
+    unsigned int seed = (unsigned int)time(NULL) ^ (ch->id * 2654435761u);
+    char cmd[MAX_LINE];
+    int len;
+
+    while (!s_quit) {
+        Rule *r;
+
+        len = readCommand(ch, cmd, sizeof(cmd));
+        if (len < 0) break;
+        if (len == 0) continue;
+
+        ch->commands++;
+        if (s_verbose) {
+            printf("ch%d << %.*s\n", ch->id, len > 2 && cmd[2] == '*' ? 3 : len, cmd);
+        }
+        if (s_replayOn && replayAnswer(ch, cmd, len)) continue;
+
+        r = findRule(cmd, len);
+        if (r == NULL) {
+            sendLines(ch, "OK", 0, NULL);
+            continue;
+        }
+        runRule(ch, r, cmd, len, &seed);
+    }
+
+    return NULL;
+}
+
+/*
+ * Flag mode: splits the shared port by channel byte and feeds each
+ * channel's pipe. A chunk ends with <CR>; a PDU, which never starts
+ * with "AT", also ends with ^Z or ESC.
+ */
+static void * flagReaderLoop(void *arg)
+{
+    int pipes[MAX_CHANNELS];
+    char chunk[MAX_LINE];
+    int len = 0, id = 0, i;
+
+    for (i = 0; i < s_channelCount; i++) pipes[i] = ((int *)arg)[i];
+
+    while (!s_quit) {
+        char c;
+        ssize_t n = read(s_sharedFd, &c, 1);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        if (id == 0) {
+            id = (unsigned char)c;
+            if (id < 1 || id > s_channelCount) {
+                fprintf(stderr, "bad channel byte %02x\n", (unsigned char)c);
+                id = 0;
+            }
+            len = 0;
+            continue;
+        }
+
+        if (len < MAX_LINE) chunk[len++] = c;
+        if (c == '\r' || ((c == '\032' || c == '\033')
+                && !(len > 2 && (chunk[0] == 'A' || chunk[0] == 'a')
+                    && (chunk[1] == 'T' || chunk[1] == 't')))) {
+            writeAll(pipes[id - 1], chunk, len);
+            id = 0;
+        }
+    }
+
+    return NULL;
+}
+
+static double nowMsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void * urcLoop(void *arg)
+{
+    double next[MAX_URCS];
+    double start = nowMsec();
+    int i;
+
+    for (i = 0; i < s_urcCount; i++) next[i] = start + 1000.0 / s_urcs[i].perSec;
+
+    while (!s_quit) {
+        double now = nowMsec(), wake = now + 100;
+
+        for (i = 0; i < s_urcCount; i++) {
+            Urc *u = &s_urcs[i];
+
+            // catch up after a stall, the rate holds on average //
+            while (next[i] <= now) {
+                sendLines(&s_channels[u->channel - 1], u->text, u->sent + 1, NULL);
+                u->sent++;
+                next[i] += 1000.0 / u->perSec;
+            }
+            if (next[i] < wake) wake = next[i];
+        }
+        sleepMsec(wake - nowMsec());
+    }
+
+    return NULL;
+}
+
+/* same settings as openMuxChannel() */
+static void setRaw(int fd)
+{
+    struct termios ios;
+
+    if (tcgetattr(fd, &ios) < 0) return;
+
+    ios.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    ios.c_oflag &= ~(OPOST | ONLCR | OCRNL);
+    ios.c_lflag &= ~(ECHO | ECHONL | ECHOE | ICANON | ISIG | IEXTEN);
+    ios.c_cflag &= ~(CSIZE | PARENB | CSTOPB);
+    ios.c_cflag |= CS8;
+    ios.c_cc[VMIN] = 1;
+    ios.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &ios);
+}
+
+/* opens a pty, returns the master and the slave path */
+static int openPty(char *path, size_t size, int slaveFd[1])
+{
+    int fd = open("/dev/ptmx", O_RDWR | O_NOCTTY);
+
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+        perror("pty");
+        return -1;
+    }
+    snprintf(path, size, "%s", ptsname(fd));
+    setRaw(fd);
+
+    // keep a slave open so the master never sees EIO between RIL restarts //
+    slaveFd[0] = open(path, O_RDWR | O_NOCTTY);
+    if (slaveFd[0] >= 0) setRaw(slaveFd[0]);
+
+    return fd;
+}
+
+static int openPort(const char *device, const char *link, int id, char *path, size_t size)
+{
+    int fd, slave;
+
+    if (device != NULL) {
+        fd = open(device, O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            perror(device);
+            return -1;
+        }
+        setRaw(fd);
+        snprintf(path, size, "%s", device);
+        return fd;
+    }
+
+    fd = openPty(path, size, &slave);
+    if (fd >= 0 && link != NULL) {
+        char name[256];
+
+        if (id > 0) {
+            snprintf(name, sizeof(name), "%s%d", link, id);
+        } else {
+            snprintf(name, sizeof(name), "%s", link);
+        }
+        unlink(name);
+        if (symlink(path, name) < 0) {
+            perror(name);
+        } else {
+            snprintf(path, size, "%s", name);
+        }
+    }
+
+    return fd;
+}
+
+static void onSignal(int sig)
+{
+    s_quit = 1;
+}
+
+static void printCounters(void)
+{
+    int i;
+
+    printf("\n%-20s %8s\n", "rule", "hits");
+    for (i = 0; i < s_ruleCount; i++) {
+        if (s_rules[i].hits == 0) continue;
+        printf("%-20s %8u\n", s_rules[i].pattern, s_rules[i].hits);
+    }
+
+    printf("\n%-4s %8s %8s\n", "ch", "cmds", "pdus");
+    for (i = 0; i < s_channelCount; i++) {
+        printf("%-4d %8u %8u\n", s_channels[i].id, s_channels[i].commands, s_channels[i].pdus);
+    }
+
+    if (s_replayOn) {
+        printf("\n%-4s %8s %8s %8s %8s %8s\n",
+                "ch", "traced", "matched", "skipped", "unmatch", "left");
+        for (i = 0; i < s_channelCount; i++) {
+            ReplayChannel *rc = &s_replay[i];
+
+            if (rc->nex == 0 && rc->unmatched == 0) continue;
+            printf("%-4d %8d %8u %8u %8u %8d\n", i + 1, rc->nex, rc->matched,
+                    rc->skipped, rc->unmatched, rc->nex - rc->next);
+        }
+        if (s_replayStart != 0) {
+            printf("replayed for %.1f s, traced session %.1f s\n",
+                    (nowMsec() - s_replayStart) / 1000, s_tracedMsec / 1000);
+        }
+    }
+
+    if (s_urcCount > 0) {
+        printf("\n%-32s %8s %8s\n", "urc", "per sec", "sent");
+        for (i = 0; i < s_urcCount; i++) {
+            printf("%-32.32s %8.1f %8u\n", s_urcs[i].text, s_urcs[i].perSec, s_urcs[i].sent);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *script = NULL;
+    const char *link = NULL;
+    const char *trace = NULL;
+    pthread_t urcTid, readerTid, timelineTid;
+    int pipeIn[MAX_CHANNELS];
+    char path[256];
+    struct sigaction sa;
+    size_t k;
+    int opt, i;
+
+    while (-1 != (opt = getopt(argc, argv, "fn:l:s:r:x:vh"))) {
+        switch (opt) {
+            case 'f':
+                s_flagMode = 1;
+                break;
+            case 'n':
+                s_channelCount = atoi(optarg);
+                break;
+            case 'l':
+                link = optarg;
+                break;
+            case 's':
+                script = optarg;
+                break;
+            case 'r':
+                trace = optarg;
+                break;
+            case 'x':
+                s_speed = atof(optarg);
+                break;
+            case 'v':
+                s_verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (s_channelCount < 1 || s_channelCount > MAX_CHANNELS
+            || s_speed < 0 || (trace != NULL && s_flagMode)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (trace != NULL) {
+        if (loadTrace(trace) < 0) return -1;
+        s_replayOn = 1;
+    }
+
+    if (script != NULL) {
+        if (loadScript(script) < 0) return -1;
+    }
+    // script rules come first, the built in ones catch the rest //
+    for (k = 0; k < sizeof(s_defaultRules) / sizeof(s_defaultRules[0]); k++) {
+        char line[MAX_LINE];
+
+        snprintf(line, sizeof(line), "%s", s_defaultRules[k]);
+        parseScriptLine(line, 0);
+    }
+    for (i = 0; i < s_urcCount; i++) {
+        if (s_urcs[i].channel > s_channelCount) s_urcs[i].channel = s_channelCount;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (s_flagMode) {
+        s_sharedFd = openPort(optind < argc ? argv[optind] : NULL, link, 0, path, sizeof(path));
+        if (s_sharedFd < 0) return -1;
+        printf("flag mode port: %s\n", path);
+    }
+
+    for (i = 0; i < s_channelCount; i++) {
+        Channel *ch = &s_channels[i];
+
+        ch->id = i + 1;
+        if (s_flagMode) {
+            int fds[2];
+
+            if (pipe(fds) < 0) {
+                perror("pipe");
+                return -1;
+            }
+            ch->inFd = fds[0];
+            pipeIn[i] = fds[1];
+            ch->outFd = s_sharedFd;
+        } else {
+            const char *device = (optind + i < argc) ? argv[optind + i] : NULL;
+
+            ch->inFd = ch->outFd = openPort(device, link, ch->id, path, sizeof(path));
+            if (ch->inFd < 0) return -1;
+            printf("channel %d: %s\n", ch->id, path);
+        }
+        pthread_create(&ch->tid, NULL, channelLoop, ch);
+    }
+    fflush(stdout);
+
+    if (s_flagMode) {
+        pthread_create(&readerTid, NULL, flagReaderLoop, pipeIn);
+    }
+    if (s_urcCount > 0) {
+        pthread_create(&urcTid, NULL, urcLoop, NULL);
+    }
+    if (s_replayOn) {
+        pthread_create(&timelineTid, NULL, timelineLoop, NULL);
+    }
+
+    while (!s_quit) pause();
+
+    printCounters();
+    return 0;
+}
@@ -3,16 +3,43 @@
 # XXX using libutils for simulator build only...
 #
 LOCAL_PATH:= $(call my-dir)
+
+# NEON line scanner, kept apart so only this object is built for NEON
+ifeq ($(TARGET_ARCH),arm)
+ifeq ($(ARCH_ARM_HAVE_NEON),true)
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := at_scan_neon.c
+LOCAL_ARM_NEON := true
+LOCAL_MODULE := libril-at-scan-neon
+LOCAL_MODULE_TAGS := optional
+include $(BUILD_STATIC_LIBRARY)
+AT_SCAN_NEON := true
+endif
+endif
+
 include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
     atparser.c \
     atchannel.c \
     misc.c \
-    at_tok.c
+    at_tok.c \
+    at_trace.c \
+    at_scan.c \
+    at_timeout.c \
+    at_stats.c \
+    at_cache.c \
+    at_buf.c \
+    at_urc.c \
+    at_calls.c \
+    at_signal.c \
+    at_reg.c \
+    at_pdp.c \
+    at_net.c \
+    at_plmn.c
 
 LOCAL_SHARED_LIBRARIES := \
-    libcutils libutils libril-cyit libnetutils
+    libcutils libutils libril-cyit libnetutils libhardware_legacy
 
 LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_TAGS := optional
@@ -22,12 +49,19 @@ LOCAL_CFLAGS := -D_GNU_SOURCE
 LOCAL_CFLAGS += -DUSE_CYIT_COMMANDS -DM_USAT_MODULE
 #LOCAL_CFLAGS += -DUSE_PPP
 #LOCAL_CFLAGS += -DUSE_MULT_AT_CHAN
+# log every at_tok result differing from the pre-scanner tokenizer
+#LOCAL_CFLAGS += -DAT_TOK_DIFF_CHECK
 LOCAL_CFLAGS += -DUSE_CYIT_FRAMEWORK
 LOCAL_CFLAGS += -DUSE_RAWIP
 LOCAL_CFLAGS += -DGSM_MUX_CHANNEL
 
 LOCAL_C_INCLUDES := $(KERNEL_HEADERS)
 
+ifeq ($(AT_SCAN_NEON),true)
+  LOCAL_CFLAGS += -DAT_SCAN_HAVE_NEON
+  LOCAL_STATIC_LIBRARIES += libril-at-scan-neon
+endif
+
 ifeq ($(TARGET_DEVICE),sooner)
   LOCAL_CFLAGS += -DOMAP_CSMI_POWER_CONTROL -DUSE_TI_COMMANDS
 endif
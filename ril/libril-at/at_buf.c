@@ -0,0 +1,175 @@
+/* //device/system/reference-ril/at_buf.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_buf.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+static ATBuffer * s_buffers[AT_BUF_MAX_BUFFERS];
+static int s_bufferCount = 0;
+static pthread_mutex_t s_bufMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int s_initial = AT_BUF_DEF_INITIAL;
+static int s_ceiling = AT_BUF_DEF_CEILING;
+// bytes held by all buffers, updated by their owners with atomic adds //
+static int s_total = 0;
+static int s_totalPeak = 0;
+
+static int getIntProperty(const char *name, int def)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(name, value, "");
+    if (value[0] == '\0') return def;
+
+    return atoi(value);
+}
+
+static void account(int delta)
+{
+    int total = __sync_add_and_fetch(&s_total, delta);
+
+    // racy max, a missed peak only under a concurrent grow //
+    if (total > s_totalPeak) s_totalPeak = total;
+}
+
+void at_buf_init(void)
+{
+    s_initial = getIntProperty(AT_BUF_PROP_INITIAL, AT_BUF_DEF_INITIAL);
+    s_ceiling = getIntProperty(AT_BUF_PROP_CEILING, AT_BUF_DEF_CEILING);
+
+    if (s_initial < 256) s_initial = 256;
+    if (s_ceiling < s_initial) s_ceiling = s_initial;
+
+    LOGI("at_buf: initial %d, ceiling %d", s_initial, s_ceiling);
+}
+
+int at_buf_open(ATBuffer *b, const char *name)
+{
+    int i;
+
+    // reopened channels keep their buffer //
+    if (b->data != NULL) return 0;
+
+    b->data = (char *)malloc(s_initial + 1);
+    if (b->data == NULL) return -1;
+    b->name = name;
+    b->size = s_initial;
+    if (b->peak < b->size) b->peak = b->size;
+    account(b->size + 1);
+
+    pthread_mutex_lock(&s_bufMutex);
+    for (i = 0; i < s_bufferCount && s_buffers[i] != b; i++);
+    if (i == s_bufferCount && s_bufferCount < AT_BUF_MAX_BUFFERS) {
+        s_buffers[s_bufferCount++] = b;
+    }
+    pthread_mutex_unlock(&s_bufMutex);
+
+    return 0;
+}
+
+int at_buf_reserve(ATBuffer *b, int need)
+{
+    int size = b->size;
+    char *data;
+
+    if (need <= size) return 0;
+    if (need > s_ceiling) {
+        b->overflows++;
+        LOGE("at_buf: %s needs %d bytes, over ceiling %d", b->name, need, s_ceiling);
+        return -1;
+    }
+
+    while (size < need) size *= 2;
+    if (size > s_ceiling) size = s_ceiling;
+
+    data = (char *)realloc(b->data, size + 1);
+    if (data == NULL) {
+        b->overflows++;
+        LOGE("at_buf: %s grow to %d failed", b->name, size);
+        return -1;
+    }
+
+    account(size - b->size);
+    LOGD("at_buf: %s grows %d -> %d", b->name, b->size, size);
+    b->data = data;
+    b->size = size;
+    b->grows++;
+    if (b->peak < size) b->peak = size;
+
+    return 0;
+}
+
+void at_buf_trim(ATBuffer *b)
+{
+    char *data;
+
+    if (b->size <= s_initial) return;
+
+    data = (char *)realloc(b->data, s_initial + 1);
+    if (data == NULL) return;
+
+    account(s_initial - b->size);
+    b->data = data;
+    b->size = s_initial;
+    b->shrinks++;
+}
+
+int at_buf_dump(char *buf, int size, int len)
+{
+    int i, n;
+
+    if (len >= size - 1) return len;
+
+    n = snprintf(buf + len, size - len, "\n%-15s %8s %8s %6s %7s %9s   (total %d, peak %d)\n",
+            "buffer", "size", "peak", "grows", "shrinks", "overflows", s_total, s_totalPeak);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+
+    pthread_mutex_lock(&s_bufMutex);
+    for (i = 0; i < s_bufferCount && len < size - 1; i++) {
+        ATBuffer *b = s_buffers[i];
+
+        n = snprintf(buf + len, size - len, "%-15s %8d %8d %6u %7u %9u\n",
+                b->name, b->size, b->peak, b->grows, b->shrinks, b->overflows);
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+    pthread_mutex_unlock(&s_bufMutex);
+
+    return len;
+}
+
+void at_buf_reset_stats(void)
+{
+    int i;
+
+    pthread_mutex_lock(&s_bufMutex);
+    for (i = 0; i < s_bufferCount; i++) {
+        s_buffers[i]->peak = s_buffers[i]->size;
+        s_buffers[i]->grows = 0;
+        s_buffers[i]->shrinks = 0;
+        s_buffers[i]->overflows = 0;
+    }
+    s_totalPeak = s_total;
+    pthread_mutex_unlock(&s_bufMutex);
+}
@@ -0,0 +1,80 @@
+/* //device/system/reference-ril/at_buf.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+
+#ifndef AT_BUF_H
+#define AT_BUF_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Growable AT input buffers
+ *
+ * Each channel reader and the URC reader keep their partial lines in
+ * one of these instead of a fixed array. A buffer starts small, doubles
+ * when a single line (or a "^ENG:" binary frame) does not fit, up to
+ * a ceiling, and goes back to its initial size once it is empty again.
+ * Phonebook and network scan answers get the headroom, idle channels
+ * hold little memory.
+ *
+ * Sizes, peaks and growth counts of every buffer are reported with the
+ * AT statistics (radiooptions 11).
+ */
+#define AT_BUF_PROP_INITIAL     "persist.ril.at.buf"      /* bytes, default 2048 */
+#define AT_BUF_PROP_CEILING     "persist.ril.at.bufmax"   /* bytes, default 128K */
+#define AT_BUF_DEF_INITIAL      2048
+#define AT_BUF_DEF_CEILING      (128 * 1024)
+#define AT_BUF_MAX_BUFFERS      16
+
+typedef struct {
+    const char *name;
+    char *data;             /* size + 1 bytes, room for a terminating '\0' */
+    int size;
+    int peak;               /* largest size reached */
+    unsigned int grows;
+    unsigned int shrinks;
+    unsigned int overflows; /* lines dropped over the ceiling */
+} ATBuffer;
+
+/* reads the properties, called from at_open() before any at_buf_open() */
+void at_buf_init(void);
+
+/* allocates the initial size and registers b for the report, 0 or -1 */
+int at_buf_open(ATBuffer *b, const char *name);
+
+/**
+ * makes b hold at least need bytes, keeping its content. Returns 0, or
+ * -1 with b unchanged when need is over the ceiling or memory is short
+ */
+int at_buf_reserve(ATBuffer *b, int need);
+
+/* back to the initial size, only to be called while b is empty */
+void at_buf_trim(ATBuffer *b);
+
+/* appends the report to buf, returns the new length */
+int at_buf_dump(char *buf, int size, int len);
+
+void at_buf_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_BUF_H*/
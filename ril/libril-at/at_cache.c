@@ -0,0 +1,385 @@
+/* //device/system/reference-ril/at_cache.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_cache.h"
+#include "at_stats.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define NUM_ELEMS(x) (sizeof(x)/sizeof(x[0]))
+
+/*
+ * A policy ending with '=' or ',' covers every command starting with it,
+ * each exact command still gets its own entry. Others match one command.
+ */
+typedef struct {
+    char *command;
+    int cmdlen;
+    long long ttlMsec;
+    int events;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t drops;
+} ATCachePolicy;
+
+typedef struct {
+    char *command;          /* NULL: free */
+    int cmdlen;
+    int policy;
+    ATCommandType type;
+    long long storedUs;
+    ATResponse *response;
+} ATCacheEntry;
+
+typedef struct {
+    const char *command;
+    long long ttlMsec;
+    int events;
+} ATCacheDefault;
+
+static const ATCacheDefault s_defaults[] = {
+    {"AT+CGSN",     AT_CACHE_TTL_FOREVER,   0},
+    {"AT+CGMR",     AT_CACHE_TTL_FOREVER,   0},
+    {"AT^HVER",     AT_CACHE_TTL_FOREVER,   0},
+    {"AT^SSWINFO",  AT_CACHE_TTL_FOREVER,   0},
+    {"AT^SHWINFO",  AT_CACHE_TTL_FOREVER,   0},
+    // a missed hot swap URC must not keep a stale IMSI for ever //
+    {"AT+CIMI",     10 * 60 * 1000,         AT_CACHE_EV_SIM},
+    {"AT+CTEC=?",   AT_CACHE_TTL_FOREVER,   AT_CACHE_EV_RADIO},
+};
+
+typedef struct {
+    const char *prefix;
+    int events;
+} ATCacheUnsolEvent;
+
+static const ATCacheUnsolEvent s_unsolEvents[] = {
+    {"^SCKS:",      AT_CACHE_EV_SIM},
+    {"+CFUN: 0",    AT_CACHE_EV_RADIO | AT_CACHE_EV_SIM},
+};
+
+static ATCachePolicy s_policies[AT_CACHE_MAX_POLICIES];
+static int s_policyCount = 0;
+static ATCacheEntry s_entries[AT_CACHE_MAX_ENTRIES];
+static pthread_mutex_t s_cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static int s_enabled = 1;
+static int s_inited = 0;
+
+/* assumes s_cacheMutex is held */
+static void addPolicy(const char *command, int cmdlen, long long ttlMsec, int events)
+{
+    ATCachePolicy *p;
+    int i;
+
+    for (i = 0; i < s_policyCount; i++) {
+        if (s_policies[i].cmdlen == cmdlen
+                && memcmp(s_policies[i].command, command, cmdlen) == 0) return;
+    }
+    if (s_policyCount >= AT_CACHE_MAX_POLICIES) {
+        LOGE("at_cache: no room for policy %.*s", cmdlen, command);
+        return;
+    }
+
+    p = &s_policies[s_policyCount];
+    memset(p, 0, sizeof(ATCachePolicy));
+    p->command = (char *)malloc(cmdlen);
+    if (p->command == NULL) return;
+    memcpy(p->command, command, cmdlen);
+    p->cmdlen = cmdlen;
+    p->ttlMsec = ttlMsec;
+    p->events = events;
+    s_policyCount++;
+}
+
+/* assumes s_cacheMutex is held */
+static int findPolicy(const char *command, int cmdlen)
+{
+    int i;
+
+    for (i = 0; i < s_policyCount; i++) {
+        ATCachePolicy *p = &s_policies[i];
+        char last = p->command[p->cmdlen - 1];
+
+        if (last == '=' || last == ',') {
+            if (cmdlen >= p->cmdlen && memcmp(p->command, command, p->cmdlen) == 0) return i;
+        } else if (cmdlen == p->cmdlen && memcmp(p->command, command, cmdlen) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* assumes s_cacheMutex is held */
+static ATCacheEntry * findEntry(const char *command, int cmdlen)
+{
+    int i;
+
+    for (i = 0; i < AT_CACHE_MAX_ENTRIES; i++) {
+        ATCacheEntry *e = &s_entries[i];
+
+        if (e->command != NULL && e->cmdlen == cmdlen
+                && memcmp(e->command, command, cmdlen) == 0) return e;
+    }
+
+    return NULL;
+}
+
+/* assumes s_cacheMutex is held */
+static void dropEntry(ATCacheEntry *e)
+{
+    free(e->command);
+    at_response_free(e->response);
+    memset(e, 0, sizeof(ATCacheEntry));
+}
+
+/* deep copy, ^ENG: lines are binary and carry their length */
+static ATResponse * copyResponse(const ATResponse *src, ATCommandType type)
+{
+    ATResponse *dst;
+    ATLine *p_cur, **tail;
+
+    dst = (ATResponse *)calloc(1, sizeof(ATResponse));
+    if (dst == NULL) return NULL;
+
+    dst->success = src->success;
+    dst->finalResponse = src->finalResponse != NULL ? strdup(src->finalResponse) : NULL;
+
+    tail = &dst->p_intermediates;
+    for (p_cur = src->p_intermediates; p_cur != NULL; p_cur = p_cur->p_next) {
+        ATLine *p_new = (ATLine *)calloc(1, sizeof(ATLine));
+
+        if (p_new == NULL) break;
+        if (type == EGATCMD) {
+            p_new->line = (char *)malloc(p_cur->len + 1);
+            if (p_new->line != NULL) {
+                memcpy(p_new->line, p_cur->line, p_cur->len);
+                p_new->line[p_cur->len] = '\0';
+            }
+            p_new->len = p_cur->len;
+        } else {
+            p_new->line = strdup(p_cur->line);
+            p_new->len = strlen(p_cur->line);
+        }
+        *tail = p_new;
+        tail = &p_new->p_next;
+    }
+
+    return dst;
+}
+
+void at_cache_init(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    size_t i;
+
+    property_get(AT_CACHE_PROP_ENABLE, value, "1");
+
+    pthread_mutex_lock(&s_cacheMutex);
+    s_enabled = (atoi(value) != 0);
+    if (!s_inited) {
+        for (i = 0; i < NUM_ELEMS(s_defaults); i++) {
+            addPolicy(s_defaults[i].command, strlen(s_defaults[i].command),
+                    s_defaults[i].ttlMsec, s_defaults[i].events);
+        }
+        s_inited = 1;
+    }
+    pthread_mutex_unlock(&s_cacheMutex);
+
+    // the modem may have been reset under a new rild //
+    at_cache_invalidate(AT_CACHE_EV_ALL);
+
+    LOGI("at_cache: enabled %d, %d policies", s_enabled, s_policyCount);
+}
+
+void at_cache_allow(const char *command, int cmdlen, long long ttlMsec, int events)
+{
+    if (command == NULL || cmdlen <= 0) return;
+
+    pthread_mutex_lock(&s_cacheMutex);
+    addPolicy(command, cmdlen, ttlMsec, events);
+    pthread_mutex_unlock(&s_cacheMutex);
+}
+
+int at_cache_lookup(const char *command, int cmdlen, ATCommandType type,
+        ATResponse **pp_outResponse)
+{
+    ATCacheEntry *e;
+    ATCachePolicy *p;
+    int policy, hit = 0;
+
+    if (!s_enabled || command == NULL || pp_outResponse == NULL) return 0;
+
+    pthread_mutex_lock(&s_cacheMutex);
+    policy = findPolicy(command, cmdlen);
+    if (policy < 0) {
+        pthread_mutex_unlock(&s_cacheMutex);
+        return 0;
+    }
+    p = &s_policies[policy];
+
+    e = findEntry(command, cmdlen);
+    if (e != NULL && p->ttlMsec != AT_CACHE_TTL_FOREVER
+            && at_stats_now() - e->storedUs > p->ttlMsec * 1000) {
+        dropEntry(e);
+        e = NULL;
+    }
+
+    // same bytes asked with another type would parse lines differently //
+    if (e != NULL && e->type == type) {
+        *pp_outResponse = copyResponse(e->response, type);
+        hit = (*pp_outResponse != NULL);
+    }
+    if (hit) {
+        p->hits++;
+    } else {
+        p->misses++;
+    }
+    pthread_mutex_unlock(&s_cacheMutex);
+
+    if (hit) {
+        LOGD("at_cache: hit %.*s", type == EGATCMD ? 3 : cmdlen, command);
+    }
+
+    return hit;
+}
+
+void at_cache_store(const char *command, int cmdlen, ATCommandType type,
+        const ATResponse *p_response)
+{
+    ATCacheEntry *e;
+    int policy, i;
+
+    if (!s_enabled || command == NULL || p_response == NULL
+            || !p_response->success || p_response->p_intermediates == NULL) return;
+
+    pthread_mutex_lock(&s_cacheMutex);
+    policy = findPolicy(command, cmdlen);
+    if (policy < 0) {
+        pthread_mutex_unlock(&s_cacheMutex);
+        return;
+    }
+
+    e = findEntry(command, cmdlen);
+    if (e != NULL) {
+        dropEntry(e);
+    } else {
+        for (i = 0; i < AT_CACHE_MAX_ENTRIES && s_entries[i].command != NULL; i++);
+        if (i == AT_CACHE_MAX_ENTRIES) {
+            pthread_mutex_unlock(&s_cacheMutex);
+            return;
+        }
+        e = &s_entries[i];
+    }
+
+    e->command = (char *)malloc(cmdlen);
+    e->response = copyResponse(p_response, type);
+    if (e->command == NULL || e->response == NULL) {
+        dropEntry(e);
+        pthread_mutex_unlock(&s_cacheMutex);
+        return;
+    }
+    memcpy(e->command, command, cmdlen);
+    e->cmdlen = cmdlen;
+    e->policy = policy;
+    e->type = type;
+    e->storedUs = at_stats_now();
+    pthread_mutex_unlock(&s_cacheMutex);
+}
+
+void at_cache_invalidate(int events)
+{
+    int i, dropped = 0;
+
+    pthread_mutex_lock(&s_cacheMutex);
+    for (i = 0; i < AT_CACHE_MAX_ENTRIES; i++) {
+        ATCacheEntry *e = &s_entries[i];
+
+        if (e->command == NULL) continue;
+        if (events != AT_CACHE_EV_ALL && !(s_policies[e->policy].events & events)) continue;
+
+        s_policies[e->policy].drops++;
+        dropEntry(e);
+        dropped++;
+    }
+    pthread_mutex_unlock(&s_cacheMutex);
+
+    if (dropped > 0) {
+        LOGD("at_cache: events 0x%02x dropped %d answers", events, dropped);
+    }
+}
+
+void at_cache_unsol(const char *line)
+{
+    size_t i;
+
+    for (i = 0; i < NUM_ELEMS(s_unsolEvents); i++) {
+        if (strStartsWith(line, s_unsolEvents[i].prefix)) {
+            at_cache_invalidate(s_unsolEvents[i].events);
+        }
+    }
+}
+
+int at_cache_dump(char *buf, int size, int len)
+{
+    int i, n;
+
+    if (len >= size - 1) return len;
+
+    n = snprintf(buf + len, size - len, "\n%-15s %8s %8s %6s %8s %s\n",
+            "cache", "hits", "misses", "drops", "ttl s", s_enabled ? "" : "(disabled)");
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+
+    pthread_mutex_lock(&s_cacheMutex);
+    for (i = 0; i < s_policyCount && len < size - 1; i++) {
+        ATCachePolicy *p = &s_policies[i];
+        char name[AT_STATS_KEY_LEN];
+
+        if (p->hits == 0 && p->misses == 0) continue;
+
+        // binary ^ENG: commands are shown by their "AT*" header only //
+        snprintf(name, sizeof(name), "%.*s",
+                p->cmdlen > 3 && p->command[2] == '*' ? 3 : p->cmdlen, p->command);
+        n = snprintf(buf + len, size - len, "%-15s %8u %8u %6u %8lld\n",
+                name, p->hits, p->misses, p->drops, p->ttlMsec / 1000);
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+    pthread_mutex_unlock(&s_cacheMutex);
+
+    return len;
+}
+
+void at_cache_reset_stats(void)
+{
+    int i;
+
+    pthread_mutex_lock(&s_cacheMutex);
+    for (i = 0; i < s_policyCount; i++) {
+        s_policies[i].hits = 0;
+        s_policies[i].misses = 0;
+        s_policies[i].drops = 0;
+    }
+    pthread_mutex_unlock(&s_cacheMutex);
+}
@@ -0,0 +1,91 @@
+/* //device/system/reference-ril/at_cache.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_CACHE_H
+#define AT_CACHE_H 1
+
+#include "atchannel.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * AT response cache
+ *
+ * Successful answers of commands that read static or slow changing
+ * values (IMEI, IMSI, firmware version...) are kept, keyed by the exact
+ * command bytes, and handed out again by at_send_command_full() and
+ * at_send_egcmd_singleline() without a round trip to the modem.
+ *
+ * Only commands with a policy are cached: the built in table in
+ * at_cache.c or one added with at_cache_allow(). A policy gives a TTL
+ * and the events that drop the answer; events come from URCs seen by
+ * the reader (at_cache_unsol) or from at_cache_invalidate().
+ *
+ * Hits and misses are reported with the AT statistics (radiooptions 11).
+ */
+#define AT_CACHE_PROP_ENABLE    "persist.ril.at.cache"  /* 0/1, default 1 */
+#define AT_CACHE_MAX_ENTRIES    32
+#define AT_CACHE_MAX_POLICIES   32
+
+/* events dropping cached answers */
+#define AT_CACHE_EV_SIM         0x01    /* SIM inserted, removed or refreshed */
+#define AT_CACHE_EV_RADIO       0x02    /* radio power changed */
+#define AT_CACHE_EV_CONFIG      0x04    /* modem configuration written */
+#define AT_CACHE_EV_ALL         0xFF    /* modem reset, channel reopened */
+
+/* TTL of answers valid until an event drops them */
+#define AT_CACHE_TTL_FOREVER    0
+
+/* reads the property, called from at_open() */
+void at_cache_init(void);
+
+/**
+ * Adds a policy for command (cmdlen bytes, binary ^ENG commands included).
+ * Does nothing if the command already has one.
+ */
+void at_cache_allow(const char *command, int cmdlen, long long ttlMsec, int events);
+
+/**
+ * Returns 1 and a copy of the cached answer in *pp_outResponse on a hit,
+ * 0 when the modem has to be asked.
+ */
+int at_cache_lookup(const char *command, int cmdlen, ATCommandType type,
+        ATResponse **pp_outResponse);
+
+/* keeps a copy of a successful answer if command has a policy */
+void at_cache_store(const char *command, int cmdlen, ATCommandType type,
+        const ATResponse *p_response);
+
+/* drops answers whose policy lists one of events */
+void at_cache_invalidate(int events);
+
+/* raises the events a URC stands for, called from the reader thread */
+void at_cache_unsol(const char *line);
+
+/* appends the report to buf, returns the new length */
+int at_cache_dump(char *buf, int size, int len);
+
+void at_cache_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_CACHE_H*/
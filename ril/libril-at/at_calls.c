@@ -0,0 +1,312 @@
+/* //device/system/reference-ril/at_calls.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_calls.h"
+#include "at_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+typedef struct {
+    uint32_t count;
+    uint32_t totalUs;
+    uint32_t maxUs;
+} ATCallsDelay;
+
+static pthread_mutex_t s_callsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// all under s_callsMutex //
+static ATCall s_calls[AT_CALLS_MAX];
+static int s_count = 0;
+static int s_valid = 0;
+static unsigned int s_gen = 0;
+static long long s_checkedUs = 0;
+// oldest change not shown to the framework yet, 0 none //
+static long long s_changedUs = 0;
+static int s_changedSetup = 0;
+// set when a trusted table is reloaded for a periodic check //
+static int s_recheck = 0;
+
+static ATCallsDelay s_setup;
+static ATCallsDelay s_change;
+static ATCallsDelay s_fromTable;
+static ATCallsDelay s_fromClcc;
+static uint32_t s_reloads = 0;
+static uint32_t s_drift = 0;
+static uint32_t s_invalidated = 0;
+static const char *s_lastWhy = "start";
+
+static void addDelay(ATCallsDelay *d, long long us)
+{
+    uint32_t v = us > 0x7FFFFFFF ? 0x7FFFFFFF : (uint32_t)us;
+
+    d->count++;
+    d->totalUs += v;
+    if (v > d->maxUs) d->maxUs = v;
+}
+
+/* assumes s_callsMutex is held */
+static ATCall * findCall(int index)
+{
+    int i;
+
+    for (i = 0; i < s_count; i++) {
+        if (s_calls[i].index == index) return &s_calls[i];
+    }
+
+    return NULL;
+}
+
+/* assumes s_callsMutex is held, why is a literal */
+static void invalidate(const char *why)
+{
+    if (s_valid) {
+        LOGI("at_calls: reload, %s", why);
+        s_invalidated++;
+    }
+    s_valid = 0;
+    s_recheck = 0;
+    s_lastWhy = why;
+}
+
+void at_calls_invalidate(const char *why)
+{
+    pthread_mutex_lock(&s_callsMutex);
+    invalidate(why);
+    s_count = 0;
+    pthread_mutex_unlock(&s_callsMutex);
+}
+
+int at_calls_indicate(const ATCall *call)
+{
+    ATCall *c;
+    int changed = 0, setup = 0;
+
+    pthread_mutex_lock(&s_callsMutex);
+    s_gen++;
+
+    c = findCall(call->index);
+    if (call->state == AT_CALL_RELEASED) {
+        if (c != NULL) {
+            *c = s_calls[--s_count];
+            changed = 1;
+        }
+    } else if (c != NULL) {
+        if (c->state != call->state || c->isMpty != call->isMpty
+                || c->mode != call->mode) {
+            c->state = call->state;
+            c->isMpty = call->isMpty;
+            c->mode = call->mode;
+            changed = 1;
+        }
+        // ^DSCI may leave the number out once the call is set up //
+        if (call->number[0] != '\0' && strcmp(c->number, call->number) != 0) {
+            memcpy(c->number, call->number, sizeof(c->number));
+            c->toa = call->toa;
+            changed = 1;
+        }
+    } else if (call->state == AT_CALL_DIALING || call->state == AT_CALL_INCOMING
+            || call->state == AT_CALL_WAITING || call->state == AT_CALL_RINGING) {
+        if (s_count < AT_CALLS_MAX) {
+            s_calls[s_count++] = *call;
+            changed = 1;
+            setup = 1;
+        } else {
+            invalidate("table full");
+        }
+    } else {
+        // we missed its setup, what else did we miss //
+        invalidate("unknown call");
+    }
+
+    if (changed) {
+        if (s_changedUs == 0) {
+            s_changedUs = at_stats_now();
+            s_changedSetup = 0;
+        }
+        s_changedSetup |= setup;
+    }
+    pthread_mutex_unlock(&s_callsMutex);
+
+    return changed;
+}
+
+int at_calls_get(ATCall *calls)
+{
+    int count = -1;
+
+    pthread_mutex_lock(&s_callsMutex);
+    if (s_valid && s_count > 0
+            && at_stats_now() - s_checkedUs > AT_CALLS_RECHECK_MSEC * 1000LL) {
+        s_valid = 0;
+        s_recheck = 1;
+        s_lastWhy = "recheck";
+    }
+    if (s_valid) {
+        count = s_count;
+        memcpy(calls, s_calls, count * sizeof(ATCall));
+    }
+    pthread_mutex_unlock(&s_callsMutex);
+
+    return count;
+}
+
+int at_calls_find(int index, ATCall *call)
+{
+    ATCall *c;
+    int ret = -1;
+
+    pthread_mutex_lock(&s_callsMutex);
+    c = s_valid ? findCall(index) : NULL;
+    if (c != NULL) {
+        *call = *c;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&s_callsMutex);
+
+    return ret;
+}
+
+unsigned int at_calls_generation(void)
+{
+    unsigned int gen;
+
+    pthread_mutex_lock(&s_callsMutex);
+    gen = s_gen;
+    pthread_mutex_unlock(&s_callsMutex);
+
+    return gen;
+}
+
+/* assumes s_callsMutex is held */
+static int sameCalls(const ATCall *calls, int count)
+{
+    int i;
+
+    if (count != s_count) return 0;
+
+    for (i = 0; i < count; i++) {
+        ATCall *c = findCall(calls[i].index);
+
+        if (c == NULL || c->state != calls[i].state || c->isMpty != calls[i].isMpty) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void at_calls_load(unsigned int gen, const ATCall *calls, int count)
+{
+    if (count > AT_CALLS_MAX) count = AT_CALLS_MAX;
+
+    pthread_mutex_lock(&s_callsMutex);
+    s_reloads++;
+    if (s_recheck && gen == s_gen && !sameCalls(calls, count)) {
+        LOGI("at_calls: table drifted from +CLCC");
+        s_drift++;
+        s_lastWhy = "drift";
+    }
+    s_recheck = 0;
+
+    memcpy(s_calls, calls, count * sizeof(ATCall));
+    s_count = count;
+    s_checkedUs = at_stats_now();
+    // a ^DSCI came in meanwhile, the answer may be older than it //
+    s_valid = (gen == s_gen);
+    pthread_mutex_unlock(&s_callsMutex);
+}
+
+void at_calls_answered(int fromTable, long long startUs)
+{
+    long long now = at_stats_now();
+
+    pthread_mutex_lock(&s_callsMutex);
+    addDelay(fromTable ? &s_fromTable : &s_fromClcc, now - startUs);
+    if (s_changedUs != 0) {
+        addDelay(s_changedSetup ? &s_setup : &s_change, now - s_changedUs);
+        s_changedUs = 0;
+        s_changedSetup = 0;
+    }
+    pthread_mutex_unlock(&s_callsMutex);
+}
+
+static int appendDelay(char *buf, int size, int len, const char *name, const ATCallsDelay *d)
+{
+    int n;
+
+    if (d->count == 0 || len >= size - 1) return len;
+
+    n = snprintf(buf + len, size - len, "%-15s %8u %8.1f %8u\n",
+            name, d->count, (double)d->totalUs / d->count, d->maxUs);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+
+    return len;
+}
+
+int at_calls_dump(char *buf, int size, int len)
+{
+    ATCallsDelay setup, change, fromTable, fromClcc;
+    int n, count, valid;
+    uint32_t reloads, drift, invalidated;
+    const char *why;
+
+    pthread_mutex_lock(&s_callsMutex);
+    setup = s_setup;
+    change = s_change;
+    fromTable = s_fromTable;
+    fromClcc = s_fromClcc;
+    count = s_count;
+    valid = s_valid;
+    reloads = s_reloads;
+    drift = s_drift;
+    invalidated = s_invalidated;
+    why = s_lastWhy;
+    pthread_mutex_unlock(&s_callsMutex);
+
+    if (len >= size - 1) return len;
+
+    n = snprintf(buf + len, size - len,
+            "\n%-15s %8s %8s %8s   (%d calls, %s, reloads %u, drift %u, invalidated %u, last %s)\n",
+            "Calls", "count", "avg us", "max us", count, valid ? "trusted" : "untrusted",
+            reloads, drift, invalidated, why);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    len = appendDelay(buf, size, len, "setup -> UI", &setup);
+    len = appendDelay(buf, size, len, "change -> UI", &change);
+    len = appendDelay(buf, size, len, "from table", &fromTable);
+    len = appendDelay(buf, size, len, "from +CLCC", &fromClcc);
+
+    return len;
+}
+
+void at_calls_reset_stats(void)
+{
+    pthread_mutex_lock(&s_callsMutex);
+    memset(&s_setup, 0, sizeof(s_setup));
+    memset(&s_change, 0, sizeof(s_change));
+    memset(&s_fromTable, 0, sizeof(s_fromTable));
+    memset(&s_fromClcc, 0, sizeof(s_fromClcc));
+    s_reloads = 0;
+    s_drift = 0;
+    s_invalidated = 0;
+    pthread_mutex_unlock(&s_callsMutex);
+}
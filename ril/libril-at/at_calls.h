@@ -0,0 +1,104 @@
+/* //device/system/reference-ril/at_calls.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_CALLS_H
+#define AT_CALLS_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Call table
+ *
+ * The calls are kept in memory and updated from the ^DSCI URCs, which
+ * carry id, direction, state and type of a call on every change, so
+ * RIL_REQUEST_GET_CURRENT_CALLS is answered without an AT+CLCC round
+ * trip. The table is reloaded from AT+CLCC only when it is suspected
+ * to have drifted: at start and radio off, on a ^DSCI that cannot be
+ * parsed or names a call we never saw set up, and when a table with
+ * calls has not been checked for AT_CALLS_RECHECK_MSEC.
+ *
+ * The time from a ^DSCI to the GET_CURRENT_CALLS answer that shows it
+ * to the framework is measured, separately for new calls, and reported
+ * with the AT statistics (radiooptions 11).
+ */
+#define AT_CALLS_MAX            7
+#define AT_CALLS_NUMBER_LEN     41
+#define AT_CALLS_RECHECK_MSEC   30000
+
+/* <stat> of +CLCC and ^DSCI */
+#define AT_CALL_ACTIVE          0
+#define AT_CALL_HELD            1
+#define AT_CALL_DIALING         2
+#define AT_CALL_ALERTING        3
+#define AT_CALL_INCOMING        4
+#define AT_CALL_WAITING         5
+#define AT_CALL_RELEASED        6   /* ^DSCI only */
+#define AT_CALL_RINGING         7   /* CYIT, incoming shown to the user */
+
+typedef struct {
+    int index;
+    int isMT;
+    int state;
+    int mode;                   /* 0 voice */
+    int isMpty;
+    int toa;
+    char number[AT_CALLS_NUMBER_LEN];
+} ATCall;
+
+/* forgets the calls, the next read reloads them from AT+CLCC */
+void at_calls_invalidate(const char *why);
+
+/**
+ * applies one ^DSCI, a released call is dropped.
+ * Returns 1 when the table changed, 0 when not
+ */
+int at_calls_indicate(const ATCall *call);
+
+/**
+ * copies the calls into calls (AT_CALLS_MAX entries).
+ * Returns their count, -1 when the table must be reloaded first
+ */
+int at_calls_get(ATCall *calls);
+
+/* finds call index, returns 0 or -1 when unknown or not trusted */
+int at_calls_find(int index, ATCall *call);
+
+/**
+ * generation to pass to at_calls_load(), read before sending AT+CLCC so a
+ * ^DSCI racing the reload keeps the table untrusted
+ */
+unsigned int at_calls_generation(void);
+
+/* replaces the table with the AT+CLCC result, counts drift if it differs */
+void at_calls_load(unsigned int gen, const ATCall *calls, int count);
+
+/* accounts one GET_CURRENT_CALLS answer started at startUs */
+void at_calls_answered(int fromTable, long long startUs);
+
+/* appends the report to buf, returns the new length */
+int at_calls_dump(char *buf, int size, int len);
+
+void at_calls_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_CALLS_H*/
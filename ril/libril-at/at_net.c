@@ -0,0 +1,506 @@
+/* //device/system/reference-ril/at_net.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_net.h"
+#include "at_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define BATCH_SIZE      512
+#define BATCH_MAX       4
+
+/* one rtnetlink transaction, messages numbered from 1 */
+typedef struct {
+    char buf[BATCH_SIZE];
+    int len;
+    int count;
+    const char *what[BATCH_MAX + 1];
+} ATNetBatch;
+
+static pthread_mutex_t s_netMutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t s_configs = 0;
+static uint32_t s_failures = 0;
+static long long s_totalUs = 0;
+static long long s_maxUs = 0;
+static long long s_lastUs = 0;
+static int s_lastError = 0;
+static uint32_t s_propSets = 0;
+static uint32_t s_propSkips = 0;
+
+/* current flags of ifname, 0 when it does not exist, and its address when addr is not NULL */
+static unsigned int linkState(const char *ifname, in_addr_t *addr)
+{
+    struct ifreq ifr;
+    unsigned int flags = 0;
+    int s;
+
+    s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) return 0;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+    if (ioctl(s, SIOCGIFFLAGS, &ifr) == 0) flags = (unsigned short)ifr.ifr_flags;
+
+    if (addr != NULL) {
+        *addr = 0;
+        if (ioctl(s, SIOCGIFADDR, &ifr) == 0) {
+            *addr = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+        }
+    }
+    close(s);
+
+    return flags;
+}
+
+static unsigned int linkFlags(const char *ifname)
+{
+    return linkState(ifname, NULL);
+}
+
+/* returns 1 when one of the RTM_NEWLINK in buf is ifname with flags */
+static int linkEvent(const char *buf, int len, const char *ifname, unsigned int flags)
+{
+    const struct nlmsghdr *nh;
+
+    for (nh = (const struct nlmsghdr *)buf; NLMSG_OK(nh, (unsigned int)len);
+            nh = NLMSG_NEXT(nh, len)) {
+        const struct ifinfomsg *ifi;
+        const struct rtattr *rta;
+        int rlen;
+
+        if (nh->nlmsg_type != RTM_NEWLINK) continue;
+
+        ifi = NLMSG_DATA(nh);
+        if ((ifi->ifi_flags & flags) != flags) continue;
+
+        rlen = IFLA_PAYLOAD(nh);
+        for (rta = IFLA_RTA(ifi); RTA_OK(rta, rlen); rta = RTA_NEXT(rta, rlen)) {
+            if (rta->rta_type == IFLA_IFNAME
+                    && strncmp(RTA_DATA(rta), ifname, RTA_PAYLOAD(rta)) == 0) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int at_net_wait_link(const char *ifname, unsigned int flags, long long timeoutMsec,
+        int (*stop)(void *arg), void *arg)
+{
+    struct sockaddr_nl addr;
+    struct pollfd pfd;
+    char buf[4096];
+    long long endUs = at_stats_now() + timeoutMsec * 1000;
+    int fd, ret = -1;
+
+    fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (fd >= 0) {
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK;
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            LOGE("at_net: bind rtnetlink failed(%d), poll %s", errno, ifname);
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // subscribed first, a change from now on can't be missed //
+    if ((linkFlags(ifname) & flags) == flags) {
+        ret = 0;
+        goto done;
+    }
+
+    for (;;) {
+        long long leftMs = (endUs - at_stats_now()) / 1000;
+        int n;
+
+        if (stop != NULL && stop(arg)) {
+            ret = 1;
+            break;
+        }
+        if (leftMs <= 0) break;
+        if (leftMs > AT_NET_POLL_MSEC) leftMs = AT_NET_POLL_MSEC;
+
+        if (fd < 0) {
+            usleep(leftMs * 1000);
+            if ((linkFlags(ifname) & flags) == flags) {
+                ret = 0;
+                break;
+            }
+            continue;
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        n = poll(&pfd, 1, (int)leftMs);
+        if (n <= 0) continue;
+
+        n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            // ENOBUFS, events were lost, ask the kernel //
+            if ((linkFlags(ifname) & flags) == flags) {
+                ret = 0;
+                break;
+            }
+            continue;
+        }
+        if (linkEvent(buf, n, ifname, flags)) {
+            ret = 0;
+            break;
+        }
+    }
+
+done:
+    if (fd >= 0) close(fd);
+
+    return ret;
+}
+
+int at_net_wait_property(const char *name, char *value, long long timeoutMsec)
+{
+    long long endUs = at_stats_now() + timeoutMsec * 1000;
+
+    for (;;) {
+        property_get(name, value, "");
+        if (value[0] != '\0') return 0;
+        if (at_stats_now() >= endUs) return -1;
+
+        usleep(AT_NET_POLL_MSEC * 1000);
+    }
+}
+
+/* appends one acked message to b, NULL when it does not fit */
+static struct nlmsghdr * batchAdd(ATNetBatch *b, const char *what, int type,
+        int flags, const void *body, int bodyLen)
+{
+    struct nlmsghdr *nh;
+    int len = NLMSG_LENGTH(bodyLen);
+
+    if (b->count >= BATCH_MAX || b->len + NLMSG_ALIGN(len) > BATCH_SIZE) return NULL;
+
+    nh = (struct nlmsghdr *)(b->buf + b->len);
+    memset(nh, 0, NLMSG_ALIGN(len));
+    nh->nlmsg_len = len;
+    nh->nlmsg_type = type;
+    nh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+    nh->nlmsg_seq = ++b->count;
+    memcpy(NLMSG_DATA(nh), body, bodyLen);
+
+    b->what[b->count] = what;
+    b->len += NLMSG_ALIGN(len);
+
+    return nh;
+}
+
+/* appends an attribute to nh, the last message of b */
+static int batchAttr(ATNetBatch *b, struct nlmsghdr *nh, int type,
+        const void *data, int dataLen)
+{
+    struct rtattr *rta;
+    int off;
+
+    if (nh == NULL) return -1;
+
+    off = (char *)nh - b->buf + NLMSG_ALIGN(nh->nlmsg_len);
+    if (off + RTA_SPACE(dataLen) > BATCH_SIZE) return -1;
+
+    rta = (struct rtattr *)(b->buf + off);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(dataLen);
+    memcpy(RTA_DATA(rta), data, dataLen);
+
+    nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_SPACE(dataLen);
+    b->len = off + RTA_SPACE(dataLen);
+
+    return 0;
+}
+
+/* sends b in one go and reads its acks, 0 or the first -errno */
+static int batchRun(ATNetBatch *b, const char *ifname)
+{
+    struct sockaddr_nl kernel;
+    struct pollfd pfd;
+    char buf[1024];
+    int fd, acked = 0, ret = 0;
+
+    fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (fd < 0) return -errno;
+
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+    if (sendto(fd, b->buf, b->len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+
+    while (acked < b->count) {
+        const struct nlmsghdr *nh;
+        int n;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, AT_NET_ACK_MSEC) <= 0) {
+            LOGE("at_net: %s, %d of %d acks", ifname, acked, b->count);
+            if (ret == 0) ret = -ETIMEDOUT;
+            break;
+        }
+
+        n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (ret == 0) ret = -errno;
+            break;
+        }
+
+        for (nh = (const struct nlmsghdr *)buf; NLMSG_OK(nh, (unsigned int)n);
+                nh = NLMSG_NEXT(nh, n)) {
+            const struct nlmsgerr *e;
+
+            if (nh->nlmsg_type != NLMSG_ERROR) continue;
+
+            e = NLMSG_DATA(nh);
+            acked++;
+            if (e->error < 0 && nh->nlmsg_seq >= 1 && nh->nlmsg_seq <= (uint32_t)b->count) {
+                LOGE("at_net: %s %s refused(%d)", ifname, b->what[nh->nlmsg_seq], -e->error);
+                if (ret == 0) ret = e->error;
+            }
+        }
+    }
+    close(fd);
+
+    return ret;
+}
+
+/* the prefix SIOCSIFADDR derives from the address class */
+static int classfulPrefix(in_addr_t addr, unsigned int flags)
+{
+    uint32_t a = ntohl(addr);
+
+    if (flags & IFF_POINTOPOINT) return 32;
+    if (IN_CLASSA(a)) return 8;
+    if (IN_CLASSB(a)) return 16;
+    if (IN_CLASSC(a)) return 24;
+
+    return 32;
+}
+
+static void accountConfig(long long us, int error)
+{
+    pthread_mutex_lock(&s_netMutex);
+    s_configs++;
+    s_lastUs = us;
+    if (error != 0) {
+        s_failures++;
+        s_lastError = error;
+    } else {
+        s_totalUs += us;
+        if (us > s_maxUs) s_maxUs = us;
+    }
+    pthread_mutex_unlock(&s_netMutex);
+}
+
+int at_net_configure(const ATNetConfig *cfg)
+{
+    ATNetBatch batch, *b = &batch;
+    struct nlmsghdr *nh;
+    struct ifaddrmsg ifa;
+    struct ifinfomsg ifi;
+    struct rtmsg rtm;
+    long long startUs = at_stats_now();
+    long long us;
+    in_addr_t addr, old;
+    unsigned int index, flags;
+    int prefix, err;
+
+    index = if_nametoindex(cfg->ifname);
+    addr = inet_addr(cfg->address);
+    if (index == 0 || addr == INADDR_NONE) {
+        LOGE("at_net: can't configure %s with %s", cfg->ifname, cfg->address);
+        accountConfig(at_stats_now() - startUs, -ENODEV);
+        return -1;
+    }
+
+    flags = linkState(cfg->ifname, &old);
+    prefix = cfg->prefixLength > 0 ? cfg->prefixLength : classfulPrefix(addr, flags);
+
+    memset(b, 0, sizeof(*b));
+
+    // SIOCSIFADDR replaced a stale address, so does the batch //
+    if (old != 0 && old != addr) {
+        memset(&ifa, 0, sizeof(ifa));
+        ifa.ifa_family = AF_INET;
+        ifa.ifa_prefixlen = 32;
+        ifa.ifa_index = index;
+        nh = batchAdd(b, "old address", RTM_DELADDR, 0, &ifa, sizeof(ifa));
+        batchAttr(b, nh, IFA_LOCAL, &old, sizeof(old));
+    }
+
+    // address first, the link then comes up with it //
+    memset(&ifa, 0, sizeof(ifa));
+    ifa.ifa_family = AF_INET;
+    ifa.ifa_prefixlen = prefix;
+    ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+    ifa.ifa_index = index;
+    nh = batchAdd(b, "address", RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE, &ifa, sizeof(ifa));
+    batchAttr(b, nh, IFA_LOCAL, &addr, sizeof(addr));
+    batchAttr(b, nh, IFA_ADDRESS, &addr, sizeof(addr));
+    if (!(flags & IFF_POINTOPOINT) && prefix < 31) {
+        in_addr_t brd = addr | htonl(0xFFFFFFFFu >> prefix);
+
+        batchAttr(b, nh, IFA_BROADCAST, &brd, sizeof(brd));
+    }
+
+    memset(&ifi, 0, sizeof(ifi));
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_index = index;
+    ifi.ifi_flags = IFF_UP;
+    ifi.ifi_change = IFF_UP;
+    nh = batchAdd(b, "link", RTM_SETLINK, 0, &ifi, sizeof(ifi));
+    if (cfg->mtu > 0) {
+        uint32_t mtu = cfg->mtu;
+
+        batchAttr(b, nh, IFLA_MTU, &mtu, sizeof(mtu));
+    }
+
+    // a route needs the link up, so it goes last //
+    if (cfg->defaultRoute) {
+        uint32_t oif = index;
+
+        memset(&rtm, 0, sizeof(rtm));
+        rtm.rtm_family = AF_INET;
+        rtm.rtm_table = RT_TABLE_MAIN;
+        rtm.rtm_protocol = RTPROT_BOOT;
+        rtm.rtm_scope = RT_SCOPE_LINK;
+        rtm.rtm_type = RTN_UNICAST;
+        nh = batchAdd(b, "route", RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE, &rtm, sizeof(rtm));
+        batchAttr(b, nh, RTA_OIF, &oif, sizeof(oif));
+    }
+
+    err = batchRun(b, cfg->ifname);
+
+    us = at_stats_now() - startUs;
+    accountConfig(us, err);
+    if (err != 0) {
+        LOGE("at_net: %s configuration failed(%d) in %lld us", cfg->ifname, -err, us);
+        return -1;
+    }
+
+    LOGD("at_net: %s %s/%d mtu %d%s up in %lld us", cfg->ifname, cfg->address, prefix,
+            cfg->mtu, cfg->defaultRoute ? " default route" : "", us);
+
+    return 0;
+}
+
+void at_net_config_defaults(ATNetConfig *cfg)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(AT_NET_PROP_MTU, value, "0");
+    cfg->mtu = atoi(value);
+    property_get(AT_NET_PROP_ROUTE, value, "0");
+    cfg->defaultRoute = atoi(value);
+}
+
+/* sets name to value unless it already is, 0 or -1 */
+static int publish(const char *name, const char *value)
+{
+    char cur[PROPERTY_VALUE_MAX];
+
+    property_get(name, cur, "");
+    if (strcmp(cur, value) == 0) {
+        pthread_mutex_lock(&s_netMutex);
+        s_propSkips++;
+        pthread_mutex_unlock(&s_netMutex);
+        return 0;
+    }
+
+    pthread_mutex_lock(&s_netMutex);
+    s_propSets++;
+    pthread_mutex_unlock(&s_netMutex);
+
+    return property_set(name, value) == 0 ? 0 : -1;
+}
+
+int at_net_publish_dns(const char *ifname, const char *dns1, const char *dns2)
+{
+    char name[PROPERTY_KEY_MAX];
+    int ret = 0;
+
+    snprintf(name, sizeof(name), "net.%s.dns1", ifname);
+    if (publish(name, dns1) < 0) ret = -1;
+    snprintf(name, sizeof(name), "net.%s.dns2", ifname);
+    if (publish(name, dns2) < 0) ret = -1;
+
+    return ret;
+}
+
+int at_net_dump(char *buf, int size, int len)
+{
+    uint32_t ok;
+    int n;
+
+    if (len >= size - 1) return len;
+
+    pthread_mutex_lock(&s_netMutex);
+    ok = s_configs - s_failures;
+    n = snprintf(buf + len, size - len,
+            "\n%-15s %8s %8s %8s %8s %8s   (dns sets %u, unchanged %u, last error %d)\n"
+            "%-15s %8u %8u %8lld %8lld %8lld\n",
+            "Net config", "count", "failed", "avg us", "max us", "last us",
+            s_propSets, s_propSkips, s_lastError,
+            "rtnetlink", s_configs, s_failures, ok ? s_totalUs / ok : 0, s_maxUs, s_lastUs);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    pthread_mutex_unlock(&s_netMutex);
+
+    return len;
+}
+
+void at_net_reset_stats(void)
+{
+    pthread_mutex_lock(&s_netMutex);
+    s_configs = 0;
+    s_failures = 0;
+    s_totalUs = 0;
+    s_maxUs = 0;
+    s_lastUs = 0;
+    s_lastError = 0;
+    s_propSets = 0;
+    s_propSkips = 0;
+    pthread_mutex_unlock(&s_netMutex);
+}
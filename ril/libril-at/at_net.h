@@ -0,0 +1,93 @@
+/* //device/system/reference-ril/at_net.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_NET_H
+#define AT_NET_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Waits of the data call setup
+ *
+ * The interface of a data call comes up on its own time (pppd dialing),
+ * and pppd reports its exit through a property. Instead of sleeping a
+ * fixed few seconds between checks, the setup waits here for the real
+ * event: the RTM_NEWLINK of the interface on a rtnetlink socket, or the
+ * property being set, polled every AT_NET_POLL_MSEC. Every wait is
+ * bounded by its caller.
+ */
+#define AT_NET_POLL_MSEC        50
+
+/**
+ * waits up to timeoutMsec for ifname to have all of flags (IFF_UP...),
+ * stop, when not NULL, is asked every AT_NET_POLL_MSEC and ends the wait
+ * when it returns non 0
+ *
+ * returns 0 when the flags are set, 1 when stop ended it, -1 on timeout
+ */
+int at_net_wait_link(const char *ifname, unsigned int flags, long long timeoutMsec,
+        int (*stop)(void *arg), void *arg);
+
+/* waits up to timeoutMsec for property name to be set, 0 and its value or -1 */
+int at_net_wait_property(const char *name, char *value, long long timeoutMsec);
+
+/*
+ * Interface configuration of a data call
+ *
+ * The address, MTU, link up and route go to the kernel in one rtnetlink
+ * sendmsg, each message acked, instead of one ioctl per step. The DNS
+ * properties are published after it only, and only those that changed.
+ */
+#define AT_NET_PROP_MTU         "persist.ril.pdp.mtu"
+#define AT_NET_PROP_ROUTE       "persist.ril.pdp.route"
+#define AT_NET_ACK_MSEC         1000
+
+typedef struct {
+    const char *ifname;
+    const char *address;        /* dotted IPv4 */
+    int prefixLength;           /* 0 for what SIOCSIFADDR would give */
+    int mtu;                    /* 0 keeps the current one */
+    int defaultRoute;           /* adds a default route through ifname */
+} ATNetConfig;
+
+/**
+ * configures and brings up cfg->ifname in one rtnetlink transaction
+ *
+ * returns 0, or -1 when the interface is unknown or one of the
+ * messages was refused
+ */
+int at_net_configure(const ATNetConfig *cfg);
+
+/* fills mtu and defaultRoute of cfg from AT_NET_PROP_MTU and AT_NET_PROP_ROUTE */
+void at_net_config_defaults(ATNetConfig *cfg);
+
+/* sets net.<ifname>.dns1/dns2 when they differ, 0 or -1 */
+int at_net_publish_dns(const char *ifname, const char *dns1, const char *dns2);
+
+/* appends the report to buf, returns the new length */
+int at_net_dump(char *buf, int size, int len);
+
+void at_net_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_NET_H*/
@@ -0,0 +1,566 @@
+/* //device/system/reference-ril/at_pdp.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_pdp.h"
+#include "at_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define MAX_EVENT_ARGS  3
+
+enum {
+    EV_IGNORE = 0,
+    EV_DETACH,
+    EV_DEACT,           /* <PDP_type>,<PDP_addr>[,<cid>] or <p_cid>,<cid>,<event_type> */
+    EV_PDN_DEACT,       /* <cid> */
+    EV_ACT,             /* <p_cid>,<cid>,<event_type> */
+    EV_PDN_ACT,         /* <cid> */
+    EV_REACT            /* <PDP_type>,<PDP_addr>[,<cid>] */
+};
+
+typedef struct {
+    const char *name;
+    int kind;
+} ATPdpEventName;
+
+// 27.007 10.1.19, longer names first //
+static const ATPdpEventName s_eventNames[] = {
+    { "NW PDN DEACT", EV_PDN_DEACT },
+    { "ME PDN DEACT", EV_PDN_DEACT },
+    { "NW PDN ACT", EV_PDN_ACT },
+    { "ME PDN ACT", EV_PDN_ACT },
+    { "NW DETACH", EV_DETACH },
+    { "ME DETACH", EV_DETACH },
+    { "NW DEACT", EV_DEACT },
+    { "ME DEACT", EV_DEACT },
+    { "NW REACT", EV_REACT },
+    { "NW ACT", EV_ACT },
+    { "ME ACT", EV_ACT },
+    { "NW MODIFY", EV_IGNORE },
+    { "ME MODIFY", EV_IGNORE },
+    { "NW CLASS", EV_IGNORE },
+    { "ME CLASS", EV_IGNORE },
+    { "REJECT", EV_IGNORE },
+};
+
+typedef struct {
+    uint32_t setups;
+    uint32_t failures;
+    uint32_t teardowns;     /* by a request */
+    uint32_t drops;         /* by the network, +CGEV */
+    uint32_t totalMs;
+    uint32_t maxMs;
+} ATPdpStats;
+
+static pthread_mutex_t s_pdpMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// all under s_pdpMutex //
+static ATPdpContext s_contexts[AT_PDP_MAX_CONTEXTS];
+static int s_count = 0;
+static int s_valid = 0;
+static unsigned int s_gen = 0;
+
+static uint32_t s_events = 0;
+static uint32_t s_changes = 0;
+static uint32_t s_resyncs = 0;
+static uint32_t s_hits = 0;
+static uint32_t s_reads = 0;
+static uint32_t s_stale = 0;
+static const char *s_lastWhy = "start";
+
+// by cid //
+static ATPdpStats s_cidStats[AT_PDP_MAX_CONTEXTS + 1];
+static ATPdpStats s_phaseStats[AT_PDP_PHASES];
+
+static const char * s_phaseNames[AT_PDP_PHASES] = {
+    "check", "define", "activate", "address", "tty", "link"
+};
+
+/* assumes s_pdpMutex is held, NULL when cid is not followed */
+static ATPdpStats * statsOf(int cid)
+{
+    if (cid < 1 || cid > AT_PDP_MAX_CONTEXTS) return NULL;
+
+    return &s_cidStats[cid];
+}
+
+/* assumes s_pdpMutex is held */
+static void countDrop(int cid)
+{
+    ATPdpStats *st = statsOf(cid);
+
+    if (st != NULL) st->drops++;
+}
+
+/* assumes s_pdpMutex is held */
+static ATPdpContext * findContext(int cid)
+{
+    int i;
+
+    for (i = 0; i < s_count; i++) {
+        if (s_contexts[i].cid == cid) return &s_contexts[i];
+    }
+
+    return NULL;
+}
+
+/* assumes s_pdpMutex is held, why is a literal */
+static void invalidate(const char *why)
+{
+    if (s_valid) LOGI("at_pdp: read again, %s", why);
+    s_valid = 0;
+    s_gen++;
+    s_lastWhy = why;
+}
+
+/* splits p in place into up to max unquoted arguments, returns their count */
+static int splitArgs(char *p, char **args, int max)
+{
+    int n = 0;
+
+    while (n < max) {
+        char *end, *next;
+
+        while (*p == ' ') p++;
+        if (*p == '\0') break;
+
+        if (*p == '"') {
+            args[n++] = ++p;
+            while (*p != '\0' && *p != '"') p++;
+            end = p;
+            while (*p != '\0' && *p != ',') p++;
+        } else {
+            args[n++] = p;
+            while (*p != '\0' && *p != ',') p++;
+            for (end = p; end > args[n - 1] && end[-1] == ' '; end--);
+        }
+
+        next = *p == ',' ? p + 1 : NULL;
+        *end = '\0';
+        if (next == NULL) break;
+        p = next;
+    }
+
+    return n;
+}
+
+static int isNumber(const char *s)
+{
+    if (*s == '\0') return 0;
+    for (; *s != '\0'; s++) {
+        if (!isdigit((unsigned char)*s)) return 0;
+    }
+
+    return 1;
+}
+
+/* assumes s_pdpMutex is held */
+static int deactivate(ATPdpContext *c)
+{
+    if (c == NULL) return AT_PDP_EVENT_RESYNC;
+    if (!c->active) return AT_PDP_EVENT_NONE;
+
+    c->active = 0;
+    countDrop(c->cid);
+    return AT_PDP_EVENT_CHANGED;
+}
+
+/* assumes s_pdpMutex is held */
+static int activate(ATPdpContext *c)
+{
+    // no type nor address in the event, a context we set up is known //
+    if (c == NULL || !c->active) return AT_PDP_EVENT_RESYNC;
+
+    return AT_PDP_EVENT_NONE;
+}
+
+/* assumes s_pdpMutex is held */
+static int apply(int kind, char **args, int n)
+{
+    ATPdpContext *c = NULL;
+    int i, ret;
+
+    switch (kind) {
+        case EV_DETACH:
+            ret = AT_PDP_EVENT_NONE;
+            for (i = 0; i < s_count; i++) {
+                if (s_contexts[i].active) {
+                    s_contexts[i].active = 0;
+                    countDrop(s_contexts[i].cid);
+                    ret = AT_PDP_EVENT_CHANGED;
+                }
+            }
+            return ret;
+
+        case EV_PDN_DEACT:
+            if (n < 1 || !isNumber(args[0])) break;
+            return deactivate(findContext(atoi(args[0])));
+
+        case EV_DEACT:
+            if (n >= 2 && isNumber(args[0])) {
+                return deactivate(findContext(atoi(args[1])));
+            }
+            if (n >= 3 && isNumber(args[2])) {
+                return deactivate(findContext(atoi(args[2])));
+            }
+            // old form without <cid>, find it by its address //
+            if (n >= 2 && args[1][0] != '\0') {
+                for (i = 0; i < s_count; i++) {
+                    if (s_contexts[i].active
+                            && strcmp(s_contexts[i].address, args[1]) == 0) {
+                        c = &s_contexts[i];
+                        break;
+                    }
+                }
+            }
+            return deactivate(c);
+
+        case EV_PDN_ACT:
+            if (n < 1 || !isNumber(args[0])) break;
+            return activate(findContext(atoi(args[0])));
+
+        case EV_ACT:
+            if (n < 2 || !isNumber(args[1])) break;
+            return activate(findContext(atoi(args[1])));
+
+        case EV_REACT:
+            if (n < 3 || !isNumber(args[2])) break;
+            return activate(findContext(atoi(args[2])));
+    }
+
+    return AT_PDP_EVENT_RESYNC;
+}
+
+int at_pdp_event(const char *line)
+{
+    char buf[128];
+    char *args[MAX_EVENT_ARGS];
+    const char *p;
+    int i, n, kind = -1, ret;
+
+    p = strchr(line, ':');
+    p = p != NULL ? p + 1 : line;
+    while (*p == ' ') p++;
+
+    for (i = 0; i < (int)(sizeof(s_eventNames) / sizeof(s_eventNames[0])); i++) {
+        size_t len = strlen(s_eventNames[i].name);
+
+        if (strncmp(p, s_eventNames[i].name, len) == 0
+                && (p[len] == '\0' || p[len] == ' ')) {
+            kind = s_eventNames[i].kind;
+            p += len;
+            break;
+        }
+    }
+
+    if (kind == EV_IGNORE) return AT_PDP_EVENT_NONE;
+
+    strncpy(buf, p, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    n = kind < 0 ? 0 : splitArgs(buf, args, MAX_EVENT_ARGS);
+
+    pthread_mutex_lock(&s_pdpMutex);
+    s_events++;
+    s_gen++;
+    if (kind < 0) {
+        ret = AT_PDP_EVENT_RESYNC;
+    } else if (!s_valid) {
+        // a read is due anyway, it sees this event too //
+        ret = AT_PDP_EVENT_RESYNC;
+    } else {
+        ret = apply(kind, args, n);
+    }
+
+    if (ret == AT_PDP_EVENT_CHANGED) {
+        s_changes++;
+    } else if (ret == AT_PDP_EVENT_RESYNC) {
+        s_resyncs++;
+        invalidate("+CGEV");
+    }
+    pthread_mutex_unlock(&s_pdpMutex);
+
+    if (ret == AT_PDP_EVENT_RESYNC) LOGD("at_pdp: can't follow %s", line);
+
+    return ret;
+}
+
+void at_pdp_activated(int cid, const char *type, const char *address)
+{
+    ATPdpContext *c;
+
+    pthread_mutex_lock(&s_pdpMutex);
+    s_gen++;
+    c = findContext(cid);
+    if (c == NULL && s_count < AT_PDP_MAX_CONTEXTS) {
+        c = &s_contexts[s_count++];
+        memset(c, 0, sizeof(*c));
+        c->cid = cid;
+    }
+
+    if (c != NULL) {
+        c->active = 1;
+        strncpy(c->type, type != NULL ? type : "", AT_PDP_TYPE_LEN - 1);
+        c->type[AT_PDP_TYPE_LEN - 1] = '\0';
+        strncpy(c->address, address != NULL ? address : "", AT_PDP_ADDR_LEN - 1);
+        c->address[AT_PDP_ADDR_LEN - 1] = '\0';
+    } else {
+        invalidate("table full");
+    }
+    pthread_mutex_unlock(&s_pdpMutex);
+}
+
+void at_pdp_deactivated(int cid)
+{
+    ATPdpContext *c;
+
+    pthread_mutex_lock(&s_pdpMutex);
+    s_gen++;
+    c = findContext(cid);
+    if (c != NULL) c->active = 0;
+    if (statsOf(cid) != NULL) statsOf(cid)->teardowns++;
+    pthread_mutex_unlock(&s_pdpMutex);
+}
+
+int at_pdp_is_active(int cid)
+{
+    ATPdpContext *c;
+    int active;
+
+    pthread_mutex_lock(&s_pdpMutex);
+    c = findContext(cid);
+    active = c != NULL && c->active;
+    pthread_mutex_unlock(&s_pdpMutex);
+
+    return active;
+}
+
+unsigned int at_pdp_generation(void)
+{
+    unsigned int gen;
+
+    pthread_mutex_lock(&s_pdpMutex);
+    gen = s_gen;
+    pthread_mutex_unlock(&s_pdpMutex);
+
+    return gen;
+}
+
+void at_pdp_load(unsigned int gen, const ATPdpContext *ctx, int count)
+{
+    pthread_mutex_lock(&s_pdpMutex);
+    s_reads++;
+    if (gen != s_gen) {
+        // an event came meanwhile, the next request reads again //
+        s_stale++;
+    } else if (count > AT_PDP_MAX_CONTEXTS) {
+        invalidate("table full");
+    } else {
+        memcpy(s_contexts, ctx, count * sizeof(ATPdpContext));
+        s_count = count;
+        s_valid = 1;
+    }
+    pthread_mutex_unlock(&s_pdpMutex);
+}
+
+int at_pdp_get(ATPdpContext *ctx, int max)
+{
+    int count = -1;
+
+    pthread_mutex_lock(&s_pdpMutex);
+    if (s_valid) {
+        count = s_count < max ? s_count : max;
+        memcpy(ctx, s_contexts, count * sizeof(ATPdpContext));
+        s_hits++;
+    }
+    pthread_mutex_unlock(&s_pdpMutex);
+
+    return count;
+}
+
+void at_pdp_invalidate(const char *why)
+{
+    pthread_mutex_lock(&s_pdpMutex);
+    invalidate(why);
+    pthread_mutex_unlock(&s_pdpMutex);
+}
+
+static uint32_t clampMs(long long us)
+{
+    long long ms = us / 1000;
+
+    if (ms < 0) return 0;
+    if (ms > 0x7FFFFFFF) return 0x7FFFFFFF;
+
+    return (uint32_t)ms;
+}
+
+/* assumes s_pdpMutex is held */
+static void addTime(ATPdpStats *st, uint32_t ms)
+{
+    st->totalMs += ms;
+    if (ms > st->maxMs) st->maxMs = ms;
+}
+
+void at_pdp_setup_begin(ATPdpSetup *s, int cid)
+{
+    memset(s, 0, sizeof(*s));
+    s->cid = cid;
+    s->phase = AT_PDP_PHASE_CHECK;
+    s->startUs = at_stats_now();
+    s->phaseUs = s->startUs;
+}
+
+void at_pdp_setup_phase(ATPdpSetup *s, int phase)
+{
+    long long now = at_stats_now();
+    uint32_t ms;
+
+    if (s->cid == 0) return;
+
+    ms = clampMs(now - s->phaseUs);
+    s->ms[s->phase] += ms;
+
+    pthread_mutex_lock(&s_pdpMutex);
+    s_phaseStats[s->phase].setups++;
+    addTime(&s_phaseStats[s->phase], ms);
+    pthread_mutex_unlock(&s_pdpMutex);
+
+    s->phase = phase;
+    s->phaseUs = now;
+}
+
+void at_pdp_setup_end(ATPdpSetup *s, int ok)
+{
+    char phases[128];
+    ATPdpStats *st;
+    uint32_t ms;
+    int i, len = 0;
+
+    if (s->cid == 0) return;
+
+    // the phase it failed in counts too //
+    at_pdp_setup_phase(s, s->phase);
+    ms = clampMs(at_stats_now() - s->startUs);
+
+    pthread_mutex_lock(&s_pdpMutex);
+    if (!ok) s_phaseStats[s->phase].failures++;
+    st = statsOf(s->cid);
+    if (st != NULL) {
+        st->setups++;
+        if (!ok) {
+            st->failures++;
+        } else {
+            addTime(st, ms);
+        }
+    }
+    pthread_mutex_unlock(&s_pdpMutex);
+
+    phases[0] = '\0';
+    for (i = 0; i < AT_PDP_PHASES && len < (int)sizeof(phases) - 1; i++) {
+        int n = snprintf(phases + len, sizeof(phases) - len, "%s%s %lld",
+                i ? ", " : "", s_phaseNames[i], s->ms[i]);
+        if (n > 0) len += n;
+    }
+    if (ok) {
+        LOGD("at_pdp: cid %d setup done in %u ms (%s)", s->cid, ms, phases);
+    } else {
+        LOGD("at_pdp: cid %d setup failed in %s after %u ms (%s)", s->cid,
+                s_phaseNames[s->phase], ms, phases);
+    }
+    s->cid = 0;
+}
+
+int at_pdp_dump(char *buf, int size, int len)
+{
+    int i, n;
+
+    if (len >= size - 1) return len;
+
+    pthread_mutex_lock(&s_pdpMutex);
+    n = snprintf(buf + len, size - len,
+            "\n%-15s %6s %8s   (%s, events %u, changes %u, resyncs %u, hits %u, reads %u, stale %u, last %s)\n",
+            "PDP contexts", "active", "type", s_valid ? "in sync" : "unknown",
+            s_events, s_changes, s_resyncs, s_hits, s_reads, s_stale, s_lastWhy);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+
+    for (i = 0; i < s_count && len < size - 1; i++) {
+        ATPdpContext *c = &s_contexts[i];
+
+        n = snprintf(buf + len, size - len, "cid %-11d %6d %8s   %s\n",
+                c->cid, c->active, c->type, c->address);
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+
+    if (len < size - 1) {
+        n = snprintf(buf + len, size - len,
+                "\n%-15s %8s %8s %8s %8s %8s %8s\n",
+                "Data calls", "setups", "failed", "avg ms", "max ms", "teardown", "drops");
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+
+    for (i = 1; i <= AT_PDP_MAX_CONTEXTS && len < size - 1; i++) {
+        ATPdpStats *st = &s_cidStats[i];
+        uint32_t ok = st->setups - st->failures;
+
+        if (st->setups == 0 && st->teardowns == 0 && st->drops == 0) continue;
+
+        n = snprintf(buf + len, size - len, "cid %-11d %8u %8u %8u %8u %8u %8u\n",
+                i, st->setups, st->failures, ok ? st->totalMs / ok : 0, st->maxMs,
+                st->teardowns, st->drops);
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+
+    if (len < size - 1) {
+        n = snprintf(buf + len, size - len, "\n%-15s %8s %8s %8s %8s\n",
+                "Setup phases", "count", "failed", "avg ms", "max ms");
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+
+    for (i = 0; i < AT_PDP_PHASES && len < size - 1; i++) {
+        ATPdpStats *st = &s_phaseStats[i];
+
+        n = snprintf(buf + len, size - len, "%-15s %8u %8u %8u %8u\n",
+                s_phaseNames[i], st->setups, st->failures,
+                st->setups ? st->totalMs / st->setups : 0, st->maxMs);
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+    pthread_mutex_unlock(&s_pdpMutex);
+
+    return len;
+}
+
+void at_pdp_reset_stats(void)
+{
+    pthread_mutex_lock(&s_pdpMutex);
+    s_events = 0;
+    s_changes = 0;
+    s_resyncs = 0;
+    s_hits = 0;
+    s_reads = 0;
+    s_stale = 0;
+    memset(s_cidStats, 0, sizeof(s_cidStats));
+    memset(s_phaseStats, 0, sizeof(s_phaseStats));
+    pthread_mutex_unlock(&s_pdpMutex);
+}
@@ -0,0 +1,126 @@
+/* //device/system/reference-ril/at_pdp.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_PDP_H
+#define AT_PDP_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * PDP context table
+ *
+ * The state of every context AT+CGACT? lists is kept here with the type
+ * and address AT+CGDCONT? gives. The table is then moved along by the
+ * data call requests and by +CGEV (deactivation, detach), and the data
+ * call list, requested or unsolicited, is built from it without asking
+ * the modem again.
+ *
+ * Only a +CGEV the table cannot follow (an activation it did not start,
+ * a context it does not know, a form it cannot parse) drops it; the
+ * data call list is then read again with AT+CGACT? and AT+CGDCONT?. So
+ * does a failed read, a channel (re)open and a radio power change.
+ *
+ * A read answer only replaces the table if no event came in meanwhile,
+ * see the generation arguments. Events and reads are reported with the
+ * AT statistics (radiooptions 11), with the setup time, failures,
+ * teardowns and network drops of every cid.
+ */
+#define AT_PDP_MAX_CONTEXTS     16
+#define AT_PDP_TYPE_LEN         16
+#define AT_PDP_ADDR_LEN         64
+
+typedef struct {
+    int cid;
+    int active;                         /* +CGACT <state> */
+    char type[AT_PDP_TYPE_LEN];         /* +CGDCONT <PDP_type> */
+    char address[AT_PDP_ADDR_LEN];      /* +CGDCONT <PDP_addr> */
+} ATPdpContext;
+
+/* at_pdp_event() results */
+enum {
+    AT_PDP_EVENT_RESYNC = -1,   /* table dropped, read the list again */
+    AT_PDP_EVENT_NONE = 0,      /* nothing the data call list shows */
+    AT_PDP_EVENT_CHANGED        /* report the table */
+};
+
+/* takes a +CGEV: line in */
+int at_pdp_event(const char *line);
+
+/* a data call request (de)activated cid */
+void at_pdp_activated(int cid, const char *type, const char *address);
+void at_pdp_deactivated(int cid);
+
+/* returns the +CGACT state of cid in the table, 0 when unknown */
+int at_pdp_is_active(int cid);
+
+/* read before sending the AT+CGACT? whose answer goes to at_pdp_load() */
+unsigned int at_pdp_generation(void);
+
+/* takes a full read in, ignored when an event came after gen was read */
+void at_pdp_load(unsigned int gen, const ATPdpContext *ctx, int count);
+
+/* copies up to max contexts, returns their count, -1 when it must be read */
+int at_pdp_get(ATPdpContext *ctx, int max);
+
+/* drops the table, why is a literal */
+void at_pdp_invalidate(const char *why);
+
+/* data call setup phases, each one ends on a real event, no fixed sleep */
+enum {
+    AT_PDP_PHASE_CHECK = 0,     /* AT+CGACT?, an old context taken down */
+    AT_PDP_PHASE_DEFINE,        /* AT+CGDCONT, ^SGPCO=0 */
+    AT_PDP_PHASE_ACTIVATE,      /* AT+CGACT=1, or pppd up to its link up */
+    AT_PDP_PHASE_ADDRESS,       /* ^SGPCO=2 and AT+CGPADDR, or pppd properties */
+    AT_PDP_PHASE_TTY,           /* raw IP tty ready and its line discipline */
+    AT_PDP_PHASE_LINK,          /* rtnetlink address, MTU, up, route and DNS */
+    AT_PDP_PHASES
+};
+
+/* one setup request, on the stack of its request thread */
+typedef struct {
+    int cid;                    /* 0 until at_pdp_setup_begin() */
+    int phase;
+    long long startUs;
+    long long phaseUs;
+    long long ms[AT_PDP_PHASES];
+} ATPdpSetup;
+
+/**
+ * data call statistics per cid and per phase: a setup request took cid,
+ * went through its phases and ended, ok or not
+ */
+void at_pdp_setup_begin(ATPdpSetup *s, int cid);
+
+/* closes the current phase of s and enters phase */
+void at_pdp_setup_phase(ATPdpSetup *s, int phase);
+
+/* closes s, nothing when it never began */
+void at_pdp_setup_end(ATPdpSetup *s, int ok);
+
+/* appends the report to buf, returns the new length */
+int at_pdp_dump(char *buf, int size, int len);
+
+void at_pdp_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_PDP_H*/
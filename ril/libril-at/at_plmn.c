@@ -0,0 +1,350 @@
+/* //device/system/reference-ril/at_plmn.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_plmn.h"
+#include "at_stats.h"
+#include "at_tok.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define BACKOFF_POLL_MSEC   100
+
+static pthread_mutex_t s_plmnMutex = PTHREAD_MUTEX_INITIALIZER;
+static long long s_ttlUs = AT_PLMN_DEF_TTL * 1000000LL;
+static long long s_maxAgeUs = AT_PLMN_DEF_MAXAGE * 1000000LL;
+
+// all under s_plmnMutex //
+static ATPlmnEntry s_entries[AT_PLMN_MAX_ENTRIES];
+static int s_count = 0;
+static long long s_scannedUs = 0;       /* 0 nothing kept */
+static unsigned int s_gen = 0;
+static int s_running = 0;
+static int s_background = 0;
+static int s_preempted = 0;
+static int s_cid = -1;
+static long long s_startUs = 0;
+static const char *s_lastWhy = "start";
+
+static uint32_t s_scans = 0;
+static uint32_t s_failures = 0;
+static uint32_t s_refreshes = 0;
+static uint32_t s_preemptions = 0;
+static uint32_t s_hits = 0;
+static uint32_t s_staleHits = 0;
+static uint32_t s_misses = 0;
+static long long s_totalMs = 0;
+static long long s_maxMs = 0;
+
+static const char * s_stateNames[] = { "unknown", "available", "current", "forbidden" };
+static const char * s_actNames[] = { "0", "1", "2", "3", "4", "5", "6", "7" };
+
+static long long getSecProperty(const char *name, long long def)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(name, value, "");
+    if (value[0] == '\0') return def;
+
+    return atoll(value);
+}
+
+void at_plmn_init(void)
+{
+    s_ttlUs = getSecProperty(AT_PLMN_PROP_TTL, AT_PLMN_DEF_TTL) * 1000000LL;
+    s_maxAgeUs = getSecProperty(AT_PLMN_PROP_MAXAGE, AT_PLMN_DEF_MAXAGE) * 1000000LL;
+    if (s_ttlUs < 0) s_ttlUs = 0;
+    if (s_maxAgeUs < s_ttlUs) s_maxAgeUs = s_ttlUs;
+
+    at_plmn_invalidate("channel open");
+
+    LOGI("at_plmn: ttl %lld s, max age %lld s", s_ttlUs / 1000000, s_maxAgeUs / 1000000);
+}
+
+int at_plmn_lookup(ATPlmnEntry *e, int max, int *n, long long *ageMs)
+{
+    long long age;
+    int ret;
+
+    pthread_mutex_lock(&s_plmnMutex);
+    age = at_stats_now() - s_scannedUs;
+    if (s_scannedUs == 0 || s_ttlUs == 0 || age >= s_maxAgeUs) {
+        s_misses++;
+        pthread_mutex_unlock(&s_plmnMutex);
+        *n = 0;
+        *ageMs = -1;
+        return AT_PLMN_SCAN;
+    }
+
+    *n = s_count < max ? s_count : max;
+    memcpy(e, s_entries, *n * sizeof(ATPlmnEntry));
+    *ageMs = age / 1000;
+
+    if (age < s_ttlUs) {
+        s_hits++;
+        ret = AT_PLMN_FRESH;
+    } else {
+        s_staleHits++;
+        ret = AT_PLMN_REFRESH;
+    }
+    pthread_mutex_unlock(&s_plmnMutex);
+
+    return ret;
+}
+
+unsigned int at_plmn_scan_begin(int cid, int background)
+{
+    unsigned int gen;
+
+    pthread_mutex_lock(&s_plmnMutex);
+    s_running = 1;
+    s_background = background;
+    s_preempted = 0;
+    s_cid = cid;
+    s_startUs = at_stats_now();
+    s_scans++;
+    if (background) s_refreshes++;
+    gen = s_gen;
+    pthread_mutex_unlock(&s_plmnMutex);
+
+    return gen;
+}
+
+int at_plmn_preempted(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&s_plmnMutex);
+    ret = s_running && s_preempted;
+    pthread_mutex_unlock(&s_plmnMutex);
+
+    return ret;
+}
+
+int at_plmn_backoff(long long msec)
+{
+    long long endUs = at_stats_now() + msec * 1000;
+
+    while (at_stats_now() < endUs) {
+        if (at_plmn_preempted()) return 1;
+        usleep(BACKOFF_POLL_MSEC * 1000);
+    }
+
+    return at_plmn_preempted();
+}
+
+void at_plmn_scan_end(unsigned int gen, const ATPlmnEntry *e, int n)
+{
+    long long now = at_stats_now();
+    long long ms;
+    int kept = 0;
+
+    pthread_mutex_lock(&s_plmnMutex);
+    ms = (now - s_startUs) / 1000;
+    if (n < 0) {
+        s_failures++;
+    } else {
+        s_totalMs += ms;
+        if (ms > s_maxMs) s_maxMs = ms;
+
+        // a radio off or a selection during the scan makes it moot //
+        if (gen == s_gen) {
+            if (n > AT_PLMN_MAX_ENTRIES) n = AT_PLMN_MAX_ENTRIES;
+            memcpy(s_entries, e, n * sizeof(ATPlmnEntry));
+            s_count = n;
+            s_scannedUs = now;
+            kept = 1;
+        }
+    }
+    s_running = 0;
+    s_background = 0;
+    s_preempted = 0;
+    s_cid = -1;
+    pthread_mutex_unlock(&s_plmnMutex);
+
+    if (kept) {
+        char value[PROPERTY_VALUE_MAX];
+
+        snprintf(value, sizeof(value), "%ld", (long)time(NULL));
+        property_set(AT_PLMN_PROP_TIME, value);
+    }
+
+    LOGD("at_plmn: scan %s in %lld ms, %d networks%s", n < 0 ? "failed" : "done", ms,
+            n < 0 ? 0 : n, n >= 0 && !kept ? ", dropped" : "");
+}
+
+int at_plmn_preempt(void)
+{
+    int cid = -1;
+
+    pthread_mutex_lock(&s_plmnMutex);
+    if (s_running && s_background && !s_preempted) {
+        s_preempted = 1;
+        s_preemptions++;
+        cid = s_cid;
+    }
+    pthread_mutex_unlock(&s_plmnMutex);
+
+    return cid;
+}
+
+void at_plmn_invalidate(const char *why)
+{
+    pthread_mutex_lock(&s_plmnMutex);
+    s_scannedUs = 0;
+    s_count = 0;
+    s_gen++;
+    s_lastWhy = why;
+    pthread_mutex_unlock(&s_plmnMutex);
+}
+
+/* copies the string token at *p into dst, "" when there is none */
+static int nextName(char **p, char *dst, int size)
+{
+    char *s;
+
+    if (at_tok_nextstr(p, &s) < 0) return -1;
+
+    if (s == NULL) s = "";
+    strncpy(dst, s, size - 1);
+    dst[size - 1] = '\0';
+
+    return 0;
+}
+
+/* ')' closing the group at p, quoted names skipped, NULL when missing */
+static char * groupEnd(char *p)
+{
+    int quoted = 0;
+
+    for (; *p != '\0'; p++) {
+        if (*p == '"') quoted = !quoted;
+        else if (*p == ')' && !quoted) return p;
+    }
+
+    return NULL;
+}
+
+int at_plmn_parse(char *line, ATPlmnEntry *e, int max)
+{
+    char *p = line, *group, *end;
+    int n = 0;
+
+    if (at_tok_start(&p) < 0) return -1;
+
+    while ((group = strchr(p, '(')) != NULL) {
+        ATPlmnEntry *cur = &e[n];
+
+        end = groupEnd(group);
+        if (end == NULL) return -1;
+
+        // supported modes and formats follow ",,", no names in them //
+        if (memchr(group, '"', end - group) == NULL) break;
+
+        if (n == max) {
+            LOGD("at_plmn: more than %d networks, rest ignored", max);
+            break;
+        }
+
+        *end = '\0';
+        p = group + 1;
+        if (at_tok_nextint(&p, &cur->state) < 0
+                || at_plmn_state_name(cur->state) == NULL
+                || nextName(&p, cur->longName, sizeof(cur->longName)) < 0
+                || nextName(&p, cur->shortName, sizeof(cur->shortName)) < 0
+                || nextName(&p, cur->numeric, sizeof(cur->numeric)) < 0) {
+            return -1;
+        }
+
+        cur->act = -1;
+        if (at_tok_hasmore(&p) && at_tok_nextint(&p, &cur->act) < 0) return -1;
+
+        n++;
+        p = end + 1;
+    }
+
+    return n;
+}
+
+const char * at_plmn_state_name(int state)
+{
+    if (state < 0 || state >= (int)(sizeof(s_stateNames) / sizeof(s_stateNames[0]))) {
+        return NULL;
+    }
+
+    return s_stateNames[state];
+}
+
+const char * at_plmn_act_name(int act)
+{
+    if (act < 0 || act >= (int)(sizeof(s_actNames) / sizeof(s_actNames[0]))) return "FF";
+
+    return s_actNames[act];
+}
+
+int at_plmn_dump(char *buf, int size, int len)
+{
+    long long age;
+    uint32_t ok;
+    int n;
+
+    if (len >= size - 1) return len;
+
+    pthread_mutex_lock(&s_plmnMutex);
+    ok = s_scans - s_failures;
+    age = s_scannedUs != 0 ? (at_stats_now() - s_scannedUs) / 1000000 : -1;
+    n = snprintf(buf + len, size - len,
+            "\n%-15s %8s %8s %8s %8s %8s %8s   (%d kept, age %lld s, %s, last drop %s)\n"
+            "%-15s %8u %8u %8u %8u %8lld %8lld\n"
+            "%-15s %8s %8s %8s\n"
+            "%-15s %8u %8u %8u\n",
+            "Network scans", "count", "failed", "refresh", "preempt", "avg ms", "max ms",
+            s_count, age, s_running ? (s_background ? "refreshing" : "scanning") : "idle",
+            s_lastWhy,
+            "AT+COPS=?", s_scans, s_failures, s_refreshes, s_preemptions,
+            ok ? s_totalMs / ok : 0, s_maxMs,
+            "Scan requests", "fresh", "stale", "scanned",
+            "", s_hits, s_staleHits, s_misses);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    pthread_mutex_unlock(&s_plmnMutex);
+
+    return len;
+}
+
+void at_plmn_reset_stats(void)
+{
+    pthread_mutex_lock(&s_plmnMutex);
+    s_scans = 0;
+    s_failures = 0;
+    s_refreshes = 0;
+    s_preemptions = 0;
+    s_hits = 0;
+    s_staleHits = 0;
+    s_misses = 0;
+    s_totalMs = 0;
+    s_maxMs = 0;
+    pthread_mutex_unlock(&s_plmnMutex);
+}
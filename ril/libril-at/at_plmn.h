@@ -0,0 +1,125 @@
+/* //device/system/reference-ril/at_plmn.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_PLMN_H
+#define AT_PLMN_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Network scan job (AT+COPS=?)
+ *
+ * A scan holds the network channel for up to two minutes, so its result
+ * is kept. Within persist.ril.plmn.ttl a scan request is answered from
+ * it. Up to persist.ril.plmn.maxage it is answered from it too, and the
+ * request thread then refreshes the list in the background. The
+ * framework gets no age field in the answer, so the age is logged and
+ * ril.plmn.scan.time holds the wall clock second of the kept scan.
+ *
+ * Only one scan runs. Both scan requests use the network channel, so a
+ * request queued behind a scan or refresh finds the fresh list when its
+ * turn comes. Any other request of the channel pre-empts a background
+ * refresh (libril calls onCancel(NULL)). A scan the user waits for is
+ * only cancelled by a network selection, as before.
+ *
+ * The +COPS line is parsed in place into the fixed entries below, and
+ * the answers point into a copy of them, nothing is allocated per
+ * entry. Scans, hits and refreshes are reported with the AT statistics.
+ */
+#define AT_PLMN_PROP_TTL        "persist.ril.plmn.ttl"      /* sec, default 60, 0 no cache */
+#define AT_PLMN_PROP_MAXAGE     "persist.ril.plmn.maxage"   /* sec, default 600 */
+#define AT_PLMN_PROP_TIME       "ril.plmn.scan.time"
+#define AT_PLMN_DEF_TTL         60
+#define AT_PLMN_DEF_MAXAGE      600
+#define AT_PLMN_MAX_ENTRIES     32
+#define AT_PLMN_NAME_LEN        32
+
+typedef struct {
+    int state;                  /* 0 unknown, 1 available, 2 current, 3 forbidden */
+    int act;                    /* 27.007 <AcT>, -1 not reported */
+    char longName[AT_PLMN_NAME_LEN];
+    char shortName[AT_PLMN_NAME_LEN];
+    char numeric[8];
+} ATPlmnEntry;
+
+/* what to do with a scan request */
+enum {
+    AT_PLMN_SCAN = 0,           /* nothing kept, scan while the request waits */
+    AT_PLMN_FRESH,              /* answer from the list */
+    AT_PLMN_REFRESH             /* answer from the list, then scan */
+};
+
+void at_plmn_init(void);
+
+/**
+ * copies up to max kept entries to e, *n gets their count and *ageMs
+ * their age, returns AT_PLMN_SCAN, AT_PLMN_FRESH or AT_PLMN_REFRESH
+ */
+int at_plmn_lookup(ATPlmnEntry *e, int max, int *n, long long *ageMs);
+
+/**
+ * marks a scan running on channel cid, background for a refresh after
+ * the answer, returns the generation to give to at_plmn_scan_end()
+ */
+unsigned int at_plmn_scan_begin(int cid, int background);
+
+/* 1 when the running scan was pre-empted */
+int at_plmn_preempted(void);
+
+/* waits msec for a busy modem, returns 1 when pre-empted meanwhile */
+int at_plmn_backoff(long long msec);
+
+/**
+ * ends the running scan, n < 0 when it failed; the entries are kept
+ * unless the list was invalidated after gen was read
+ */
+void at_plmn_scan_end(unsigned int gen, const ATPlmnEntry *e, int n);
+
+/**
+ * pre-empts a background refresh, returns the channel it runs on so its
+ * command can be cancelled, -1 when there is none
+ */
+int at_plmn_preempt(void);
+
+/* drops the list (radio off, selection...), why is a literal */
+void at_plmn_invalidate(const char *why);
+
+/**
+ * parses "+COPS: (...),(...),,(modes),(formats)" in place into up to
+ * max entries, returns their count or -1
+ */
+int at_plmn_parse(char *line, ATPlmnEntry *e, int max);
+
+/* "unknown", "available", "current", "forbidden", NULL when out of range */
+const char * at_plmn_state_name(int state);
+
+/* "0".."7", "FF" when not reported */
+const char * at_plmn_act_name(int act);
+
+/* appends the report to buf, returns the new length */
+int at_plmn_dump(char *buf, int size, int len);
+
+void at_plmn_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_PLMN_H*/
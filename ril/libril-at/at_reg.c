@@ -0,0 +1,252 @@
+/* //device/system/reference-ril/at_reg.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_reg.h"
+#include "at_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+typedef struct {
+    ATRegState st;
+    long long updatedUs;        /* 0 unknown */
+    unsigned int gen;
+    uint32_t urcs;
+    uint32_t changes;
+    uint32_t hits;
+    uint32_t queries;
+} ATRegDomain;
+
+static pthread_mutex_t s_regMutex = PTHREAD_MUTEX_INITIALIZER;
+static long long s_maxAgeUs = AT_REG_DEF_MAXAGE * 1000LL;
+
+// all under s_regMutex //
+static ATRegDomain s_domains[AT_REG_DOMAINS];
+static ATRegOperator s_oper;
+static long long s_operUs = 0;
+static unsigned int s_operGen = 0;
+static uint32_t s_operHits = 0;
+static uint32_t s_operQueries = 0;
+static uint32_t s_operDrops = 0;
+
+static const char * s_domainNames[AT_REG_DOMAINS] = { "+CREG", "+CGREG" };
+
+void at_reg_init(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(AT_REG_PROP_MAXAGE, value, "");
+    s_maxAgeUs = (value[0] != '\0' ? atoll(value) : AT_REG_DEF_MAXAGE) * 1000LL;
+    if (s_maxAgeUs < 0) s_maxAgeUs = 0;
+
+    LOGI("at_reg: max age %lld ms", s_maxAgeUs / 1000);
+}
+
+/* assumes s_regMutex is held */
+static void dropOperator(void)
+{
+    if (s_operUs != 0) s_operDrops++;
+    s_operUs = 0;
+    s_operGen++;
+}
+
+/* assumes s_regMutex is held, returns 1 on a change */
+static int store(ATRegDomain *d, const ATRegState *st)
+{
+    int changed = d->updatedUs == 0
+            || memcmp(&d->st, st, sizeof(ATRegState)) != 0;
+
+    // another LA or AcT may be another PLMN, CI alone is not //
+    if (d->updatedUs == 0 || d->st.stat != st->stat
+            || d->st.lac != st->lac || d->st.tech != st->tech) {
+        dropOperator();
+    }
+
+    d->st = *st;
+    d->updatedUs = at_stats_now();
+    if (changed) d->changes++;
+
+    return changed;
+}
+
+int at_reg_indicate(int domain, const ATRegState *st)
+{
+    ATRegDomain *d = &s_domains[domain];
+    int changed;
+
+    pthread_mutex_lock(&s_regMutex);
+    d->urcs++;
+    d->gen++;
+    changed = store(d, st);
+    pthread_mutex_unlock(&s_regMutex);
+
+    return changed;
+}
+
+unsigned int at_reg_generation(int domain)
+{
+    unsigned int gen;
+
+    pthread_mutex_lock(&s_regMutex);
+    gen = s_domains[domain].gen;
+    pthread_mutex_unlock(&s_regMutex);
+
+    return gen;
+}
+
+void at_reg_load(int domain, unsigned int gen, const ATRegState *st)
+{
+    ATRegDomain *d = &s_domains[domain];
+
+    pthread_mutex_lock(&s_regMutex);
+    d->queries++;
+    // a URC came meanwhile and is newer than this answer //
+    if (gen == d->gen) store(d, st);
+    pthread_mutex_unlock(&s_regMutex);
+}
+
+int at_reg_get(int domain, ATRegState *st)
+{
+    ATRegDomain *d = &s_domains[domain];
+    int ret = -1;
+
+    pthread_mutex_lock(&s_regMutex);
+    if (d->updatedUs != 0 && at_stats_now() - d->updatedUs < s_maxAgeUs) {
+        *st = d->st;
+        d->hits++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&s_regMutex);
+
+    return ret;
+}
+
+int at_reg_get_operator(ATRegOperator *op)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&s_regMutex);
+    if (s_operUs != 0 && s_maxAgeUs > 0
+            && at_stats_now() - s_operUs < AT_REG_OPER_MAX_AGE_MSEC * 1000LL) {
+        *op = s_oper;
+        s_operHits++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&s_regMutex);
+
+    return ret;
+}
+
+unsigned int at_reg_operator_generation(void)
+{
+    unsigned int gen;
+
+    pthread_mutex_lock(&s_regMutex);
+    gen = s_operGen;
+    pthread_mutex_unlock(&s_regMutex);
+
+    return gen;
+}
+
+void at_reg_set_operator(unsigned int gen, const ATRegOperator *op)
+{
+    pthread_mutex_lock(&s_regMutex);
+    s_operQueries++;
+    if (gen == s_operGen) {
+        s_oper = *op;
+        s_operUs = at_stats_now();
+    }
+    pthread_mutex_unlock(&s_regMutex);
+}
+
+void at_reg_drop_operator(void)
+{
+    pthread_mutex_lock(&s_regMutex);
+    dropOperator();
+    pthread_mutex_unlock(&s_regMutex);
+}
+
+void at_reg_invalidate(void)
+{
+    int i;
+
+    pthread_mutex_lock(&s_regMutex);
+    for (i = 0; i < AT_REG_DOMAINS; i++) {
+        s_domains[i].updatedUs = 0;
+        s_domains[i].gen++;
+    }
+    dropOperator();
+    pthread_mutex_unlock(&s_regMutex);
+}
+
+int at_reg_dump(char *buf, int size, int len)
+{
+    long long now = at_stats_now();
+    int i, n;
+
+    if (len >= size - 1) return len;
+
+    pthread_mutex_lock(&s_regMutex);
+    n = snprintf(buf + len, size - len, "\n%-15s %5s %8s %8s %5s %8s %8s %8s %8s %8s\n",
+            "Registration", "stat", "lac", "ci", "tech", "age ms", "urcs", "changes",
+            "hits", "queries");
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+
+    for (i = 0; i < AT_REG_DOMAINS && len < size - 1; i++) {
+        ATRegDomain *d = &s_domains[i];
+
+        n = snprintf(buf + len, size - len, "%-15s %5d %8x %8x %5d %8lld %8u %8u %8u %8u\n",
+                s_domainNames[i], d->st.stat, d->st.lac, d->st.ci, d->st.tech,
+                d->updatedUs ? (now - d->updatedUs) / 1000 : -1LL,
+                d->urcs, d->changes, d->hits, d->queries);
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+
+    if (len < size - 1) {
+        n = snprintf(buf + len, size - len, "%-15s \"%s\" %s, hits %u, queries %u, drops %u\n",
+                "+COPS", s_oper.present[2] ? s_oper.name[2] : "",
+                s_operUs ? "kept" : "unknown", s_operHits, s_operQueries, s_operDrops);
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+    pthread_mutex_unlock(&s_regMutex);
+
+    return len;
+}
+
+void at_reg_reset_stats(void)
+{
+    int i;
+
+    pthread_mutex_lock(&s_regMutex);
+    for (i = 0; i < AT_REG_DOMAINS; i++) {
+        s_domains[i].urcs = 0;
+        s_domains[i].changes = 0;
+        s_domains[i].hits = 0;
+        s_domains[i].queries = 0;
+    }
+    s_operHits = 0;
+    s_operQueries = 0;
+    s_operDrops = 0;
+    pthread_mutex_unlock(&s_regMutex);
+}
@@ -0,0 +1,103 @@
+/* //device/system/reference-ril/at_reg.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_REG_H
+#define AT_REG_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Registration store
+ *
+ * With AT+CREG=2 and AT+CGREG=2 the modem reports <stat>, LAC, CI and
+ * AcT on every camping change. The last report of each domain is kept
+ * here and the voice and data registration requests are answered from
+ * it while it is younger than persist.ril.reg.maxage. Older or unknown
+ * state is asked with AT+CREG?/AT+CGREG?, and the answer is stored too.
+ *
+ * The operator names (AT+COPS?) are kept until a registration change
+ * that may mean another PLMN (<stat>, LAC or AcT), a network selection,
+ * or AT_REG_OPER_MAX_AGE_MSEC; the next RIL_REQUEST_OPERATOR then asks
+ * the modem again.
+ *
+ * A query answer only replaces the state if no URC came in meanwhile,
+ * see the generation arguments. Hits and queries are reported with the
+ * AT statistics (radiooptions 11).
+ */
+#define AT_REG_PROP_MAXAGE          "persist.ril.reg.maxage"    /* msec, default 30000, 0 off */
+#define AT_REG_DEF_MAXAGE           30000
+#define AT_REG_OPER_MAX_AGE_MSEC    300000
+#define AT_REG_NAME_LEN             64
+
+/* domains */
+enum {
+    AT_REG_CS = 0,      /* +CREG */
+    AT_REG_PS,          /* +CGREG */
+    AT_REG_DOMAINS
+};
+
+typedef struct {
+    int stat;
+    int lac;            /* -1 unknown */
+    int ci;             /* -1 unknown */
+    int tech;           /* RADIO_TECHNOLOGY_APP_*, -1 not reported */
+} ATRegState;
+
+/* operator names as +COPS? gives them: long, short, numeric */
+typedef struct {
+    char name[3][AT_REG_NAME_LEN];
+    char present[3];
+} ATRegOperator;
+
+void at_reg_init(void);
+
+/* takes a URC in, returns 1 when the state of domain changed */
+int at_reg_indicate(int domain, const ATRegState *st);
+
+/* read before sending the query whose answer goes to at_reg_load() */
+unsigned int at_reg_generation(int domain);
+
+/* takes a query answer in, ignored when a URC came after gen was read */
+void at_reg_load(int domain, unsigned int gen, const ATRegState *st);
+
+/* returns 0 and the state of domain, -1 when it must be asked */
+int at_reg_get(int domain, ATRegState *st);
+
+/* operator names, same rules, the generation is at_reg_operator_generation() */
+int at_reg_get_operator(ATRegOperator *op);
+unsigned int at_reg_operator_generation(void);
+void at_reg_set_operator(unsigned int gen, const ATRegOperator *op);
+
+/* the network selection changed, forget the operator names */
+void at_reg_drop_operator(void);
+
+/* forgets everything, reports off or radio off */
+void at_reg_invalidate(void);
+
+/* appends the report to buf, returns the new length */
+int at_reg_dump(char *buf, int size, int len);
+
+void at_reg_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_REG_H*/
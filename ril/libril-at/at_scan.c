@@ -0,0 +1,251 @@
+/* //device/system/reference-ril/at_scan.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_scan.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+static int scanEolWord(const char *buf, int len);
+static const char * scanDelimWord(const char *s);
+
+int (*at_scan_eol)(const char *buf, int len) = scanEolWord;
+const char * (*at_scan_delim)(const char *s) = scanDelimWord;
+static const char * s_scanImpl = "word";
+
+/* byte by byte, used for heads and tails of the vector versions */
+static inline int scanEolByte(const char *buf, int i, int len)
+{
+    for (; i < len; i++) {
+        if (buf[i] == '\r' || buf[i] == '\n') break;
+    }
+
+    return i;
+}
+
+/*
+ * Word at a time: a byte of x is zero iff the matching byte of
+ * (x - 0x01..01) & ~x & 0x80..80 is set.
+ */
+#define ONES    ((unsigned long)-1 / 0xFF)
+#define HIGHS   (ONES * 0x80)
+#define HASZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+
+static int scanEolWord(const char *buf, int len)
+{
+    const unsigned long cr = ONES * '\r';
+    const unsigned long lf = ONES * '\n';
+    int i = 0;
+
+    // align to word boundary //
+    while (i < len && ((uintptr_t)(buf + i) & (sizeof(unsigned long) - 1))) {
+        if (buf[i] == '\r' || buf[i] == '\n') return i;
+        i++;
+    }
+
+    for (; i + (int)sizeof(unsigned long) <= len; i += sizeof(unsigned long)) {
+        unsigned long w = *(const unsigned long *)(buf + i);
+        if (HASZERO(w ^ cr) | HASZERO(w ^ lf)) break;
+    }
+
+    return scanEolByte(buf, i, len);
+}
+
+static inline int isDelim(char c)
+{
+    return c == ',' || c == '"' || c == '\0';
+}
+
+static const char * scanDelimWord(const char *s)
+{
+    const unsigned long comma = ONES * ',';
+    const unsigned long quote = ONES * '"';
+    const unsigned long *w;
+
+    while ((uintptr_t)s & (sizeof(unsigned long) - 1)) {
+        if (isDelim(*s)) return s;
+        s++;
+    }
+
+    // an aligned word never straddles a page //
+    for (w = (const unsigned long *)s;
+            !(HASZERO(*w) | HASZERO(*w ^ comma) | HASZERO(*w ^ quote)); w++);
+
+    for (s = (const char *)w; !isDelim(*s); s++);
+
+    return s;
+}
+
+#ifdef __SSE2__
+static int scanEolSse2(const char *buf, int len)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        int mask = _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return scanEolByte(buf, i, len);
+}
+
+static const char * scanDelimSse2(const char *s)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i *a = (const __m128i *)((uintptr_t)s & ~(uintptr_t)15);
+    unsigned int skip = (uintptr_t)s & 15;
+
+    for (;; a++) {
+        __m128i v = _mm_load_si128(a);
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero),
+                _mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, quote))));
+
+        // bytes of the first block before s //
+        mask = (mask >> skip) << skip;
+        skip = 0;
+        if (mask != 0) {
+            return (const char *)a + __builtin_ctz(mask);
+        }
+    }
+}
+#endif
+
+#ifdef AT_SCAN_HAVE_NEON
+/* NEON is optional on ARMv7, ask the kernel */
+static int cpuHasNeon(void)
+{
+    char line[512];
+    int neon = 0;
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+
+    if (fp == NULL) return 0;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, "Features", 8) == 0) {
+            neon = (strstr(line, " neon") != NULL);
+            break;
+        }
+    }
+    fclose(fp);
+
+    return neon;
+}
+#endif
+
+void at_scan_init(void)
+{
+#if defined(AT_SCAN_HAVE_NEON)
+    if (cpuHasNeon()) {
+        at_scan_eol = at_scan_eol_neon;
+        at_scan_delim = at_scan_delim_neon;
+        s_scanImpl = "neon";
+    }
+#elif defined(__SSE2__)
+    at_scan_eol = scanEolSse2;
+    at_scan_delim = scanDelimSse2;
+    s_scanImpl = "sse2";
+#endif
+
+    LOGI("at_scan: using %s EOL scanner", s_scanImpl);
+}
+
+const char * at_scan_impl_name(void)
+{
+    return s_scanImpl;
+}
+
+/**
+ * Builds a first byte indexed matcher from a prefix table.
+ * Within a bucket longer prefixes are tried first so that the most
+ * specific entry wins.
+ */
+int at_prefix_matcher_build(ATPrefixMatcher *m,
+        const ATPrefixEntry *entries, int num)
+{
+    int c, i, n = 0;
+
+    if (num > AT_PREFIX_MAX) return -1;
+
+    memset(m, 0, sizeof(ATPrefixMatcher));
+
+    for (c = 0; c < 256; c++) {
+        int first = n;
+
+        for (i = 0; i < num; i++) {
+            int j;
+            size_t len = strlen(entries[i].prefix);
+
+            if ((unsigned char)entries[i].prefix[0] != c || len == 0) continue;
+
+            // insertion by descending length //
+            for (j = n; j > first && m->len[j - 1] < len; j--) {
+                m->prefix[j] = m->prefix[j - 1];
+                m->len[j] = m->len[j - 1];
+                m->cls[j] = m->cls[j - 1];
+            }
+            m->prefix[j] = entries[i].prefix;
+            m->len[j] = (unsigned char)len;
+            m->cls[j] = entries[i].cls;
+            n++;
+        }
+
+        m->start[c] = (unsigned char)first;
+        m->count[c] = (unsigned char)(n - first);
+    }
+
+    return 0;
+}
+
+int at_prefix_match(const ATPrefixMatcher *m, const char *line)
+{
+    unsigned char c = (unsigned char)line[0];
+    int i, end;
+
+    if (m->count[c] == 0) return 0;
+
+    end = m->start[c] + m->count[c];
+    for (i = m->start[c]; i < end; i++) {
+        const char *p = m->prefix[i] + 1;
+        const char *l = line + 1;
+
+        // first byte already matched, inline since most lines differ //
+        // in their second or third byte, a '\0' of line never matches //
+        while (*p != '\0' && *p == *l) {
+            p++;
+            l++;
+        }
+        if (*p == '\0') return m->cls[i];
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/* //device/system/reference-ril/at_scan.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_SCAN_H
+#define AT_SCAN_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * Returns offset of the first '\r' or '\n' in buf[0, len),
+ * or len if there is none.
+ *
+ * Points to the best implementation for the running CPU
+ * (NEON, SSE2 or word at a time) once at_scan_init() returned.
+ */
+extern int (*at_scan_eol)(const char *buf, int len);
+
+/* picks at_scan_eol implementation, safe to call more than once */
+void at_scan_init(void);
+
+/* name of the selected implementation, for logs */
+const char * at_scan_impl_name(void);
+
+/**
+ * Returns a pointer to the first ',', '"' or '\0' of the nul terminated
+ * string s, the token delimiters of at_tok.
+ *
+ * Vector versions only do aligned loads: they may read past the
+ * terminator but never across a page boundary.
+ */
+extern const char * (*at_scan_delim)(const char *s);
+
+/* NEON versions live in their own object built with NEON enabled */
+int at_scan_eol_neon(const char *buf, int len);
+const char * at_scan_delim_neon(const char *s);
+
+/* ------------------------------------------------------------------ */
+/* prefix matcher: classifies a line against a fixed prefix table     */
+/* ------------------------------------------------------------------ */
+
+#define AT_PREFIX_MAX 32
+
+typedef struct {
+    const char * prefix;
+    int cls; /* caller defined class, must be > 0 */
+} ATPrefixEntry;
+
+typedef struct {
+    /* entries sorted by first byte, longest prefix first */
+    const char * prefix[AT_PREFIX_MAX];
+    unsigned char len[AT_PREFIX_MAX];
+    int cls[AT_PREFIX_MAX];
+    /* first byte -> [start, start + count) in the arrays above */
+    unsigned char start[256];
+    unsigned char count[256];
+} ATPrefixMatcher;
+
+/* returns 0 on success, -1 if the table does not fit */
+int at_prefix_matcher_build(ATPrefixMatcher *m,
+        const ATPrefixEntry *entries, int num);
+
+/* returns class of the matched prefix, 0 if none matches */
+int at_prefix_match(const ATPrefixMatcher *m, const char *line);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_SCAN_H*/
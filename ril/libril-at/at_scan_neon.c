@@ -0,0 +1,99 @@
+/* //device/system/reference-ril/at_scan_neon.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/*
+ * Built as its own static library with LOCAL_ARM_NEON, the rest of
+ * libril-at stays runnable on ARMv7 cores without NEON.
+ * at_scan_init() only selects this after checking /proc/cpuinfo.
+ */
+
+#include "at_scan.h"
+
+#include <stdint.h>
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+int at_scan_eol_neon(const char *buf, int len)
+{
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    const uint8x16_t lf = vdupq_n_u8('\n');
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(buf + i));
+        uint8x16_t hit = vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, lf));
+        // narrow to 4 bits per byte: 64 bits mask //
+        uint8x8_t nib = vshrn_n_u16(vreinterpretq_u16_u8(hit), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nib), 0);
+
+        if (mask != 0) {
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+
+    for (; i < len; i++) {
+        if (buf[i] == '\r' || buf[i] == '\n') break;
+    }
+
+    return i;
+}
+
+const char * at_scan_delim_neon(const char *s)
+{
+    const uint8x16_t comma = vdupq_n_u8(',');
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8_t *a = (const uint8_t *)((uintptr_t)s & ~(uintptr_t)15);
+    unsigned int skip = ((uintptr_t)s & 15) * 4;
+
+    for (;; a += 16) {
+        uint8x16_t v = vld1q_u8(a);
+        uint8x16_t hit = vorrq_u8(vceqq_u8(v, vdupq_n_u8(0)),
+                vorrq_u8(vceqq_u8(v, comma), vceqq_u8(v, quote)));
+        uint8x8_t nib = vshrn_n_u16(vreinterpretq_u16_u8(hit), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nib), 0);
+
+        // bytes of the first block before s //
+        mask = (mask >> skip) << skip;
+        skip = 0;
+        if (mask != 0) {
+            return (const char *)a + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+}
+
+#else
+
+int at_scan_eol_neon(const char *buf, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (buf[i] == '\r' || buf[i] == '\n') break;
+    }
+
+    return i;
+}
+
+const char * at_scan_delim_neon(const char *s)
+{
+    while (*s != ',' && *s != '"' && *s != '\0') s++;
+
+    return s;
+}
+
+#endif /* __ARM_NEON__ */
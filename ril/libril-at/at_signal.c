@@ -0,0 +1,266 @@
+/* //device/system/reference-ril/at_signal.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_signal.h"
+#include "at_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define RSSI_UNKNOWN    99
+#define CESQ_UNKNOWN    255
+
+static pthread_mutex_t s_sigMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long s_interval = AT_SIGNAL_DEF_INTERVAL;
+static int s_hyst = AT_SIGNAL_DEF_HYST;
+
+// all under s_sigMutex, +CSQ/+CESQ scales //
+static int s_rssi = RSSI_UNKNOWN;
+static int s_ber = RSSI_UNKNOWN;
+static int s_rscp = CESQ_UNKNOWN;
+static int s_ecno = CESQ_UNKNOWN;
+static int s_rsrq = CESQ_UNKNOWN;
+static int s_rsrp = CESQ_UNKNOWN;
+static long long s_updatedUs = 0;
+
+// what the framework got last //
+static int s_sentAsu = -1;
+static int s_sentRsrp = -1;
+static long long s_pushedUs = 0;
+static int s_pending = 0;
+
+static uint32_t s_reports = 0;
+static uint32_t s_pushes = 0;
+static uint32_t s_small = 0;
+static uint32_t s_held = 0;
+static uint32_t s_hits = 0;
+static uint32_t s_polls = 0;
+
+static int getIntProperty(const char *name, int def)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(name, value, "");
+    if (value[0] == '\0') return def;
+
+    return atoi(value);
+}
+
+void at_signal_init(void)
+{
+    s_interval = getIntProperty(AT_SIGNAL_PROP_INTERVAL, AT_SIGNAL_DEF_INTERVAL);
+    s_hyst = getIntProperty(AT_SIGNAL_PROP_HYST, AT_SIGNAL_DEF_HYST);
+    if (s_interval < 0) s_interval = 0;
+    if (s_hyst < 1) s_hyst = 1;
+
+    LOGI("at_signal: interval %lld ms, hysteresis %d asu", s_interval, s_hyst);
+}
+
+/* GW strength on the +CSQ scale, from RSCP when the cell gives one */
+static int gwAsu(void)
+{
+    int asu;
+
+    if (s_rscp > 96) return s_rssi;
+
+    // RSCP index n is n - 121 dBm, +CSQ is (dBm + 113) / 2 //
+    asu = (s_rscp - 121 + 113) / 2;
+    if (asu < 0) asu = 0;
+    if (asu > 31) asu = 31;
+
+    return asu;
+}
+
+/* RSRP as RIL_LTE_SignalStrength wants it, -dBm, -1 unknown */
+static int lteRsrp(void)
+{
+    return s_rsrp <= 97 ? 141 - s_rsrp : -1;
+}
+
+/* assumes s_sigMutex is held */
+static void fill(int *response)
+{
+    int i;
+
+    for (i = 0; i < AT_SIGNAL_INTS; i++) response[i] = -1;
+
+    response[0] = gwAsu();
+    response[1] = s_ber;
+    response[8] = lteRsrp();
+    if (s_rsrq <= 34) response[9] = 20 - s_rsrq / 2;
+}
+
+static int moved(int now, int sent, int hyst)
+{
+    if (now == sent) return 0;
+    // a value appearing or going away always counts //
+    if (now < 0 || sent < 0 || now == RSSI_UNKNOWN || sent == RSSI_UNKNOWN) return 1;
+
+    return abs(now - sent) >= hyst;
+}
+
+/* takes the new values in, assumes s_sigMutex is held */
+static int decide(int fromUrc)
+{
+    long long now = at_stats_now();
+    int asu = gwAsu();
+    int rsrp = lteRsrp();
+
+    s_updatedUs = now;
+
+    // the framework asked, it has these now //
+    if (!fromUrc) {
+        s_polls++;
+        s_sentAsu = asu;
+        s_sentRsrp = rsrp;
+        s_pending = 0;
+        return 0;
+    }
+
+    s_reports++;
+    if (!moved(asu, s_sentAsu, s_hyst) && !moved(rsrp, s_sentRsrp, s_hyst * 2)) {
+        s_small++;
+        s_pending = 0;
+        return 0;
+    }
+    if (now - s_pushedUs < s_interval * 1000) {
+        if (!s_pending) s_held++;
+        s_pending = 1;
+        return 0;
+    }
+
+    s_pending = 0;
+    s_sentAsu = asu;
+    s_sentRsrp = rsrp;
+    s_pushedUs = now;
+    s_pushes++;
+
+    return 1;
+}
+
+int at_signal_csq(int rssi, int ber, int fromUrc)
+{
+    int push;
+
+    pthread_mutex_lock(&s_sigMutex);
+    s_rssi = rssi;
+    s_ber = ber;
+    s_rscp = s_ecno = s_rsrq = s_rsrp = CESQ_UNKNOWN;
+    push = decide(fromUrc);
+    pthread_mutex_unlock(&s_sigMutex);
+
+    return push;
+}
+
+int at_signal_cesq(const int *cesq, int count)
+{
+    int push;
+
+    pthread_mutex_lock(&s_sigMutex);
+    // <rxlev>,<ber>,<rscp>,<ecno>,<rsrq>,<rsrp> //
+    s_rssi = RSSI_UNKNOWN;
+    if (count > 0 && cesq[0] <= 63) {
+        // rxlev index n is n - 111 dBm //
+        s_rssi = (cesq[0] + 2) / 2;
+        if (s_rssi > 31) s_rssi = 31;
+    }
+    s_ber = count > 1 && cesq[1] <= 7 ? cesq[1] : RSSI_UNKNOWN;
+    s_rscp = count > 2 ? cesq[2] : CESQ_UNKNOWN;
+    s_ecno = count > 3 ? cesq[3] : CESQ_UNKNOWN;
+    s_rsrq = count > 4 ? cesq[4] : CESQ_UNKNOWN;
+    s_rsrp = count > 5 ? cesq[5] : CESQ_UNKNOWN;
+    push = decide(1);
+    pthread_mutex_unlock(&s_sigMutex);
+
+    return push;
+}
+
+static int readCached(int *response, int hit)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&s_sigMutex);
+    if (s_updatedUs != 0
+            && at_stats_now() - s_updatedUs <= AT_SIGNAL_STALE_MSEC * 1000LL) {
+        fill(response);
+        if (hit) s_hits++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&s_sigMutex);
+
+    return ret;
+}
+
+int at_signal_get(int *response)
+{
+    return readCached(response, 1);
+}
+
+int at_signal_peek(int *response)
+{
+    return readCached(response, 0);
+}
+
+void at_signal_invalidate(void)
+{
+    pthread_mutex_lock(&s_sigMutex);
+    s_rssi = s_ber = RSSI_UNKNOWN;
+    s_rscp = s_ecno = s_rsrq = s_rsrp = CESQ_UNKNOWN;
+    s_updatedUs = 0;
+    s_sentAsu = s_sentRsrp = -1;
+    s_pending = 0;
+    pthread_mutex_unlock(&s_sigMutex);
+}
+
+int at_signal_dump(char *buf, int size, int len)
+{
+    int n;
+
+    if (len >= size - 1) return len;
+
+    pthread_mutex_lock(&s_sigMutex);
+    n = snprintf(buf + len, size - len,
+            "\nSignal          rssi %d ber %d rscp %d ecno %d rsrq %d rsrp %d, %lld ms old\n"
+            "                reports %u, pushed %u, small %u, held %u, cache %u, AT+CSQ %u\n",
+            s_rssi, s_ber, s_rscp, s_ecno, s_rsrq, s_rsrp,
+            s_updatedUs ? (at_stats_now() - s_updatedUs) / 1000 : -1LL,
+            s_reports, s_pushes, s_small, s_held, s_hits, s_polls);
+    pthread_mutex_unlock(&s_sigMutex);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+
+    return len;
+}
+
+void at_signal_reset_stats(void)
+{
+    pthread_mutex_lock(&s_sigMutex);
+    s_reports = 0;
+    s_pushes = 0;
+    s_small = 0;
+    s_held = 0;
+    s_hits = 0;
+    s_polls = 0;
+    pthread_mutex_unlock(&s_sigMutex);
+}
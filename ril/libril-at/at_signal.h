@@ -0,0 +1,82 @@
+/* //device/system/reference-ril/at_signal.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_SIGNAL_H
+#define AT_SIGNAL_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Signal strength cache
+ *
+ * The modem's periodic signal reports (+CSQ: and the extended +CESQ:
+ * with TD-SCDMA RSCP/EcNo and LTE RSRP/RSRQ) are kept here, so
+ * RIL_REQUEST_SIGNAL_STRENGTH is answered from memory. AT+CSQ is only
+ * sent when no report came for AT_SIGNAL_STALE_MSEC, and its answer
+ * feeds the cache too.
+ *
+ * RIL_UNSOL_SIGNAL_STRENGTH is pushed when a report moves the level by
+ * the hysteresis at least, and never more often than the interval. A
+ * change held back by the interval goes out with the next report.
+ *
+ * RIL_SignalStrength_v6 has no TD-SCDMA field: with a valid RSCP the GW
+ * strength is computed from it on the +CSQ scale, RSCP and EcNo show in
+ * the AT statistics (radiooptions 11).
+ */
+#define AT_SIGNAL_PROP_URC          "persist.ril.sig.urc"       /* report command, "" none */
+#define AT_SIGNAL_DEF_URC           "AT^SCSQ=1"
+#define AT_SIGNAL_PROP_INTERVAL     "persist.ril.sig.interval"  /* msec, default 3000 */
+#define AT_SIGNAL_DEF_INTERVAL      3000
+#define AT_SIGNAL_PROP_HYST         "persist.ril.sig.hyst"      /* asu, default 2 */
+#define AT_SIGNAL_DEF_HYST          2
+#define AT_SIGNAL_STALE_MSEC        15000
+
+/* RIL_SignalStrength_v6 as ints */
+#define AT_SIGNAL_INTS              12
+
+void at_signal_init(void);
+
+/**
+ * accounts a +CSQ (cesq NULL) or +CESQ line, fromUrc when unsolicited.
+ * Returns 1 when RIL_UNSOL_SIGNAL_STRENGTH should be sent with the
+ * values at_signal_peek() fills, 0 when not
+ */
+int at_signal_csq(int rssi, int ber, int fromUrc);
+int at_signal_cesq(const int *cesq, int count);
+
+/* fills response (AT_SIGNAL_INTS), returns 0, -1 when AT+CSQ must be asked */
+int at_signal_get(int *response);
+
+/* as at_signal_get() for the unsolicited push, not counted as a hit */
+int at_signal_peek(int *response);
+
+/* forgets the values, radio off */
+void at_signal_invalidate(void);
+
+/* appends the report to buf, returns the new length */
+int at_signal_dump(char *buf, int size, int len);
+
+void at_signal_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_SIGNAL_H*/
@@ -0,0 +1,483 @@
+/* //device/system/reference-ril/at_stats.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_stats.h"
+#include "at_cache.h"
+#include "at_buf.h"
+#include "at_urc.h"
+#include "at_calls.h"
+#include "at_signal.h"
+#include "at_reg.h"
+#include "at_pdp.h"
+#include "at_net.h"
+#include "at_plmn.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <telephony/ril.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define ATOMIC_INC(p)       __sync_fetch_and_add((p), 1)
+
+/* exported by libril */
+extern long long RIL_getRequestQueuedUs(int cid);
+extern void RIL_registerDebugDumper(void (*dumper)(int fd, int argc, char **argv));
+
+typedef struct {
+    volatile uint32_t hash;     /* 0: free slot */
+    volatile uint32_t ready;    /* key written */
+    char key[AT_STATS_KEY_LEN];
+    uint32_t count;
+    uint32_t timeouts;
+    uint32_t maxUs;
+    uint32_t hist[AT_STATS_PHASES][AT_STATS_BUCKETS];
+} ATStatsCommand;
+
+typedef struct {
+    volatile uint32_t hash;
+    volatile uint32_t ready;
+    char key[AT_STATS_KEY_LEN];
+    uint32_t count;
+} ATStatsUnsol;
+
+/* only the request thread of the channel writes here */
+typedef struct {
+    uint32_t count;
+    uint32_t timeouts;
+    long long busyUs;   /* written -> final, summed */
+    long long lastDoneUs;
+    long long readyMs;  /* handshake answered, after rild start */
+    uint32_t smsSegments;
+    uint32_t smsFailed;
+    uint32_t smsBursts;     /* multi-part messages fully sent */
+    uint32_t smsBurstSegs;  /* segments of those */
+    uint32_t smsPending;    /* segments of the burst going on */
+    long long smsBurstUs;   /* first segment start -> last segment done, summed */
+    long long smsBurstStartUs;
+    uint32_t queue[AT_STATS_BUCKETS];
+    uint32_t final[AT_STATS_BUCKETS];
+} ATStatsChannel;
+
+static ATStatsCommand s_commands[AT_STATS_MAX_KEYS];
+static ATStatsUnsol s_unsols[AT_STATS_MAX_URCS];
+static ATStatsChannel s_channels[RIL_CHANNELS];
+static uint32_t s_unsolTotal = 0;
+static uint32_t s_unsolDropped = 0;
+static long long s_startUs = 0;
+
+long long at_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* 0 and 1 map to themselves, above that 2 buckets per power of 2 */
+static int bucketOf(long long us)
+{
+    int lg, b;
+
+    if (us < 2) return us < 0 ? 0 : (int)us;
+    if (us > 0x7FFFFFFF) us = 0x7FFFFFFF;
+
+    lg = 31 - __builtin_clz((unsigned int)us);
+    b = lg * 2 + (int)((us >> (lg - 1)) & 1);
+
+    return b < AT_STATS_BUCKETS ? b : AT_STATS_BUCKETS - 1;
+}
+
+/* exclusive upper bound of bucket b in usec */
+static long long bucketTop(int b)
+{
+    if (b < 2) return b + 1;
+
+    return (long long)(2 + (b & 1) + 1) << ((b >> 1) - 1);
+}
+
+static uint32_t keyHash(const char *key)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *key != '\0'; key++) {
+        h = (h ^ (unsigned char)*key) * 16777619u;
+    }
+
+    return h != 0 ? h : 1;
+}
+
+/**
+ * Lock free find-or-add in an open addressed table: a free slot is
+ * claimed by swapping its hash in, the key is published with 'ready'.
+ * A slot being claimed by another thread right now is skipped, so the
+ * sample may be lost but nobody waits.
+ */
+#define FIND_SLOT(table, num, key, out) \
+    do { \
+        uint32_t h_ = keyHash(key); \
+        int i_; \
+        (out) = NULL; \
+        for (i_ = 0; i_ < (num); i_++) { \
+            __typeof__(&(table)[0]) s_ = &(table)[(h_ + i_) % (num)]; \
+            if (s_->hash == 0 && __sync_bool_compare_and_swap(&s_->hash, 0, h_)) { \
+                strncpy(s_->key, (key), AT_STATS_KEY_LEN - 1); \
+                __sync_synchronize(); \
+                s_->ready = 1; \
+                (out) = s_; \
+                break; \
+            } \
+            if (s_->hash == h_) { \
+                if (!s_->ready) break; \
+                if (strncmp(s_->key, (key), AT_STATS_KEY_LEN) == 0) { \
+                    (out) = s_; \
+                    break; \
+                } \
+            } \
+        } \
+    } while (0)
+
+void at_stats_init(void)
+{
+    if (s_startUs == 0) {
+        s_startUs = at_stats_now();
+    }
+    RIL_registerDebugDumper(at_stats_debug);
+}
+
+void at_stats_begin(int cid, ATStatsStamp *st)
+{
+    memset(st, 0, sizeof(ATStatsStamp));
+    st->submitUs = RIL_getRequestQueuedUs(cid);
+}
+
+static void addPhase(ATStatsCommand *c, int phase, long long fromUs, long long toUs)
+{
+    if (fromUs == 0 || toUs == 0 || toUs < fromUs) return;
+
+    ATOMIC_INC(&c->hist[phase][bucketOf(toUs - fromUs)]);
+}
+
+void at_stats_command(int cid, const char *command, const ATStatsStamp *st,
+        int timedOut)
+{
+    char key[AT_STATS_KEY_LEN];
+    ATStatsChannel *ch;
+    ATStatsCommand *c;
+    long long queuedUs, doneUs, busyUs;
+
+    if (cid < 0 || cid >= RIL_CHANNELS || command == NULL) return;
+
+    ch = &s_channels[cid];
+    doneUs = st->finalUs != 0 ? st->finalUs : at_stats_now();
+
+    // a request issuing several commands: later ones queue behind the earlier //
+    queuedUs = st->submitUs;
+    if (queuedUs < ch->lastDoneUs) queuedUs = ch->lastDoneUs;
+    ch->lastDoneUs = doneUs;
+
+    busyUs = doneUs - st->writtenUs;
+    ch->count++;
+    ch->busyUs += busyUs;
+    if (timedOut) ch->timeouts++;
+    if (queuedUs != 0 && st->writeUs >= queuedUs) {
+        ch->queue[bucketOf(st->writeUs - queuedUs)]++;
+    }
+    if (!timedOut) {
+        ch->final[bucketOf(busyUs)]++;
+    }
+
+    atCommandKey(command, key, sizeof(key));
+    FIND_SLOT(s_commands, AT_STATS_MAX_KEYS, key, c);
+    if (c == NULL) return;
+
+    ATOMIC_INC(&c->count);
+    if (timedOut) {
+        ATOMIC_INC(&c->timeouts);
+        return;
+    }
+
+    if (queuedUs != 0) addPhase(c, AT_STATS_QUEUE, queuedUs, st->writeUs);
+    addPhase(c, AT_STATS_WRITE, st->writeUs, st->writtenUs);
+    addPhase(c, AT_STATS_FIRST, st->writtenUs, st->firstUs);
+    addPhase(c, AT_STATS_INTERM, st->writtenUs, st->intermUs);
+    addPhase(c, AT_STATS_FINAL, st->writtenUs, st->finalUs);
+
+    // max by compare and swap, a lost race only means a smaller max //
+    if (busyUs > 0x7FFFFFFF) busyUs = 0x7FFFFFFF;
+    {
+        uint32_t old = c->maxUs;
+        while ((uint32_t)busyUs > old
+                && !__sync_bool_compare_and_swap(&c->maxUs, old, (uint32_t)busyUs)) {
+            old = c->maxUs;
+        }
+    }
+}
+
+void at_stats_channel_ready(int cid, long long msec)
+{
+    if (cid < 0 || cid >= RIL_CHANNELS) return;
+
+    s_channels[cid].readyMs = msec;
+}
+
+void at_stats_sms(int cid, long long startUs, int ok, int more)
+{
+    ATStatsChannel *ch;
+
+    if (cid < 0 || cid >= RIL_CHANNELS) return;
+
+    ch = &s_channels[cid];
+    ch->smsSegments++;
+    if (!ok) ch->smsFailed++;
+
+    if (more && ok) {
+        if (ch->smsBurstStartUs == 0) ch->smsBurstStartUs = startUs;
+        ch->smsPending++;
+        return;
+    }
+
+    // last segment: a burst is only counted when all of it went out //
+    if (ch->smsBurstStartUs != 0 && ok) {
+        ch->smsBursts++;
+        ch->smsBurstSegs += ch->smsPending + 1;
+        ch->smsBurstUs += at_stats_now() - ch->smsBurstStartUs;
+    }
+    ch->smsBurstStartUs = 0;
+    ch->smsPending = 0;
+}
+
+void at_stats_unsol(const char *line)
+{
+    char key[AT_STATS_KEY_LEN];
+    ATStatsUnsol *u;
+
+    ATOMIC_INC(&s_unsolTotal);
+
+    atUnsolKey(line, key, sizeof(key));
+    FIND_SLOT(s_unsols, AT_STATS_MAX_URCS, key, u);
+    if (u == NULL) {
+        ATOMIC_INC(&s_unsolDropped);
+        return;
+    }
+    ATOMIC_INC(&u->count);
+}
+
+/* clears counters, keys stay so concurrent writers never see a torn slot */
+void at_stats_reset(void)
+{
+    int i;
+
+    for (i = 0; i < AT_STATS_MAX_KEYS; i++) {
+        s_commands[i].count = 0;
+        s_commands[i].timeouts = 0;
+        s_commands[i].maxUs = 0;
+        memset(s_commands[i].hist, 0, sizeof(s_commands[i].hist));
+    }
+    for (i = 0; i < AT_STATS_MAX_URCS; i++) {
+        s_unsols[i].count = 0;
+    }
+    for (i = 0; i < RIL_CHANNELS; i++) {
+        long long lastDoneUs = s_channels[i].lastDoneUs;
+        long long readyMs = s_channels[i].readyMs;
+        long long smsBurstStartUs = s_channels[i].smsBurstStartUs;
+        uint32_t smsPending = s_channels[i].smsPending;
+        memset(&s_channels[i], 0, sizeof(ATStatsChannel));
+        s_channels[i].lastDoneUs = lastDoneUs;
+        s_channels[i].readyMs = readyMs;
+        s_channels[i].smsBurstStartUs = smsBurstStartUs;
+        s_channels[i].smsPending = smsPending;
+    }
+    s_unsolTotal = 0;
+    s_unsolDropped = 0;
+    s_startUs = at_stats_now();
+    at_cache_reset_stats();
+    at_buf_reset_stats();
+    at_urc_reset_stats();
+    at_calls_reset_stats();
+    at_signal_reset_stats();
+    at_reg_reset_stats();
+    at_pdp_reset_stats();
+    at_net_reset_stats();
+    at_plmn_reset_stats();
+}
+
+/* percentile p (0-1000) of hist in msec, -1 if empty */
+static double percentile(const uint32_t *hist, int p)
+{
+    uint32_t snap[AT_STATS_BUCKETS];
+    uint32_t total = 0, rank, sum = 0;
+    int b;
+
+    for (b = 0; b < AT_STATS_BUCKETS; b++) {
+        snap[b] = hist[b];
+        total += snap[b];
+    }
+    if (total == 0) return -1;
+
+    rank = (uint32_t)(((unsigned long long)total * p + 999) / 1000);
+    if (rank == 0) rank = 1;
+    for (b = 0; b < AT_STATS_BUCKETS; b++) {
+        sum += snap[b];
+        if (sum >= rank) break;
+    }
+
+    return bucketTop(b) / 1000.0;
+}
+
+/* "p50/p99" of hist, "-" when empty */
+static void fmtPair(char *out, int size, const uint32_t *hist)
+{
+    double p50 = percentile(hist, 500);
+
+    if (p50 < 0) {
+        snprintf(out, size, "-");
+    } else {
+        snprintf(out, size, "%.1f/%.1f", p50, percentile(hist, 990));
+    }
+}
+
+static void append(char *buf, int size, int *len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (*len >= size - 1) return;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0) return;
+    *len += (n < size - *len) ? n : size - *len - 1;
+}
+
+int at_stats_dump(char *buf, int size)
+{
+    long long elapsedUs = at_stats_now() - s_startUs;
+    double elapsedSec = elapsedUs / 1000000.0;
+    int len = 0;
+    int i;
+
+    if (elapsedUs <= 0) elapsedUs = 1;
+    buf[0] = '\0';
+
+    append(buf, size, &len, "AT statistics over %.1f s, times in ms (bucket upper bound)\n\n",
+            elapsedSec);
+
+    append(buf, size, &len, "%-4s %8s %8s %6s %6s %9s %9s %9s\n",
+            "ch", "ready", "cmds", "tmo", "busy%", "queue99", "final50", "final99");
+    for (i = 0; i < RIL_CHANNELS; i++) {
+        ATStatsChannel *ch = &s_channels[i];
+
+        if (ch->count == 0 && ch->readyMs == 0) continue;
+        append(buf, size, &len, "%-4d %8lld %8u %6u %6.1f %9.1f %9.1f %9.1f\n",
+                i, ch->readyMs, ch->count, ch->timeouts,
+                ch->busyUs * 100.0 / elapsedUs,
+                percentile(ch->queue, 990),
+                percentile(ch->final, 500), percentile(ch->final, 990));
+    }
+
+    for (i = 0; i < RIL_CHANNELS; i++) {
+        ATStatsChannel *ch = &s_channels[i];
+
+        if (ch->smsSegments == 0) continue;
+        append(buf, size, &len, "sms ch %d: %u segments, %u failed, %u multi-part",
+                i, ch->smsSegments, ch->smsFailed, ch->smsBursts);
+        if (ch->smsBurstUs > 0) {
+            append(buf, size, &len, ", %.1f segments/min in bursts",
+                    ch->smsBurstSegs * 60000000.0 / ch->smsBurstUs);
+        }
+        append(buf, size, &len, "\n");
+    }
+
+    append(buf, size, &len, "\n%-15s %7s %5s %13s %7s %13s %13s %20s\n",
+            "command", "count", "tmo", "queue 50/99", "write99",
+            "first 50/99", "interm 50/99", "final 50/99/max");
+    for (i = 0; i < AT_STATS_MAX_KEYS; i++) {
+        ATStatsCommand *c = &s_commands[i];
+        char queue[32], first[32], interm[32], final[48];
+
+        if (!c->ready || c->count == 0) continue;
+        fmtPair(queue, sizeof(queue), c->hist[AT_STATS_QUEUE]);
+        fmtPair(first, sizeof(first), c->hist[AT_STATS_FIRST]);
+        fmtPair(interm, sizeof(interm), c->hist[AT_STATS_INTERM]);
+        fmtPair(final, sizeof(final), c->hist[AT_STATS_FINAL]);
+        if (c->maxUs != 0) {
+            snprintf(final + strlen(final), sizeof(final) - strlen(final),
+                    "/%.1f", c->maxUs / 1000.0);
+        }
+        append(buf, size, &len, "%-15s %7u %5u %13s %7.1f %13s %13s %20s\n",
+                c->key, c->count, c->timeouts, queue,
+                percentile(c->hist[AT_STATS_WRITE], 990),
+                first, interm, final);
+    }
+
+    append(buf, size, &len, "\n%-15s %8s %9s   (total %u, %.1f/min, untracked %u)\n",
+            "URC", "count", "per min", s_unsolTotal,
+            s_unsolTotal * 60000000.0 / elapsedUs, s_unsolDropped);
+    for (i = 0; i < AT_STATS_MAX_URCS; i++) {
+        ATStatsUnsol *u = &s_unsols[i];
+
+        if (!u->ready || u->count == 0) continue;
+        append(buf, size, &len, "%-15s %8u %9.1f\n",
+                u->key, u->count, u->count * 60000000.0 / elapsedUs);
+    }
+
+    len = at_cache_dump(buf, size, len);
+    len = at_urc_dump(buf, size, len);
+    len = at_calls_dump(buf, size, len);
+    len = at_signal_dump(buf, size, len);
+    len = at_reg_dump(buf, size, len);
+    len = at_pdp_dump(buf, size, len);
+    len = at_net_dump(buf, size, len);
+    len = at_plmn_dump(buf, size, len);
+    len = at_buf_dump(buf, size, len);
+
+    return len;
+}
+
+void at_stats_debug(int fd, int argc, char **argv)
+{
+    int size = 32 * 1024;
+    char *buf = (char *)malloc(size);
+    int len, off = 0;
+
+    if (buf == NULL) return;
+
+    len = at_stats_dump(buf, size);
+    while (off < len) {
+        int n = write(fd, buf + off, len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += n;
+    }
+    free(buf);
+
+    if (argc > 0 && strcmp(argv[0], "reset") == 0) {
+        LOGI("at_stats: reset by debug port");
+        at_stats_reset();
+    }
+}
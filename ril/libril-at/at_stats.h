@@ -0,0 +1,105 @@
+/* //device/system/reference-ril/at_stats.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_STATS_H
+#define AT_STATS_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * AT latency statistics
+ *
+ * Every command is timestamped when its request was queued in libril,
+ * when writeline starts and returns, and when the first byte, first
+ * intermediate line and final response come back. The deltas go into
+ * per channel and per command histograms updated with atomic adds
+ * only, so request threads never contend on a lock for them.
+ *
+ * SMS segments are counted per channel too, with the segments per
+ * minute reached inside multi-part bursts.
+ *
+ * The report is read through the libril debug port:
+ *     radiooptions 11          dump
+ *     radiooptions 11 reset    dump and clear
+ */
+#define AT_STATS_KEY_LEN        16
+#define AT_STATS_MAX_KEYS       128
+#define AT_STATS_MAX_URCS       64
+#define AT_STATS_BUCKETS        64 /* 2 per power of 2 of usec */
+
+enum {
+    AT_STATS_QUEUE = 0,     /* queued in libril -> writeline */
+    AT_STATS_WRITE,         /* writeline, s_commandmutex wait included */
+    AT_STATS_FIRST,         /* written -> first byte back */
+    AT_STATS_INTERM,        /* written -> first intermediate line */
+    AT_STATS_FINAL,         /* written -> final response */
+    AT_STATS_PHASES
+};
+
+/* timestamps of one command in monotonic usec, 0 when not reached */
+typedef struct {
+    long long submitUs;
+    long long writeUs;
+    long long writtenUs;
+    long long firstUs;
+    long long intermUs;
+    long long finalUs;
+} ATStatsStamp;
+
+/* monotonic clock in usec */
+long long at_stats_now(void);
+
+/* registers the debug port dumper, called from at_open() */
+void at_stats_init(void);
+
+/* fills st->submitUs for the calling request thread of channel cid */
+void at_stats_begin(int cid, ATStatsStamp *st);
+
+/* accounts one finished command, timedOut when no final response came */
+void at_stats_command(int cid, const char *command, const ATStatsStamp *st,
+        int timedOut);
+
+/* records when channel cid answered its first handshake, msec after rild start */
+void at_stats_channel_ready(int cid, long long msec);
+
+/**
+ * accounts one SMS segment sent on channel cid from startUs, more is set
+ * while further segments of the same message follow (AT+CMMS burst)
+ */
+void at_stats_sms(int cid, long long startUs, int ok, int more);
+
+/* accounts one unsolicited line */
+void at_stats_unsol(const char *line);
+
+void at_stats_reset(void);
+
+/* writes the text report into buf, returns its length */
+int at_stats_dump(char *buf, int size);
+
+/* debug port handler, see RIL_registerDebugDumper() */
+void at_stats_debug(int fd, int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_STATS_H*/
@@ -0,0 +1,340 @@
+/* //device/system/reference-ril/at_timeout.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_timeout.h"
+#include "misc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define MAX_STRIKES     3
+#define CALM_ANSWERS    100
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t count;
+} ATTimeoutFileHeader;
+
+static ATTimeoutEntry s_entries[AT_TIMEOUT_MAX_KEYS];
+static pthread_mutex_t s_timeoutMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t s_saveMutex = PTHREAD_MUTEX_INITIALIZER;
+static int s_saverStarted = 0;
+
+static int s_adaptive = 1;
+static long long s_floor = AT_TIMEOUT_DEF_FLOOR;
+static long long s_ceiling = AT_TIMEOUT_DEF_CEILING;
+static long long s_margin = AT_TIMEOUT_DEF_MARGIN;
+static int s_sinceSave = 0;
+
+static long long getLongProperty(const char *name, long long def)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(name, value, "");
+    if (value[0] == '\0') return def;
+
+    return atoll(value);
+}
+
+/* finds or adds key, assumes s_timeoutMutex is held */
+static ATTimeoutEntry * findEntry(const char *key, int add)
+{
+    unsigned int h = 2166136261u;
+    const char *p;
+    int i;
+
+    for (p = key; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+
+    for (i = 0; i < AT_TIMEOUT_MAX_KEYS; i++) {
+        ATTimeoutEntry *e = &s_entries[(h + i) % AT_TIMEOUT_MAX_KEYS];
+
+        if (e->key[0] == '\0') {
+            if (!add) return NULL;
+            strncpy(e->key, key, AT_TIMEOUT_KEY_LEN - 1);
+            return e;
+        }
+        if (strncmp(e->key, key, AT_TIMEOUT_KEY_LEN) == 0) return e;
+    }
+
+    return NULL;
+}
+
+/* 0..3 map to themselves, above that 4 buckets per power of 2 */
+static int bucketOf(long long msec)
+{
+    int lg, b;
+
+    if (msec < 4) return msec < 0 ? 0 : (int)msec;
+    if (msec > 0x7FFFFFFF) msec = 0x7FFFFFFF;
+
+    lg = 31 - __builtin_clz((unsigned int)msec);
+    b = lg * 4 + (int)((msec >> (lg - 2)) & 3);
+
+    return b < AT_TIMEOUT_BUCKETS ? b : AT_TIMEOUT_BUCKETS - 1;
+}
+
+/* exclusive upper bound of bucket b in msec */
+static long long bucketTop(int b)
+{
+    if (b < 4) return b + 1;
+
+    return (long long)(4 + (b & 3) + 1) << ((b >> 2) - 2);
+}
+
+/* p99.9 of e, assumes s_timeoutMutex is held */
+static long long percentile999(const ATTimeoutEntry *e)
+{
+    uint32_t total = 0, rank, sum = 0;
+    int b;
+
+    for (b = 0; b < AT_TIMEOUT_BUCKETS; b++) total += e->buckets[b];
+    if (total == 0) return 0;
+
+    rank = total - total / 1000;
+    for (b = 0; b < AT_TIMEOUT_BUCKETS; b++) {
+        sum += e->buckets[b];
+        if (sum >= rank) break;
+    }
+
+    return bucketTop(b);
+}
+
+static void loadProfile(void)
+{
+    ATTimeoutFileHeader hdr;
+    ATTimeoutEntry entry;
+    uint32_t i, loaded = 0;
+    FILE *fp;
+
+    fp = fopen(AT_TIMEOUT_FILE, "rb");
+    if (fp == NULL) return;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+            || hdr.magic != AT_TIMEOUT_MAGIC
+            || hdr.version != AT_TIMEOUT_VERSION
+            || hdr.entrySize != sizeof(ATTimeoutEntry)) {
+        LOGE("at_timeout: ignore stale profile %s", AT_TIMEOUT_FILE);
+        fclose(fp);
+        return;
+    }
+
+    for (i = 0; i < hdr.count; i++) {
+        ATTimeoutEntry *e;
+
+        if (fread(&entry, sizeof(entry), 1, fp) != 1) break;
+        entry.key[AT_TIMEOUT_KEY_LEN - 1] = '\0';
+
+        e = findEntry(entry.key, 1);
+        if (e == NULL) break;
+        memcpy(e, &entry, sizeof(entry));
+        loaded++;
+    }
+    fclose(fp);
+
+    LOGI("at_timeout: loaded %u commands from %s", loaded, AT_TIMEOUT_FILE);
+}
+
+/* saves the profile off the AT request threads, at most once a period */
+static void *saverLoop(void *arg)
+{
+    int due;
+
+    for (;;) {
+        sleep(AT_TIMEOUT_SAVE_PERIOD);
+
+        pthread_mutex_lock(&s_timeoutMutex);
+        due = s_sinceSave >= AT_TIMEOUT_SAVE_EVERY;
+        pthread_mutex_unlock(&s_timeoutMutex);
+
+        if (due) at_timeout_save();
+    }
+
+    return NULL;
+}
+
+static void startSaver(void)
+{
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    if (!s_adaptive || s_saverStarted) return;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, saverLoop, NULL) != 0) {
+        LOGE("at_timeout: saver not started, profile saved at close only");
+    } else {
+        s_saverStarted = 1;
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void at_timeout_init(void)
+{
+    s_adaptive = (int)getLongProperty(AT_TIMEOUT_PROP_ENABLE, 1);
+    s_floor = getLongProperty(AT_TIMEOUT_PROP_FLOOR, AT_TIMEOUT_DEF_FLOOR);
+    s_ceiling = getLongProperty(AT_TIMEOUT_PROP_CEILING, AT_TIMEOUT_DEF_CEILING);
+    s_margin = getLongProperty(AT_TIMEOUT_PROP_MARGIN, AT_TIMEOUT_DEF_MARGIN);
+
+    if (s_floor < 500) s_floor = 500;
+    if (s_ceiling < s_floor) s_ceiling = s_floor;
+    if (s_margin < 100) s_margin = 100;
+
+    pthread_mutex_lock(&s_timeoutMutex);
+    memset(s_entries, 0, sizeof(s_entries));
+    loadProfile();
+    pthread_mutex_unlock(&s_timeoutMutex);
+
+    LOGI("at_timeout: adaptive %d, floor %lld, ceiling %lld, margin %lld%%",
+            s_adaptive, s_floor, s_ceiling, s_margin);
+
+    startSaver();
+}
+
+/* writes a snapshot through a temp file so a crash never leaves half a profile */
+static void writeProfile(const ATTimeoutEntry *entries, uint32_t count)
+{
+    char tmp[128];
+    ATTimeoutFileHeader hdr;
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", AT_TIMEOUT_FILE);
+    fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        LOGE("at_timeout: open %s failed(%d)", tmp, errno);
+        return;
+    }
+
+    hdr.magic = AT_TIMEOUT_MAGIC;
+    hdr.version = AT_TIMEOUT_VERSION;
+    hdr.entrySize = sizeof(ATTimeoutEntry);
+    hdr.count = count;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+            || fwrite(entries, sizeof(ATTimeoutEntry), count, fp) != count) {
+        LOGE("at_timeout: write %s failed(%d)", tmp, errno);
+        fclose(fp);
+        unlink(tmp);
+        return;
+    }
+    fclose(fp);
+
+    if (rename(tmp, AT_TIMEOUT_FILE) < 0) {
+        LOGE("at_timeout: rename to %s failed(%d)", AT_TIMEOUT_FILE, errno);
+        unlink(tmp);
+    }
+}
+
+void at_timeout_save(void)
+{
+    ATTimeoutEntry *snap;
+    uint32_t count = 0;
+    int i;
+
+    snap = (ATTimeoutEntry *)malloc(sizeof(s_entries));
+    if (snap == NULL) return;
+
+    // saver and at_close() share the temp file //
+    pthread_mutex_lock(&s_saveMutex);
+    pthread_mutex_lock(&s_timeoutMutex);
+    for (i = 0; i < AT_TIMEOUT_MAX_KEYS; i++) {
+        if (s_entries[i].key[0] != '\0') {
+            memcpy(&snap[count++], &s_entries[i], sizeof(ATTimeoutEntry));
+        }
+    }
+    s_sinceSave = 0;
+    pthread_mutex_unlock(&s_timeoutMutex);
+
+    writeProfile(snap, count);
+    pthread_mutex_unlock(&s_saveMutex);
+    free(snap);
+}
+
+long long at_timeout_get(const char *command, long long requested, int *learned)
+{
+    char key[AT_TIMEOUT_KEY_LEN];
+    ATTimeoutEntry *e;
+    long long value;
+
+    *learned = 0;
+    if (!s_adaptive || command == NULL) return requested;
+
+    atCommandKey(command, key, sizeof(key));
+
+    pthread_mutex_lock(&s_timeoutMutex);
+    e = findEntry(key, 0);
+    if (e == NULL || e->samples < AT_TIMEOUT_MIN_SAMPLES) {
+        pthread_mutex_unlock(&s_timeoutMutex);
+        return requested;
+    }
+    value = percentile999(e) * s_margin / 100;
+    if (value < s_floor) value = s_floor;
+    value <<= e->strikes;
+    pthread_mutex_unlock(&s_timeoutMutex);
+
+    // slow by nature (+COPS=?, +CGACT...), caller knows better //
+    if (value > s_ceiling || value >= requested) return requested;
+
+    *learned = 1;
+    return value;
+}
+
+void at_timeout_record(const char *command, long long elapsedMsec,
+        int timedOut, int early)
+{
+    char key[AT_TIMEOUT_KEY_LEN];
+    ATTimeoutEntry *e;
+
+    if (command == NULL) return;
+
+    atCommandKey(command, key, sizeof(key));
+
+    pthread_mutex_lock(&s_timeoutMutex);
+    e = findEntry(key, 1);
+    if (e != NULL) {
+        // a timed out sample is a lower bound, still pulls p99.9 up //
+        e->buckets[bucketOf(elapsedMsec)]++;
+        e->samples++;
+
+        if (timedOut) {
+            e->timeouts++;
+            if (early) {
+                e->early++;
+                if (e->strikes < MAX_STRIKES) e->strikes++;
+                e->calm = 0;
+            }
+        } else if (e->strikes > 0 && ++e->calm >= CALM_ANSWERS) {
+            e->strikes--;
+            e->calm = 0;
+        }
+    }
+    // written by saverLoop(), never on the AT request thread //
+    s_sinceSave++;
+    pthread_mutex_unlock(&s_timeoutMutex);
+}
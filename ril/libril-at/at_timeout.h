@@ -0,0 +1,102 @@
+/* //device/system/reference-ril/at_timeout.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_TIMEOUT_H
+#define AT_TIMEOUT_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Adaptive AT timeouts
+ *
+ * Latency from write to final response is kept per command key in a
+ * log scale histogram. The key is the command name plus its form, so
+ * "AT+COPS?" and "AT+COPS=?" are learned apart.
+ *
+ * Once a key has enough samples, its timeout becomes
+ *     max(p99.9 * margin, floor)
+ * as long as that is below both the ceiling and the timeout the caller
+ * asked for; slower commands keep the caller's value. A command still
+ * silent past that point fails with AT_ERROR_TIMEOUT right away and is
+ * left behind a ^SUTEST fence: the next command on the channel drains
+ * its late answer for the rest of the caller's timeout, and only a fence
+ * unanswered by then starts the at_processTimeout() recovery.
+ *
+ * The profile is saved to AT_TIMEOUT_FILE by a saver thread and at
+ * at_close(), and loaded by the next rild.
+ */
+#define AT_TIMEOUT_PROP_ENABLE  "persist.ril.at.to.adaptive"    /* 0/1, default 1 */
+#define AT_TIMEOUT_PROP_FLOOR   "persist.ril.at.to.floor"       /* msec */
+#define AT_TIMEOUT_PROP_CEILING "persist.ril.at.to.ceiling"     /* msec */
+#define AT_TIMEOUT_PROP_MARGIN  "persist.ril.at.to.margin"      /* percent of p99.9 */
+#define AT_TIMEOUT_FILE         "/data/misc/radio/attimeout.bin"
+
+/* defaults, same as CYIT_MIN_AT_TIMEOUT_MSEC and CYIT_DEFAULT_AT_TIMEOUT_MSEC */
+#define AT_TIMEOUT_DEF_FLOOR    4000
+#define AT_TIMEOUT_DEF_CEILING  30000
+#define AT_TIMEOUT_DEF_MARGIN   300
+
+#define AT_TIMEOUT_MAGIC        0x4F545441 /* "ATTO" */
+#define AT_TIMEOUT_VERSION      1
+
+#define AT_TIMEOUT_KEY_LEN      16
+#define AT_TIMEOUT_MAX_KEYS     128
+#define AT_TIMEOUT_BUCKETS      72 /* 4 per power of 2 up to ~4 min, then last */
+#define AT_TIMEOUT_MIN_SAMPLES  50
+#define AT_TIMEOUT_SAVE_EVERY   256 /* new samples before the saver writes */
+#define AT_TIMEOUT_SAVE_PERIOD  60  /* sec, saver check interval */
+
+typedef struct {
+    char key[AT_TIMEOUT_KEY_LEN];
+    uint32_t samples;
+    uint32_t timeouts;      /* all AT_ERROR_TIMEOUT */
+    uint32_t early;         /* timeouts fired by the learned value */
+    uint32_t strikes;       /* recent early timeouts, each doubles the value */
+    uint32_t calm;          /* answers since the last strike */
+    uint32_t buckets[AT_TIMEOUT_BUCKETS];
+} ATTimeoutEntry;
+
+/* loads properties and the saved profile and starts the saver, called from at_open() */
+void at_timeout_init(void);
+
+/* saves the profile, called from at_close() and the saver */
+void at_timeout_save(void);
+
+/**
+ * Returns the timeout to use for command, in msec.
+ * requested is what the caller asked for (already defaulted).
+ * *learned is set to 1 if the value comes from the histogram.
+ */
+long long at_timeout_get(const char *command, long long requested, int *learned);
+
+/**
+ * Records the outcome of command.
+ * timedOut: 0 for a final response, else 1; early: the learned value fired.
+ */
+void at_timeout_record(const char *command, long long elapsedMsec,
+        int timedOut, int early);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_TIMEOUT_H*/
@@ -17,9 +17,16 @@
 */
 
 #include "at_tok.h"
+#include "at_scan.h"
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdio.h>
+
+#ifdef AT_TOK_DIFF_CHECK
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+#endif
 
 /**
  * Starts tokenizing an AT response string
@@ -46,26 +53,53 @@ int at_tok_start(char **p_cur)
     return 0;
 }
 
+#ifdef AT_TOK_DIFF_CHECK
+static int legacyNextIntBase(char **p_cur, int *p_out, int base, int uns);
+static char * legacyNextTok(char **p_cur);
+static void diffCheck(const char *what, const char *in, char *cur, char *legacyCur,
+        int ret, int legacyRet, const char *out, const char *legacyOut);
+#endif
+
+/* same set as isspace() in the C locale */
+static inline int isSpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * First ',', '"' or '\0' from p. Most fields are a few bytes long, they
+ * are scanned inline, the vector scanner only takes over for long ones.
+ */
+static inline char * nextDelim(char *p)
+{
+    int i;
+
+    for (i = 0; i < 16; i++, p++) {
+        if (*p == ',' || *p == '"' || *p == '\0') return p;
+    }
+
+    return (char *)at_scan_delim(p);
+}
+
 static void skipWhiteSpace(char **p_cur)
 {
     if (*p_cur == NULL) return;
 
-    while (**p_cur != '\0' && isspace(**p_cur)) {
+    while (isSpace(**p_cur)) {
         (*p_cur)++;
     }
 }
 
 static void skipNextComma(char **p_cur)
 {
+    char *p;
+
     if (*p_cur == NULL) return;
 
-    while (**p_cur != '\0' && **p_cur != ',') {
-        (*p_cur)++;
-    }
+    // a quote is not a stop here //
+    for (p = nextDelim(*p_cur); *p == '"'; p = nextDelim(p + 1));
 
-    if (**p_cur == ',') {
-        (*p_cur)++;
-    }
+    *p_cur = p + (*p == ',');
 }
 
 static char * nextTok(char **p_cur)
@@ -77,44 +111,77 @@ static char * nextTok(char **p_cur)
     if (*p_cur == NULL) {
         ret = NULL;
     } else if (**p_cur == '"') {
-        int i = 0,n=0;
-
-        (*p_cur)++;
-        while(1)
-        {
-            while(*((*p_cur)+i) != '\0' && *((*p_cur)+i) != ',' && *((*p_cur)+i) != '"')
-            {
-                i++;
-            }
-            if(*((*p_cur)+i) == '"')
-            {
-                n = i;
-                i++;
-            }
-            else
-            {
-                /*
-                //ret = *p_cur;
-                ret=strdup(*p_cur);
-                //  *(p_cur+n) = '\0';
-                *(ret+n) = '\0';
-                *(p_cur) += (n+1);
-                */
-
-                ret = *p_cur;
-                *(*p_cur + n) = '\0';
-                *p_cur += i;
-                break;
-            }
+        char *p = *p_cur + 1;
+        char *closing = p;
+        char *stop;
+
+        // the token ends at the last quote before a comma or end of line, //
+        // or is empty when there is none //
+        for (stop = nextDelim(p); *stop == '"'; stop = nextDelim(stop + 1)) {
+            closing = stop;
         }
+
+        ret = p;
+        *closing = '\0';
+        *p_cur = stop;
         skipNextComma(p_cur);
     } else {
-        ret = strsep(p_cur, ",");
+        char *stop;
+
+        // strsep(p_cur, ",") //
+        for (stop = nextDelim(*p_cur); *stop == '"'; stop = nextDelim(stop + 1));
+
+        ret = *p_cur;
+        if (*stop == ',') {
+            *stop = '\0';
+            *p_cur = stop + 1;
+        } else {
+            *p_cur = NULL;
+        }
     }
 
     return ret;
 }
 
+/**
+ * Converts the plain "[0-9]+" or hex "[0-9a-fA-F]+" head of s, stopping at
+ * the first other char. Returns -1 when s needs strtol: no digit first,
+ * sign, white space, "0x" or too many digits to be sure of overflow.
+ */
+static inline int fastInt(const char *s, int base, long *p_out)
+{
+    unsigned long v = 0;
+    int i;
+
+    if (base == 10) {
+        for (i = 0; i < 10; i++) {
+            unsigned int d = (unsigned char)s[i] - '0';
+
+            if (d > 9) break;
+            v = v * 10 + d;
+        }
+        if (i == 0 || i == 10) return -1;
+        *p_out = (long)v;
+    } else {
+        if (s[0] == '0' && (s[1] | 0x20) == 'x') return -1;
+        for (i = 0; i < 8; i++) {
+            unsigned int c = (unsigned char)s[i];
+            unsigned int d = c - '0';
+
+            if (d > 9) {
+                d = (c | 0x20) - 'a';
+                if (d > 5) break;
+                d += 10;
+            }
+            v = (v << 4) | d;
+        }
+        if (i == 0 || i == 8) return -1;
+        *p_out = (long)v;
+    }
+
+    return 0;
+}
+
 /**
  * Parses the next integer in the AT response line and places it in *p_out
  * returns 0 on success and -1 on fail
@@ -125,6 +192,7 @@ static char * nextTok(char **p_cur)
 static int at_tok_nextint_base(char **p_cur, int *p_out, int base, int  uns)
 {
     char *ret;
+    long l;
 
     if (*p_cur == NULL) {
         return -1;
@@ -134,8 +202,9 @@ static int at_tok_nextint_base(char **p_cur, int *p_out, int base, int  uns)
 
     if (ret == NULL) {
         return -1;
-    } else {
-        long l;
+    }
+
+    if (fastInt(ret, base, &l) < 0) {
         char *end;
 
         if (uns)
@@ -148,11 +217,36 @@ static int at_tok_nextint_base(char **p_cur, int *p_out, int base, int  uns)
         if (end == ret) {
             return -1;
         }
+    } else {
+        *p_out = (int)l;
     }
 
     return 0;
 }
 
+#ifdef AT_TOK_DIFF_CHECK
+static int checkedNextIntBase(char **p_cur, int *p_out, int base, int uns)
+{
+    char *in = (*p_cur != NULL) ? strdup(*p_cur) : NULL;
+    char *legacyCur = in;
+    int out = 0, legacyOut = 0;
+    int ret, legacyRet;
+    char a[16], b[16];
+
+    ret = at_tok_nextint_base(p_cur, &out, base, uns);
+    legacyRet = legacyNextIntBase(&legacyCur, &legacyOut, base, uns);
+    if (ret == 0) *p_out = out;
+
+    snprintf(a, sizeof(a), "%d", ret == 0 ? out : 0);
+    snprintf(b, sizeof(b), "%d", legacyRet == 0 ? legacyOut : 0);
+    diffCheck("int", in, *p_cur, legacyCur, ret, legacyRet, a, b);
+    free(in);
+
+    return ret;
+}
+#define at_tok_nextint_base checkedNextIntBase
+#endif
+
 /**
  * Parses the next base 10 integer in the AT response line
  * and places it in *p_out
@@ -200,11 +294,23 @@ int at_tok_nextbool(char **p_cur, char *p_out)
 
 int at_tok_nextstr(char **p_cur, char **p_out)
 {
+#ifdef AT_TOK_DIFF_CHECK
+    char *in, *legacyCur, *legacyOut;
+#endif
+
     if (*p_cur == NULL) {
         return -1;
     }
 
+#ifdef AT_TOK_DIFF_CHECK
+    in = legacyCur = strdup(*p_cur);
+    legacyOut = legacyNextTok(&legacyCur);
+    *p_out = nextTok(p_cur);
+    diffCheck("str", in, *p_cur, legacyCur, 0, 0, *p_out, legacyOut);
+    free(in);
+#else
     *p_out = nextTok(p_cur);
+#endif
 
     return 0;
 }
@@ -215,3 +321,253 @@ int at_tok_hasmore(char **p_cur)
     return ! (*p_cur == NULL || **p_cur == '\0');
 }
 
+
+static char * skipSpace(char *p)
+{
+    while (*p == ' ' || *p == '\t') p++;
+
+    return p;
+}
+
+/* closing quote is the one followed by a comma or the end of line */
+static char * closingQuote(char *p)
+{
+    char *q;
+
+    for (q = strchr(p, '"'); q != NULL; q = strchr(q + 1, '"')) {
+        char *next = skipSpace(q + 1);
+
+        if (*next == ',' || *next == '\0' || *next == '\r' || *next == '\n') {
+            return q;
+        }
+    }
+
+    return NULL;
+}
+
+static int parseNumber(char *tok, int type, void *dst)
+{
+    unsigned int value = 0;
+    int negative = 0, digits = 0;
+    char *p = tok;
+
+    if (type != AT_FIELD_HEX) {
+        if (*p == '-' || *p == '+') negative = (*p++ == '-');
+    }
+
+    for (;; p++, digits++) {
+        unsigned int d;
+
+        if (*p >= '0' && *p <= '9') {
+            d = *p - '0';
+        } else if (type == AT_FIELD_HEX && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'f') {
+            d = (*p | 0x20) - 'a' + 10;
+        } else {
+            break;
+        }
+        value = value * (type == AT_FIELD_HEX ? 16 : 10) + d;
+    }
+    if (digits == 0) return -1;
+
+    if (negative) value = 0u - value;
+
+    if (type == AT_FIELD_BOOL) {
+        if (value > 1) return -1;
+        if (dst != NULL) *(char *)dst = (char)value;
+    } else if (dst != NULL) {
+        *(int *)dst = (int)value;
+    }
+
+    return 0;
+}
+
+int at_tok_parse(char *line, const ATLayout *layout, void *out, ATTokError *p_err)
+{
+    char *p, *mark = line;
+    int i = 0;
+
+    p = (line == NULL) ? NULL : strchr(line, ':');
+    if (p == NULL) goto error;
+    p++;
+
+    for (i = 0; i < layout->count; i++) {
+        const ATField *f = &layout->fields[i];
+        int type = f->type & ~AT_FIELD_OPTIONAL;
+        void *dst = (type == AT_FIELD_SKIP) ? NULL : (char *)out + f->offset;
+        char *tok, *end;
+
+        // previous field was the last one //
+        if (p == NULL) {
+            if (f->type & AT_FIELD_OPTIONAL) return i;
+            goto error;
+        }
+
+        p = mark = skipSpace(p);
+        if (*p == '"') {
+            tok = p + 1;
+            end = closingQuote(tok);
+            if (end == NULL) goto error;
+            *end = '\0';
+            p = skipSpace(end + 1);
+        } else {
+            tok = p;
+            for (p = nextDelim(p); *p == '"'; p = nextDelim(p + 1));
+        }
+
+        if (*p == ',') {
+            *p++ = '\0';
+        } else {
+            *p = '\0';
+            mark = p;
+            p = NULL;
+        }
+
+        if (type == AT_FIELD_STR) {
+            *(char **)dst = tok;
+        } else if (type != AT_FIELD_SKIP) {
+            if (parseNumber(tok, type, dst) < 0) {
+                if ((f->type & AT_FIELD_OPTIONAL) && *tok == '\0') continue;
+                mark = tok;
+                goto error;
+            }
+        }
+    }
+
+    return layout->count;
+
+error:
+    if (p_err != NULL) {
+        p_err->field = i;
+        p_err->column = (mark != NULL) ? (int)(mark - line) : -1;
+        p_err->name = (i < layout->count) ? layout->fields[i].name : NULL;
+    }
+
+    return -1;
+}
+
+#ifdef AT_TOK_DIFF_CHECK
+/*
+ * Tokenizer as it was before the scanner based one, every at_tok_next*()
+ * call also runs it on a copy of the input and logs any difference.
+ */
+static unsigned int s_diffCalls;
+static unsigned int s_diffMismatches;
+
+static void diffCheck(const char *what, const char *in, char *cur, char *legacyCur,
+        int ret, int legacyRet, const char *out, const char *legacyOut)
+{
+    int curOff = (cur != NULL) ? (int)strlen(cur) : -1;
+    int legacyOff = (legacyCur != NULL) ? (int)strlen(legacyCur) : -1;
+
+    s_diffCalls++;
+    if (ret == legacyRet && curOff == legacyOff
+            && ((out == NULL && legacyOut == NULL)
+                || (out != NULL && legacyOut != NULL && strcmp(out, legacyOut) == 0))) {
+        return;
+    }
+
+    s_diffMismatches++;
+    LOGE("at_tok diff %s #%u/%u on \"%s\": ret %d/%d out \"%s\"/\"%s\" left %d/%d",
+            what, s_diffMismatches, s_diffCalls, in != NULL ? in : "(null)",
+            ret, legacyRet, out != NULL ? out : "(null)",
+            legacyOut != NULL ? legacyOut : "(null)", curOff, legacyOff);
+}
+
+void at_tok_diff_stats(unsigned int *p_calls, unsigned int *p_mismatches)
+{
+    *p_calls = s_diffCalls;
+    *p_mismatches = s_diffMismatches;
+}
+
+static void legacySkipWhiteSpace(char **p_cur)
+{
+    if (*p_cur == NULL) return;
+
+    while (**p_cur != '\0' && isspace(**p_cur)) {
+        (*p_cur)++;
+    }
+}
+
+static void legacySkipNextComma(char **p_cur)
+{
+    if (*p_cur == NULL) return;
+
+    while (**p_cur != '\0' && **p_cur != ',') {
+        (*p_cur)++;
+    }
+
+    if (**p_cur == ',') {
+        (*p_cur)++;
+    }
+}
+
+static char * legacyNextTok(char **p_cur)
+{
+    char *ret = NULL;
+
+    legacySkipWhiteSpace(p_cur);
+
+    if (*p_cur == NULL) {
+        ret = NULL;
+    } else if (**p_cur == '"') {
+        int i = 0,n=0;
+
+        (*p_cur)++;
+        while(1)
+        {
+            while(*((*p_cur)+i) != '\0' && *((*p_cur)+i) != ',' && *((*p_cur)+i) != '"')
+            {
+                i++;
+            }
+            if(*((*p_cur)+i) == '"')
+            {
+                n = i;
+                i++;
+            }
+            else
+            {
+                ret = *p_cur;
+                *(*p_cur + n) = '\0';
+                *p_cur += i;
+                break;
+            }
+        }
+        legacySkipNextComma(p_cur);
+    } else {
+        ret = strsep(p_cur, ",");
+    }
+
+    return ret;
+}
+
+static int legacyNextIntBase(char **p_cur, int *p_out, int base, int uns)
+{
+    char *ret;
+
+    if (*p_cur == NULL) {
+        return -1;
+    }
+
+    ret = legacyNextTok(p_cur);
+
+    if (ret == NULL) {
+        return -1;
+    } else {
+        long l;
+        char *end;
+
+        if (uns)
+            l = strtoul(ret, &end, base);
+        else
+            l = strtol(ret, &end, base);
+
+        *p_out = (int)l;
+
+        if (end == ret) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+#endif /* AT_TOK_DIFF_CHECK */
@@ -19,6 +19,8 @@
 #ifndef AT_TOK_H
 #define AT_TOK_H 1
 
+#include <stddef.h>
+
 int at_tok_start(char **p_cur);
 int at_tok_nextint(char **p_cur, int *p_out);
 int at_tok_nexthexint(char **p_cur, int *p_out);
@@ -28,4 +30,67 @@ int at_tok_nextstr(char **p_cur, char **out);
 
 int at_tok_hasmore(char **p_cur);
 
+#ifdef AT_TOK_DIFF_CHECK
+/* at_tok_next*() calls compared with the old tokenizer, and differences */
+void at_tok_diff_stats(unsigned int *p_calls, unsigned int *p_mismatches);
+#endif
+
+/*
+ * Layout driven parsing
+ *
+ * A response layout is declared once as a const table of fields, each
+ * naming its type and where it goes in the output struct. at_tok_parse()
+ * then walks the line a single time, in place and without allocation,
+ * instead of one at_tok_next*() call and goto per field:
+ *
+ *     typedef struct { int cid; int state; } CGACTLine;
+ *     static const ATField s_cgactFields[] = {
+ *         AT_FIELD(AT_FIELD_INT, CGACTLine, cid),
+ *         AT_FIELD(AT_FIELD_INT, CGACTLine, state),
+ *     };
+ *     static const ATLayout s_cgact = AT_LAYOUT(s_cgactFields);
+ *
+ *     err = at_tok_parse(line, &s_cgact, &out, &tokErr);
+ */
+enum {
+    AT_FIELD_INT = 0,   /* int, base 10 */
+    AT_FIELD_HEX,       /* int, base 16, unsigned */
+    AT_FIELD_BOOL,      /* char, 0 or 1 */
+    AT_FIELD_STR,       /* char *, quotes removed, points into the line */
+    AT_FIELD_SKIP       /* not stored */
+};
+
+/* the line may end before this field, parsing then stops successfully */
+#define AT_FIELD_OPTIONAL   0x80
+
+typedef struct {
+    unsigned char type;         /* AT_FIELD_* | AT_FIELD_OPTIONAL */
+    unsigned short offset;      /* in the output struct */
+    const char *name;
+} ATField;
+
+typedef struct {
+    const ATField *fields;
+    int count;
+} ATLayout;
+
+/* where and why at_tok_parse() failed */
+typedef struct {
+    int field;                  /* index in the layout */
+    int column;                 /* offset in the line */
+    const char *name;
+    int line;                   /* at_response_parse() only, index of the line */
+} ATTokError;
+
+#define AT_FIELD(type, st, member)  { (type), offsetof(st, member), #member }
+#define AT_FIELD_SKIPPED            { AT_FIELD_SKIP, 0, NULL }
+#define AT_LAYOUT(fields)           { (fields), sizeof(fields) / sizeof((fields)[0]) }
+
+/**
+ * parses a whole response line, prefix included, into out
+ * returns the number of fields reached or -1 on fail with *p_err set
+ * line is modified, STR fields point into it
+ */
+int at_tok_parse(char *line, const ATLayout *layout, void *out, ATTokError *p_err);
+
 #endif /*AT_TOK_H */
@@ -0,0 +1,189 @@
+/* //device/system/reference-ril/at_trace.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <cutils/properties.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+int s_atTraceEnabled = 0;
+
+static ATTraceHeader * s_traceHdr = NULL;
+static unsigned char * s_traceData = NULL;
+static pthread_mutex_t s_traceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Maps the trace file and enables tracing if AT_TRACE_PROPERTY asks so.
+ * Content of a previous run is kept when the ring size did not change,
+ * so the tail of a crashed session can still be dumped.
+ */
+void at_trace_init(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    unsigned int size;
+    size_t mapsize;
+    void * map;
+    int fd;
+
+    if (s_atTraceEnabled) return;
+
+    property_get(AT_TRACE_PROPERTY, value, "0");
+    size = (unsigned int)atoi(value) * 1024;
+    if (size == 0) return;
+
+    if (size < AT_TRACE_MIN_SIZE) size = AT_TRACE_MIN_SIZE;
+    if (size > AT_TRACE_MAX_SIZE) size = AT_TRACE_MAX_SIZE;
+    mapsize = sizeof(ATTraceHeader) + size;
+
+    fd = open(AT_TRACE_FILE, O_RDWR | O_CREAT, 0660);
+    if (fd < 0) {
+        LOGE("at_trace: open %s failed(%d)", AT_TRACE_FILE, errno);
+        return;
+    }
+
+    if (ftruncate(fd, mapsize) < 0) {
+        LOGE("at_trace: resize %s failed(%d)", AT_TRACE_FILE, errno);
+        close(fd);
+        return;
+    }
+
+    map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOGE("at_trace: mmap failed(%d)", errno);
+        return;
+    }
+
+    s_traceHdr = (ATTraceHeader *)map;
+    s_traceData = (unsigned char *)map + sizeof(ATTraceHeader);
+
+    if (s_traceHdr->magic != AT_TRACE_MAGIC
+            || s_traceHdr->version != AT_TRACE_VERSION
+            || s_traceHdr->size != size
+            || s_traceHdr->head >= size
+            || s_traceHdr->tail >= size
+            || s_traceHdr->used > size) {
+        memset(s_traceHdr, 0, sizeof(ATTraceHeader));
+        s_traceHdr->magic = AT_TRACE_MAGIC;
+        s_traceHdr->version = AT_TRACE_VERSION;
+        s_traceHdr->hdrSize = sizeof(ATTraceHeader);
+        s_traceHdr->size = size;
+    }
+
+    LOGI("at_trace: %u bytes ring at %s", size, AT_TRACE_FILE);
+    s_atTraceEnabled = 1;
+}
+
+/* drop the oldest record, assumes s_traceMutex is held */
+static void dropOldest(void)
+{
+    ATTraceHeader * hdr = s_traceHdr;
+    ATTraceRecord * rec;
+    unsigned int recsize;
+
+    // no room for a record header or padding: rest of ring is unused //
+    if (hdr->size - hdr->tail < sizeof(ATTraceRecord)) {
+        hdr->used -= hdr->size - hdr->tail;
+        hdr->tail = 0;
+        return;
+    }
+
+    rec = (ATTraceRecord *)(s_traceData + hdr->tail);
+    if (rec->len == AT_TRACE_PAD_LEN) {
+        hdr->used -= hdr->size - hdr->tail;
+        hdr->tail = 0;
+        return;
+    }
+
+    recsize = AT_TRACE_ALIGN(sizeof(ATTraceRecord) + rec->len);
+    hdr->used -= recsize;
+    hdr->tail += recsize;
+    if (hdr->tail >= hdr->size) hdr->tail = 0;
+    hdr->lost++;
+}
+
+/**
+ * Appends one record to the ring, overwriting the oldest ones if needed.
+ * Called from the reader thread and all request threads.
+ */
+void at_trace_record(int channel, int dir, const void *buf, int len)
+{
+    ATTraceHeader * hdr = s_traceHdr;
+    ATTraceRecord * rec;
+    struct timeval tv;
+    unsigned int need;
+
+    if (hdr == NULL || buf == NULL || len <= 0) return;
+
+    if ((unsigned int)len > hdr->size / 4) len = hdr->size / 4;
+    if (len >= AT_TRACE_PAD_LEN) len = AT_TRACE_PAD_LEN - 1;
+    need = AT_TRACE_ALIGN(sizeof(ATTraceRecord) + len);
+
+    gettimeofday(&tv, NULL);
+
+    pthread_mutex_lock(&s_traceMutex);
+
+    // record doesn't fit before end of ring: pad and wrap //
+    if (hdr->head + need > hdr->size) {
+        while (hdr->used > 0 && hdr->tail >= hdr->head) {
+            dropOldest();
+        }
+        if (hdr->size - hdr->head >= sizeof(ATTraceRecord)) {
+            rec = (ATTraceRecord *)(s_traceData + hdr->head);
+            memset(rec, 0, sizeof(ATTraceRecord));
+            rec->len = AT_TRACE_PAD_LEN;
+        }
+        if (hdr->used == 0) {
+            hdr->tail = 0;
+        } else {
+            hdr->used += hdr->size - hdr->head;
+        }
+        hdr->head = 0;
+    }
+
+    while (hdr->used > 0 && hdr->size - hdr->used < need) {
+        dropOldest();
+    }
+    if (hdr->used == 0) {
+        hdr->tail = hdr->head;
+    }
+
+    rec = (ATTraceRecord *)(s_traceData + hdr->head);
+    rec->sec = tv.tv_sec;
+    rec->usec = tv.tv_usec;
+    rec->len = len;
+    rec->channel = channel;
+    rec->dir = dir;
+    memcpy(rec + 1, buf, len);
+
+    hdr->used += need;
+    hdr->head += need;
+    if (hdr->head >= hdr->size) hdr->head = 0;
+
+    pthread_mutex_unlock(&s_traceMutex);
+}
@@ -0,0 +1,92 @@
+/* //device/system/reference-ril/at_trace.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_TRACE_H
+#define AT_TRACE_H 1
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Binary AT trace ring
+ *
+ * Raw AT bytes are recorded into a file backed ring mapped with mmap(),
+ * so the trace survives a crash of rild. Nothing is formatted on the AT
+ * hot path, hex rendering is left to the offline 'attrace' tool.
+ *
+ * The ring is enabled by setting AT_TRACE_PROPERTY to its size in KB
+ * before rild starts, "0" or unset means tracing off.
+ */
+#define AT_TRACE_PROPERTY       "persist.ril.at.trace"
+#define AT_TRACE_FILE           "/data/misc/radio/attrace.bin"
+
+#define AT_TRACE_MAGIC          0x52545441 /* "ATTR" */
+#define AT_TRACE_VERSION        1
+#define AT_TRACE_MIN_SIZE       (16 * 1024)
+#define AT_TRACE_MAX_SIZE       (4 * 1024 * 1024)
+
+#define AT_TRACE_DIR_TX         0 /* AP -> BB */
+#define AT_TRACE_DIR_RX         1 /* BB -> AP */
+
+/* record length used to pad the tail of the ring before wrapping */
+#define AT_TRACE_PAD_LEN        0xFFFF
+
+/* all records start on a 4 bytes boundary */
+#define AT_TRACE_ALIGN(x)       (((x) + 3) & ~3)
+
+/* file header, data area follows immediately */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t hdrSize;
+    uint32_t size;      /* bytes of data area */
+    uint32_t head;      /* offset of next record to write */
+    uint32_t tail;      /* offset of oldest record */
+    uint32_t used;      /* bytes between tail and head, padding included */
+    uint32_t lost;      /* records dropped to make room */
+    uint32_t reserved;
+} ATTraceHeader;
+
+/* record header, 'len' raw bytes follow */
+typedef struct {
+    uint32_t sec;       /* gettimeofday() */
+    uint32_t usec;
+    uint16_t len;
+    uint8_t channel;    /* 0 based AT channel */
+    uint8_t dir;        /* AT_TRACE_DIR_* */
+} ATTraceRecord;
+
+extern int s_atTraceEnabled;
+
+void at_trace_init(void);
+void at_trace_record(int channel, int dir, const void *buf, int len);
+
+/* costs one load and branch when tracing is off */
+#define AT_TRACE(channel, dir, buf, len) \
+    do { \
+        if (s_atTraceEnabled) at_trace_record((channel), (dir), (buf), (len)); \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_TRACE_H*/
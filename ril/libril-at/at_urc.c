@@ -0,0 +1,455 @@
+/* //device/system/reference-ril/at_urc.c
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include "at_urc.h"
+#include "at_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <cutils/properties.h>
+#include <hardware_legacy/power.h>
+
+#define LOG_TAG "AT"
+#include <utils/Log.h>
+
+#define ATOMIC_ADD(p, v)    __sync_fetch_and_add((p), (v))
+
+#define URC_PREFIX_LEN      24
+#define URC_BUCKETS         64  /* power of 2 */
+
+typedef struct {
+    char prefix[URC_PREFIX_LEN];
+    int len;
+    ATUrcHandler handler;
+    int flags;
+    int lane;
+    int next;               /* next entry of the bucket + 1, 0 ends */
+    uint32_t count;
+    uint32_t totalUs;
+    uint32_t maxUs;
+    uint32_t coalesced;
+} ATUrcEntry;
+
+/* a queued URC, line and PDU copied behind the header */
+typedef struct ATUrcItem {
+    struct ATUrcItem *next;
+    ATUrcEntry *entry;
+    long long postedUs;
+    char *pdu;
+    char line[1];
+} ATUrcItem;
+
+typedef struct {
+    ATUrcItem *head;
+    ATUrcItem *tail;
+    int busy;               /* a worker runs one of its items */
+} ATUrcLane;
+
+/* time spent by posting threads or waiting in the queue */
+typedef struct {
+    uint32_t count;
+    uint32_t totalUs;
+    uint32_t maxUs;
+} ATUrcDelay;
+
+static ATUrcEntry s_entries[AT_URC_MAX_HANDLERS];
+static int s_entryCount = 0;
+// first entry of each bucket + 1, 0 empty //
+static int s_buckets[URC_BUCKETS];
+static uint32_t s_unhandled = 0;
+
+static ATUrcLane s_lanes[AT_URC_LANES];
+static int s_queued = 0;
+static int s_nextLane = 0;
+static int s_workers = 0;
+static pthread_mutex_t s_queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_workCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t s_spaceCond = PTHREAD_COND_INITIALIZER;
+
+// under s_queueMutex //
+static int s_queuePeak = 0;
+static uint32_t s_fullWaits = 0;
+// AT_URC_WAKE items queued or running, AT_URC_WAKE_LOCK held while > 0 //
+static int s_wakeItems = 0;
+static uint32_t s_wakeLocks = 0;
+static ATUrcDelay s_post;
+static ATUrcDelay s_wait;
+
+/* assumes s_queueMutex is held, so lock and unlock keep their order */
+static void holdWake(ATUrcEntry *e)
+{
+    if (!(e->flags & AT_URC_WAKE)) return;
+
+    if (s_wakeItems++ == 0) {
+        acquire_wake_lock(PARTIAL_WAKE_LOCK, AT_URC_WAKE_LOCK);
+        s_wakeLocks++;
+    }
+}
+
+/* assumes s_queueMutex is held */
+static void dropWake(ATUrcEntry *e)
+{
+    if (!(e->flags & AT_URC_WAKE)) return;
+
+    if (--s_wakeItems == 0) release_wake_lock(AT_URC_WAKE_LOCK);
+}
+
+static void addDelay(ATUrcDelay *d, long long us)
+{
+    uint32_t v = us > 0x7FFFFFFF ? 0x7FFFFFFF : (uint32_t)us;
+
+    d->count++;
+    d->totalUs += v;
+    if (v > d->maxUs) d->maxUs = v;
+}
+
+/* the caller makes sure p has AT_URC_KEY_LEN bytes */
+static unsigned int bucketOf(const char *p)
+{
+    unsigned int h = 2166136261u;
+    int i;
+
+    for (i = 0; i < AT_URC_KEY_LEN; i++) {
+        h = (h ^ (unsigned char)p[i]) * 16777619u;
+    }
+
+    return (h ^ (h >> 16)) & (URC_BUCKETS - 1);
+}
+
+static ATUrcEntry * findEntry(const char *line)
+{
+    int i;
+
+    for (i = 0; i < AT_URC_KEY_LEN; i++) {
+        if (line[i] == '\0') return NULL;
+    }
+
+    for (i = s_buckets[bucketOf(line)]; i != 0; i = s_entries[i - 1].next) {
+        ATUrcEntry *e = &s_entries[i - 1];
+
+        if (memcmp(line, e->prefix, e->len) == 0) return e;
+    }
+
+    return NULL;
+}
+
+int at_urc_register(const char *prefix, ATUrcHandler handler, int flags, int lane)
+{
+    int len = strlen(prefix);
+    int *link;
+    ATUrcEntry *e;
+
+    if (len < AT_URC_KEY_LEN || len >= URC_PREFIX_LEN
+            || lane < 0 || lane >= AT_URC_LANES
+            || s_entryCount >= AT_URC_MAX_HANDLERS) {
+        LOGE("at_urc: cannot register \"%s\"", prefix);
+        return -1;
+    }
+
+    e = &s_entries[s_entryCount];
+    memcpy(e->prefix, prefix, len + 1);
+    e->len = len;
+    e->handler = handler;
+    e->flags = flags;
+    e->lane = lane;
+
+    // longest first, "+CME ERROR: 150" before a "+CME ERROR:" //
+    for (link = &s_buckets[bucketOf(prefix)];
+            *link != 0 && s_entries[*link - 1].len >= len;
+            link = &s_entries[*link - 1].next);
+    e->next = *link;
+    *link = ++s_entryCount;
+
+    return 0;
+}
+
+static void runHandler(ATUrcEntry *e, char *line, const char *sms_pdu)
+{
+    long long startUs = at_stats_now();
+    uint32_t us, old;
+
+    e->handler(line, sms_pdu);
+    us = (uint32_t)(at_stats_now() - startUs);
+
+    ATOMIC_ADD(&e->count, 1);
+    ATOMIC_ADD(&e->totalUs, us);
+    // a lost race only means a smaller max //
+    old = e->maxUs;
+    while (us > old && !__sync_bool_compare_and_swap(&e->maxUs, old, us)) {
+        old = e->maxUs;
+    }
+}
+
+/* next runnable item, lanes taken in turn, assumes s_queueMutex is held */
+static ATUrcItem * takeItem(void)
+{
+    int i;
+
+    for (i = 0; i < AT_URC_LANES; i++) {
+        int l = (s_nextLane + i) % AT_URC_LANES;
+        ATUrcLane *lane = &s_lanes[l];
+        ATUrcItem *item = lane->head;
+
+        if (item == NULL || lane->busy) continue;
+
+        lane->head = item->next;
+        if (lane->head == NULL) lane->tail = NULL;
+        if (l != AT_URC_LANE_ANY) lane->busy = 1;
+        s_queued--;
+        s_nextLane = l + 1;
+
+        return item;
+    }
+
+    return NULL;
+}
+
+static void * workerLoop(void *arg)
+{
+    for (;;) {
+        ATUrcItem *item;
+        ATUrcEntry *e;
+
+        pthread_mutex_lock(&s_queueMutex);
+        while ((item = takeItem()) == NULL) {
+            pthread_cond_wait(&s_workCond, &s_queueMutex);
+        }
+        addDelay(&s_wait, at_stats_now() - item->postedUs);
+        pthread_cond_signal(&s_spaceCond);
+        pthread_mutex_unlock(&s_queueMutex);
+
+        e = item->entry;
+        runHandler(e, item->line, item->pdu);
+        free(item);
+
+        if (e->lane != AT_URC_LANE_ANY || (e->flags & AT_URC_WAKE)) {
+            pthread_mutex_lock(&s_queueMutex);
+            dropWake(e);
+            if (e->lane != AT_URC_LANE_ANY) {
+                s_lanes[e->lane].busy = 0;
+                // the lane's next item may wait for us only //
+                if (s_lanes[e->lane].head != NULL) pthread_cond_signal(&s_workCond);
+            }
+            pthread_mutex_unlock(&s_queueMutex);
+        }
+    }
+
+    return NULL;
+}
+
+void at_urc_start(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    pthread_attr_t attr;
+    int i, n;
+
+    if (s_workers > 0) return;
+
+    property_get(AT_URC_PROP_WORKERS, value, "");
+    n = value[0] != '\0' ? atoi(value) : AT_URC_DEF_WORKERS;
+    if (n > AT_URC_MAX_WORKERS) n = AT_URC_MAX_WORKERS;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (i = 0; i < n; i++) {
+        pthread_t tid;
+
+        if (pthread_create(&tid, &attr, workerLoop, NULL) != 0) {
+            LOGE("at_urc: worker %d not started", i);
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    // set last, lines posted before run inline //
+    s_workers = i;
+    LOGI("at_urc: %d workers, queue %d", s_workers, AT_URC_QUEUE_MAX);
+}
+
+/* drops a queued item of e, assumes s_queueMutex is held */
+static void dropQueued(ATUrcEntry *e)
+{
+    ATUrcLane *lane = &s_lanes[e->lane];
+    ATUrcItem **link, *prev = NULL;
+
+    for (link = &lane->head; *link != NULL; prev = *link, link = &(*link)->next) {
+        ATUrcItem *item = *link;
+
+        if (item->entry != e) continue;
+
+        *link = item->next;
+        if (lane->tail == item) lane->tail = prev;
+        s_queued--;
+        e->coalesced++;
+        dropWake(e);
+        free(item);
+        return;
+    }
+}
+
+static void postItem(ATUrcEntry *e, const char *line, const char *sms_pdu)
+{
+    int len = strlen(line);
+    int pdulen = sms_pdu != NULL ? strlen(sms_pdu) : 0;
+    long long startUs = at_stats_now();
+    ATUrcItem *item;
+    ATUrcLane *lane;
+
+    item = (ATUrcItem *)malloc(sizeof(ATUrcItem) + len + 1 + pdulen + 1);
+    if (item == NULL) {
+        LOGE("at_urc: no memory, %s handled inline", e->prefix);
+        runHandler(e, (char *)line, sms_pdu);
+        return;
+    }
+    item->next = NULL;
+    item->entry = e;
+    item->postedUs = startUs;
+    memcpy(item->line, line, len + 1);
+    item->pdu = NULL;
+    if (sms_pdu != NULL) {
+        item->pdu = item->line + len + 1;
+        memcpy(item->pdu, sms_pdu, pdulen + 1);
+    }
+
+    pthread_mutex_lock(&s_queueMutex);
+    // before a wait for space, the AP must not sleep on a full queue //
+    holdWake(e);
+    if (e->flags & AT_URC_COALESCE) dropQueued(e);
+    while (s_queued >= AT_URC_QUEUE_MAX) {
+        s_fullWaits++;
+        pthread_cond_wait(&s_spaceCond, &s_queueMutex);
+    }
+
+    lane = &s_lanes[e->lane];
+    if (lane->tail != NULL) {
+        lane->tail->next = item;
+    } else {
+        lane->head = item;
+    }
+    lane->tail = item;
+    if (++s_queued > s_queuePeak) s_queuePeak = s_queued;
+    pthread_cond_signal(&s_workCond);
+
+    addDelay(&s_post, at_stats_now() - startUs);
+    pthread_mutex_unlock(&s_queueMutex);
+}
+
+int at_urc_dispatch(char *line, const char *sms_pdu)
+{
+    ATUrcEntry *e = findEntry(line);
+
+    if (e == NULL) {
+        ATOMIC_ADD(&s_unhandled, 1);
+        return 0;
+    }
+
+    // the copy is only needed by a worker, the line is ours till we return //
+    if (s_workers > 0 && (e->flags & AT_URC_COPY)) {
+        postItem(e, line, sms_pdu);
+        return 1;
+    }
+
+    runHandler(e, line, sms_pdu);
+
+    return 1;
+}
+
+static int appendDelay(char *buf, int size, int len, const char *name, const ATUrcDelay *d)
+{
+    int n;
+
+    if (d->count == 0 || len >= size - 1) return len;
+
+    n = snprintf(buf + len, size - len, "%-15s %8u %8.1f %8u\n",
+            name, d->count, (double)d->totalUs / d->count, d->maxUs);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+
+    return len;
+}
+
+int at_urc_dump(char *buf, int size, int len)
+{
+    static const char * laneNames[AT_URC_LANES] = { "any", "call", "sms", "net", "sim" };
+    ATUrcDelay post, wait;
+    int i, n, queued, peak;
+    uint32_t fullWaits, wakeLocks;
+
+    if (len >= size - 1) return len;
+
+    n = snprintf(buf + len, size - len, "\n%-15s %8s %8s %8s %5s %4s %9s   (no handler %u)\n",
+            "URC handler", "count", "avg us", "max us", "flags", "lane", "coalesced",
+            s_unhandled);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+
+    for (i = 0; i < s_entryCount && len < size - 1; i++) {
+        ATUrcEntry *e = &s_entries[i];
+
+        if (e->count == 0 && e->coalesced == 0) continue;
+        n = snprintf(buf + len, size - len, "%-15s %8u %8.1f %8u   %c%c%c %4s %9u\n",
+                e->prefix, e->count, e->count ? (double)e->totalUs / e->count : 0.0,
+                e->maxUs,
+                e->flags & AT_URC_WAKE ? 'w' : '-',
+                e->flags & AT_URC_COALESCE ? 'c' : '-',
+                e->flags & AT_URC_COPY ? 'q' : '-',
+                laneNames[e->lane], e->coalesced);
+        if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    }
+
+    pthread_mutex_lock(&s_queueMutex);
+    post = s_post;
+    wait = s_wait;
+    queued = s_queued;
+    peak = s_queuePeak;
+    fullWaits = s_fullWaits;
+    wakeLocks = s_wakeLocks;
+    pthread_mutex_unlock(&s_queueMutex);
+
+    if (len >= size - 1) return len;
+    n = snprintf(buf + len, size - len,
+            "\n%-15s %8s %8s %8s   (%d workers, queued %d, peak %d/%d, full %u, wake locks %u)\n",
+            "URC queue", "count", "avg us", "max us",
+            s_workers, queued, peak, AT_URC_QUEUE_MAX, fullWaits, wakeLocks);
+    if (n > 0) len += (n < size - len) ? n : size - len - 1;
+    len = appendDelay(buf, size, len, "reader post", &post);
+    len = appendDelay(buf, size, len, "queue wait", &wait);
+
+    return len;
+}
+
+void at_urc_reset_stats(void)
+{
+    int i;
+
+    for (i = 0; i < s_entryCount; i++) {
+        s_entries[i].count = 0;
+        s_entries[i].totalUs = 0;
+        s_entries[i].maxUs = 0;
+        s_entries[i].coalesced = 0;
+    }
+    s_unhandled = 0;
+
+    pthread_mutex_lock(&s_queueMutex);
+    memset(&s_post, 0, sizeof(s_post));
+    memset(&s_wait, 0, sizeof(s_wait));
+    s_queuePeak = s_queued;
+    s_fullWaits = 0;
+    s_wakeLocks = 0;
+    pthread_mutex_unlock(&s_queueMutex);
+}
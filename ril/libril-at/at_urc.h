@@ -0,0 +1,102 @@
+/* //device/system/reference-ril/at_urc.h
+**
+** Copyright (C) 2012-2013 CYIT CO., LTD. All rights reserved.
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#ifndef AT_URC_H
+#define AT_URC_H 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * URC dispatcher
+ *
+ * Unsolicited lines are handed to the handler registered for their
+ * prefix. The table is hashed on the first AT_URC_KEY_LEN bytes at
+ * registration, so a line costs one hash and a compare or two instead
+ * of a strStartsWith() per known URC.
+ *
+ * Handlers registered with AT_URC_COPY are queued: the reader copies
+ * the line into a bounded queue and a few worker threads run them.
+ * Each handler belongs to a lane: URCs of one lane run one at a time,
+ * in arrival order, and lanes run in parallel. AT_URC_LANE_ANY keeps no
+ * order. When the queue is full the reader waits. Handlers without
+ * AT_URC_COPY run on the reader's line right away, so all entries of a
+ * lane should agree on it. With persist.ril.urc.workers set to 0, every
+ * handler runs on the caller's thread.
+ *
+ * While an AT_URC_WAKE entry is queued or running, AT_URC_WAKE_LOCK is
+ * held so the AP does not suspend between the reader and the worker.
+ *
+ * Handlers get the line in a buffer they may tokenize in place, it is
+ * only valid during the call. Count, handler time and flags of every
+ * entry are reported with the AT statistics (radiooptions 11), with
+ * the time the caller spent posting, the queue wait and queue depth.
+ */
+#define AT_URC_MAX_HANDLERS     48
+#define AT_URC_KEY_LEN          3   /* shortest prefix */
+#define AT_URC_PROP_WORKERS     "persist.ril.urc.workers" /* default 2 */
+#define AT_URC_DEF_WORKERS      2
+#define AT_URC_MAX_WORKERS      4
+#define AT_URC_QUEUE_MAX        128
+#define AT_URC_WAKE_LOCK        "ril-urc"
+
+/* lanes */
+enum {
+    AT_URC_LANE_ANY = 0,    /* no order kept */
+    AT_URC_LANE_CALL,
+    AT_URC_LANE_SMS,
+    AT_URC_LANE_NET,        /* registration, PDP, network lists, signal */
+    AT_URC_LANE_SIM,        /* SIM and STK */
+    AT_URC_LANES
+};
+
+/* flags */
+#define AT_URC_COALESCE         0x01    /* a newer one supersedes a queued older */
+#define AT_URC_WAKE             0x02    /* keeps the AP awake until handled */
+#define AT_URC_COPY             0x04    /* queued with a copy, else runs inline */
+
+typedef void (*ATUrcHandler)(char *line, const char *sms_pdu);
+
+/**
+ * adds handler for lines starting with prefix (AT_URC_KEY_LEN bytes at
+ * least) to lane, before at_open(). Longer prefixes are tried first.
+ * Returns 0, -1 when the table is full or the prefix too short
+ */
+int at_urc_register(const char *prefix, ATUrcHandler handler, int flags, int lane);
+
+/* starts the workers, called from at_open() */
+void at_urc_start(void);
+
+/**
+ * queues a copy of line for its AT_URC_COPY handler, or runs the handler
+ * on line, which stays the caller's and may be changed.
+ * Returns 1 if a handler takes it, 0 if none is registered
+ */
+int at_urc_dispatch(char *line, const char *sms_pdu);
+
+/* appends the report to buf, returns the new length */
+int at_urc_dump(char *buf, int size, int len);
+
+void at_urc_reset_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*AT_URC_H*/
@@ -18,6 +18,17 @@
 
 #include "atchannel.h"
 #include "at_tok.h"
+#include "at_trace.h"
+#include "at_scan.h"
+#include "at_timeout.h"
+#include "at_stats.h"
+#include "at_cache.h"
+#include "at_buf.h"
+#include "at_urc.h"
+#include "at_signal.h"
+#include "at_reg.h"
+#include "at_pdp.h"
+#include "at_plmn.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -30,6 +41,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <telephony/ril.h>
+#include <cutils/properties.h>
 
 #define LOG_NDEBUG 0
 #define LOG_NIDEBUG 0
@@ -50,15 +62,18 @@
 
 #define NUM_ELEMS(x) (sizeof(x)/sizeof(x[0]))
 
-#define MAX_AT_RESPONSE (8 * 1024)
-#define HANDSHAKE_RETRY_COUNT 8
-#define HANDSHAKE_TIMEOUT_MSEC 250
+// same ~2 s budget as before, but retried every 80 ms //
+#define HANDSHAKE_RETRY_COUNT 25
+#define HANDSHAKE_TIMEOUT_MSEC 80
+#define HANDSHAKE_DRAIN_MSEC 100
 
 #define FINDCRLF(pos, len) \
-    while (*pos != '\r' && *pos != '\n' && len > 0) { \
-        pos++; len--; \
-    }
+    do { \
+        int eol_ = at_scan_eol(pos, len); \
+        pos += eol_; len -= eol_; \
+    } while (0)
 
+// leading terminators are one or two bytes, not worth a vector scan //
 #define SKIPCRLF(pos, len) \
     while ((*pos == '\r' || *pos == '\n') && len > 0) { \
         pos++; len--; \
@@ -76,19 +91,19 @@ static int s_fd = -1; /* fd of the AT channel */
 #endif
 static ATUnsolHandler s_unsolHandler;
 
-/* for input buffering */
+/* for input buffering, grown on demand, see at_buf.h */
 
-static char s_ATBuffer[RIL_CHANNELS][MAX_AT_RESPONSE + 1];
+static ATBuffer s_ATBuffer[RIL_CHANNELS];
+static char s_ATBufferName[RIL_CHANNELS][8];
 static char * s_ATBufferCur[RIL_CHANNELS];
+// reader thread: bytes of the URC channel, lines copied to a pipe //
+static ATBuffer s_readerBuf;
+static ATBuffer s_readerLine;
 
 static int s_ackPowerIoctl; /* true if TTY has android byte-count
                                 handshake for low power*/
 static int s_readCount = 0;
 
-// print AT data //
-static unsigned char s_at_dump_buff_r[RIL_CHANNELS][3 * 1024];
-static unsigned char s_at_dump_buff_w[RIL_CHANNELS][3 * 1024];
-
 // Length of AT data unhandled //
 //static int s_ATBufferLen;
 static int s_ATBufferLen[RIL_CHANNELS] = {0};
@@ -99,15 +114,48 @@ static int s_ATBufferLen[RIL_CHANNELS] = {0};
 
 // use for 2 step AT cmd //
 static const char * s_2stepATReq[] = {"AT+CMGS=", "AT+CMGW="};
-static int s_2stepFinished = 1;
-static int s_stepFlag = 0;
+// "> " prompts seen by the channel's 2 step cmd: 1 PDU written, 2 PDU taken //
+static int s_stepFlag[RIL_CHANNELS] = {0};
+// a 2 step cmd is between its AT and the PDU taken, other cmds wait //
+static int s_2stepBusy[RIL_CHANNELS] = {0};
 static pthread_mutex_t s_2stepATMutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t s_2stepATCond = PTHREAD_COND_INITIALIZER;
 
+// each DLC has its own AT parser, without mux one prompt blocks the port //
+#ifdef GSM_MUX_CHANNEL
+#define TWO_STEP_SLOT(cid)  (cid)
+#else
+#define TWO_STEP_SLOT(cid)  0
+#endif
+
 extern int fd_ReqRead[];
 extern int fd_ReqWrite[];
 extern pthread_key_t CID;
 
+// late output of an abandoned command is drained up to "^SUTEST: <fence>" //
+// and the final response of AT^SUTEST behind it //
+#define FENCE_BASE              10 /* 1..3 are taken by at_processTimeout() */
+#define FENCE_RANGE             90
+#define FENCE_SEEN              -1 /* ATRequest.fence once the fence line came */
+#define FENCE_TIMEOUT_MSEC      CYIT_MIN_AT_TIMEOUT_IMMEDIATE
+
+// commands written per channel, identifies the one in flight //
+static unsigned int s_seq[RIL_CHANNELS];
+// seq of the abortable command waited for, 0 none //
+static unsigned int s_inflight[RIL_CHANNELS];
+static unsigned int s_cancelSeq[RIL_CHANNELS];
+// fence to drain before the next command, 0 none //
+static int s_fence[RIL_CHANNELS];
+// the drain does not give up on the fence before this, usec //
+static long long s_fenceUntil[RIL_CHANNELS];
+// set by at_send_command_abortable() for its own nolock call //
+static int s_abortable[RIL_CHANNELS];
+static int s_abortType[RIL_CHANNELS];
+// wakes the request thread select()ing for its answer //
+static int s_wakePipe[RIL_CHANNELS][2];
+static int s_wakeReady = 0;
+static pthread_mutex_t s_cancelMutex = PTHREAD_MUTEX_INITIALIZER;
+
 // for check the baseband status
 int s_basebandReadyFlag = 0;
 int s_recoverFlag = 0;
@@ -122,6 +170,14 @@ void AT_DUMP(const char* prefix, const char* buff, int len)
 }
 #endif
 
+static int at_send_command_full_nolock( const char *command, const int cmdlen, 
+    ATCommandType type, const char *responsePrefix, const char *smspdu,
+    long long timeoutMsec, ATResponse **pp_outResponse );
+
+static int at_send_command_full( const char *command , ATCommandType type ,
+    const char *responsePrefix , const char *smspdu ,
+    long long timeoutMsec , ATResponse **pp_outResponse );
+
 // for current pending write to VIPE //
 static pthread_mutex_t s_commandmutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t s_commandcond = PTHREAD_COND_INITIALIZER;
@@ -137,7 +193,17 @@ static void (*s_onTimeout)(void) = NULL;
 static void (*s_onReaderClosed)(void) = NULL;
 static int s_readerClosed;
 
+// per channel readiness: 0 handshaking, 1 answered, -1 never answered //
+static int s_channelReady[RIL_CHANNELS] = {0};
+static int s_handshakeCid[RIL_CHANNELS];
+static int s_channelsPending = 0;
+static int s_firstATDone = 0;
+static pthread_mutex_t s_readyMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_readyCond = PTHREAD_COND_INITIALIZER;
+
 static void onReaderClosed();
+static void startHandshake(void);
+static void initBatch(void);
 static int writeCtrlZ(const char *s, int cid);
 static int writeline(const char *s, const int cmdlen, int cid);
 static void at_processTimeout(int err, const char* smsPdu);
@@ -231,6 +297,30 @@ static void addIntermediate(const char *line, ATResponse * response)
     response->p_intermediates = p_new;
 }
 
+/* index of the prefix in the '\n' joined list line starts with, -1 if none */
+static int batchPrefixIndex(const char *line, const char *prefixes)
+{
+    int i = 0;
+
+    while (*prefixes != '\0') {
+        const char *p = prefixes;
+        const char *l = line;
+
+        while (*p != '\0' && *p != '\n' && *p == *l) {
+            p++;
+            l++;
+        }
+        if (*p == '\0' || *p == '\n') return i;
+
+        prefixes = strchr(prefixes, '\n');
+        if (prefixes == NULL) break;
+        prefixes++;
+        i++;
+    }
+
+    return -1;
+}
+
 static void addEGResponse(const char *line, ATRequest * request, ATResponse * response)
 {
     ATLine *p_new;
@@ -239,7 +329,6 @@ static void addEGResponse(const char *line, ATRequest * request, ATResponse * re
     if (request->egATLen > 0) {
         p_new = (ATLine *)malloc(sizeof(ATLine));
         p_new->line = (char *)malloc(request->egATLen);
-        memset(p_new->line, 0, request->egATLen);
         memcpy(p_new->line, line, request->egATLen);
         p_new->len = request->egATLen;
         request->egATLen = 0;
@@ -265,18 +354,6 @@ static const char * s_finalResponsesError[] = {
     /*"NO ANSWER",
     "NO DIALTONE",*/
 };
-static int isFinalResponseError(const char *line)
-{
-    size_t i;
-
-    for (i = 0 ; i < NUM_ELEMS(s_finalResponsesError) ; i++) {
-        if (strStartsWith(line, s_finalResponsesError[i])) {
-            return 1;
-        }
-    }
-
-    return 0;
-}
 
 /**
  * returns 1 if line is a final response indicating success
@@ -287,17 +364,52 @@ static const char * s_finalResponsesSuccess[] = {
     "OK",
     "CONNECT"       /* some stacks start up data on another channel */
 };
-static int isFinalResponseSuccess(const char *line)
+
+/**
+ * returns 1 if line is the first line in (what will be) a two-line
+ * SMS unsolicited response
+ */
+static const char * s_smsUnsoliciteds[] = {
+    "+CMT:",
+    "+CDS:",
+    "+CBM:"
+};
+
+/* line classes, the tables above are compiled into one matcher */
+#define LINE_OTHER          0
+#define LINE_FINAL_SUCCESS  1
+#define LINE_FINAL_ERROR    2
+#define LINE_SMS_UNSOL      3
+
+static ATPrefixMatcher s_lineMatcher;
+
+static void initLineMatcher(void)
 {
+    ATPrefixEntry entries[NUM_ELEMS(s_finalResponsesError)
+            + NUM_ELEMS(s_finalResponsesSuccess) + NUM_ELEMS(s_smsUnsoliciteds)];
     size_t i;
+    int n = 0;
 
+    for (i = 0 ; i < NUM_ELEMS(s_finalResponsesError) ; i++) {
+        entries[n].prefix = s_finalResponsesError[i];
+        entries[n++].cls = LINE_FINAL_ERROR;
+    }
     for (i = 0 ; i < NUM_ELEMS(s_finalResponsesSuccess) ; i++) {
-        if (strStartsWith(line, s_finalResponsesSuccess[i])) {
-            return 1;
-        }
+        entries[n].prefix = s_finalResponsesSuccess[i];
+        entries[n++].cls = LINE_FINAL_SUCCESS;
+    }
+    for (i = 0 ; i < NUM_ELEMS(s_smsUnsoliciteds) ; i++) {
+        entries[n].prefix = s_smsUnsoliciteds[i];
+        entries[n++].cls = LINE_SMS_UNSOL;
     }
 
-    return 0;
+    at_prefix_matcher_build(&s_lineMatcher, entries, n);
+}
+
+/* one pass over the line instead of strStartsWith per table entry */
+static int classifyLine(const char *line)
+{
+    return at_prefix_match(&s_lineMatcher, line);
 }
 
 /**
@@ -307,30 +419,14 @@ static int isFinalResponseSuccess(const char *line)
  */
 static int isFinalResponse(const char *line)
 {
-    return isFinalResponseSuccess(line) || isFinalResponseError(line);
-}
+    int cls = classifyLine(line);
 
+    return cls == LINE_FINAL_SUCCESS || cls == LINE_FINAL_ERROR;
+}
 
-/**
- * returns 1 if line is the first line in (what will be) a two-line
- * SMS unsolicited response
- */
-static const char * s_smsUnsoliciteds[] = {
-    "+CMT:",
-    "+CDS:",
-    "+CBM:"
-};
 static int isSMSUnsolicited(const char *line)
 {
-    size_t i;
-
-    for (i = 0 ; i < NUM_ELEMS(s_smsUnsoliciteds) ; i++) {
-        if (strStartsWith(line, s_smsUnsoliciteds[i])) {
-            return 1;
-        }
-    }
-
-    return 0;
+    return classifyLine(line) == LINE_SMS_UNSOL;
 }
 
 /** assumes s_commandmutex is held */
@@ -348,6 +444,8 @@ static void handleFinalResponse(const char *line, ATResponse * response)
 
 static void handleUnsolicited(const char *line)
 {
+    at_stats_unsol(line);
+    at_cache_unsol(line);
     if (s_unsolHandler != NULL) {
         s_unsolHandler(line, NULL);
     }
@@ -657,6 +755,25 @@ static const char *readline( )
 static void processLine(const char *line, int cid, 
         ATRequest * request, ATResponse * response)
 {
+    int cls;
+
+    // output of an abandoned command, up to the fence answer //
+    if (request != NULL && request->fence != 0) {
+        if (request->fence == FENCE_SEEN) {
+            // OK or ERROR of AT^SUTEST, must not be left to the next command //
+            cls = classifyLine(line);
+            if (cls == LINE_FINAL_SUCCESS || cls == LINE_FINAL_ERROR) {
+                request->fence = 0;
+                return;
+            }
+        } else if (strStartsWith(line, "^SUTEST:") && atoi(line + 8) == request->fence) {
+            request->fence = FENCE_SEEN;
+            return;
+        }
+        request->drained++;
+        return;
+    }
+
     if(s_recoverFlag && s_recoverChannel == cid){
         if(s_recoverFlag <= 3){
             char *cmd = NULL;
@@ -679,28 +796,28 @@ static void processLine(const char *line, int cid,
     if (response == NULL) {
         /* no command pending */
         handleUnsolicited(line);
-    } else if (isFinalResponseSuccess(line)) {
+    } else if ((cls = classifyLine(line)) == LINE_FINAL_SUCCESS) {
         response->success = 1;
         handleFinalResponse(line, response);
-    } else if (isFinalResponseError(line)) {
+    } else if (cls == LINE_FINAL_ERROR) {
         response->success = 0;
         handleFinalResponse(line, response);
     } else if (request->smsPDU != NULL && 0 == strcmp(line, "> ")) {
         // See eg. TS 27.005 4.3
         // Commands like AT+CMGS have a "> " prompt
         pthread_mutex_lock(&s_commandmutex);
-        if(s_stepFlag == 0){
-            writeCtrlZ(request->smsPDU, cid + 1);
-            s_stepFlag = 1;
-        }else if(s_stepFlag == 1){
-            s_stepFlag = 2;
+        if(s_stepFlag[cid] == 0){
+            writeCtrlZ(request->smsPDU, cid);
+            s_stepFlag[cid] = 1;
+        }else if(s_stepFlag[cid] == 1){
+            s_stepFlag[cid] = 2;
             pthread_mutex_lock(&s_2stepATMutex);
-            s_2stepFinished = 1;
+            s_2stepBusy[TWO_STEP_SLOT(cid)] = 0;
             pthread_cond_broadcast(&s_2stepATCond);
             pthread_mutex_unlock(&s_2stepATMutex);
             LOGD("[REQ%d]: 2 step command finished, release mutex", cid);
         }else{
-            LOGE("[REQ3]Send SMS procedure para:s_stepFlag MUST BE ERROR!!!\n");
+            LOGE("[REQ%d]Send SMS procedure para:s_stepFlag MUST BE ERROR!!!\n", cid);
         }
         pthread_mutex_unlock(&s_commandmutex);
     } else {
@@ -743,6 +860,14 @@ static void processLine(const char *line, int cid,
             }
             break;
 
+        case BATCHLINE:
+            if (batchPrefixIndex(line, request->rspPrefix) >= 0) {
+                addIntermediate(line, response);
+            } else {
+                handleUnsolicited(line);
+            }
+            break;
+
         // this should never be reached //
         default: 
             LOGE("[REQ%d]Unsupported AT command type %d\n", cid, request->type);
@@ -792,10 +917,8 @@ static char * findNextEOL(char *cur, int cid, ATRequest * request)
     }
 
     // Normal AT, turn to string //
-    while (i < s_ATBufferLen[cid] && *cur != '\r' && *cur != '\n' ) {
-        cur++;
-        i++;
-    }
+    i = at_scan_eol(cur, s_ATBufferLen[cid]);
+    cur += i;
 
     if (i >= s_ATBufferLen[cid]) {
         return NULL;
@@ -808,7 +931,6 @@ static char * findNextEOL(char *cur, int cid, ATRequest * request)
 static void readline(int cid, ATRequest * request, ATResponse * response)
 {
     ssize_t count;
-    ssize_t i;
 
     // Pointer that begin to read from device //
     char *p_read = NULL;
@@ -824,8 +946,10 @@ static void readline(int cid, ATRequest * request, ATResponse * response)
         // All AT data be handled //
         if (s_ATBufferLen[cid] == 0) {
             //LOGD("[REQ%d]: No AT data in buffer.", cid);
-            s_ATBufferCur[cid] = s_ATBuffer[cid];
-            p_read = s_ATBuffer[cid];
+            // give back what a huge answer took //
+            at_buf_trim(&s_ATBuffer[cid]);
+            s_ATBufferCur[cid] = s_ATBuffer[cid].data;
+            p_read = s_ATBuffer[cid].data;
         }
 
         // There's data in the buffer from the last read //
@@ -847,9 +971,9 @@ static void readline(int cid, ATRequest * request, ATResponse * response)
                 LOGD("[REQ%d]: Last AT data is not full.", cid);
 
                 // A partial line. move it up and prepare to read more //
-                memmove(s_ATBuffer[cid], s_ATBufferCur[cid], s_ATBufferLen[cid]);
-                p_read = s_ATBuffer[cid] + s_ATBufferLen[cid];
-                s_ATBufferCur[cid] = s_ATBuffer[cid];
+                memmove(s_ATBuffer[cid].data, s_ATBufferCur[cid], s_ATBufferLen[cid]);
+                p_read = s_ATBuffer[cid].data + s_ATBufferLen[cid];
+                s_ATBufferCur[cid] = s_ATBuffer[cid].data;
             }
 
             // Otherwise, (p_eol != NULL) there is a complete line  //
@@ -857,31 +981,32 @@ static void readline(int cid, ATRequest * request, ATResponse * response)
         }
 
         if (p_eol == NULL && readed == 0) {
-            if (0 == MAX_AT_RESPONSE - (p_read - s_ATBuffer[cid])) {
-                LOGE("[REQ%d]: ERROR: Input line exceeded buffer\n", cid);
+            if (s_ATBuffer[cid].size == p_read - s_ATBuffer[cid].data) {
+                // the partial line is at the start, see above //
+                if (at_buf_reserve(&s_ATBuffer[cid], s_ATBuffer[cid].size + 1) == 0) {
+                    s_ATBufferCur[cid] = s_ATBuffer[cid].data;
+                    p_read = s_ATBuffer[cid].data + s_ATBufferLen[cid];
+                } else {
+                    LOGE("[REQ%d]: ERROR: Input line exceeded buffer\n", cid);
 
-                // Ditch buffer and start over again //
-                s_ATBufferCur[cid] = s_ATBuffer[cid];
-                s_ATBufferLen[cid] = 0;
-                p_read = s_ATBuffer[cid];
+                    // Ditch buffer and start over again //
+                    s_ATBufferCur[cid] = s_ATBuffer[cid].data;
+                    s_ATBufferLen[cid] = 0;
+                    p_read = s_ATBuffer[cid].data;
+                }
             }
 
             //LOGD( "[REQ%d]: Begin to read device.", cid );
 
             do {
                 count = read(fd_ReqRead[cid], p_read, 
-                        MAX_AT_RESPONSE - (p_read - s_ATBuffer[cid]));
+                        s_ATBuffer[cid].size - (p_read - s_ATBuffer[cid].data));
                 readed++;
             } while (count < 0 && errno == EINTR);
 
             if (count > 0) {
                 AT_DUMP("<< ", p_read, count);
-                memset(s_at_dump_buff_r[cid], 0, sizeof(s_at_dump_buff_r[cid]));
-                for (i = 0; i < count 
-                        && i < sizeof(s_at_dump_buff_r[cid]) / 3; i++) {
-                    sprintf(s_at_dump_buff_r[cid] + i * 3, "%02x ", p_read[i]);
-                }
-                LOGD("[REQ%d]: read at data(%d):%s", cid, count, s_at_dump_buff_r[cid]);
+                if (request->firstUs == 0) request->firstUs = at_stats_now();
 
                 s_ATBufferLen[cid] += count;
                 LOGD("[REQ%d]: 3 s_ATBufferLen = %d", cid, s_ATBufferLen[cid]);
@@ -916,6 +1041,9 @@ static void readline(int cid, ATRequest * request, ATResponse * response)
             LOGD("[REQ%d]: AT< %s\n", cid, ret);
 
             processLine(ret, cid, request, response);
+            if (request->intermUs == 0 && response->p_intermediates != NULL) {
+                request->intermUs = at_stats_now();
+            }
         }
     } while (p_eol != NULL);
 
@@ -1044,10 +1172,8 @@ static void * readerLoop(void *arg)
 {
 	int rev = 0;
 	int flag = 0;
-	int i = 0;
 	int len = 0; // whole AT data length //
-	char tempbuf[1024 * 3]; // use to print AT command //
-	char atbuf[1024 * 2], atdata[1024];
+	char * atbuf = NULL, * atdata = NULL;
 	char * pcur;
 	ssize_t count = 0;
 	char * smsprefix = NULL;
@@ -1056,12 +1182,6 @@ static void * readerLoop(void *arg)
 	fd_set muxs;
 	int j = 0;
 	int n = 0;
-	char urcbuf[1024 * 2];
-	int urcbufLen = 0;
-
-	if(urcbufLen == 0x00){
-		memset(urcbuf, 0x00, 1024 * 2);
-	}
 #endif
 
 	while (1) {
@@ -1075,12 +1195,20 @@ static void * readerLoop(void *arg)
 			{
 #endif
 
+				// count bytes of a partial URC fill the buffer //
+				if (count == s_readerBuf.size
+						&& at_buf_reserve(&s_readerBuf, count + 1) < 0) {
+					LOGE("[READER]: ERROR: Input line exceeded buffer, drop %d bytes", (int)count);
+					count = 0;
+				}
+				atbuf = s_readerBuf.data;
+
 				do {
 					readcount = 0;
 #ifdef GSM_MUX_CHANNEL
-					readcount = read(v_fds[j], atbuf + count, sizeof(atbuf) - count);		//独到的数据暂存放入atbuf
+					readcount = read(v_fds[j], atbuf + count, s_readerBuf.size - count);		//独到的数据暂存放入atbuf
 #else
-					readcount = read(s_fd, atbuf + count, sizeof(atbuf) - count);
+					readcount = read(s_fd, atbuf + count, s_readerBuf.size - count);
 #endif
 					count += readcount;
 				} while (readcount < 0 && errno == EINTR);
@@ -1088,11 +1216,14 @@ static void * readerLoop(void *arg)
 				if (readcount > 0) {		//有读取到的数据，进行处理 
 					pcur = atbuf;
 
-					memset(tempbuf, 0, sizeof(tempbuf));
-					for (i = 0; i < count && i < sizeof(tempbuf) / 3; i++) {
-						sprintf(tempbuf + i * 3, "%02x ", pcur[i]);
-					}
-					LOGD("[READER MUX]: channel%d handle %d bytes: %s", j, count, tempbuf);
+					// raw bytes go to trace ring, no formatting here //
+#ifdef GSM_MUX_CHANNEL
+					AT_TRACE(j, AT_TRACE_DIR_RX, atbuf + count - readcount, readcount);
+					LOGD("[READER MUX]: channel%d handle %d bytes", j, (int)count);
+#else
+					AT_TRACE(0xFF, AT_TRACE_DIR_RX, atbuf + count - readcount, readcount);
+					LOGD("[READER]: handle %d bytes", (int)count);
+#endif
 
 #ifdef GSM_MUX_CHANNEL
 					if((j + 1) == RIL_CHANNEL_URC)	//随时相应的，比如短信，电话打入
@@ -1100,18 +1231,6 @@ static void * readerLoop(void *arg)
 #endif
 
 						while (count > 0) {
-
-#ifdef GSM_MUX_CHANNEL
-							memcpy(&urcbuf[urcbufLen], pcur, count);
-							pcur = urcbuf;
-#endif
-
-							memset(tempbuf, 0, sizeof(tempbuf));
-							for (i = 0; i < count && i < sizeof(tempbuf) / 3; i++) {
-								sprintf(tempbuf + i * 3, "%02x ", pcur[i]);
-							}
-							LOGD("[READER]: handle %d bytes: %s", count, tempbuf);
-
 							// skip over leading newlines //
 							SKIPCRLF(pcur, count);
 
@@ -1129,12 +1248,7 @@ static void * readerLoop(void *arg)
 								flag = rev;
 #endif
 							} else if (rev == 0x00) {
-								LOGD("[READER]: not whole AT data");
-								memset(tempbuf, 0, sizeof(tempbuf));
-								for (i = 0; i < count && i < sizeof(tempbuf) / 3; i++) {
-									sprintf(tempbuf + i * 3, "%02x ", pcur[i]);
-								}
-								LOGD("[READER]: residual %d bytes: %s", count, tempbuf);
+								LOGD("[READER]: not whole AT data, residual %d bytes", (int)count);
 								memmove(atbuf, pcur, count);
 								break;
 							} else {
@@ -1158,23 +1272,13 @@ static void * readerLoop(void *arg)
 								// till next call to 'getATFlag()' hence making a copy of line
 								// before calling getATFlag() again.
 								smsprefix = strdup(pcur);
-
-#ifdef GSM_MUX_CHANNEL
-								memset(urcbuf, 0x00, len);
-								urcbufLen = 0x00;
-#endif
-
 							} else if (smsprefix) {
+								at_stats_unsol(smsprefix);
 								if (s_unsolHandler != NULL) {
 									s_unsolHandler(smsprefix, pcur);
 								}
 								free(smsprefix);
 								smsprefix = NULL;
-
-#ifdef GSM_MUX_CHANNEL
-								memset(urcbuf, 0x00, len);
-								urcbufLen = 0x00;
-#endif
 							}
 
 #ifndef GSM_MUX_CHANNEL
@@ -1188,11 +1292,6 @@ static void * readerLoop(void *arg)
 #endif
 							{
 								handleUnsolicited(pcur);
-
-#ifdef GSM_MUX_CHANNEL
-								memset(urcbuf, 0x00, len);
-								urcbufLen = 0x00;
-#endif
 							}
 
 							// normal AT cmd //
@@ -1202,6 +1301,14 @@ static void * readerLoop(void *arg)
 								int prelen = sizeof(prefix);
 								int wholelen = prelen + len + prelen - 1;
 
+								if (at_buf_reserve(&s_readerLine, wholelen) < 0) {
+									LOGE("[READER]: drop %d bytes for PIPE(%d)", wholelen, flag - 1);
+									count -= len;
+									pcur += len;
+									continue;
+								}
+								atdata = s_readerLine.data;
+
 								memcpy(atdata, prefix, prelen);
 								memcpy(atdata + prelen, pcur, len - 1);
 								memcpy(atdata + prelen + len - 1, prefix, prelen);
@@ -1228,22 +1335,30 @@ static void * readerLoop(void *arg)
 								}
 								LOGD("[READER]: written %d bytes to PIPE(%d)", 
 										writecount, flag - 1);
+								at_buf_trim(&s_readerLine);
 							} 
 
 							count -= len;
 							pcur += len;
 						}
 
+						// a huge URC is over //
+						if (count == 0) at_buf_trim(&s_readerBuf);
+
 #ifdef GSM_MUX_CHANNEL
 					}// end if((i + 1) == RIL_CHANNEL_URC)
 					// normal AT cmd //
 					else {
 						int writecount = 0;
 
-						LOGD("[READER]: write %d bytes to PIPE(%d)", count, j);
-						while (writecount < count) {
+						// only what was just read, a partial URC may precede it //
+						pcur = atbuf + count - readcount;
+						count -= readcount;
+
+						LOGD("[READER]: write %d bytes to PIPE(%d)", readcount, j);
+						while (writecount < readcount) {
 							do {	//将数据写入管道 
-								rev = write(fd_ReqWrite[j], pcur + writecount, count - writecount);
+								rev = write(fd_ReqWrite[j], pcur + writecount, readcount - writecount);
 							} while (rev < 0 && errno == EINTR);
 
 							if (rev < 0) {
@@ -1256,7 +1371,6 @@ static void * readerLoop(void *arg)
 
 							writecount += rev;
 						}
-						count = 0x00;
 						//LOGD("[READER]: written %d bytes to PIPE(%d)", writecount, j);
 					}
 #endif
@@ -1367,7 +1481,6 @@ static int writeline(const char *s, const int cmdlen, int cid)
     size_t cur = 0;
     size_t len = 0;
     ssize_t written;
-    int i = 0;
     char * buf = NULL;
 
     if ( cmdlen <= 0 )
@@ -1412,12 +1525,8 @@ static int writeline(const char *s, const int cmdlen, int cid)
 #else
     LOGD("[REQ%d]: AT> %s\n", cid, buf);
     AT_DUMP(">> ", buf, len);
-    memset(s_at_dump_buff_w[cid], 0, sizeof(s_at_dump_buff_w[cid]));
-    for (i = 0; i < len && i < sizeof( s_at_dump_buff_w[cid]) / 3; i++) {
-        sprintf( s_at_dump_buff_w[cid] + i * 3, "%02x ", buf[i] );
-    }
-    LOGD("[REQ%d]: send at data: %s", cid, s_at_dump_buff_w[cid]);
 #endif
+    AT_TRACE(cid, AT_TRACE_DIR_TX, buf, len);
 
     while (cur < len) {
         do {
@@ -1463,7 +1572,7 @@ static int writeCtrlZ(const char *s, int cid)
     len = 1 + strlen(s) + 1;
     buf = (char *)malloc(len);
     memset(buf, 0, len);
-    buf[0] = cid;
+    buf[0] = cid + 1; // channel id is 1-9 in BB side //
     memcpy(buf + 1, s, strlen(s));
     buf[len - 1] = '\032';
 
@@ -1477,14 +1586,15 @@ static int writeCtrlZ(const char *s, int cid)
 
 #endif
 
-    LOGD("[REQ%d]: AT> %s", cid - 1, buf);
+    LOGD("[REQ%d]: AT> %s", cid, buf);
     AT_DUMP(">* ", buf, len);
+    AT_TRACE(cid, AT_TRACE_DIR_TX, buf, len);
 
     /* the main string */
     while (cur < len) {
         do {
 #ifdef GSM_MUX_CHANNEL
-            written = write(v_fds[RIL_CHANNEL_SMS - 1], buf + cur, len - cur);
+            written = write(v_fds[cid], buf + cur, len - cur);
 #else
             written = write(s_fd, buf + cur, len - cur);
 #endif
@@ -1534,6 +1644,48 @@ int at_open( int fd , ATUnsolHandler h )
     s_unsolHandler = h;
     s_readerClosed = 0;
 
+    at_trace_init();
+    at_scan_init();
+    initLineMatcher();
+    at_timeout_init();
+    at_stats_init();
+    at_cache_init();
+    at_buf_init();
+    initBatch();
+    at_urc_start();
+    at_signal_init();
+    at_reg_init();
+    at_plmn_init();
+    // the modem may have moved while the channel was down //
+    at_pdp_invalidate("channel open");
+
+    for (i = 0; i < RIL_CHANNELS; i++) {
+        snprintf(s_ATBufferName[i], sizeof(s_ATBufferName[i]), "ch%d", i);
+        if (at_buf_open(&s_ATBuffer[i], s_ATBufferName[i]) < 0) {
+            LOGE("at_open: no memory for channel %d buffer", i);
+            return -1;
+        }
+    }
+    if (at_buf_open(&s_readerBuf, "reader") < 0
+            || at_buf_open(&s_readerLine, "reader line") < 0) {
+        LOGE("at_open: no memory for reader buffers");
+        return -1;
+    }
+    i = 0;
+
+    if (!s_wakeReady) {
+        for (i = 0; i < RIL_CHANNELS; i++) {
+            if (pipe(s_wakePipe[i]) < 0) {
+                LOGE("at_open: wake pipe %d failed(%d)", i, errno);
+                return -1;
+            }
+            fcntl(s_wakePipe[i][0], F_SETFL, O_NONBLOCK);
+            fcntl(s_wakePipe[i][1], F_SETFL, O_NONBLOCK);
+        }
+        s_wakeReady = 1;
+        i = 0;
+    }
+
     //s_responsePrefix = NULL;
     //s_smsPDU = NULL;
     //sp_response = NULL;
@@ -1588,6 +1740,9 @@ int at_open( int fd , ATUnsolHandler h )
         return -1;
     }
 
+    // every channel handshakes on its own, see at_wait_channel_ready() //
+    startHandshake();
+
     return 0;
 }
 
@@ -1615,6 +1770,8 @@ void at_close( )
 
 void at_close()
 {
+    at_timeout_save();
+
 #ifdef GSM_MUX_CHANNEL
     int i;
     for (i = 0 ; i < RIL_CHANNELS; i++)
@@ -1665,6 +1822,25 @@ void at_response_free(ATResponse *p_response)
     free(p_response);
 }
 
+int at_response_parse(ATResponse *p_response, const ATLayout *layout,
+        void *out, size_t stride, int max, ATTokError *p_err)
+{
+    ATLine *p_cur;
+    int n = 0;
+
+    if (p_response == NULL) return 0;
+
+    for (p_cur = p_response->p_intermediates; p_cur != NULL && n < max;
+            p_cur = p_cur->p_next, n++) {
+        if (at_tok_parse(p_cur->line, layout, (char *)out + n * stride, p_err) < 0) {
+            if (p_err != NULL) p_err->line = n;
+            return -1;
+        }
+    }
+
+    return n;
+}
+
 void at_request_free(ATRequest * p_request)
 {
     if (p_request != NULL) {
@@ -1798,6 +1974,82 @@ static int at_send_command_full_nolock( const char *command, const int cmdlen,
 
 // End modify //
 
+/**
+ * writes the abort of channel cid's abandoned command and a fence behind
+ * it, the next command drains up to the fence answer first
+ * graceMsec: time the abandoned command may still take to answer
+ */
+static void abandonCommand(int cid, int abortType, long long graceMsec)
+{
+    char cmd[32];
+    int fence = FENCE_BASE + s_seq[cid] % FENCE_RANGE;
+
+    pthread_mutex_lock(&s_commandmutex);
+    if (abortType != AT_ABORT_NONE) {
+        snprintf(cmd, sizeof(cmd), "AT^SAOC=%d", abortType);
+        writeline(cmd, strlen(cmd), cid);
+    }
+    snprintf(cmd, sizeof(cmd), "AT^SUTEST=%d", fence);
+    if (writeline(cmd, strlen(cmd), cid) >= 0) {
+        s_fence[cid] = fence;
+        s_fenceUntil[cid] = at_stats_now() + graceMsec * 1000LL;
+    }
+    pthread_mutex_unlock(&s_commandmutex);
+
+    LOGI("[REQ%d]: command %u abandoned, fence %d", cid, s_seq[cid], s_fence[cid]);
+}
+
+/* drops the late output of an abandoned command up to its fence answer and its OK */
+static int drainFence(int cid)
+{
+    int n;
+    fd_set rfds;
+    struct timeval tv;
+    long long deadline = at_stats_now() + FENCE_TIMEOUT_MSEC * 1000LL;
+    ATRequest * request = at_request_new();
+    ATResponse * response = at_response_new();
+
+    // the fence answer queues behind the late answer of a learned timeout //
+    if (deadline < s_fenceUntil[cid] + FENCE_TIMEOUT_MSEC * 1000LL) {
+        deadline = s_fenceUntil[cid] + FENCE_TIMEOUT_MSEC * 1000LL;
+    }
+
+    request->type = NO_RESULT;
+    request->fence = s_fence[cid];
+
+    while (request->fence != 0 && s_readerClosed == 0) {
+        long long left = deadline - at_stats_now();
+
+        if (left <= 0) break;
+        tv.tv_sec = left / 1000000;
+        tv.tv_usec = left % 1000000;
+
+        FD_ZERO(&rfds);
+        FD_SET(fd_ReqRead[cid], &rfds);
+        n = select(fd_ReqRead[cid] + 1, &rfds, NULL, NULL, &tv);
+        if (n < 0 && errno != EINTR) break;
+        if (n > 0) readline(cid, request, response);
+    }
+
+    if (request->fence == 0) {
+        LOGI("[REQ%d]: fence %d reached, %d stale lines dropped",
+                cid, s_fence[cid], request->drained);
+        s_fence[cid] = 0;
+        n = 0;
+    } else {
+        // the channel is wedged, leave it to at_processTimeout() //
+        LOGE("[REQ%d]: fence %d not answered, %d lines dropped",
+                cid, s_fence[cid], request->drained);
+        s_fence[cid] = 0;
+        n = AT_ERROR_TIMEOUT;
+    }
+
+    at_request_free(request);
+    at_response_free(response);
+
+    return n;
+}
+
 static int at_send_command_full_nolock( const char *command, const int cmdlen, 
         ATCommandType type, const char *responsePrefix, const char *smspdu,
         long long timeoutMsec, ATResponse **pp_outResponse )
@@ -1805,37 +2057,69 @@ static int at_send_command_full_nolock( const char *command, const int cmdlen,
     int err = 0;
     int nfds = 0, n = 0;
     int cid = *(int *)pthread_getspecific(CID);
+    int abortable = s_abortable[cid];
+    int abortType = s_abortType[cid];
+    unsigned int seq;
+    char wake;
     fd_set rfds;
     struct timeval tv;
+    ATStatsStamp st;
     ATRequest * request = NULL;
     ATResponse * response = NULL;
+    // SMS PDU and 2 step commands wait on the network, keep caller's timeout //
+    int learnable = (smspdu == NULL && !is2stepATReq(command) && type != BATCHLINE);
+    long long requested;
+    int learned = 0;
+    int slot = TWO_STEP_SLOT(cid);
+
+    s_abortable[cid] = 0;
 
     // 2 step AT cmd like: +CMGS/+CMGW //
     pthread_mutex_lock(&s_2stepATMutex);
-    if (!s_2stepFinished) {
+    if (s_2stepBusy[slot]) {
         LOGD("[REQ%d]: wait for 2 step AT finished.", cid);
-        while (!s_2stepFinished) {
+        while (s_2stepBusy[slot]) {
             pthread_cond_wait(&s_2stepATCond, &s_2stepATMutex);
         }
         LOGD("[REQ%d]: signal coming 2 step AT finished.", cid);
-    } else if (is2stepATReq(command)) {
-        s_2stepFinished = 0;
+    }
+    if (is2stepATReq(command)) {
+        s_2stepBusy[slot] = 1;
         LOGD("[REQ%d]: begin to send 2 step AT command.", cid);
     }
     pthread_mutex_unlock(&s_2stepATMutex);
 
     s_Req[cid] = 1;
+
+    // late output of the last abandoned command must not be taken as ours //
+    if (s_fence[cid] != 0 && drainFence(cid) < 0) {
+        err = AT_ERROR_TIMEOUT;
+        goto error;
+    }
+
+    seq = ++s_seq[cid];
+    if (abortable) {
+        pthread_mutex_lock(&s_cancelMutex);
+        while (read(s_wakePipe[cid][0], &wake, 1) == 1);
+        s_inflight[cid] = seq;
+        pthread_mutex_unlock(&s_cancelMutex);
+    }
     
     // write AT data to VPIPE use mutex lock to keep line //
+    at_stats_begin(cid, &st);
+    st.writeUs = at_stats_now();
     pthread_mutex_lock(&s_commandmutex);
     err = writeline(command, cmdlen, cid);
     pthread_mutex_unlock(&s_commandmutex);
     if (err < 0) goto error;
+    st.writtenUs = at_stats_now();
     
     // to store AT data answer from BB or send from AP //
     request = at_request_new();
     response = at_response_new();
     request->egATLen = 0;
+    request->firstUs = 0;
+    request->intermUs = 0;
     request->type = type;
     request->smsPDU = smspdu;
     request->rspPrefix = responsePrefix;
@@ -1844,32 +2128,37 @@ static int at_send_command_full_nolock( const char *command, const int cmdlen,
     if (timeoutMsec == 0) {
         timeoutMsec = CYIT_DEFAULT_AT_TIMEOUT_MSEC;
     }
+    requested = timeoutMsec;
+    if (learnable) {
+        timeoutMsec = at_timeout_get(command, timeoutMsec, &learned);
+    }
     tv.tv_sec = timeoutMsec / 1000;
     tv.tv_usec = timeoutMsec % 1000 * 1000;
 
 	/*
 	 * 等待在对应的管道上，知道有回应数据出现
 	 */
-    // initialize fd set //
-    FD_ZERO(&rfds);
-    FD_SET(fd_ReqRead[cid], &rfds);
-    nfds = fd_ReqRead[cid] + 1;
-
     // wait until AT data answer from BB or time out or error occur //
     while (response->finalResponse == NULL && s_readerClosed == 0) {
-        if(cid == 3){
-            if(s_stepFlag != 2 && !s_2stepFinished){
+        // prompts come at once, only the network answer takes time //
+        if(smspdu != NULL){
+            if(s_stepFlag[cid] != 2){
                 tv.tv_sec = CYIT_MIN_AT_TIMEOUT_IMMEDIATE / 1000;
                 tv.tv_usec = CYIT_MIN_AT_TIMEOUT_IMMEDIATE % 1000 * 1000;
-            }else if(s_stepFlag == 2 && s_2stepFinished){
-                tv.tv_sec = CYIT_AT_TIMEOUT_70_SEC / 1000;
-                tv.tv_usec = CYIT_AT_TIMEOUT_70_SEC % 1000 * 1000;
             }else{
-                LOGE("[REQ3]Send SMS procedure MUST BE ERROR!!!\n");
-                LOGE("[REQ3]s_stepFlag = %d, s_2stepFinished = %d\n" , s_stepFlag, s_2stepFinished);
+                tv.tv_sec = timeoutMsec / 1000;
+                tv.tv_usec = timeoutMsec % 1000 * 1000;
             }
         }
 
+        FD_ZERO(&rfds);
+        FD_SET(fd_ReqRead[cid], &rfds);
+        nfds = fd_ReqRead[cid] + 1;
+        if (abortable) {
+            FD_SET(s_wakePipe[cid][0], &rfds);
+            if (s_wakePipe[cid][0] >= nfds) nfds = s_wakePipe[cid][0] + 1;
+        }
+
         n = select(nfds, &rfds, NULL, NULL, &tv);
 
         if (n < 0) {
@@ -1878,11 +2167,45 @@ static int at_send_command_full_nolock( const char *command, const int cmdlen,
             goto error;
             continue;
         } else if (n == 0) {
-            LOGD("[REQ%d]: ###AT Time Out!###", cid);
+            if (learned) {
+                LOGE("[REQ%d]: ###AT Time Out!### %s silent over learned %lld ms, assume hang",
+                        cid, command, timeoutMsec);
+            } else {
+                LOGD("[REQ%d]: ###AT Time Out!###", cid);
+            }
+            if (learnable) {
+                at_timeout_record(command, (at_stats_now() - st.writeUs) / 1000, 1, learned);
+            }
+            at_stats_command(cid, command, &st, 1);
+            if (abortable) {
+                abandonCommand(cid, abortType, 0);
+            } else if (learned) {
+                // a slow answer is no hang, keep the caller's budget for it //
+                abandonCommand(cid, AT_ABORT_NONE, requested - timeoutMsec);
+            }
             err = AT_ERROR_TIMEOUT;
             goto error;
-        } else {
+        } else if (FD_ISSET(fd_ReqRead[cid], &rfds)) {
             readline(cid, request, response);
+        } else if (abortable && s_cancelSeq[cid] == seq) {
+            LOGI("[REQ%d]: %s cancelled", cid, command);
+            at_stats_command(cid, command, &st, 1);
+            abandonCommand(cid, abortType, 0);
+            err = AT_ERROR_CANCELLED;
+            goto error;
+        } else {
+            // stale wake up of an earlier command //
+            while (read(s_wakePipe[cid][0], &wake, 1) == 1);
+        }
+    }
+
+    if (response->finalResponse != NULL) {
+        st.finalUs = at_stats_now();
+        st.firstUs = request->firstUs;
+        st.intermUs = request->intermUs;
+        at_stats_command(cid, command, &st, 0);
+        if (learnable) {
+            at_timeout_record(command, (st.finalUs - st.writeUs) / 1000, 0, 0);
         }
     }
 
@@ -1904,18 +2227,22 @@ static int at_send_command_full_nolock( const char *command, const int cmdlen,
 
 error:
 
-    if(cid == 3){
-        s_stepFlag = 0;
+    if (abortable) {
+        pthread_mutex_lock(&s_cancelMutex);
+        s_inflight[cid] = 0;
+        pthread_mutex_unlock(&s_cancelMutex);
     }
 
+    s_stepFlag[cid] = 0;
+
     s_Req[cid] = 0;
     at_request_free(request);
     at_response_free(response);
-    if (is2stepATReq(command) && !s_2stepFinished) {
+    if (is2stepATReq(command) && s_2stepBusy[slot]) {
         if(err != AT_ERROR_TIMEOUT){
             LOGD("[REQ%d]: 2 step AT command failed, begin to release mutex", cid);
             pthread_mutex_lock(&s_2stepATMutex);
-            s_2stepFinished = 1;
+            s_2stepBusy[slot] = 0;
             pthread_cond_broadcast(&s_2stepATCond);
             pthread_mutex_unlock(&s_2stepATMutex);
             LOGD("[REQ%d]: 2 step AT command failed, release mutex", cid);
@@ -1942,16 +2269,25 @@ static int at_send_command_full( const char *command , ATCommandType type ,
         return AT_ERROR_INVALID_THREAD;
     }
 
+    if (smspdu == NULL && type != NO_RESULT && type != BATCHLINE
+            && at_cache_lookup(command, strlen(command), type, pp_outResponse)) {
+        return 0;
+    }
+
     // Modified by dxy 2011-4-7 //
     err = at_send_command_full_nolock( command, strlen( command ), 
             type, responsePrefix, smspdu,
             timeoutMsec, pp_outResponse );
     // End mofidy //
 
+    if (err == 0 && smspdu == NULL && pp_outResponse != NULL) {
+        at_cache_store(command, strlen(command), type, *pp_outResponse);
+    }
+
     at_processTimeout(err, smspdu);
 
 #ifndef USE_CYIT_COMMANDS
-    if (err == AT_ERROR_TIMEOUT && s_onTimeout != NULL)
+    if (err == AT_ERROR_TIMEOUT && s_fence[cid] == 0 && s_onTimeout != NULL)
     {
         s_onTimeout();
     }
@@ -1961,6 +2297,57 @@ static int at_send_command_full( const char *command , ATCommandType type ,
 }
 
 
+int at_send_command_abortable( const char * command ,
+        ATCommandType type , const char * responsePrefix ,
+        ATResponse ** pp_outResponse , long long timeout , int abortType )
+{
+    int err;
+    int cid = *(int *)pthread_getspecific(CID);
+
+    if (0 != pthread_equal(s_tid_reader, pthread_self())) {
+        /* cannot be called from reader thread */
+        return AT_ERROR_INVALID_THREAD;
+    }
+
+    s_abortable[cid] = 1;
+    s_abortType[cid] = abortType;
+    err = at_send_command_full_nolock( command, strlen( command ),
+            type, responsePrefix, NULL, timeout, pp_outResponse );
+
+    at_processTimeout(err, NULL);
+
+    if ( err == 0 && pp_outResponse != NULL && type == SINGLELINE
+            && ( *pp_outResponse )->success > 0
+            && ( *pp_outResponse )->p_intermediates == NULL )
+    {
+        /* successful command must have an intermediate response */
+        at_response_free( *pp_outResponse );
+        *pp_outResponse = NULL;
+        return AT_ERROR_INVALID_RESPONSE;
+    }
+
+    return err;
+}
+
+int at_cancel_channel(int cid)
+{
+    int ret = -1;
+
+    if (cid < 0 || cid >= RIL_CHANNELS || !s_wakeReady) return -1;
+
+    pthread_mutex_lock(&s_cancelMutex);
+    if (s_inflight[cid] != 0) {
+        s_cancelSeq[cid] = s_inflight[cid];
+        if (write(s_wakePipe[cid][1], "c", 1) == 1) ret = 0;
+    }
+    pthread_mutex_unlock(&s_cancelMutex);
+
+    LOGD("[REQ%d]: cancel %s", cid, ret == 0 ? "posted" : "found nothing in flight");
+
+    return ret;
+}
+
+
 int at_send_command_timeout_poll( const char * command , unsigned char commandtype ,
         const char * responsePrefix , ATResponse ** pp_outResponse ,
         long long timeout, int pollNum )
@@ -2152,12 +2539,20 @@ int at_send_egcmd_singleline( const char *command, const int cmdlen,
         return AT_ERROR_INVALID_THREAD;
     }
 
+    if (at_cache_lookup(command, cmdlen, EGATCMD, pp_outResponse)) {
+        return 0;
+    }
+
     err = at_send_command_full_nolock( command, cmdlen, 
             EGATCMD, responsePrefix, NULL, 
             CYIT_MIN_AT_TIMEOUT_IMMEDIATE, pp_outResponse );
 
     at_processTimeout(err, NULL);
 
+    if (err == 0 && pp_outResponse != NULL) {
+        at_cache_store(command, cmdlen, EGATCMD, *pp_outResponse);
+    }
+
     if ( err == 0 && pp_outResponse != NULL && ( *pp_outResponse )->success > 0
             && ( *pp_outResponse )->p_intermediates == NULL )
     {
@@ -2171,6 +2566,127 @@ int at_send_egcmd_singleline( const char *command, const int cmdlen,
 }
 // End add //
 
+// an engineering command this size or less is encoded on the stack //
+#define EG_STACK_CMD    256
+
+// "AT*" + <crnum> //
+#define EG_HEADER_LEN   4
+
+// <crpos> is one byte: 1 based position + 0x0D //
+#define EG_MAX_CR_POS   (0xFF - 0x0D)
+
+int at_eg_encode(unsigned short fc, const void *payload, unsigned int len,
+        unsigned char *out, unsigned int size)
+{
+    const unsigned char *src = (const unsigned char *)payload;
+    unsigned char fcBytes[M_EGFC_LEN];
+    unsigned char *pos, *body;
+    unsigned int i, num = 0, total = M_EGFC_LEN + len;
+
+    // same byte order as the (unsigned char *)&fc callers always sent //
+    memcpy(fcBytes, &fc, M_EGFC_LEN);
+
+    for (i = 0; i < total; i++) {
+        unsigned char c = (i < M_EGFC_LEN) ? fcBytes[i] : src[i - M_EGFC_LEN];
+
+        if (c == 0x0D) {
+            if (i + 1 > EG_MAX_CR_POS) {
+                LOGE("at_eg_encode: fc 0x%x, <CR> at %u can not be escaped", fc, i);
+                return -1;
+            }
+            num++;
+        }
+    }
+
+    if (EG_HEADER_LEN + num + total > size) return -1;
+
+    memcpy(out, "AT*", 3);
+    // 13 <CR>s would read as a <CR> itself //
+    out[3] = (num == 0x0D) ? 0xFB : num;
+    pos = out + EG_HEADER_LEN;
+    body = pos + num;
+
+    for (i = 0; i < total; i++) {
+        unsigned char c = (i < M_EGFC_LEN) ? fcBytes[i] : src[i - M_EGFC_LEN];
+
+        if (c == 0x0D) {
+            *pos++ = i + 1 + 0x0D;
+            c = 0x0C;
+        }
+        body[i] = c;
+    }
+
+    return EG_HEADER_LEN + num + total;
+}
+
+int at_send_egcmd_binary(unsigned short fc, const void *payload,
+        unsigned int len, const char *responsePrefix,
+        ATResponse **pp_outResponse)
+{
+    unsigned char stackCmd[EG_STACK_CMD];
+    unsigned char *cmd = stackCmd;
+    unsigned int total = M_EGFC_LEN + len;
+    unsigned int size = EG_HEADER_LEN + (total < EG_MAX_CR_POS ? total : EG_MAX_CR_POS) + total;
+    int cmdlen, err;
+
+    if (size > sizeof(stackCmd)) {
+        cmd = (unsigned char *)malloc(size);
+        if (cmd == NULL) return AT_ERROR_GENERIC;
+    }
+
+    cmdlen = at_eg_encode(fc, payload, len, cmd, size);
+    if (cmdlen < 0) {
+        err = AT_ERROR_INVALID_CMD;
+    } else if (responsePrefix != NULL) {
+        err = at_send_egcmd_singleline((const char *)cmd, cmdlen,
+                responsePrefix, pp_outResponse);
+    } else {
+        err = at_send_egcmd((const char *)cmd, cmdlen, pp_outResponse);
+    }
+
+    if (cmd != stackCmd) free(cmd);
+
+    return err;
+}
+
+int at_eg_frame(const ATResponse *p_response, ATEgFrame *p_frame)
+{
+    const ATLine *p_line;
+    unsigned short len;
+
+    if (p_response == NULL || p_response->p_intermediates == NULL) return -1;
+
+    p_line = p_response->p_intermediates;
+    if (p_line->len < M_EGPREFIX_LEN + M_EGFC_LEN + M_EGDATA_LEN) return -1;
+
+    memcpy(&p_frame->fc, p_line->line + M_EGPREFIX_LEN, M_EGFC_LEN);
+    memcpy(&len, p_line->line + M_EGPREFIX_LEN + M_EGFC_LEN, M_EGDATA_LEN);
+    if (len != p_line->len - (M_EGPREFIX_LEN + M_EGFC_LEN + M_EGDATA_LEN)) {
+        LOGE("at_eg_frame: fc 0x%x says %u bytes, got %d", p_frame->fc, len,
+                p_line->len - (M_EGPREFIX_LEN + M_EGFC_LEN + M_EGDATA_LEN));
+        return -1;
+    }
+    p_frame->len = len;
+    p_frame->data = (const unsigned char *)p_line->line
+            + M_EGPREFIX_LEN + M_EGFC_LEN + M_EGDATA_LEN;
+
+    return 0;
+}
+
+unsigned int at_eg_u8(const ATEgFrame *p_frame, unsigned int offset)
+{
+    if (offset + 1 > p_frame->len) return 0;
+
+    return p_frame->data[offset];
+}
+
+unsigned int at_eg_u16(const ATEgFrame *p_frame, unsigned int offset)
+{
+    if (offset + 2 > p_frame->len) return 0;
+
+    return p_frame->data[offset] | (p_frame->data[offset + 1] << 8);
+}
+
 int at_send_command_numeric( const char *command , ATResponse **pp_outResponse )
 {
     int err;
@@ -2255,6 +2771,212 @@ int at_send_command_multiline_min_timeout( const char *command ,
 }
 
 
+/*
+ * Command batching
+ *
+ * Only commands in s_batchAllowed are joined: queries and format
+ * setters that change nothing when repeated and whose answers carry a
+ * prefix. An entry ending with ',' matches any argument after it, other
+ * entries must match the whole command.
+ *
+ * Intermediates go back to the items in order: a line belongs to the
+ * first item not yet served whose prefix it has, so "+COPS?" asked three
+ * times gets its three answers in turn. An ERROR does not tell which
+ * command failed, the items of that line are then sent one by one.
+ */
+#define AT_BATCH_PROP       "persist.ril.at.batch"  /* 0/1, default 1 */
+#define AT_BATCH_MAX_ITEMS  8
+#define AT_BATCH_MAX_LINE   200
+
+static const char * s_batchAllowed[] = {
+    "AT+CSQ",
+    "AT+CREG?",
+    "AT+CGREG?",
+    "AT+COPS?",
+    "AT+COPS=3,",
+    "AT+CGATT?",
+    "AT+CFUN?",
+    "AT+CPIN?",
+};
+
+static int s_batchEnabled = 1;
+
+static void initBatch(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(AT_BATCH_PROP, value, "1");
+    s_batchEnabled = (atoi(value) != 0);
+}
+
+static int isBatchable(const ATBatchItem *item)
+{
+    size_t i, n;
+
+    if (!s_batchEnabled || item->command == NULL) return 0;
+    if (item->type != NO_RESULT && item->responsePrefix == NULL) return 0;
+    if (item->type != NO_RESULT && item->type != SINGLELINE
+            && item->type != MULTILINE) return 0;
+
+    for (i = 0; i < NUM_ELEMS(s_batchAllowed); i++) {
+        n = strlen(s_batchAllowed[i]);
+        if (s_batchAllowed[i][n - 1] == ',' ?
+                strncmp(item->command, s_batchAllowed[i], n) == 0 :
+                strcmp(item->command, s_batchAllowed[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void sendBatchItem(ATBatchItem *item, long long timeoutMsec)
+{
+    item->err = at_send_command_full(item->command, item->type,
+            item->responsePrefix, NULL, timeoutMsec, item->pp_outResponse);
+
+    if (item->err == 0 && item->type == SINGLELINE && item->pp_outResponse != NULL
+            && (*item->pp_outResponse)->success > 0
+            && (*item->pp_outResponse)->p_intermediates == NULL) {
+        /* successful command must have an intermediate response */
+        at_response_free(*item->pp_outResponse);
+        *item->pp_outResponse = NULL;
+        item->err = AT_ERROR_INVALID_RESPONSE;
+    }
+}
+
+/* sends items[0..count) as one line, falls back to one by one on ERROR */
+static int sendBatchLine(ATBatchItem *items, int count, long long timeoutMsec)
+{
+    char line[AT_BATCH_MAX_LINE + 1];
+    char prefixes[AT_BATCH_MAX_LINE + 1];
+    ATResponse *p_response = NULL;
+    ATResponse *outs[AT_BATCH_MAX_ITEMS];
+    ATLine *p_line, *p_next;
+    ATLine **tails[AT_BATCH_MAX_ITEMS];
+    int pos = 0, plen = 0;
+    int i, err;
+
+    line[0] = '\0';
+    prefixes[0] = '\0';
+    for (i = 0; i < count; i++) {
+        // "AT" only once, the others follow as ";+CMD" //
+        pos += snprintf(line + pos, sizeof(line) - pos, "%s%s",
+                i == 0 ? "" : ";", i == 0 ? items[i].command : items[i].command + 2);
+        if (items[i].type != NO_RESULT) {
+            plen += snprintf(prefixes + plen, sizeof(prefixes) - plen, "%s%s",
+                    plen == 0 ? "" : "\n", items[i].responsePrefix);
+        }
+    }
+
+    err = at_send_command_full(line, BATCHLINE, prefixes, NULL, timeoutMsec, &p_response);
+    if (err < 0) {
+        for (i = 0; i < count; i++) items[i].err = err;
+        at_response_free(p_response);
+        return err;
+    }
+
+    if (p_response->success == 0) {
+        LOGD("batch %s failed with %s, one by one", line, p_response->finalResponse);
+        at_response_free(p_response);
+        for (i = 0; i < count; i++) {
+            sendBatchItem(&items[i], timeoutMsec);
+            err = items[i].err;
+            if (err == AT_ERROR_TIMEOUT || err == AT_ERROR_CHANNEL_CLOSED) {
+                for (i++; i < count; i++) items[i].err = err;
+                return err;
+            }
+        }
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        outs[i] = at_response_new();
+        outs[i]->success = 1;
+        outs[i]->finalResponse = strdup(p_response->finalResponse);
+        tails[i] = &outs[i]->p_intermediates;
+    }
+
+    // hand the lines over in order, see above //
+    p_line = p_response->p_intermediates;
+    p_response->p_intermediates = NULL;
+    for (; p_line != NULL; p_line = p_next) {
+        p_next = p_line->p_next;
+        p_line->p_next = NULL;
+
+        for (i = 0; i < count; i++) {
+            if (items[i].type == NO_RESULT
+                    || !strStartsWith(p_line->line, items[i].responsePrefix)) continue;
+            if (items[i].type == SINGLELINE && outs[i]->p_intermediates != NULL) continue;
+            break;
+        }
+        if (i == count) {
+            free(p_line->line);
+            free(p_line);
+            continue;
+        }
+        *tails[i] = p_line;
+        tails[i] = &p_line->p_next;
+    }
+    at_response_free(p_response);
+
+    for (i = 0; i < count; i++) {
+        items[i].err = 0;
+        if (items[i].type == SINGLELINE && outs[i]->p_intermediates == NULL) {
+            items[i].err = AT_ERROR_INVALID_RESPONSE;
+        }
+        if (items[i].pp_outResponse != NULL && items[i].err == 0) {
+            *items[i].pp_outResponse = outs[i];
+        } else {
+            at_response_free(outs[i]);
+        }
+    }
+
+    return 0;
+}
+
+int at_send_command_batch(ATBatchItem *items, int count, long long timeoutMsec)
+{
+    int i = 0, n, len, err;
+
+    if (0 != pthread_equal(s_tid_reader, pthread_self())) {
+        /* cannot be called from reader thread */
+        return AT_ERROR_INVALID_THREAD;
+    }
+
+    for (n = 0; n < count; n++) {
+        items[n].err = 0;
+        if (items[n].pp_outResponse != NULL) *items[n].pp_outResponse = NULL;
+    }
+
+    while (i < count) {
+        // longest run of batchable items from i that fits one line //
+        n = 0;
+        len = 0;
+        while (i + n < count && n < AT_BATCH_MAX_ITEMS && isBatchable(&items[i + n])) {
+            len += strlen(items[i + n].command) + 1;
+            if (len > AT_BATCH_MAX_LINE) break;
+            n++;
+        }
+
+        if (n <= 1) {
+            sendBatchItem(&items[i], timeoutMsec);
+            err = items[i].err;
+            n = 1;
+        } else {
+            err = sendBatchLine(&items[i], n, timeoutMsec);
+        }
+
+        if (err == AT_ERROR_TIMEOUT || err == AT_ERROR_CHANNEL_CLOSED) {
+            for (i += n; i < count; i++) items[i].err = err;
+            return err;
+        }
+        i += n;
+    }
+
+    return 0;
+}
+
 /** This callback is invoked on the command thread */
 void at_set_on_timeout(void (*onTimeout)(void))
 {
@@ -2279,33 +3001,243 @@ void at_set_on_reader_closed(void (*onClose)(void))
  * Used to ensure channel has start up and is active
  */
 
-int at_handshake()
+/* discards late OKs of timed out handshakes, else they answer the next command */
+static void drainChannel(int cid)
 {
-    int i;
-    int err = 0;
+    char buf[256];
+    fd_set rfds;
+    struct timeval tv;
 
-    if (0 != pthread_equal(s_tid_reader, pthread_self())) {
-        /* cannot be called from reader thread */
-        return AT_ERROR_INVALID_THREAD;
+    for (;;) {
+        FD_ZERO(&rfds);
+        FD_SET(fd_ReqRead[cid], &rfds);
+        tv.tv_sec = 0;
+        tv.tv_usec = HANDSHAKE_DRAIN_MSEC * 1000;
+
+        if (select(fd_ReqRead[cid] + 1, &rfds, NULL, NULL, &tv) <= 0) break;
+        if (read(fd_ReqRead[cid], buf, sizeof(buf)) <= 0) break;
     }
 
-    for (i = 0 ; i < HANDSHAKE_RETRY_COUNT ; i++) {
-        // Modified by dxy CYIT 2011-4-7 //
+    s_ATBufferCur[cid] = s_ATBuffer[cid].data;
+    s_ATBufferLen[cid] = 0;
+}
+
+/* handshakes channel of the calling thread */
+static int handshakeChannel(int cid)
+{
+    int i;
+    int err = AT_ERROR_GENERIC;
+
+    for (i = 0 ; i < HANDSHAKE_RETRY_COUNT && s_readerClosed == 0 ; i++) {
         /* some stacks start with verbose off */
         err = at_send_command_full_nolock( "AT", strlen( "AT" ), NO_RESULT, NULL, NULL,
                 HANDSHAKE_TIMEOUT_MSEC, NULL );
-        // End modify //
 
         if (err == 0) {
             break;
         }
+
+        // write failed at once, keep the pacing anyway //
+        if (err != AT_ERROR_TIMEOUT) {
+            sleepMsec(HANDSHAKE_TIMEOUT_MSEC);
+        }
     }
 
     if (err == 0) {
-        /* pause for a bit to let the input buffer drain any unmatched OK's
-         (they will appear as extraneous unsolicited responses) */
+        drainChannel(cid);
+    }
+
+    return err;
+}
+
+/* msec since rild was started, -1 if unknown */
+static long long processAgeMsec(void)
+{
+    char buf[512];
+    char *p;
+    struct timespec now;
+    unsigned long long start;
+    int fd, n, i;
+
+    fd = open("/proc/self/stat", O_RDONLY);
+    if (fd < 0) return -1;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+
+    // comm may hold spaces, starttime is the 20th field after ')' //
+    p = strrchr(buf, ')');
+    for (i = 0; i < 20 && p != NULL; i++) {
+        p = strchr(p + 1, ' ');
+    }
+    if (p == NULL) return -1;
+    start = strtoull(p + 1, NULL, 10);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000
+            - (long long)(start * 1000 / sysconf(_SC_CLK_TCK));
+}
+
+static void markChannelReady(int cid, int ok)
+{
+    char value[PROPERTY_VALUE_MAX];
+    long long age = processAgeMsec();
+    int first = 0, all = 0;
+
+    pthread_mutex_lock(&s_readyMutex);
+    if (s_channelReady[cid] == 0) {
+        s_channelReady[cid] = ok ? 1 : -1;
+        s_channelsPending--;
+        all = (s_channelsPending == 0);
+        if (ok && !s_firstATDone) {
+            s_firstATDone = first = 1;
+        }
+    }
+    pthread_cond_broadcast(&s_readyCond);
+    pthread_mutex_unlock(&s_readyMutex);
+
+    if (!ok) {
+        LOGE("[REQ%d]: channel never answered handshake", cid);
+        return;
+    }
+
+    LOGI("[REQ%d]: channel ready %lld ms after rild start", cid, age);
+    at_stats_channel_ready(cid, age);
+
+    if (first) {
+        LOGI("time to first AT: %lld ms", age);
+        snprintf(value, sizeof(value), "%lld", age);
+        property_set("ril.at.first_at_ms", value);
+    }
+    if (all) {
+        LOGI("all AT channels up: %lld ms", age);
+        snprintf(value, sizeof(value), "%lld", age);
+        property_set("ril.at.all_ready_ms", value);
+    }
+}
+
+static void *handshakeLoop(void *arg)
+{
+    int cid = *(int *)arg;
+    int err;
+#ifndef GSM_MUX_CHANNEL
+    int i;
+#endif
+
+    // at_send_command_full_nolock() finds its channel through CID //
+    pthread_setspecific(CID, arg);
+    err = handshakeChannel(cid);
+    // libril's TSD destructor would free arg and delete the key //
+    pthread_setspecific(CID, NULL);
+
+#ifdef GSM_MUX_CHANNEL
+    markChannelReady(cid, err == 0);
+#else
+    // one tty behind all channels, its answer stands for every one //
+    for (i = 0; i < RIL_CHANNELS; i++) {
+        markChannelReady(i, err == 0);
+    }
+#endif
+
+    return NULL;
+}
+
+/**
+ * Handshakes all request channels in parallel, one thread each, so a
+ * channel is usable as soon as it answers instead of after the slowest.
+ * The URC channel is only read by the reader thread and is ready at once.
+ */
+static void startHandshake(void)
+{
+    pthread_attr_t attr;
+    pthread_t tid;
+    int i;
+
+    pthread_mutex_lock(&s_readyMutex);
+    s_firstATDone = 0;
+    s_channelsPending = 0;
+    for (i = 0; i < RIL_CHANNELS; i++) {
+        s_handshakeCid[i] = i;
+        s_channelReady[i] = (i == RIL_CHANNEL_URC - 1) ? 1 : 0;
+        if (s_channelReady[i] == 0) s_channelsPending++;
+    }
+    pthread_mutex_unlock(&s_readyMutex);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+#ifdef GSM_MUX_CHANNEL
+    for (i = 0; i < RIL_CHANNELS; i++) {
+        if (i == RIL_CHANNEL_URC - 1) continue;
+
+        if (pthread_create(&tid, &attr, handshakeLoop, &s_handshakeCid[i]) != 0) {
+            LOGE("[REQ%d]: create handshake thread failed(%d)", i, errno);
+            markChannelReady(i, 0);
+        }
+    }
+#else
+    i = RIL_CHANNEL_OTHERS - 1;
+    if (pthread_create(&tid, &attr, handshakeLoop, &s_handshakeCid[i]) != 0) {
+        LOGE("create handshake thread failed(%d)", errno);
+        for (i = 0; i < RIL_CHANNELS; i++) markChannelReady(i, 0);
+    }
+#endif
+
+    pthread_attr_destroy(&attr);
+}
+
+int at_channel_ready(int cid)
+{
+    if (cid < 0 || cid >= RIL_CHANNELS) return 0;
+
+    return s_channelReady[cid] > 0;
+}
+
+/**
+ * Waits until channel cid (0 based) finished its handshake.
+ * Returns 0 if it answered, -1 on timeout or if it never answered.
+ */
+int at_wait_channel_ready(int cid, long long timeoutMsec)
+{
+    int err = 0;
+#ifndef USE_NP
+    struct timespec ts;
+
+    setTimespecRelative(&ts, timeoutMsec);
+#endif
+
+    if (cid < 0 || cid >= RIL_CHANNELS) return -1;
 
-        sleepMsec(HANDSHAKE_TIMEOUT_MSEC);
+    pthread_mutex_lock(&s_readyMutex);
+    while (s_channelReady[cid] == 0 && err != ETIMEDOUT) {
+#ifdef USE_NP
+        err = pthread_cond_timeout_np(&s_readyCond, &s_readyMutex, timeoutMsec);
+#else
+        err = pthread_cond_timedwait(&s_readyCond, &s_readyMutex, &ts);
+#endif
+    }
+    err = s_channelReady[cid] > 0 ? 0 : -1;
+    pthread_mutex_unlock(&s_readyMutex);
+
+    return err;
+}
+
+/* handshakes the channel of the calling request thread again */
+int at_handshake()
+{
+    int err;
+    int cid = *(int *)pthread_getspecific(CID);
+
+    if (0 != pthread_equal(s_tid_reader, pthread_self())) {
+        /* cannot be called from reader thread */
+        return AT_ERROR_INVALID_THREAD;
+    }
+
+    err = handshakeChannel(cid);
+    if (err == 0) {
+        markChannelReady(cid, 1);
     }
 
     return err;
@@ -2352,13 +3284,21 @@ void at_processTimeout(int err, const char* smsPdu)
     int i = 0;
     int cid = *(int *)pthread_getspecific(CID);
 
+    // abandoned behind a fence, the channel recovers by itself, and only //
+    // a fence left unanswered by the next command is taken for a hang //
+    if (err == AT_ERROR_TIMEOUT && s_fence[cid] != 0) {
+        return;
+    }
+
     if(err == AT_ERROR_TIMEOUT && s_basebandReadyFlag){
         LOGD("at_processTimeout, cid = %d", cid);
-        if(cid == 3 && smsPdu && !s_2stepFinished){
+        if(smsPdu && s_2stepBusy[TWO_STEP_SLOT(cid)]){
             char endChar[1] = {0x1B};
 
             LOGD("at_processTimeout, send SMS step1 failed, begin to end the procedure");
-            s_2stepFinished = 1;
+            pthread_mutex_lock(&s_2stepATMutex);
+            s_2stepBusy[TWO_STEP_SLOT(cid)] = 0;
+            pthread_mutex_unlock(&s_2stepATMutex);
 
             err = at_send_command_full_nolock(
                     endChar, 1, NO_RESULT, NULL, NULL, CYIT_MIN_AT_TIMEOUT_IMMEDIATE, NULL);
@@ -2386,6 +3326,7 @@ void at_processTimeout(int err, const char* smsPdu)
                 if(i == 2){
                     LOGE("at_processTimeout ERROR!!!!! we going to recover procedure.\n");
                     FILE * psys = 0;
+                    at_cache_invalidate(AT_CACHE_EV_ALL);
                     if ((psys = fopen("/sys/devices/platform/c63xx_cp/command", "w")) != NULL){
                         fputs("3", psys);
                     }
@@ -19,6 +19,8 @@
 #ifndef ATCHANNEL_H
 #define ATCHANNEL_H 1
 
+#include "at_tok.h"
+
 #ifdef USE_MULT_AT_CHAN
 #define ATFLAGLEN 1
 #else
@@ -56,6 +58,9 @@ extern void  AT_DUMP(const char* prefix, const char*  buff, int  len);
 
 #define CYIT_AT_TIMEOUT_DEFAULT_POLL_NUM    3
 
+// longest a request waits for its channel handshake //
+#define CYIT_CHANNEL_READY_TIMEOUT_MSEC 3000
+
 #define CYIT_SAOC_TYPE_CALL             0x00
 #define CYIT_SAOC_TYPE_SS               0x01
 #define CYIT_SAOC_TYPE_SMS              0x02
@@ -79,6 +84,10 @@ extern void  AT_DUMP(const char* prefix, const char*  buff, int  len);
 // modify by CYIT 20110407 //
 
 #define AT_ERROR_INVALID_CMD -7 // Invalid AT cmd //
+#define AT_ERROR_CANCELLED -8 // at_cancel_channel() //
+
+// no AT^SAOC for at_send_command_abortable() //
+#define AT_ABORT_NONE -1
 
 #define M_EGPREFIX "^ENG:"
 #define M_EGPREFIX_LEN 5
@@ -175,6 +184,7 @@ typedef enum
         MULTILINE,      // multiple line intermediate response starting with a prefix //
         MULTISMS,       // sms operate //
         EGATCMD,        // "^ENG:" AT cmd //
+        BATCHLINE,      // at_send_command_batch(), prefixes joined by '\n' //
     } ATCommandType;
 
     /** a singly-lined list of intermediate responses */
@@ -200,6 +210,10 @@ typedef enum
         const char * rspPrefix;
         const char * smsPDU;
         int egATLen;
+        long long firstUs;  /* first byte back, for at_stats */
+        long long intermUs; /* first intermediate line */
+        int fence;          /* drop lines until "^SUTEST: <fence>" and its final response */
+        int drained;        /* lines dropped so */
     } ATRequest;
 
     /**
@@ -207,20 +221,14 @@ typedef enum
      * this will be called from the reader thread, so do not block
      * "s" is the line, and "sms_pdu" is either NULL or the PDU response
      * for multi-line TS 27.005 SMS PDU responses (eg +CMT:)
+     * "s" is in the caller's buffer, the handler may modify it (at_urc.h)
+     * until it returns
      */
     typedef void (*ATUnsolHandler)(const char *s, const char *sms_pdu);
 
     int at_open(int fd, ATUnsolHandler h);
     void at_close();
 
-    static int at_send_command_full_nolock( const char *command, const int cmdlen, 
-        ATCommandType type, const char *responsePrefix, const char *smspdu,
-        long long timeoutMsec, ATResponse **pp_outResponse );
-
-    static int at_send_command_full( const char *command , ATCommandType type ,
-        const char *responsePrefix , const char *smspdu ,
-        long long timeoutMsec , ATResponse **pp_outResponse );
-
     /* This callback is invoked on the command thread.
      You should reset or handshake here to avoid getting out of sync */
     void at_set_on_timeout(void (*onTimeout)(void));
@@ -250,8 +258,32 @@ typedef enum
     int at_send_command_multiline_min_timeout( const char *command ,
             const char *responsePrefix , ATResponse **pp_outResponse );
 
+    /**
+     * One command of at_send_command_batch(). type is NO_RESULT, SINGLELINE
+     * or MULTILINE; err and *pp_outResponse are filled in as the matching
+     * at_send_command_* would do.
+     */
+    typedef struct {
+        const char *command;
+        ATCommandType type;
+        const char *responsePrefix;
+        ATResponse **pp_outResponse;
+        int err;
+    } ATBatchItem;
+
+    /**
+     * Sends independent commands, joining the allowlisted ones into
+     * "AT+CSQ;+CREG?;..." lines. Returns 0 once every item has its result,
+     * or the error that stopped the channel.
+     */
+    int at_send_command_batch(ATBatchItem *items, int count, long long timeoutMsec);
+
     int at_handshake();
 
+    /* channel readiness, channels are handshaken in parallel by at_open() */
+    int at_channel_ready(int cid);
+    int at_wait_channel_ready(int cid, long long timeoutMsec);
+
     int at_send_command(const char *command, ATResponse **pp_outResponse);
     int at_send_command_min_timeout(const char *command, ATResponse **pp_outResponse);
     int at_send_command_timeout_poll( const char * command , unsigned char commandtype ,
@@ -265,6 +297,43 @@ typedef enum
         const char *responsePrefix, ATResponse **pp_outResponse );
     // modify by CYIT 20110407 ---- end ----- //
 
+    /**
+     * Encodes fc and payload as an "AT*" engineering command:
+     * "AT*" <crnum> <crpos>... <fc> <payload>, every 0x0D of fc and payload
+     * sent as 0x0C and its 1 based position + 0x0D listed in <crpos>.
+     * payload is not modified.
+     * returns the length written to out, or -1 if out is too small or a
+     * 0x0D lies beyond the last position a <crpos> byte can express
+     */
+    int at_eg_encode(unsigned short fc, const void *payload, unsigned int len,
+            unsigned char *out, unsigned int size);
+
+    /**
+     * Sends fc and payload as a binary engineering command, encoded in
+     * place without hex or intermediate copies. With responsePrefix
+     * (M_EGPREFIX or M_IFXPREFIX) one binary answer is expected.
+     */
+    int at_send_egcmd_binary(unsigned short fc, const void *payload,
+            unsigned int len, const char *responsePrefix,
+            ATResponse **pp_outResponse);
+
+    /* view of a binary "^ENG:"/"^IFX:" answer, data points into the response */
+    typedef struct {
+        unsigned short fc;
+        unsigned short len;
+        const unsigned char *data;
+    } ATEgFrame;
+
+    /**
+     * fills p_frame from the binary answer of p_response
+     * returns 0, or -1 if there is none or its length field is inconsistent
+     */
+    int at_eg_frame(const ATResponse *p_response, ATEgFrame *p_frame);
+
+    /* little endian fields of an ATEgFrame, 0 past its end */
+    unsigned int at_eg_u8(const ATEgFrame *p_frame, unsigned int offset);
+    unsigned int at_eg_u16(const ATEgFrame *p_frame, unsigned int offset);
+
     int at_send_command_sms(const char * command,
             const char * pdu,
             const char * responsePrefix,
@@ -275,11 +344,40 @@ typedef enum
             unsigned char commandtype , const char * responsePrefix ,
             ATResponse ** pp_outResponse , long long timeout );
 
+    /**
+     * at_send_command_timeout() for long commands (+COPS=?, SS queries)
+     * which at_cancel_channel() may interrupt from any thread.
+     *
+     * When cancelled (AT_ERROR_CANCELLED) or timed out, "AT^SAOC=<abortType>"
+     * (CYIT_SAOC_TYPE_*, or AT_ABORT_NONE) and a fence "AT^SUTEST=<n>" go
+     * out at once and the call returns. The next command of the channel
+     * first drops the late output up to the fence answer and the final
+     * response of the fence command, so nothing is misattributed and the
+     * channel needs no reset.
+     */
+    int at_send_command_abortable( const char * command ,
+            ATCommandType type , const char * responsePrefix ,
+            ATResponse ** pp_outResponse , long long timeout , int abortType );
+
+    /**
+     * cancels the at_send_command_abortable() command waiting on channel
+     * cid (0 based), returns 0 if there was one, -1 otherwise
+     */
+    int at_cancel_channel(int cid);
+
     int at_send_command_multiline_sms( const char *command ,
             const char *responsePrefix , ATResponse **pp_outResponse );
 
     void at_response_free(ATResponse *p_response);
 
+    /**
+     * at_tok_parse() of every intermediate line in one call, line n goes
+     * to out + n * stride, at most max lines
+     * returns the number of lines parsed or -1 on fail with *p_err set
+     */
+    int at_response_parse(ATResponse *p_response, const ATLayout *layout,
+            void *out, size_t stride, int max, ATTokError *p_err);
+
     typedef enum
     {
         CME_ERROR_NON_CME = -1,
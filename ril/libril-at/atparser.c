@@ -31,6 +31,15 @@
 #include "atchannel.h"
 #include "at_tok.h"
 #include "misc.h"
+#include "at_stats.h"
+#include "at_cache.h"
+#include "at_urc.h"
+#include "at_calls.h"
+#include "at_signal.h"
+#include "at_reg.h"
+#include "at_pdp.h"
+#include "at_net.h"
+#include "at_plmn.h"
 #include <getopt.h>
 #include <sys/socket.h>
 #include <cutils/sockets.h>
@@ -47,8 +56,7 @@
 #ifdef USE_RAWIP
 #include <sys/ioctl.h>
 #endif
-
-#define MAX_AT_RESPONSE 0x1000
+#include <net/if.h>
 
 /* pathname returned from RIL_REQUEST_SETUP_DATA_CALL / RIL_REQUEST_SETUP_DEFAULT_PDP */
 #define PPP_TTY_PATH "/dev/omap_csmi_tty1"
@@ -67,6 +75,11 @@
 #define WORKAROUND_FAKE_CGEV 1
 #endif
 
+#ifndef POLL_CALL_STATE
+// ^DSCI reports every call change, calls are answered from at_calls //
+#define USE_CALL_TABLE 1
+#endif
+
 /* Modem Technology bits */
 #define MDM_GSM         0x01
 //#define MDM_WCDMA       0x02
@@ -236,28 +249,32 @@ static int s_RingID = 0;
 // modify by CYIT 20120525 ----- end-----//
 #endif
 
-#define M_MAXNUM_PDP 2
+// data call slots, each one a cid with its own port //
+#define PDP_PROP_COUNT "persist.ril.pdp.count"
+#define PDP_DEF_COUNT 2
 
 typedef struct {
     int m_PID; // PDP id //
     char m_Port[10]; // PDP port //
-    int m_Used; // 0: unused; 1: used //
+    int m_Used; // 0: unused; 1: used; 2: being set up //
 } RIL_PS_Ctl;
 
-static RIL_PS_Ctl s_PSCtl[M_MAXNUM_PDP] = {
-
+// port of slot i is PDP_PORT_FORMAT with i //
 #ifdef USE_VM
-    {1, "veth0", 0}, 
-    {2, "veth1", 0},
+#define PDP_PORT_FORMAT "veth%d"
 #elif defined USE_PPP
-    {1, "ppp0", 0},
-    {2, "ppp1", 0},
+#define PDP_PORT_FORMAT "ppp%d"
 #elif defined USE_RAWIP
-    {1, "rmnet0", 0},
-    {2, "rmnet1", 0},
+#define PDP_PORT_FORMAT "rmnet%d"
 #endif
 
-};
+// s_PSCtl[pdpid - 1], set up by initPdpList() //
+static RIL_PS_Ctl *s_PSCtl = NULL;
+static int s_pdpNum = 0;
+// bit cid of the cids given to a secondary context by +CGDSCONT //
+static unsigned int s_2ndPdp = 0;
+// guards the slots and s_2ndPdp against data call list reads and +CGEV //
+static pthread_mutex_t s_pdpMutex = PTHREAD_MUTEX_INITIALIZER;
 
 #ifdef USE_RAWIP
 typedef struct {
@@ -267,26 +284,40 @@ typedef struct {
 
 int s_RawIP_Disc = 25; // N_RMNET defined in kernel //
 
+// tty of slot i is PDP_TTY_FORMAT with PDP_TTY_BASE + i * PDP_TTY_STEP //
 #ifdef GSM_MUX_CHANNEL
-RIL_PS_Tty s_Ttys[M_MAXNUM_PDP] = {
-    {"gsm0710mux.channel11", -1},
-    {"gsm0710mux.channel12", -1},
-};
+#define PDP_TTY_FORMAT "gsm0710mux.channel%d"
+#define PDP_TTY_BASE 11
+#define PDP_TTY_STEP 1
 #else
-RIL_PS_Tty s_Ttys[M_MAXNUM_PDP] = {
-    {"/dev/ttyUSB0", -1},
-    {"/dev/ttyUSB2", -1},
-};
+#define PDP_TTY_FORMAT "/dev/ttyUSB%d"
+#define PDP_TTY_BASE 0
+#define PDP_TTY_STEP 2
+#endif
+
+RIL_PS_Tty *s_Ttys = NULL;
+
+// the mux channel device may show up after the activation //
+#define PDP_TTY_TIMEOUT_MSEC 2000
 #endif
+
+#ifdef USE_PPP
+// pppd exit, was 10 x sleep(3) //
+#define PPP_STOP_TIMEOUT_MSEC 30000
+// pppd link up, was 10 x sleep(5) //
+#define PPP_UP_TIMEOUT_MSEC 50000
 #endif
 
 #define PDPID_MIN 1
 #define PDPID_MAX 11
 #define MAINPDPID_MIN 1
-#define MAINPDPID_MAX 2
 
 
 
+// request each channel is running, maps onCancel() to its channel //
+static RIL_Token s_curToken[RIL_CHANNELS];
+static pthread_mutex_t s_curTokenMutex = PTHREAD_MUTEX_INITIALIZER;
+
 static void onRequest (int request, void *data, size_t datalen, RIL_Token t);
 static RIL_RadioState currentState();
 static int onSupports (int requestCode);
@@ -301,9 +332,12 @@ static void onDataCallListChanged(void *param, RIL_Token t);
 /**************************************************************************
   Modified by CYIT 20120825 ----- start -----
 **************************************************************************/
+static void initPdpList(void);
 static void resetPdpList();
 static char * getPdpPort(char * PdpID);
-static int getUnUsedPdp();
+static int claimPdp(void);
+static void setPdpUsed(int pdpid, int used);
+static void refreshPdpUsed(int pdpid, int used);
 
 static void requestSetTEType( void * data , size_t datalen , RIL_Token t );
 static void requestGetTEType( void * data , size_t datalen , RIL_Token t );
@@ -363,26 +397,10 @@ static int isMainPdp(int pdpid);
 
 static void requestGetIMEISV( void * data , size_t datalen , RIL_Token t );
 
-typedef struct S_CRPos
-{
-    unsigned char m_pos;
-    struct S_CRPos *m_pnext;
-} T_CRPos;
-
 static unsigned char HandleBinaryStr( 
     char *prefixstr, 
     unsigned char *srcbinary, unsigned int srclen, 
     unsigned char **dstbinary, unsigned int *dstlen );
-/*
-static void GetCROfBinaryStr( 
-    unsigned char *srcbinary, int srclen, 
-    int *crnum, T_CRPos **crpos );
-    */
-
-static void GetCROfBinaryStr( 
-    unsigned char *srcbinary, int srclen, 
-    int *crnum, T_CRPos *crpos );
-
 static int HexStrToByteArray( char *Sour, unsigned int SourLen, 
     unsigned char *Dst, unsigned int DstLen );
 /**************************************************************************
@@ -439,8 +457,6 @@ static int          s_device_socket = 0;
 static int s_closed = 0;
 
 static int sFD;     /* file desc of AT channel */
-static char sATBuffer[MAX_AT_RESPONSE+1];
-static char *sATBufferCur = NULL;
 
 static const struct timeval TIMEVAL_SIMPOLL = {1,0};
 static const struct timeval TIMEVAL_CALLSTATEPOLL = {0,500000};
@@ -492,55 +508,88 @@ static int clccStateToRILState(int state, RIL_CallState *p_state)
  * Note: directly modified line and has *p_call point directly into
  * modified line
  */
-static int callFromCLCCLine(char *line, RIL_Call *p_call)
-{
-        //+CLCC: 1,0,2,0,0,\"+18005551212\",145
-        //     index,isMT,state,mode,isMpty(,number,TOA)?
-
-    int err;
+typedef struct {
+    int index;
+    char isMT;
     int state;
     int mode;
+    char isMpty;
+    char *number;
+    int toa;
+} CLCCLine;
+
+static const ATField s_clccFields[] = {
+    AT_FIELD(AT_FIELD_INT, CLCCLine, index),
+    AT_FIELD(AT_FIELD_BOOL, CLCCLine, isMT),
+    AT_FIELD(AT_FIELD_INT, CLCCLine, state),
+    AT_FIELD(AT_FIELD_INT, CLCCLine, mode),
+    AT_FIELD(AT_FIELD_BOOL, CLCCLine, isMpty),
+    AT_FIELD(AT_FIELD_STR | AT_FIELD_OPTIONAL, CLCCLine, number),
+    AT_FIELD(AT_FIELD_INT, CLCCLine, toa),
+};
+static const ATLayout s_clccLayout = AT_LAYOUT(s_clccFields);
+
+static const ATField s_dsciFields[] = {
+    AT_FIELD(AT_FIELD_INT, CLCCLine, index),
+    AT_FIELD(AT_FIELD_BOOL, CLCCLine, isMT),
+    AT_FIELD(AT_FIELD_INT, CLCCLine, state),
+    AT_FIELD(AT_FIELD_INT, CLCCLine, mode),
+    AT_FIELD(AT_FIELD_BOOL | AT_FIELD_OPTIONAL, CLCCLine, isMpty),
+    AT_FIELD(AT_FIELD_STR | AT_FIELD_OPTIONAL, CLCCLine, number),
+    AT_FIELD(AT_FIELD_INT | AT_FIELD_OPTIONAL, CLCCLine, toa),
+};
+static const ATLayout s_dsciLayout = AT_LAYOUT(s_dsciFields);
 
-    err = at_tok_start(&line);
-    if (err < 0) goto error;
-
-    err = at_tok_nextint(&line, &(p_call->index));
-    if (err < 0) goto error;
+/* parses a +CLCC or ^DSCI line into call */
+static int parseCallLine(char *line, const ATLayout *layout, ATCall *call)
+{
+    CLCCLine clcc;
+    ATTokError tokErr;
+    int err;
 
-    err = at_tok_nextbool(&line, &(p_call->isMT));
-    if (err < 0) goto error;
+    memset(&clcc, 0, sizeof(clcc));
+    err = at_tok_parse(line, layout, &clcc, &tokErr);
+    if (err < 0) {
+        LOGE("call field %s bad at column %d", tokErr.name, tokErr.column);
+        return -1;
+    }
 
-    err = at_tok_nextint(&line, &state);
-    if (err < 0) goto error;
+    memset(call, 0, sizeof(ATCall));
+    call->index = clcc.index;
+    call->isMT = clcc.isMT;
+    call->state = clcc.state;
+    call->mode = clcc.mode;
+    call->isMpty = clcc.isMpty;
+    call->toa = clcc.toa;
+    if (clcc.number != NULL) {
+        strncpy(call->number, clcc.number, AT_CALLS_NUMBER_LEN - 1);
+    }
 
-    err = clccStateToRILState(state, &(p_call->state));
-    if (err < 0) goto error;
+    return 0;
+}
 
-    err = at_tok_nextint(&line, &mode);
-    if (err < 0) goto error;
+/**
+ * Note: p_call->number points into call
+ */
+static int callFromATCall(ATCall *call, RIL_Call *p_call)
+{
+    int err;
 
-    p_call->isVoice = (mode == 0);
+    p_call->index = call->index;
+    p_call->isMT = call->isMT;
+    p_call->isMpty = call->isMpty;
+    p_call->isVoice = (call->mode == 0);
 
-    err = at_tok_nextbool(&line, &(p_call->isMpty));
+    err = clccStateToRILState(call->state, &(p_call->state));
     if (err < 0) goto error;
 
-    if (at_tok_hasmore(&line)) {
-        err = at_tok_nextstr(&line, &(p_call->number));
-
-        /* tolerate null here */
-        if (err < 0) return 0;
-
-        // Some lame implementations return strings
-        // like "NOT AVAILABLE" in the CLCC line
-        if (p_call->number != NULL
-            && 0 == strspn(p_call->number, "+0123456789")
-        ) {
-            p_call->number = NULL;
-        }
-
-        err = at_tok_nextint(&line, &p_call->toa);
-        if (err < 0) goto error;
+    // Some lame implementations return strings
+    // like "NOT AVAILABLE" in the CLCC line
+    p_call->number = NULL;
+    if (0 != strspn(call->number, "+0123456789")) {
+        p_call->number = call->number;
     }
+    p_call->toa = call->toa;
 
     p_call->uusInfo = NULL;
 
@@ -564,6 +613,19 @@ error:
     return -1;
 }
 
+static int callFromCLCCLine(char *line, ATCall *call, RIL_Call *p_call)
+{
+        //+CLCC: 1,0,2,0,0,\"+18005551212\",145
+        //     index,isMT,state,mode,isMpty(,number,TOA)?
+
+    if (parseCallLine(line, &s_clccLayout, call) < 0) {
+        LOGE("invalid CLCC line\n");
+        return -1;
+    }
+
+    return callFromATCall(call, p_call);
+}
+
 /**
  * Note: get version information
  */
@@ -584,6 +646,8 @@ int getVersionInfo()
     LOGD( "dstlen = %d", dstlen );
     if ( err == 0 || dstbinary == NULL || dstlen == 0 ) goto error;
 
+    // only changes with requestSetVersionCtrl() //
+    at_cache_allow((const char *)dstbinary, dstlen, AT_CACHE_TTL_FOREVER, AT_CACHE_EV_CONFIG);
     err = at_send_egcmd_singleline(dstbinary, dstlen, M_EGPREFIX, &p_response);
     free( dstbinary );
 
@@ -795,6 +859,7 @@ static void requestRadioPower(void *data, size_t datalen, RIL_Token t)
         // modify by CYIT 20120626 ----- start -----//
         // process 'PHONE' start or restart then set all PDP unused //
         resetPdpList();
+        at_pdp_invalidate("radio on");
         // modify by CYIT 20120626 -----  end -----//
 
         err = at_send_command_min_timeout("AT+CFUN=1", &p_response);
@@ -847,10 +912,13 @@ static void requestRadioPower(void *data, size_t datalen, RIL_Token t)
     //  modified by CYIT 20130219 for airplane mode  -----  end  -----
     // ---------------------------------------------------------------
 
+    at_cache_invalidate(AT_CACHE_EV_RADIO);
     at_response_free(p_response);
     RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
     return;
 error:
+    // a failed CFUN may still have switched part of the radio //
+    at_cache_invalidate(AT_CACHE_EV_RADIO);
     at_response_free(p_response);
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
@@ -868,13 +936,100 @@ static void requestDataCallList(void *data, size_t datalen, RIL_Token t)
     requestOrSendDataCallList(&t);
 }
 
+typedef struct {
+    int cid;
+    int state;
+} CGACTLine;
+
+static const ATField s_cgactFields[] = {
+    AT_FIELD(AT_FIELD_INT, CGACTLine, cid),
+    AT_FIELD(AT_FIELD_INT, CGACTLine, state),
+};
+static const ATLayout s_cgactLayout = AT_LAYOUT(s_cgactFields);
+
+typedef struct {
+    int cid;
+    char *type;
+    char *address;
+} CGDCONTLine;
+
+// +CGDCONT: <cid>,<PDP_type>,<APN>,<PDP_addr>,... //
+static const ATField s_cgdcontFields[] = {
+    AT_FIELD(AT_FIELD_INT, CGDCONTLine, cid),
+    AT_FIELD(AT_FIELD_STR, CGDCONTLine, type),
+    AT_FIELD_SKIPPED,
+    AT_FIELD(AT_FIELD_STR, CGDCONTLine, address),
+};
+static const ATLayout s_cgdcontLayout = AT_LAYOUT(s_cgdcontFields);
+
+/* answers t, or reports the list when t is NULL */
+static void sendDataCallList(RIL_Token *t, const ATPdpContext *ctx, int n)
+{
+    RIL_Data_Call_Response_v6 *responses =
+        alloca(n * sizeof(RIL_Data_Call_Response_v6));
+    int i;
+
+    memset(responses, 0, n * sizeof(RIL_Data_Call_Response_v6));
+
+    for (i = 0; i < n; i++) {
+        RIL_Data_Call_Response_v6 *response = &responses[i];
+
+        response->cid = ctx[i].cid;
+        response->active = ctx[i].active;
+        response->type = (char *)ctx[i].type;
+        response->addresses = (char *)ctx[i].address;
+        response->ifname = "";
+
+        // modify by CYIT 20120626 //
+        if (isMainPdp(response->cid)) {
+            // in JAVA this field 'active' has 3 values downstairs //
+            // DATA_CONNECTION_ACTIVE_PH_LINK_UP: 2 //
+            // DATA_CONNECTION_ACTIVE_PH_LINK_DOWN: 1 //
+            // DATA_CONNECTION_ACTIVE_PH_LINK_INACTIVE: 0 //
+            response->active = response->active ? 2 : 0;
+            if (response->active != 0) {
+                response->ifname = s_PSCtl[response->cid - 1].m_Port;
+            }
+        }
+        // end add //
+    }
+
+    if (t != NULL)
+        RIL_onRequestComplete(*t, RIL_E_SUCCESS, responses,
+                              n * sizeof(RIL_Data_Call_Response_v6));
+    else
+        RIL_onUnsolicitedResponse(RIL_UNSOL_DATA_CALL_LIST_CHANGED,
+                                  responses,
+                                  n * sizeof(RIL_Data_Call_Response_v6));
+}
+
+/* sends the list from at_pdp, returns -1 when it must be read */
+static int reportPdpTable(RIL_Token *t)
+{
+    ATPdpContext table[AT_PDP_MAX_CONTEXTS];
+    int n;
+
+    n = at_pdp_get(table, AT_PDP_MAX_CONTEXTS);
+    if (n < 0) return -1;
+
+    sendDataCallList(t, table, n);
+    return 0;
+}
+
 static void requestOrSendDataCallList(RIL_Token *t)
 {
     ATResponse *p_response = NULL;
     ATLine *p_cur;
+    ATPdpContext *ctx;
+    CGACTLine *cgact;
+    unsigned int gen;
     int err;
-    int n = 0;
-    char *out;
+    int i, n = 0;
+
+    // +CGEV keeps the table, the unsolicited report is asked when it can't //
+    if (t != NULL && reportPdpTable(t) == 0) return;
+
+    gen = at_pdp_generation();
 
     // modify by CYIT 20120626 -----start-----//
     resetPdpList();
@@ -889,52 +1044,21 @@ static void requestOrSendDataCallList(RIL_Token *t)
          p_cur = p_cur->p_next)
         n++;
 
-    RIL_Data_Call_Response_v6 *responses =
-        alloca(n * sizeof(RIL_Data_Call_Response_v6));
-    memset(responses, 0, n * sizeof(RIL_Data_Call_Response_v6));
-
-    int i;
-    for (i = 0; i < n; i++) {
-        responses[i].cid = -1;
-        responses[i].active = -1;
-        responses[i].type = "";
-        responses[i].addresses = "";
-        responses[i].ifname = "";
-    }
-
-    RIL_Data_Call_Response_v6 *response = responses;
-    for (p_cur = p_response->p_intermediates; p_cur != NULL;
-         p_cur = p_cur->p_next) {
-        char *line = p_cur->line;
-
-        err = at_tok_start(&line);
-        if (err < 0)
-            goto error;
+    ctx = alloca(n * sizeof(ATPdpContext));
+    memset(ctx, 0, n * sizeof(ATPdpContext));
+    cgact = alloca(n * sizeof(CGACTLine));
 
-        err = at_tok_nextint(&line, &response->cid);
-        if (err < 0)
-            goto error;
+    err = at_response_parse(p_response, &s_cgactLayout, cgact, sizeof(CGACTLine), n, NULL);
+    if (err < 0)
+        goto error;
 
-        err = at_tok_nextint(&line, &response->active);
-        if (err < 0)
-            goto error;
+    for (i = 0; i < n; i++) {
+        ctx[i].cid = cgact[i].cid;
+        ctx[i].active = cgact[i].state;
 
         // modify by CYIT 20120626 //
-        if (response->cid - 1 < M_MAXNUM_PDP) {
-            s_PSCtl[response->cid - 1].m_Used = response->active;
-            // in JAVA this field 'active' has 3 values downstairs //
-            // DATA_CONNECTION_ACTIVE_PH_LINK_UP: 2 //
-            // DATA_CONNECTION_ACTIVE_PH_LINK_DOWN: 1 //
-            // DATA_CONNECTION_ACTIVE_PH_LINK_INACTIVE: 0 //
-            response->active = response->active ? 2 : 0;
-            if (response->active != 0) {
-                response->ifname = alloca(strlen(s_PSCtl[response->cid - 1].m_Port) + 1);
-                strcpy(response->ifname, s_PSCtl[response->cid - 1].m_Port);
-            }
-        }
+        refreshPdpUsed(ctx[i].cid, ctx[i].active);
         // end add //
-
-        response++;
     }
 
     at_response_free(p_response);
@@ -947,23 +1071,14 @@ static void requestOrSendDataCallList(RIL_Token *t)
 
     for (p_cur = p_response->p_intermediates; p_cur != NULL;
          p_cur = p_cur->p_next) {
-        char *line = p_cur->line;
-        int cid;
-        char *type;
-        char *apn;
-        char *address;
+        CGDCONTLine cgdcont;
 
-
-        err = at_tok_start(&line);
-        if (err < 0)
-            goto error;
-
-        err = at_tok_nextint(&line, &cid);
+        err = at_tok_parse(p_cur->line, &s_cgdcontLayout, &cgdcont, NULL);
         if (err < 0)
             goto error;
 
         for (i = 0; i < n; i++) {
-            if (responses[i].cid == cid)
+            if (ctx[i].cid == cgdcont.cid)
                 break;
         }
 
@@ -972,39 +1087,14 @@ static void requestOrSendDataCallList(RIL_Token *t)
             continue;
         }
 
-        err = at_tok_nextstr(&line, &out);
-        if (err < 0)
-            goto error;
-
-        responses[i].type = alloca(strlen(out) + 1);
-        strcpy(responses[i].type, out);
-
-        err = at_tok_nextstr(&line, &out);
-        if (err < 0)
-            goto error;
-
-#if 0
-        responses[i].apn = alloca(strlen(out) + 1);
-        strcpy(responses[i].apn, out);
-#endif
-
-        err = at_tok_nextstr(&line, &out);
-        if (err < 0)
-            goto error;
-
-        responses[i].addresses = alloca(strlen(out) + 1);
-        strcpy(responses[i].addresses, out);
+        strncpy(ctx[i].type, cgdcont.type, AT_PDP_TYPE_LEN - 1);
+        strncpy(ctx[i].address, cgdcont.address, AT_PDP_ADDR_LEN - 1);
     }
 
     at_response_free(p_response);
 
-    if (t != NULL)
-        RIL_onRequestComplete(*t, RIL_E_SUCCESS, responses,
-                              n * sizeof(RIL_Data_Call_Response_v6));
-    else
-        RIL_onUnsolicitedResponse(RIL_UNSOL_DATA_CALL_LIST_CHANGED,
-                                  responses,
-                                  n * sizeof(RIL_Data_Call_Response_v6));
+    at_pdp_load(gen, ctx, n);
+    sendDataCallList(t, ctx, n);
 
     return;
 
@@ -1016,6 +1106,7 @@ error:
                                   NULL, 0);
 
     at_response_free(p_response);
+    at_pdp_invalidate("read failed");
 
     // modify by CYIT 20120626 ---- start -----//
     resetPdpList();
@@ -1076,6 +1167,53 @@ static void sendCallStateChanged(void *param, RIL_Token t)
     RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
 }
 
+#ifdef USE_CALL_TABLE
+/**
+ * answers GET_CURRENT_CALLS from the call table, returns 0 when AT+CLCC
+ * must be asked instead
+ */
+static int answerCallsFromTable(RIL_Token t, long long startUs)
+{
+    ATCall calls[AT_CALLS_MAX];
+    RIL_Call p_calls[AT_CALLS_MAX];
+    RIL_Call *pp_calls[AT_CALLS_MAX];
+    int count, countValidCalls, i;
+
+    count = at_calls_get(calls);
+    if (count < 0) return 0;
+
+    memset(p_calls, 0, sizeof(p_calls));
+    for (i = 0, countValidCalls = 0; i < count; i++) {
+#ifdef USE_CYIT_FRAMEWORK
+        // only +CLCC tells when a ring state call is shown //
+        if (calls[i].state == AT_CALL_INCOMING) return 0;
+#endif
+        if (callFromATCall(&calls[i], &p_calls[countValidCalls]) < 0) continue;
+        pp_calls[countValidCalls] = &p_calls[countValidCalls];
+        countValidCalls++;
+    }
+
+#ifdef WORKAROUND_ERRONEOUS_ANSWER
+    // ^DSCI does not show the +CLCC glitch, keep the next poll from seeing one //
+    s_incomingOrWaitingLine = -1;
+    for (i = 0; i < countValidCalls; i++) {
+        if (p_calls[i].state == RIL_CALL_INCOMING || p_calls[i].state == RIL_CALL_WAITING) {
+            s_incomingOrWaitingLine = p_calls[i].index;
+        }
+    }
+    s_expectAnswer = 0;
+    s_repollCallsCount = 0;
+#endif /*WORKAROUND_ERRONEOUS_ANSWER*/
+
+    // no repoll, the next ^DSCI notifies the change //
+    RIL_onRequestComplete(t, RIL_E_SUCCESS, pp_calls,
+            countValidCalls * sizeof (RIL_Call *));
+    at_calls_answered(1, startUs);
+
+    return 1;
+}
+#endif /* USE_CALL_TABLE */
+
 static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
 {
     int err;
@@ -1085,8 +1223,15 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
     int countValidCalls;
     RIL_Call *p_calls;
     RIL_Call **pp_calls;
+    ATCall *p_atCalls;
     int i;
     int needRepoll = 0;
+    long long startUs = at_stats_now();
+    unsigned int gen;
+
+#ifdef USE_CALL_TABLE
+    if (answerCallsFromTable(t, startUs)) return;
+#endif /* USE_CALL_TABLE */
 
 #ifdef WORKAROUND_ERRONEOUS_ANSWER
     int prevIncomingOrWaitingLine;
@@ -1095,6 +1240,7 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
     s_incomingOrWaitingLine = -1;
 #endif /*WORKAROUND_ERRONEOUS_ANSWER*/
 
+    gen = at_calls_generation();
     err =at_send_command_timeout_poll(
             "AT+CLCC", MULTILINE, "+CLCC:",
             &p_response, CYIT_MIN_AT_TIMEOUT_MSEC, CYIT_AT_TIMEOUT_DEFAULT_POLL_NUM);
@@ -1125,17 +1271,21 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
     pp_calls = (RIL_Call **)alloca(countCalls * sizeof(RIL_Call *));
     p_calls = (RIL_Call *)alloca(countCalls * sizeof(RIL_Call));
     memset (p_calls, 0, countCalls * sizeof(RIL_Call));
+    p_atCalls = (ATCall *)alloca(countCalls * sizeof(ATCall));
+    memset(p_atCalls, 0, countCalls * sizeof(ATCall));
 
     /* init the pointer array */
     for(i = 0; i < countCalls ; i++) {
         pp_calls[i] = &(p_calls[i]);
     }
 
-    for (countValidCalls = 0, p_cur = p_response->p_intermediates
+    for (countValidCalls = 0, i = 0, p_cur = p_response->p_intermediates
             ; p_cur != NULL
             ; p_cur = p_cur->p_next
     ) {
-        err = callFromCLCCLine(p_cur->line, p_calls + countValidCalls);
+        err = callFromCLCCLine(p_cur->line, p_atCalls + i, p_calls + countValidCalls);
+        // ring state calls too, p_atCalls is what the modem has //
+        if (p_atCalls[i].index != 0) i++;
 
         if (err != 0) {
             memset(p_calls + countValidCalls, 0, sizeof(RIL_Call));
@@ -1158,6 +1308,7 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
 
         countValidCalls++;
     }
+    at_calls_load(gen, p_atCalls, i);
 
 #ifdef WORKAROUND_ERRONEOUS_ANSWER
     // Basically:
@@ -1192,6 +1343,7 @@ static void requestGetCurrentCalls(void *data, size_t datalen, RIL_Token t)
 
     RIL_onRequestComplete(t, RIL_E_SUCCESS, pp_calls,
             countValidCalls * sizeof (RIL_Call *));
+    at_calls_answered(0, startUs);
 
     at_response_free(p_response);
 
@@ -1289,12 +1441,29 @@ static void requestHangup(void *data, size_t datalen, RIL_Token t)
     ATLine *p_cur;
     int countCalls = 0;
     RIL_Call *p_calls;
+    ATCall *p_atCalls;
+#ifdef USE_CALL_TABLE
+    ATCall call;
+#endif
+    RIL_CallState state;
     int i = 0;
     int err;
     ATResponse *p_response = NULL;
 
-    // Get the state of current calls //
     p_line = (int *)data;
+
+#ifdef USE_CALL_TABLE
+    if (at_calls_find(p_line[0], &call) == 0
+            && clccStateToRILState(call.state, &state) == 0) {
+#ifdef USE_CYIT_FRAMEWORK
+        // as callFromATCall does for a +CLCC line //
+        if (7 == state) state = RIL_CALL_INCOMING;
+#endif
+        goto hangup;
+    }
+#endif /* USE_CALL_TABLE */
+
+    // Get the state of current calls //
     err =at_send_command_timeout_poll(
             "AT+CLCC", MULTILINE, "+CLCC:",
             &p_response, CYIT_MIN_AT_TIMEOUT_MSEC, CYIT_AT_TIMEOUT_DEFAULT_POLL_NUM);
@@ -1312,15 +1481,21 @@ static void requestHangup(void *data, size_t datalen, RIL_Token t)
 
     p_calls = (RIL_Call *)alloca(countCalls * sizeof(RIL_Call));
     memset(p_calls, 0, countCalls * sizeof(RIL_Call));
+    p_atCalls = (ATCall *)alloca(countCalls * sizeof(ATCall));
 
     for (p_cur = p_response->p_intermediates; 
             p_cur != NULL; 
             p_cur = p_cur->p_next, i++ ) {
-        err = callFromCLCCLine(p_cur->line, p_calls + i);
+        err = callFromCLCCLine(p_cur->line, p_atCalls + i, p_calls + i);
     }
-    LOGD("%d,%d", p_line[0], p_calls[p_line[0]-1].state);
+    state = p_calls[p_line[0] - 1].state;
+
+#ifdef USE_CALL_TABLE
+hangup:
+#endif
+    LOGD("%d,%d", p_line[0], state);
 
-    switch (p_calls[p_line[0] - 1].state) {
+    switch (state) {
         case RIL_CALL_ACTIVE:
             asprintf(&cmd, "AT+CHLD=1%d", p_line[0]);
             ret = at_send_command(cmd, NULL);
@@ -1358,6 +1533,12 @@ static void requestSignalStrength(void *data, size_t datalen, RIL_Token t)
     int numofElements=sizeof(RIL_SignalStrength_v6)/sizeof(int);
     int response[numofElements];
 
+    // fed by the modem's reports, no AT round trip //
+    if (at_signal_get(response) == 0) {
+        RIL_onRequestComplete(t, RIL_E_SUCCESS, response, sizeof(response));
+        return;
+    }
+
     err = at_send_command_singleline("AT+CSQ", "+CSQ:", &p_response);
 
     if (err < 0 || p_response->success == 0) {
@@ -1388,6 +1569,7 @@ static void requestSignalStrength(void *data, size_t datalen, RIL_Token t)
     /**************************************************************************
       Modified by CYIT 20121228 ----- end -----
     **************************************************************************/
+    at_signal_csq(response[0], response[1], 0);
 
     RIL_onRequestComplete(t, RIL_E_SUCCESS, response, sizeof(response));
 
@@ -1739,6 +1921,7 @@ static int parseRegistrationState(char *str, int *type, int *items, int **respon
     int skip;
     int count = 3;
     int commas;
+    int unsolicited = 0;
 
     LOGD("parseRegistrationState. Parsing: %s",str);
     err = at_tok_start(&line);
@@ -1771,7 +1954,16 @@ static int parseRegistrationState(char *str, int *type, int *items, int **respon
         if (*p == ',') commas++;
     }
 
-    resp = (int *)calloc(commas + 1, sizeof(int));
+    /* 3 commas are <n>, <stat>, <lac>, <cid> or, with the <lac> quoted
+     * second, the unsolicited <stat>, <lac>, <cid>, <networkType>
+     */
+    if (commas == 3) {
+        p = strchr(line, ',') + 1;
+        while (*p == ' ') p++;
+        if (*p == '"') unsolicited = 1;
+    }
+
+    resp = (int *)calloc(4, sizeof(int));
     if (!resp) goto error;
     switch (commas) {
         case 0: /* +CREG: <stat> */
@@ -1800,14 +1992,21 @@ static int parseRegistrationState(char *str, int *type, int *items, int **respon
             if (err < 0) goto error;
         break;
         case 3: /* +CREG: <n>, <stat>, <lac>, <cid> */
-            err = at_tok_nextint(&line, &skip);
-            if (err < 0) goto error;
+            if (!unsolicited) {
+                err = at_tok_nextint(&line, &skip);
+                if (err < 0) goto error;
+            }
             err = at_tok_nextint(&line, &resp[0]);
             if (err < 0) goto error;
             err = at_tok_nexthexint(&line, &resp[1]);
             if (err < 0) goto error;
             err = at_tok_nexthexint(&line, &resp[2]);
             if (err < 0) goto error;
+            if (unsolicited) {
+                err = at_tok_nextint(&line, &resp[3]);
+                if (err < 0) goto error;
+                count = 4;
+            }
         break;
         /* special case for CGREG, there is a fourth parameter
          * that is the network type (unknown/gprs/edge/umts)
@@ -1879,7 +2078,7 @@ static int parseRegistrationState(char *str, int *type, int *items, int **respon
     if (response)
         *response = resp;
     if (items)
-        *items = commas + 1;
+        *items = count;
     if (type)
         *type = techFamilyFromModemType(TECH(sMdmInfo));
     return 0;
@@ -1888,6 +2087,23 @@ error:
     return -1;
 }
 
+/* parses a +CREG/+CGREG line, solicited or not, into st */
+static int regStateFromLine(char *line, ATRegState *st)
+{
+    int *resp = NULL;
+    int count;
+
+    if (parseRegistrationState(line, NULL, &count, &resp) < 0) return -1;
+
+    st->stat = resp[0];
+    st->lac = resp[1];
+    st->ci = resp[2];
+    st->tech = count > 3 ? resp[3] : -1;
+    free(resp);
+
+    return 0;
+}
+
 #define REG_STATE_LEN 15
 #define REG_DATA_STATE_LEN 6
 static void requestRegistrationState(int request, void *data,
@@ -1903,28 +2119,52 @@ static void requestRegistrationState(int request, void *data,
     int i = 0, j = 0, numElements = 0;
     int count = 3;
     int type, startfrom;
+    int domain;
+    ATRegState st;
+    unsigned int gen;
 
     LOGD("requestRegistrationState");
     if (request == RIL_REQUEST_VOICE_REGISTRATION_STATE) {
         cmd = "AT+CREG?";
         prefix = "+CREG:";
         numElements = REG_STATE_LEN;
+        domain = AT_REG_CS;
     } else if (request == RIL_REQUEST_DATA_REGISTRATION_STATE) {
         cmd = "AT+CGREG?";
         prefix = "+CGREG:";
         numElements = REG_DATA_STATE_LEN;
+        domain = AT_REG_PS;
     } else {
         assert(0);
         goto error;
     }
 
-    err = at_send_command_singleline_timeout(cmd, prefix, &p_response, CYIT_AT_TIMEOUT_10_SEC);
+    // kept up to date by the +CREG/+CGREG URCs //
+    if (at_reg_get(domain, &st) == 0) {
+        registration = (int *)calloc(4, sizeof(int));
+        if (!registration) goto error;
+        registration[0] = st.stat;
+        registration[1] = st.lac;
+        registration[2] = st.ci;
+        registration[3] = st.tech;
+        count = st.tech >= 0 ? 4 : 3;
+        type = techFamilyFromModemType(TECH(sMdmInfo));
+    } else {
+        gen = at_reg_generation(domain);
+        err = at_send_command_singleline_timeout(cmd, prefix, &p_response, CYIT_AT_TIMEOUT_10_SEC);
 
-    if (err != 0 || p_response->success == 0) goto error;
+        if (err != 0 || p_response->success == 0) goto error;
 
-    line = p_response->p_intermediates->line;
+        line = p_response->p_intermediates->line;
 
-    if (parseRegistrationState(line, &type, &count, &registration)) goto error;
+        if (parseRegistrationState(line, &type, &count, &registration)) goto error;
+
+        st.stat = registration[0];
+        st.lac = registration[1];
+        st.ci = registration[2];
+        st.tech = count > 3 ? registration[3] : -1;
+        at_reg_load(domain, gen, &st);
+    }
 
     responseStr = malloc(numElements * sizeof(char *));
     if (!responseStr) goto error;
@@ -2012,32 +2252,54 @@ static void requestOperator(void *data, size_t datalen, RIL_Token t)
     int err;
     int i;
     int skip;
-    ATLine *p_cur;
     char *response[3];
-    char *line, *cmd = NULL;
+    char *line;
+    char cmds[3][16];
+    ATBatchItem items[6];
+    ATResponse *p_responses[3] = {NULL, NULL, NULL};
+    ATRegOperator op;
+    unsigned int gen;
 
     memset(response, 0, sizeof(response));
 
-    ATResponse *p_response = NULL;
+    // kept until the registration moves, see at_reg.h //
+    if (at_reg_get_operator(&op) == 0) {
+        for (i = 0; i < 3; i++) {
+            response[i] = op.present[i] ? op.name[i] : NULL;
+        }
+        RIL_onRequestComplete(t, RIL_E_SUCCESS, response, sizeof(response));
+        return;
+    }
+    gen = at_reg_operator_generation();
 
     // modify by CYIT 20120330 ----- start -----
     /* we expect 3 lines here:
      * +COPS: 0,0,"T - Mobile"
      * +COPS: 0,1,"TMO"
      * +COPS: 0,2,"310170"
+     * all asked in one line: AT+COPS=3,0;+COPS?;+COPS=3,1;+COPS?;...
      */
-
+    memset(items, 0, sizeof(items));
     for(i = 0x00; i < 3; i++)
     {
-        asprintf(&cmd, "AT+COPS=3,%d", i);
-        err = at_send_command_min_timeout(cmd, NULL);
-        free(cmd);
-        if (err < 0) goto error;
+        snprintf(cmds[i], sizeof(cmds[i]), "AT+COPS=3,%d", i);
+        items[2 * i].command = cmds[i];
+        items[2 * i].type = NO_RESULT;
+        items[2 * i + 1].command = "AT+COPS?";
+        items[2 * i + 1].type = SINGLELINE;
+        items[2 * i + 1].responsePrefix = "+COPS:";
+        items[2 * i + 1].pp_outResponse = &p_responses[i];
+    }
 
-        err = at_send_command_singleline_min_timeout("AT+COPS?", "+COPS:", &p_response);
-        if (err != 0 || p_response->success == 0) goto error;
+    err = at_send_command_batch(items, 6, CYIT_MIN_AT_TIMEOUT_IMMEDIATE);
+    if (err < 0) goto error;
 
-        line = p_response->p_intermediates->line;
+    for(i = 0x00; i < 3; i++)
+    {
+        if (items[2 * i].err < 0) goto error;
+        if (items[2 * i + 1].err != 0 || p_responses[i]->success == 0) goto error;
+
+        line = p_responses[i]->p_intermediates->line;
 
         err = at_tok_start(&line);
         if (err < 0) goto error;
@@ -2066,14 +2328,22 @@ static void requestOperator(void *data, size_t datalen, RIL_Token t)
     }
     // modify by CYIT 20120330 -----  end  -----
 
+    memset(&op, 0, sizeof(op));
+    for (i = 0; i < 3; i++) {
+        if (response[i] == NULL) continue;
+        strncpy(op.name[i], response[i], AT_REG_NAME_LEN - 1);
+        op.present[i] = 1;
+    }
+    at_reg_set_operator(gen, &op);
+
     RIL_onRequestComplete(t, RIL_E_SUCCESS, response, sizeof(response));
-    at_response_free(p_response);
+    for(i = 0x00; i < 3; i++) at_response_free(p_responses[i]);
     return;
 
 error:
     LOGE("requestOperator must not return error when radio is on");
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
-    at_response_free(p_response);
+    for(i = 0x00; i < 3; i++) at_response_free(p_responses[i]);
 }
 
 static void requestCdmaSendSMS(void *data, size_t datalen, RIL_Token t)
@@ -2108,9 +2378,23 @@ error:
     RIL_onRequestComplete(t, RIL_E_SMS_SEND_FAIL_RETRY, NULL, 0);
 }
 
-static void requestSendSMS(void *data, size_t datalen, RIL_Token t)
+/*
+ * Multi-part SMS: segments sent with RIL_REQUEST_SEND_SMS_EXPECT_MORE are
+ * preceded by AT+CMMS=1 so the modem keeps the relay link up and the next
+ * segment goes out at once instead of setting up a new link. The modem
+ * drops the link by itself 1-5 s after the last send (TS 27.005 3.5.6),
+ * so nothing has to be closed and a failed burst leaves no state behind.
+ * AT+CMMS is only sent again when the previous segment is older than the
+ * shortest hold the modem may apply.
+ */
+#define CMMS_HOLD_MSEC  1000
+
+static long long s_cmmsUntilUs[RIL_CHANNELS] = {0};
+
+static void requestSendSMS(void *data, size_t datalen, RIL_Token t, int more)
 {
     int err;
+    int cid = *(int *)pthread_getspecific(CID);
     const char *smsc;
     const char *pdu;
     int tpLayerLength = 0x00;
@@ -2118,8 +2402,9 @@ static void requestSendSMS(void *data, size_t datalen, RIL_Token t)
     RIL_SMS_Response response;
     ATResponse *p_response = NULL;
     char * line;
+    long long startUs = at_stats_now();
 
-    LOGD("requestSendSMS datalen =%d", datalen);
+    LOGD("requestSendSMS datalen =%d, more =%d", datalen, more);
     smsc = ((const char **)data)[0];
     pdu = ((const char **)data)[1];
 
@@ -2143,6 +2428,11 @@ static void requestSendSMS(void *data, size_t datalen, RIL_Token t)
     }
     LOGD("smsc=%s, pdu=%s", smsc, pdu);
 
+    if (more && startUs >= s_cmmsUntilUs[cid]) {
+        // a modem without +CMMS still sends, only slower //
+        at_send_command("AT+CMMS=1", NULL);
+    }
+
     asprintf(&cmd1, "AT+CMGS=%d", tpLayerLength);
     asprintf(&cmd2, "%s%s", smsc, pdu);
     // modify by CYIT 20120405 ----- start -----
@@ -2169,11 +2459,15 @@ static void requestSendSMS(void *data, size_t datalen, RIL_Token t)
     err = at_tok_nextint(&line, &(response.messageRef));
     if (err < 0) goto error;
     
+    s_cmmsUntilUs[cid] = more ? at_stats_now() + CMMS_HOLD_MSEC * 1000LL : 0;
+    at_stats_sms(cid, startUs, 1, more);
     RIL_onRequestComplete(t, RIL_E_SUCCESS, &response, sizeof(response));
     at_response_free(p_response);
 
     return;
 error:
+    s_cmmsUntilUs[cid] = 0;
+    at_stats_sms(cid, startUs, 0, more);
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
     at_response_free(p_response);
 }
@@ -2560,13 +2854,59 @@ error:
 }
 */
 
+#ifdef USE_RAWIP
+/* opens the raw IP tty of pdpid once it is there, -1 after PDP_TTY_TIMEOUT_MSEC */
+static int openPdpTty(int pdpid)
+{
+    char devpath[PROPERTY_VALUE_MAX];
+    long long endUs = at_stats_now() + PDP_TTY_TIMEOUT_MSEC * 1000LL;
+    int fd;
+
+#ifdef GSM_MUX_CHANNEL
+    // published by the mux daemon for its channel //
+    if (at_net_wait_property(s_Ttys[pdpid - 1].ttyPath, devpath, PDP_TTY_TIMEOUT_MSEC) < 0) {
+        LOGE("get %s's device path failed", s_Ttys[pdpid - 1].ttyPath);
+        return -1;
+    }
+    LOGD("device path is %s", devpath);
+#else
+    strncpy(devpath, s_Ttys[pdpid - 1].ttyPath, sizeof(devpath) - 1);
+    devpath[sizeof(devpath) - 1] = '\0';
+#endif
+
+    for (;;) {
+        fd = open(devpath, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (fd >= 0) return fd;
+
+        // the node is not there or not free yet //
+        if ((errno != ENOENT && errno != ENXIO && errno != EBUSY)
+                || at_stats_now() >= endUs) {
+            break;
+        }
+        usleep(AT_NET_POLL_MSEC * 1000);
+    }
+
+    LOGE("open failed, errno is %s", strerror(errno));
+    return -1;
+}
+#endif
+
 #ifdef USE_PPP
+/* at_net_wait_link() stop, pppd set its exit code */
+static int pppExited(void *arg)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get((const char *)arg, value, "");
+
+    return value[0] != '\0';
+}
+
 static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
 {
     int err = 0;
     int pdpid = 0, ppp_num = 0;
-    int retry_cnt = 10;
-    unsigned int ppp_flags = 0;
+    ATPdpSetup setup = { 0 };
     char *cmd = NULL;
     char *apn = NULL;
     char dns1[PROPERTY_VALUE_MAX] = "", dns2[PROPERTY_VALUE_MAX] = "";
@@ -2577,7 +2917,6 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     char *pppd_stop_args = NULL;
     char *pppd_exit = NULL;
     char *pppd_pid = NULL;
-    char *ppp_path = NULL;
     char *ppp_ip = NULL;
     char *ppp_dns1 = NULL, *ppp_dns2 = NULL;
     ATLine *p_cur = NULL;
@@ -2587,13 +2926,14 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     if (datalen != 7 * sizeof(char *)) goto error;
 
     // find unused PDP //
-    pdpid = getUnUsedPdp();
+    pdpid = claimPdp();
 
     // all PDP be used, weird ??? //
     if (pdpid == 0) {
         LOGE("all PDP be used, cancel this request");
         goto error;
     }
+    at_pdp_setup_begin(&setup, pdpid);
     pdpport = s_PSCtl[pdpid - 1].m_Port;
 
     // Initialize response //
@@ -2612,7 +2952,6 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     asprintf(&pppd_stop_args, "stop_pppd%d:%d", ppp_num, ppp_num);
     asprintf(&pppd_exit, "net.gprs.ppp%d-exit", ppp_num);
     asprintf(&pppd_pid, "net.ppp%d.pid", ppp_num);
-    asprintf(&ppp_path, "/sys/class/net/ppp%d", ppp_num);
     asprintf(&ppp_ip, "net.ppp%d.local-ip", ppp_num);
     asprintf(&ppp_dns1, "net.ppp%d.dns1", ppp_num);
     asprintf(&ppp_dns2, "net.ppp%d.dns2", ppp_num);
@@ -2655,20 +2994,12 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
 
                     //property_set("ctl.start", pppd_stop_args);
                     property_set("ril.gprs.start", "0");
-                    while (retry_cnt--) {
-                        LOGD("deactive retry_cnt:%d", retry_cnt);
-                        sleep(3);
-                        err = property_get(pppd_exit, ppp_exit_code, "");
-                        if (strcmp(ppp_exit_code, "")) {
-                            LOGD("deactive exit code:%s", ppp_exit_code);
-                            break;
-                        }
-                    }
-
-                    if (!strcmp(ppp_exit_code, "")) {
+                    if (at_net_wait_property(pppd_exit, ppp_exit_code,
+                            PPP_STOP_TIMEOUT_MSEC) < 0) {
                         LOGD("kill pppd%d failed", ppp_num);
                         goto error;
                     }
+                    LOGD("deactive exit code:%s", ppp_exit_code);
                 }
 
                 break;
@@ -2679,6 +3010,7 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     at_response_free(p_response);
     p_response = NULL;
 
+    at_pdp_setup_phase(&setup, AT_PDP_PHASE_DEFINE);
     asprintf(&cmd, "AT+CGDCONT=%d,\"%s\",\"%s\"", 
             response.cid, response.type, apn);
     err = at_send_command_min_timeout(cmd, &p_response);
@@ -2690,7 +3022,10 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     p_response = NULL;
 
     // Start pppd to acquire dns/ip adresses //
+    at_pdp_setup_phase(&setup, AT_PDP_PHASE_ACTIVATE);
     LOGD("start pppd%d...", ppp_num);
+    // nobody clears the exit code of the last pppd, pppExited() would take it //
+    property_set(pppd_exit, "");
     //err = property_set("ctl.start", pppd_start_args);
     err = property_set("ril.gprs.start", "1");
     if (err < 0) {
@@ -2698,25 +3033,11 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
         goto error;
     }
 
-    ifc_init();
-    retry_cnt = 10;
-    while (retry_cnt--) {
-        sleep(5);
-        err = property_get(pppd_exit, ppp_exit_code, "");
-        if (strcmp(ppp_exit_code, "")) break;
-
-        if (!(err = access(ppp_path, F_OK)) &&
-                !ifc_get_info(pdpport, NULL, NULL, &ppp_flags))
-        {
-            LOGD("ppp%d_flags: %x", ppp_num, ppp_flags);
-            if (ppp_flags & 1) break;
-        }
-
-        LOGD("Check ppp%d status cnt:%d; access return:%d; error:%s", ppp_num, retry_cnt, err, strerror(errno));
-    }
-    ifc_close();
+    // up once pppd brings ppp<n> up, or gives up //
+    err = at_net_wait_link(pdpport, IFF_UP, PPP_UP_TIMEOUT_MSEC, pppExited, pppd_exit);
 
-    if (ppp_flags & 1) {
+    if (err == 0) {
+        at_pdp_setup_phase(&setup, AT_PDP_PHASE_ADDRESS);
         err = property_get(ppp_ip, ipaddr, "");
         if (err < 0) {
             LOGD("### error getting %s value: err %d", ppp_ip, err);
@@ -2730,6 +3051,7 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
         LOGD("local-ip: %s", ipaddr);
         LOGD("dns1: %s, dns2: %s", dns1, dns2);
     } else {
+        property_get(pppd_exit, ppp_exit_code, "");
         if (!strcmp(ppp_exit_code, "")) {
             LOGD("### time out and stop pppd!");
             goto error2;
@@ -2743,7 +3065,6 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     free(pppd_stop_args);
     free(pppd_exit);
     free(pppd_pid);
-    free(ppp_path);
     free(ppp_ip);
     free(ppp_dns1);
     free(ppp_dns2);
@@ -2754,21 +3075,16 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     RIL_onRequestComplete(t, RIL_E_SUCCESS, &response, sizeof(response));
     free(response.dnses);
 
-    s_PSCtl[pdpid - 1].m_Used = 1;
+    setPdpUsed(pdpid, 1);
+    at_pdp_activated(pdpid, response.type, ipaddr);
+    at_pdp_setup_end(&setup, 1);
     return;
 
 error2:
     //property_set("ctl.start", pppd_stop_args);
     property_set("ril.gprs.start", "0");
-    retry_cnt = 10;
-    while (retry_cnt--) {
-        LOGD("deactive retry_cnt:%d", retry_cnt);
-        sleep(3);
-        err = property_get(pppd_exit, ppp_exit_code, "");
-        if (strcmp(ppp_exit_code, "")) {
-            LOGD("deactive exit code:%s", ppp_exit_code);
-            break;
-        }
+    if (at_net_wait_property(pppd_exit, ppp_exit_code, PPP_STOP_TIMEOUT_MSEC) == 0) {
+        LOGD("deactive exit code:%s", ppp_exit_code);
     }
 
 error:
@@ -2776,10 +3092,13 @@ error:
     free(pppd_stop_args);
     free(pppd_exit);
     free(pppd_pid);
-    free(ppp_path);
     free(ppp_ip);
     free(ppp_dns1);
     free(ppp_dns2);
+    if (pdpid != 0) {
+        setPdpUsed(pdpid, 0);
+        at_pdp_setup_end(&setup, 0);
+    }
     RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
     at_response_free(p_response);
 }
@@ -2791,14 +3110,14 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     int err = 0;
     int pdpid = 0;
     int pcolen = 0;
+    ATPdpSetup setup = { 0 };
     char *cmd = NULL;
     char *line = NULL;
     char *apn = NULL;
     char *pcostr = NULL;
-    char *prop1 = NULL, *prop2 = NULL;
     char *pdpport = NULL;
-    char *devpath = NULL;
     unsigned char *pcoarray = NULL;
+    ATNetConfig netcfg;
     unsigned char dns1[16] = { 0 }, dns2[16] = { 0 };
     ATLine *p_cur = NULL;
     ATResponse *p_response = NULL;
@@ -2811,13 +3130,14 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     if (datalen != 7 * sizeof(char *)) goto error;
 
     // find unused PDP //
-    pdpid = getUnUsedPdp();
+    pdpid = claimPdp();
 
     // all PDP be used, weird ??? //
     if (pdpid == 0) {
         LOGE("all PDP be used, cancel this request");
         goto error;
     }
+    at_pdp_setup_begin(&setup, pdpid);
 
     pdpport = s_PSCtl[pdpid - 1].m_Port;
 
@@ -2885,6 +3205,7 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     p_response = NULL;
 
     // Set pdp context //
+    at_pdp_setup_phase(&setup, AT_PDP_PHASE_DEFINE);
     asprintf(&cmd, "AT+CGDCONT=%d,\"%s\",\"%s\"", 
             response.cid, response.type, apn);
     err = at_send_command_min_timeout(cmd, &p_response);
@@ -2909,6 +3230,7 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     p_response = NULL;
 
     // Activate pdp //
+    at_pdp_setup_phase(&setup, AT_PDP_PHASE_ACTIVATE);
     asprintf( &cmd, "AT+CGACT=1,%d", response.cid );
     // modify by CYIT 20120405 ----- start -----
     err = at_send_command_timeout( cmd, NO_RESULT, NULL, &p_response, CYIT_AT_TIMEOUT_70_SEC);
@@ -2926,6 +3248,7 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     p_response = NULL;
 
     // Get PCO string //
+    at_pdp_setup_phase(&setup, AT_PDP_PHASE_ADDRESS);
     asprintf( &cmd, "AT^SGPCO=2,%d", response.cid );
     err = at_send_command_singleline_min_timeout( cmd, "^SGPCO:", &p_response );
     free( cmd );
@@ -3028,23 +3351,7 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
        goto error2;
        }
      */
-
-    asprintf(&prop1, "net.%s.dns1", pdpport);
-    asprintf(&prop2, "net.%s.dns2", pdpport);
-    if (property_set(prop1, dns1) == -1 
-            || property_set(prop2, dns2) == -1)
-    {
-        LOGE("Set system properties failed !");
-        property_set(prop1, "0.0.0.0");
-        property_set(prop2, "0.0.0.0");
-
-        free(prop1);
-        free(prop2);
-        goto error2;
-    }
-
-    free(prop1);
-    free(prop2);
+    // published once the interface is configured //
     // end modify //
 
     at_response_free(p_response);
@@ -3089,26 +3396,9 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     // Set IP and turn it on //
 
 #ifdef USE_RAWIP
-#ifdef GSM_MUX_CHANNEL
-    devpath = malloc(PROPERTY_VALUE_MAX);
-    memset(devpath, 0, PROPERTY_VALUE_MAX);
-    property_get(s_Ttys[pdpid - 1].ttyPath, devpath, "");
-    if (!strcmp(devpath, "")) {
-        LOGE("get %s's device path failed", s_Ttys[pdpid - 1].ttyPath);
-        free(devpath);
-        goto error2;
-    }
-    LOGD("device path is %s", devpath);
-#else
-    devpath = s_Ttys[pdpid - 1].ttyPath;
-#endif
-
-    ttyfd = open(devpath, O_RDWR | O_NOCTTY | O_NONBLOCK);
-#ifdef GSM_MUX_CHANNEL
-    free(devpath);
-#endif
+    at_pdp_setup_phase(&setup, AT_PDP_PHASE_TTY);
+    ttyfd = openPdpTty(pdpid);
     if (ttyfd < 0) {
-        LOGE("open failed, errno is %s", strerror(errno));
         goto error2;
     }
     s_Ttys[pdpid - 1].ttyFd = ttyfd;
@@ -3119,35 +3409,36 @@ static void requestSetupDataCall( void *data , size_t datalen , RIL_Token t )
     }
 #endif
 
-    ifc_init();
-
-    // modify by CYIT 20120625 ------- start -----//
-    //if ( ifc_up( "veth0" ) 
-    //        || ifc_set_addr( "veth0", inet_addr( response.addresses )))
-
-    if (ifc_up(pdpport)
-            || ifc_set_addr(pdpport, inet_addr(response.addresses))
-    )
-    // modify by CYIT 20120625 -------  end  -----//
-
-    {
+    at_pdp_setup_phase(&setup, AT_PDP_PHASE_LINK);
+    memset(&netcfg, 0, sizeof(netcfg));
+    netcfg.ifname = pdpport;
+    netcfg.address = response.addresses;
+    at_net_config_defaults(&netcfg);
+    if (at_net_configure(&netcfg) < 0) {
         LOGE( "Set IP failed." );
-        ifc_close();
         goto error2;
     }
-    ifc_close();
+
+    if (at_net_publish_dns(pdpport, (const char *)dns1, (const char *)dns2) < 0) {
+        LOGE("Set system properties failed !");
+        at_net_publish_dns(pdpport, "0.0.0.0", "0.0.0.0");
+        ifc_disable(pdpport);
+        goto error2;
+    }
 
     response.gateways = response.addresses;
     asprintf(&response.dnses, "%s %s", dns1, dns2);
     RIL_onRequestComplete( t, RIL_E_SUCCESS, &response, sizeof( response ) );
     free(response.dnses);
+    at_pdp_activated(response.cid, response.type, response.addresses);
     at_response_free( p_response );
     p_response = NULL;
 
     // add by dengxiangyu 2012-6-25 //
     // pdp is actived then set m_Used be true //
-    s_PSCtl[pdpid - 1].m_Used = 1;
+    setPdpUsed(pdpid, 1);
     // end add //
+    at_pdp_setup_end(&setup, 1);
 
     return;
 
@@ -3170,6 +3461,10 @@ error2:
     // modify by CYIT 20120405 -----  end  -----
 
 error:
+    if (setup.cid != 0) {
+        setPdpUsed(setup.cid, 0);
+        at_pdp_setup_end(&setup, 0);
+    }
     RIL_onRequestComplete( t, RIL_E_GENERIC_FAILURE, NULL, 0 );
     at_response_free( p_response );
 }
@@ -3182,14 +3477,12 @@ static void requestDeactivateDataCall( void * data, size_t datalen, RIL_Token t
     char *cmd = NULL;
     char *pdpidstr = (( char ** )data )[0];
     char *pdpport = NULL;
-    char *prop1 = NULL, *prop2 = NULL;
     char pid[10] = "";
     ATLine *p_cur = NULL;
     ATResponse *p_response = NULL;
 
 #ifdef USE_PPP
     int ppp_num = 0;
-    int retry_cnt = 10;
     char ppp_exit_code[PROPERTY_VALUE_MAX];
     char *pppd_pid = NULL;
     char *pppd_stop_args = NULL;
@@ -3210,7 +3503,8 @@ static void requestDeactivateDataCall( void * data, size_t datalen, RIL_Token t
     }
 
     // JAVA don't care about deactivate or not, set it unused //
-    s_PSCtl[atoi(pdpidstr) - 1].m_Used = 0;
+    setPdpUsed(atoi(pdpidstr), 0);
+    at_pdp_deactivated(atoi(pdpidstr));
 
 #ifdef USE_PPP
 
@@ -3230,20 +3524,11 @@ static void requestDeactivateDataCall( void * data, size_t datalen, RIL_Token t
     LOGD("stop pppd%d...", ppp_num);
     //property_set("ctl.start", pppd_stop_args);
     property_set("ril.gprs.start", "0");
-    while (retry_cnt--) {
-        LOGD("deactive retry_cnt:%d", retry_cnt);
-        sleep(3);
-        err = property_get(pppd_exit, ppp_exit_code, "");
-        if (strcmp(ppp_exit_code, "")) {
-            LOGD("deactive exit code:%s", ppp_exit_code);
-            break;
-        }
-    }
-
-    if (!strcmp(ppp_exit_code, "")) {
+    if (at_net_wait_property(pppd_exit, ppp_exit_code, PPP_STOP_TIMEOUT_MSEC) < 0) {
         LOGD("stop pppd failed");
         goto error;
     }
+    LOGD("deactive exit code:%s", ppp_exit_code);
 
     free(pppd_pid);
     free(pppd_stop_args);
@@ -3264,12 +3549,7 @@ static void requestDeactivateDataCall( void * data, size_t datalen, RIL_Token t
     }
 #endif
 
-    asprintf(&prop1, "net.%s.dns1", pdpport);
-    asprintf(&prop2, "net.%s.dns2", pdpport);
-    property_set(prop1, "0.0.0.0");
-    property_set(prop2, "0.0.0.0");
-    free(prop1);
-    free(prop2);
+    at_net_publish_dns(pdpport, "0.0.0.0", "0.0.0.0");
 
     // modify by CYIT 20120405 ----- start -----
     asprintf( &cmd, "AT+CGACT=0,%s", pdpidstr );
@@ -3422,15 +3702,12 @@ static void requestQueryCallWaiting( void *data , size_t datalen , RIL_Token t )
     int i = 0x00;
 
     // modify by CYIT 20120405 ----- start -----
-    err = at_send_command_timeout(
-        "AT+CCWA=1,2", MULTILINE, "+CCWA:", &p_response, CYIT_AT_TIMEOUT_40_SEC);
+    err = at_send_command_abortable(
+        "AT+CCWA=1,2", MULTILINE, "+CCWA:", &p_response, CYIT_AT_TIMEOUT_40_SEC,
+        CYIT_SAOC_TYPE_SS);
 
     if ( err < 0 || p_response->success == 0 )
     {
-        if(err == AT_ERROR_TIMEOUT)
-        {
-            sendAbortCmd(CYIT_SAOC_TYPE_SS);
-        }
         goto error;
     }
     // modify by CYIT 20120405 -----  end  -----
@@ -3476,7 +3753,8 @@ static void requestQueryCallWaiting( void *data , size_t datalen , RIL_Token t )
     }
 
     error: LOGE("query call waiting error");
-    RIL_onRequestComplete( t, RIL_E_GENERIC_FAILURE, NULL, 0 );
+    RIL_onRequestComplete( t, err == AT_ERROR_CANCELLED
+            ? RIL_E_CANCELLED : RIL_E_GENERIC_FAILURE, NULL, 0 );
     at_response_free( p_response );
 }
 
@@ -3649,16 +3927,12 @@ static void requestQueryCallRestrictStatus( void *data , size_t datalen , RIL_To
 
     // modify by CYIT 20120405 ----- start -----
     asprintf( &cmd, "AT+CLCK=\"%s\",2", strings[0] );
-    err = at_send_command_timeout( cmd
-        , MULTILINE, "+CLCK:", &p_response, CYIT_AT_TIMEOUT_40_SEC );
+    err = at_send_command_abortable( cmd
+        , MULTILINE, "+CLCK:", &p_response, CYIT_AT_TIMEOUT_40_SEC, CYIT_SAOC_TYPE_SS );
     free( cmd );
 
     if ( err < 0 || p_response->success == 0 )
     {
-        if(err == AT_ERROR_TIMEOUT)
-        {
-            sendAbortCmd(CYIT_SAOC_TYPE_SS);
-        }
         goto error;
     }
     // modify by CYIT 20120405 -----  end  -----
@@ -3707,7 +3981,8 @@ static void requestQueryCallRestrictStatus( void *data , size_t datalen , RIL_To
     }
 
     error: LOGE("query call restrict status error");
-    RIL_onRequestComplete( t, RIL_E_GENERIC_FAILURE, NULL, 0 );
+    RIL_onRequestComplete( t, err == AT_ERROR_CANCELLED
+            ? RIL_E_CANCELLED : RIL_E_GENERIC_FAILURE, NULL, 0 );
     at_response_free( p_response );
 }
 
@@ -4258,6 +4533,8 @@ static void requestSetScreenState(void * data, size_t datalen, RIL_Token t)
             LOGE( "At command \"AT+CGREG=2\" return error.\n" );
             //goto error;
         }
+        // what changed while reports were off is unknown //
+        at_reg_invalidate();
 
         if(v_airmodeOper != RADIO_ACTION_AIRMODE_ON){
             // modify by CYIT ----- start -----
@@ -4284,6 +4561,7 @@ static void requestSetScreenState(void * data, size_t datalen, RIL_Token t)
             LOGE( "At command \"AT+CGREG=0\" return error.\n" );
             //goto error;
         }
+        at_reg_invalidate();
     }
 
     RIL_onRequestComplete( t, RIL_E_SUCCESS, NULL, 0 );
@@ -4297,86 +4575,113 @@ error:
     at_response_free( p_response );
 }
 
-static void requestQueryNetworks(void *data, size_t datalen, RIL_Token t)
+/* answers a scan request, withType adds the AcT column ("FF" when unknown) */
+static void sendNetworkList(RIL_Token t, const ATPlmnEntry *e, int n, int withType)
 {
-    int err;
-    ATResponse * p_response = NULL;
+    const char *response[5 * AT_PLMN_MAX_ENTRIES];
+    int cols = withType ? 5 : 4;
+    int i;
 
-    err = at_send_command_timeout("AT+COPS=?", SINGLELINE, "+COPS:",
-            &p_response, CYIT_OPER_AT_TIMEOUT_MSEC);
-    if (err < 0 || p_response->success == 0) {
-        if (AT_ERROR_TIMEOUT == err) {
-            sendAbortCmd(CYIT_SAOC_TYPE_NET); // modify by CYIT 20120405
-        }
-        goto error;
-    } else {
-        char *line, *p;
-        int i = 0, n = 0;
+    for (i = 0; i < n; i++) {
+        const char **row = &response[cols * i];
 
-        line = p_response->p_intermediates->line;
-        err = at_tok_start(&line);
-        if (err < 0) goto error;
+        row[0] = e[i].longName;
+        row[1] = e[i].shortName;
+        row[2] = e[i].numeric;
+        row[3] = at_plmn_state_name(e[i].state);
+        if (withType) row[4] = at_plmn_act_name(e[i].act);
+    }
 
-        for (p = line; *p != '\0'; p++) {
-            if (*p == '(') n++;
-        }
+    RIL_onRequestComplete(t, RIL_E_SUCCESS, response, sizeof(char *) * cols * n);
+}
 
-        if (n <= 2) goto error;
-        else {
-            int state = 0, act = 0;
-            char *response[4 * (n - 2)];
+/**
+ * AT+COPS=? into e, retried every 5 s while the modem is busy (+CME
+ * ERROR: 201) when retryBusy, returns the number of networks or -1
+ */
+static int scanNetworks(ATPlmnEntry *e, long long timeoutMsec, int retryBusy, int *p_err)
+{
+    ATResponse *p_response = NULL;
+    int busy = 0, n = -1, err;
 
-            for (i = 0; i < (n - 2); i++) {
-                // Skip "(" in the begin //
-                line += 2;
+    for (;;) {
+        if (at_plmn_preempted()) {
+            err = AT_ERROR_CANCELLED;
+            goto done;
+        }
 
-                // State //
-                err = at_tok_nextint(&line, &state);
-                if (err < 0) goto error;
+        err = at_send_command_abortable("AT+COPS=?", SINGLELINE, "+COPS:",
+                &p_response, timeoutMsec, CYIT_SAOC_TYPE_NET);
+        if (err == 0 && p_response->success != 0) break;
 
-                // Long Name //
-                err = at_tok_nextstr(&line, &response[4 * i + 0]);
-                if (err < 0) goto error;
+        if (retryBusy && err == 0 && busy++ < 12
+                && strStartsWith(p_response->finalResponse, "+CME ERROR: 201")) {
+            at_response_free(p_response);
+            p_response = NULL;
+            if (at_plmn_backoff(5000) == 0) continue;
+            err = AT_ERROR_CANCELLED;
+        }
+        goto done;
+    }
 
-                // Short Name //
-                err = at_tok_nextstr(&line, &response[4 * i + 1]);
-                if (err < 0) goto error;
+    n = at_plmn_parse(p_response->p_intermediates->line, e, AT_PLMN_MAX_ENTRIES);
+    if (n == 0) n = -1;
 
-                // Number Name //
-                err = at_tok_nextstr(&line, &response[4 * i + 2]);
-                if (err < 0) goto error;
+done:
+    *p_err = err;
+    at_response_free(p_response);
 
-                if (0 == state) asprintf(&response[4 * i + 3], "%s", "unknown");
-                else if (1 == state) asprintf(&response[4 * i + 3], "%s", "available");
-                else if (2 == state) asprintf(&response[4 * i + 3], "%s", "current");
-                else if (3 == state) asprintf(&response[4 * i + 3], "%s", "forbidden");
-                else
-                {
-                    for ( ; i >= 0; i--) {
-                        free(response[4 * i + 3]);
-                    }
-                    goto error;
-                }
+    return n;
+}
 
-                // Skip technology in the end //
-                line = strstr(line, ")");
-                line++;
-            }
+/**
+ * network scan job: the kept list answers at once when young enough,
+ * and is refreshed after the answer once past its TTL; a refresh gives
+ * way to any other request of the channel, see at_plmn.h
+ */
+static void queryNetworks(RIL_Token t, long long timeoutMsec, int withType)
+{
+    ATPlmnEntry entries[AT_PLMN_MAX_ENTRIES];
+    long long ageMs;
+    unsigned int gen;
+    int cid = *(int *)pthread_getspecific(CID);
+    int n, how, err = 0;
+
+    how = at_plmn_lookup(entries, AT_PLMN_MAX_ENTRIES, &n, &ageMs);
+    if (how == AT_PLMN_FRESH) {
+        LOGD("[REQ%d]: %d networks scanned %lld ms ago", cid, n, ageMs);
+        sendNetworkList(t, entries, n, withType);
+        return;
+    }
 
-            RIL_onRequestComplete(t, RIL_E_SUCCESS, response, sizeof(char *) * 4 * (n - 2));
-            for (i = 0; i < (n - 2); i++) {
-                free(response[4 * i + 3]);
-            }
-            at_response_free(p_response);
-        }
+    // begun before the answer, a request right behind it can pre-empt it //
+    gen = at_plmn_scan_begin(cid, how == AT_PLMN_REFRESH);
+    if (how == AT_PLMN_REFRESH) {
+        LOGD("[REQ%d]: %d networks scanned %lld ms ago, refresh", cid, n, ageMs);
+        sendNetworkList(t, entries, n, withType);
+
+        // answered, onCancel() must not take the refresh for the request //
+        pthread_mutex_lock(&s_curTokenMutex);
+        s_curToken[cid] = NULL;
+        pthread_mutex_unlock(&s_curTokenMutex);
     }
 
-    return;
+    n = scanNetworks(entries, timeoutMsec, withType, &err);
+    at_plmn_scan_end(gen, entries, n);
 
-error:
+    if (how == AT_PLMN_REFRESH) return;
 
-    at_response_free( p_response );
-    RIL_onRequestComplete( t, RIL_E_GENERIC_FAILURE, NULL, 0 );
+    if (n < 0) {
+        RIL_onRequestComplete(t, err == AT_ERROR_CANCELLED
+                ? RIL_E_CANCELLED : RIL_E_GENERIC_FAILURE, NULL, 0);
+        return;
+    }
+    sendNetworkList(t, entries, n, withType);
+}
+
+static void requestQueryNetworks(void *data, size_t datalen, RIL_Token t)
+{
+    queryNetworks(t, CYIT_OPER_AT_TIMEOUT_MSEC, 0);
 }
 
 /**************************************************************************
@@ -4386,141 +4691,7 @@ error:
 **************************************************************************/
 static void requestQueryNetworksWithType(void *data, size_t datalen, RIL_Token t)
 {
-    int          err;
-    ATResponse * p_response = NULL;
-    int          v_time = 0x00;
-    int          v_pollTime = 12;
-
-    while(1){
-        err = at_send_command_timeout("AT+COPS=?", SINGLELINE, "+COPS:",
-                &p_response, CYIT_AT_TIMEOUT_70_SEC);
-        if (err < 0 || p_response->success == 0){
-            if (AT_ERROR_TIMEOUT == err) 
-            {
-                sendAbortCmd(CYIT_SAOC_TYPE_NET);
-            }else if(p_response
-                    && (strStartsWith(p_response->finalResponse, "+CME ERROR: 201"))){
-                if(v_time++ != v_pollTime){
-                    sleep(5);
-                    continue;
-                }
-            }
-            goto error;
-        }else{
-            break;
-        }
-    }
-
-    {
-        char *line, *p;
-        int i = 0, n = 0;
-
-        line = p_response->p_intermediates->line;
-        err = at_tok_start(&line);
-        if (err < 0) goto error;
-
-        for (p = line; *p != '\0'; p++) 
-        {
-            if (*p == '(') n++;
-        }
-
-        if (n <= 2) goto error;
-        else 
-        {
-            int state = 0, act = 0;
-            char *response[5 * (n - 2)];
-
-            for (i = 0; i < (n - 2); i++) 
-            {
-                // Skip "(" in the begin //
-                if (i == 0) 
-                {
-                    line ++;
-                }
-                line++;
-
-                // State //
-                err = at_tok_nextint(&line, &state);
-                if (err < 0) goto error;
-
-                // Long Name //
-                err = at_tok_nextstr(&line, &response[5 * i + 0]);
-                if (err < 0) goto error;
-
-                // Short Name //
-                err = at_tok_nextstr(&line, &response[5 * i + 1]);
-                if (err < 0) goto error;
-
-                // Number Name //
-                err = at_tok_nextstr(&line, &response[5 * i + 2]);
-                if (err < 0) goto error;
-
-                if (0 == state) asprintf(&response[5 * i + 3], "%s", "unknown");
-                else if (1 == state) asprintf(&response[5 * i + 3], "%s", "available");
-                else if (2 == state) asprintf(&response[5 * i + 3], "%s", "current");
-                else if (3 == state) asprintf(&response[5 * i + 3], "%s", "forbidden");
-                else
-                {
-                    for ( ; i >= 0; i--) 
-                    {
-                        free(response[5 * i + 3]);
-                    }
-                    goto error;
-                }
-
-                if ( at_tok_hasmore( &line ) )
-                {
-                    err = at_tok_nextint( &line, &act ); // access technology
-                    if(err < 0) goto error;
-
-                    if (0 == act) asprintf(&response[5 * i + 4], "%s", "0");
-                    else if (1 == act) asprintf(&response[5 * i + 4], "%s", "1");
-                    else if (2 == act) asprintf(&response[5 * i + 4], "%s", "2");
-                    else if (3 == act) asprintf(&response[5 * i + 4], "%s", "3");
-                    else if (4 == act) asprintf(&response[5 * i + 4], "%s", "4");
-                    else if (5 == act) asprintf(&response[5 * i + 4], "%s", "5");
-                    else if (6 == act) asprintf(&response[5 * i + 4], "%s", "6");
-                    else if (7 == act) asprintf(&response[5 * i + 4], "%s", "7");
-                    else
-                    {
-                        for ( ; i >= 0; i--) 
-                        {
-                            free(response[5 * i + 4]);
-                        }
-                        goto error;
-                    }
-                }
-                else
-                {
-                    asprintf(&response[5 * i + 4], "%s", "FF");
-                }
-
-            }
-
-            // printf response
-            int j = 0;
-            for (j = 0; j < (n - 2); j++) 
-            {
-                for (i = 0; i < 5; i++) 
-                {
-                    LOGD("[requestQueryNetworksWithType] response[%d] = %s", (5 * j + i), response[5 * j + i]);
-                }
-            }
-
-            RIL_onRequestComplete(t, RIL_E_SUCCESS, response, sizeof(char *) * 5 * (n - 2));
-            for (i = 0; i < (n - 2); i++) {
-                free(response[5 * i + 3]);
-            }
-            at_response_free(p_response);
-        }
-    }
-
-    return;
-
-error:
-
-    at_response_free( p_response );
-    RIL_onRequestComplete( t, RIL_E_GENERIC_FAILURE, NULL, 0 );
+    queryNetworks(t, CYIT_AT_TIMEOUT_70_SEC, 1);
 }
     /**************************************************************************
       Modified by CYIT 20130304 ----- end -----
@@ -4863,14 +5034,31 @@ request_error:
     // modify by CYIT 20111230 -----  end  -----
 }
 
+// ^SCPBR: index,number,type,anr1,type,anr2,type,anr3,type,alpha,coding[,email] //
+static const ATField s_scpbrFields[] = {
+    AT_FIELD(AT_FIELD_INT, RIL_Read_PB_Record, index),
+    AT_FIELD(AT_FIELD_STR, RIL_Read_PB_Record, number),
+    AT_FIELD(AT_FIELD_INT, RIL_Read_PB_Record, numType),
+    AT_FIELD(AT_FIELD_STR, RIL_Read_PB_Record, anr1),
+    AT_FIELD(AT_FIELD_INT, RIL_Read_PB_Record, anr1Type),
+    AT_FIELD(AT_FIELD_STR, RIL_Read_PB_Record, anr2),
+    AT_FIELD(AT_FIELD_INT, RIL_Read_PB_Record, anr2Type),
+    AT_FIELD(AT_FIELD_STR, RIL_Read_PB_Record, anr3),
+    AT_FIELD(AT_FIELD_INT, RIL_Read_PB_Record, anr3Type),
+    AT_FIELD(AT_FIELD_STR, RIL_Read_PB_Record, alpha),
+    AT_FIELD(AT_FIELD_INT, RIL_Read_PB_Record, coding),
+    AT_FIELD(AT_FIELD_STR | AT_FIELD_OPTIONAL, RIL_Read_PB_Record, email),
+};
+static const ATLayout s_scpbrLayout = AT_LAYOUT(s_scpbrFields);
+
 static void requestReadPbRecordUserDefined(void * data, size_t datalen, RIL_Token t)
 {
     int                        err;
     ATResponse                *p_response = NULL;
     int                        recNum = 0x00;
     RIL_Read_PB_Record         response;
+    ATTokError                 tokErr;
     char                      *cmd = NULL;
-    char                      *line;
     // bitmap point to the parameter whether exsit
     recNum = ((int *)data)[0];
 
@@ -4880,56 +5068,15 @@ static void requestReadPbRecordUserDefined(void * data, size_t datalen, RIL_Toke
         goto request_error;
     }
 
-    line = p_response->p_intermediates->line;
-    err = at_tok_start(&line);
-    if (err < 0) goto request_error;
-
     memset(&response, 0, sizeof(response));
 
-    err = at_tok_nextint(&line, &(response.index));// index
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextstr(&line, &(response.number)); // number
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextint(&line, &(response.numType));
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextstr(&line, &(response.anr1));// anr1
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextint(&line, &(response.anr1Type));
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextstr(&line, &(response.anr2));// anr2
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextint(&line, &(response.anr2Type));
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextstr(&line, &(response.anr3));// anr3
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextint(&line, &(response.anr3Type));
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextstr(&line, &(response.alpha));// alpha
-    if (err < 0) goto request_error;
-
-    err = at_tok_nextint(&line, &(response.coding));
-    if (err < 0) goto request_error;
-
-    if (at_tok_hasmore(&line))
-    {
-        err = at_tok_nextstr(&line, &(response.email));// email
-        if (err < 0) goto request_error;
-
-        if(!strlen(response.email))
-        {
-            response.email = NULL;
-        }
+    err = at_tok_parse(p_response->p_intermediates->line, &s_scpbrLayout, &response, &tokErr);
+    if (err < 0) {
+        LOGE("SCPBR field %s bad at column %d", tokErr.name, tokErr.column);
+        goto request_error;
     }
-    else
+
+    if (response.email != NULL && !strlen(response.email))
     {
         response.email = NULL;
     }
@@ -5342,6 +5489,17 @@ onRequest (int request, void *data, size_t datalen, RIL_Token t)
     //   modified by CYIT 20130219 for airplane mode  -----  end  -----
     // ----------------------------------------------------------------
 
+    // other channels may still be handshaking, only ours matters //
+    if (!at_channel_ready(cid)
+            && at_wait_channel_ready(cid, CYIT_CHANNEL_READY_TIMEOUT_MSEC) < 0) {
+        LOGE("[REQ%d]: channel not ready, send %s anyway", cid, requestToString(request));
+    }
+
+    // for onCancel() //
+    pthread_mutex_lock(&s_curTokenMutex);
+    s_curToken[cid] = t;
+    pthread_mutex_unlock(&s_curTokenMutex);
+
     switch (request) {
         case RIL_REQUEST_GET_SIM_STATUS: {
             RIL_CardStatus_v6 *p_card_status;
@@ -5504,7 +5662,10 @@ onRequest (int request, void *data, size_t datalen, RIL_Token t)
             break;
         }
         case RIL_REQUEST_SEND_SMS:
-            requestSendSMS(data, datalen, t);
+            requestSendSMS(data, datalen, t, 0);
+            break;
+        case RIL_REQUEST_SEND_SMS_EXPECT_MORE:
+            requestSendSMS(data, datalen, t, 1);
             break;
         // modify by CYIT 20111017 ----- start -----
         case RIL_REQUEST_SET_SMS_STORAGE_LOC:
@@ -5671,6 +5832,8 @@ onRequest (int request, void *data, size_t datalen, RIL_Token t)
             p_response = NULL;
             err = at_send_command_timeout(
                     "AT+COPS=0", NO_RESULT, NULL, &p_response, CYIT_AT_TIMEOUT_40_SEC);
+            at_reg_drop_operator();
+            at_plmn_invalidate("selection");
             if ( err < 0 || p_response->success == 0 ) {
                 RIL_onRequestComplete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
             } else {
@@ -5690,6 +5853,8 @@ onRequest (int request, void *data, size_t datalen, RIL_Token t)
                 err = at_send_command_timeout(
                     cmd, NO_RESULT, NULL, &p_response, CYIT_AT_TIMEOUT_40_SEC);
                 free(cmd);
+                at_reg_drop_operator();
+                at_plmn_invalidate("selection");
 
                 if (err < 0 || p_response->success == 0) {
                     if (AT_ERROR_TIMEOUT == err) {
@@ -5783,6 +5948,7 @@ onRequest (int request, void *data, size_t datalen, RIL_Token t)
 
         case RIL_REQUEST_SET_PREFERRED_NETWORK_TYPE:
             requestSetPreferredNetworkType(request, data, datalen, t);
+            at_plmn_invalidate("network type");
             break;
 
         case RIL_REQUEST_STK_SEND_TERMINAL_RESPONSE:
@@ -6324,6 +6490,9 @@ onRequest (int request, void *data, size_t datalen, RIL_Token t)
             RIL_onRequestComplete(t, RIL_E_REQUEST_NOT_SUPPORTED, NULL, 0);
             break;
     }
+    pthread_mutex_lock(&s_curTokenMutex);
+    s_curToken[cid] = NULL;
+    pthread_mutex_unlock(&s_curTokenMutex);
 }
 
 /**
@@ -6352,8 +6521,27 @@ onSupports (int requestCode)
 
 static void onCancel (RIL_Token t)
 {
-    //@@@todo
+    int cid;
+
+    // no token, a request waits behind the network scan refresh //
+    if (t == NULL) {
+        cid = at_plmn_preempt();
+        if (cid >= 0) at_cancel_channel(cid);
+        return;
+    }
+
+    // only at_send_command_abortable() commands stop, the rest run on //
+    pthread_mutex_lock(&s_curTokenMutex);
+    for (cid = 0; cid < RIL_CHANNELS; cid++) {
+        if (s_curToken[cid] == t) break;
+    }
+    pthread_mutex_unlock(&s_curTokenMutex);
 
+    if (cid == RIL_CHANNELS) {
+        LOGD("onCancel: request already done");
+        return;
+    }
+    at_cancel_channel(cid);
 }
 
 static const char * getVersion(void)
@@ -6407,6 +6595,13 @@ setRadioState(RIL_RadioState newState)
 
     /* do these outside of the mutex */
     if (sState != oldState) {
+        if (sState == RADIO_STATE_OFF || sState == RADIO_STATE_UNAVAILABLE) {
+            at_calls_invalidate("radio off");
+            at_signal_invalidate();
+            at_reg_invalidate();
+            at_pdp_invalidate("radio off");
+            at_plmn_invalidate("radio off");
+        }
         RIL_onUnsolicitedResponse (RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED, NULL, 0);
 
         if (sState == RADIO_STATE_SIM_READY) {
@@ -7010,8 +7205,28 @@ static void probeForModemMode(ModemInfo *info)
 }
 
 /**
- * Initialize everything that can be configured while we're still in
- * AT+CFUN=0
+ * asks the modem for periodic signal reports, see at_signal.h. Without
+ * them RIL_REQUEST_SIGNAL_STRENGTH keeps sending AT+CSQ
+ */
+static void enableSignalReports(void)
+{
+    char cmd[PROPERTY_VALUE_MAX];
+    ATResponse *p_response = NULL;
+    int err;
+
+    property_get(AT_SIGNAL_PROP_URC, cmd, AT_SIGNAL_DEF_URC);
+    if (cmd[0] == '\0') return;
+
+    err = at_send_command_min_timeout(cmd, &p_response);
+    if (err < 0 || p_response->success == 0) {
+        LOGI("%s not supported, signal strength is polled", cmd);
+    }
+    at_response_free(p_response);
+}
+
+/**
+ * Initialize everything that can be configured while we're still in
+ * AT+CFUN=0
  */
 static void initializeCallback(void *param, RIL_Token t)
 {
@@ -7020,7 +7235,8 @@ static void initializeCallback(void *param, RIL_Token t)
 
     setRadioState (RADIO_STATE_OFF);
 
-    at_handshake();
+    // channels handshake in parallel since at_open(), onRequest() //
+    // already waited for ours                                     //
 
     probeForModemMode(sMdmInfo);
     /* note: we don't check errors here. Everything important will
@@ -7054,6 +7270,9 @@ static void initializeCallback(void *param, RIL_Token t)
      // Set URC mode //
  
      at_send_command_min_timeout( "AT+CGEREP=2,0", NULL );
+     // LAC, CI and AcT in the reports feed at_reg //
+     at_send_command_min_timeout( "AT+CREG=2", NULL );
+     at_send_command_min_timeout( "AT+CGREG=2", NULL );
      //at_send_command( "AT+CMER=1,0,0,2", NULL );
      //at_send_command( "AT+CLIP=1", NULL );
      //at_send_command( "AT+CRC=1", NULL );
@@ -7067,6 +7286,7 @@ static void initializeCallback(void *param, RIL_Token t)
      //at_send_command( "AT^SRABI=1", NULL );
      at_send_command_min_timeout( "AT^SSTMY=1", NULL );
      at_send_command_min_timeout( "AT^DSCI=1", NULL );
+     enableSignalReports();
       // modify by CYIT 20121025         ----- start -----
      at_send_command_min_timeout( "AT+CPLS=0", NULL );
       // modify by CYIT 20121025         -----  end  -----
@@ -7102,634 +7322,541 @@ static void waitForClose()
     pthread_mutex_unlock(&s_state_mutex);
 }
 
-/**
- * Called by atchannel when an unsolicited line appears
- * This is called on atchannel's reader thread. AT commands may
- * not be issued here
+/*
+ * URC handlers, registered in registerUnsolHandlers(). They run on a
+ * URC worker, one at a time per lane. line is a private copy and is
+ * tokenized in place.
  */
-static void onUnsolicited (const char *s, const char *sms_pdu)
+static void onNitzTime(char *line, const char *sms_pdu)
 {
-    char *line = NULL, *p;
-    int err;
-
-    LOGD("URC: %s", s);
+    /* TI specific -- NITZ time */
+    char *response;
 
-    /* Ignore unsolicited responses until we're initialized.
-     * This is OK because the RIL library will poll for initial state
-     */
-    if ( sState == RADIO_STATE_UNAVAILABLE )
-    {
-        LOGD("radio unavailable ignored URC");
+    at_tok_start(&line);
+    if (at_tok_nextstr(&line, &response) != 0) {
+        LOGE("invalid NITZ line\n");
         return;
     }
 
-    if ( strStartsWith( s, "%CTZV:" ) )
-    {
-        /* TI specific -- NITZ time */
-        char *response;
+    RIL_onUnsolicitedResponse( RIL_UNSOL_NITZ_TIME_RECEIVED, response,
+            strlen( response ) );
+}
 
-        line = p = strdup(s);
-        at_tok_start(&p);
-        err = at_tok_nextstr(&p, &response);
-        if ( err != 0 )
-        {
-            LOGE("invalid NITZ line %s\n", s);
-        }
-        else
-        {
-            RIL_onUnsolicitedResponse( RIL_UNSOL_NITZ_TIME_RECEIVED, response,
-                    strlen( response ) );
-        }
-        
-        free(line);
+static void onCallStateIndication(char *line, const char *sms_pdu)
+{
+    ATCall call;
+
+    //^DSCI: 1,0,2,0,0,"+18005551212",145
+    //     id,dir,state,type(,mpty,number,TOA)?
+    if (parseCallLine(line, &s_dsciLayout, &call) < 0) {
+        at_calls_invalidate("bad ^DSCI");
+        return;
     }
-//    else if (strStartsWith(s,"+CRING:")
-//                || strStartsWith(s,"RING")
-//                || strStartsWith(s,"NO CARRIER")
-//                || strStartsWith(s,"+CCWA")
-//    ) {
-//        RIL_onUnsolicitedResponse (
-//            RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
-//            NULL, 0);
-//#ifdef WORKAROUND_FAKE_CGEV
-//        RIL_requestTimedCallback (onDataCallListChanged, NULL, NULL); //TODO use new function
-//#endif /* WORKAROUND_FAKE_CGEV */
-//    }
-    else if (strStartsWith(s, "^DSCI:")) {
-        int calltype;
-        int state;
-        int skip;
-        int callid;
-
-        line = p = strdup(s);
-        at_tok_start(&p);
-        err = at_tok_nextint(&p, &callid);
-        if (err != 0) goto error;
-        err = at_tok_nextint(&p, &skip);
-        if (err != 0) goto error;
-        err = at_tok_nextint(&p, &state);
-        if (err != 0) goto error;
-        err = at_tok_nextint(&p, &calltype);
-        if (err != 0) goto error;
+    at_calls_indicate(&call);
 
 #ifdef USE_CYIT_FRAMEWORK
 
-        if (calltype == 0 && state == 4) {
-            s_RingID = callid;
-        }
+    if (call.mode == 0 && call.state == 4) {
+        s_RingID = call.index;
+    }
 
-        if (calltype == 0 && state != 4) {
-            if (s_RingID == callid) s_RingID = 0;
-            RIL_onUnsolicitedResponse (
-                RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
-                NULL, 0);
-        }
+    if (call.mode == 0 && call.state != 4) {
+        if (s_RingID == call.index) s_RingID = 0;
+        RIL_onUnsolicitedResponse (
+            RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
+            NULL, 0);
+    }
 
 #else
 
-        if (calltype == 0) {
-            RIL_onUnsolicitedResponse (
-                    RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
-                    NULL, 0);
-        }
+    if (call.mode == 0) {
+        RIL_onUnsolicitedResponse (
+                RIL_UNSOL_RESPONSE_CALL_STATE_CHANGED,
+                NULL, 0);
+    }
 
 #endif
+}
 
-error:
-        free(line);
-    }// else if (strStartsWith(s,"+CREG:")
-               // || strStartsWith(s,"+CGREG:") 
-    else if (strStartsWith(s,"+CREG:")) {
-        int        state = -1;
-
-        line = p = strdup(s);
-        if (!line) {
-            LOGE("+CREG: Unable to allocate memory");
-            return;
-        }
+static void onNetworkRegistration(char *line, const char *sms_pdu)
+{
+    ATRegState st;
 
-        if (at_tok_start(&p) < 0) goto creg_error;
-        if (at_tok_nextint(&p, &state) < 0) goto creg_error;
-        if(state != 7){
-            RIL_onUnsolicitedResponse (
-                RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED,
-                NULL, 0);
-    #ifdef WORKAROUND_FAKE_CGEV
-            //RIL_requestTimedCallback (onDataCallListChanged, NULL, NULL);
-            RIL_requestTimedCallback(RIL_TIME_REQUEST_DATA_CALL_LIST, NULL, NULL);
-    #endif /* WORKAROUND_FAKE_CGEV */
-        //} else if (strStartsWith(s,"+CGREG:")) {
-        //    RIL_onUnsolicitedResponse (
-        //        RIL_UNSOL_RESPONSE_DATA_NETWORK_STATE_CHANGED,
-        //        NULL, 0);
-        }
+    if (regStateFromLine(line, &st) < 0) {
+        LOGE("invalid +CREG response");
         return;
+    }
 
-creg_error:
-        LOGE("invalid +CREG/CGREG response: %s", line);
-        free(line);
-    } else if (strStartsWith(s, "+CMT:"))
-    {
+    // a report repeating the state does not need a framework poll //
+    if (at_reg_indicate(AT_REG_CS, &st) && st.stat != 7) {
         RIL_onUnsolicitedResponse (
-            RIL_UNSOL_RESPONSE_NEW_SMS,
-            sms_pdu, strlen(sms_pdu));
+            RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED,
+            NULL, 0);
+#ifdef WORKAROUND_FAKE_CGEV
+        RIL_requestTimedCallback(RIL_TIME_REQUEST_DATA_CALL_LIST, NULL, NULL);
+#endif /* WORKAROUND_FAKE_CGEV */
     }
-    // ----------------------------------------------------------------
-    // modify by CYIT 20111017 ----- start -----
-    // ----------------------------------------------------------------
-    else if (strStartsWith(s, "+CMTI:"))
-    {
-        char      *skip = 0;
-        int        index = -1;
-
-        line = p = strdup(s);
-        if (!line) {
-            LOGE("+CMTI: Unable to allocate memory");
-            return;
-        }
+}
 
-        if (at_tok_start(&p) < 0) goto cmti_error;
-        if (at_tok_nextstr(&p, &skip) < 0) goto cmti_error;
-        if (at_tok_nextint(&p, &index) < 0) goto cmti_error;
+static void onDataRegistration(char *line, const char *sms_pdu)
+{
+    ATRegState st;
 
-        RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_NEW_SMS_ON_SIM, &index, sizeof(int *));
-        free(line);
+    if (regStateFromLine(line, &st) < 0) {
+        LOGE("invalid +CGREG response");
         return;
+    }
 
-cmti_error:
-        LOGE("invalid +CMTI response: %s", line);
-        free(line);
-    } 
-    // ----------------------------------------------------------------
-    // modify by CYIT 20111017 -----  end  -----
-    // ----------------------------------------------------------------
-    else if ( strStartsWith( s, "+CDS:" ) )
-    {
+    // the framework polls voice and data on this one //
+    if (at_reg_indicate(AT_REG_PS, &st)) {
         RIL_onUnsolicitedResponse (
-            RIL_UNSOL_RESPONSE_NEW_SMS_STATUS_REPORT,
-            sms_pdu, strlen(sms_pdu));
+            RIL_UNSOL_RESPONSE_VOICE_NETWORK_STATE_CHANGED,
+            NULL, 0);
     }
-    else if ( strStartsWith( s, "+CGEV:" ) )
-    {
-        /* Really, we can ignore NW CLASS and ME CLASS events here,
-         * but right now we don't since extranous
-         * RIL_UNSOL_DATA_CALL_LIST_CHANGED calls are tolerated
-         */
+}
+
+static void pushSignalStrength(void)
+{
+    int response[AT_SIGNAL_INTS];
+
+    if (at_signal_peek(response) == 0) {
+        RIL_onUnsolicitedResponse(RIL_UNSOL_SIGNAL_STRENGTH,
+                response, sizeof(RIL_SignalStrength_v6));
+    }
+}
+
+static void onSignalStrength(char *line, const char *sms_pdu)
+{
+    int rssi, ber;
+
+    if (at_tok_start(&line) < 0
+            || at_tok_nextint(&line, &rssi) < 0
+            || at_tok_nextint(&line, &ber) < 0) {
+        LOGE("invalid +CSQ report");
+        return;
+    }
+
+    if (at_signal_csq(rssi, ber, 1)) pushSignalStrength();
+}
+
+static void onExtendedSignalStrength(char *line, const char *sms_pdu)
+{
+    int cesq[6];
+    int count = 0;
+
+    //+CESQ: <rxlev>,<ber>,<rscp>,<ecno>,<rsrq>,<rsrp>
+    if (at_tok_start(&line) < 0) goto error;
+    while (count < 6 && at_tok_hasmore(&line)) {
+        if (at_tok_nextint(&line, &cesq[count]) < 0) goto error;
+        count++;
+    }
+    if (count < 4) goto error;
+
+    if (at_signal_cesq(cesq, count)) pushSignalStrength();
+    return;
+
+error:
+    LOGE("invalid +CESQ report");
+}
+
+static void onNewSms(char *line, const char *sms_pdu)
+{
+    RIL_onUnsolicitedResponse (
+        RIL_UNSOL_RESPONSE_NEW_SMS,
+        sms_pdu, strlen(sms_pdu));
+}
+
+// modify by CYIT 20111017 //
+static void onNewSmsOnSim(char *line, const char *sms_pdu)
+{
+    char      *skip = 0;
+    int        index = -1;
+
+    if (at_tok_start(&line) < 0
+            || at_tok_nextstr(&line, &skip) < 0
+            || at_tok_nextint(&line, &index) < 0) {
+        LOGE("invalid +CMTI response");
+        return;
+    }
+
+    RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_NEW_SMS_ON_SIM, &index, sizeof(int *));
+}
+
+static void onSmsStatusReport(char *line, const char *sms_pdu)
+{
+    RIL_onUnsolicitedResponse (
+        RIL_UNSOL_RESPONSE_NEW_SMS_STATUS_REPORT,
+        sms_pdu, strlen(sms_pdu));
+}
+
+static void onPacketDomainEvent(char *line, const char *sms_pdu)
+{
+    int ret = AT_PDP_EVENT_RESYNC;
+    int i;
+
+    // the fake one (+CME ERROR: 150) tells nothing, read the list //
+    if (strStartsWith(line, "+CGEV:")) ret = at_pdp_event(line);
+
+    if (ret == AT_PDP_EVENT_CHANGED) {
+        // a context the network took down frees its port //
+        for (i = 1; i <= s_pdpNum; i++) {
+            if (!at_pdp_is_active(i)) refreshPdpUsed(i, 0);
+        }
+        if (reportPdpTable(NULL) == 0) return;
+        ret = AT_PDP_EVENT_RESYNC;
+    }
+
+    if (ret == AT_PDP_EVENT_RESYNC) {
         /* can't issue AT commands here -- call on main thread */
-        //RIL_requestTimedCallback (onDataCallListChanged, NULL, NULL);
         RIL_requestTimedCallback(RIL_TIME_REQUEST_DATA_CALL_LIST, NULL, NULL);
-#ifdef WORKAROUND_FAKE_CGEV
     }
-    else if (strStartsWith(s, "+CME ERROR: 150"))
-    {
-        //RIL_requestTimedCallback (onDataCallListChanged, NULL, NULL);
-        RIL_requestTimedCallback(RIL_TIME_REQUEST_DATA_CALL_LIST, NULL, NULL);
-#endif /* WORKAROUND_FAKE_CGEV */
+}
+
+static void onSubscriptionSource(char *line, const char *sms_pdu)
+{
+    int source = 0;
 
+    if (at_tok_start(&line) < 0) return;
+    if (at_tok_nextint(&line, &source) < 0) {
+        LOGE("invalid +CCSS response");
+        return;
     }
-	 /*else if (strStartsWith(s, "+CTEC: ")) {
-        int tech, mask;
-        switch (parse_technology_response(s, &tech, NULL))
-        {
-            case -1: // no argument could be parsed.
-                LOGE("invalid CTEC line %s\n", s);
-                break;
-            case 1: // current mode correctly parsed
-            case 0: // preferred mode correctly parsed
-                mask = 1 << tech;
-                if (mask != MDM_GSM && mask != MDM_CDMA &&
-                     mask != MDM_WCDMA && mask != MDM_LTE) {
-                    LOGE("Unknown technology %d\n", tech);
-                } else {
-                    setRadioTechnology(sMdmInfo, tech);
-                }
-                break;
-        }
-    }*/ else if (strStartsWith(s, "+CCSS: ")) {
-        int source = 0;
-        line = p = strdup(s);
-        if (!line) {
-            LOGE("+CCSS: Unable to allocate memory");
-            return;
-        }
-        if (at_tok_start(&p) < 0) {
-            free(line);
-            return;
-        }
-        if (at_tok_nextint(&p, &source) < 0) {
-            LOGE("invalid +CCSS response: %s", line);
-            free(line);
-            return;
-        }
-        SSOURCE(sMdmInfo) = source;
-        RIL_onUnsolicitedResponse(RIL_UNSOL_CDMA_SUBSCRIPTION_SOURCE_CHANGED, &source, sizeof(int *));
-    } else if (strStartsWith(s, "+WSOS: ")) {
-        char state = 0;
-        int unsol;
-        line = p = strdup(s);
-        if (!line) {
-            LOGE("+WSOS: Unable to allocate memory");
-            return;
-        }
-        if (at_tok_start(&p) < 0) {
-            free(line);
-            return;
-        }
-        if (at_tok_nextbool(&p, &state) < 0) {
-            LOGE("invalid +WSOS response: %s", line);
-            free(line);
-            return;
-        }
+    SSOURCE(sMdmInfo) = source;
+    RIL_onUnsolicitedResponse(RIL_UNSOL_CDMA_SUBSCRIPTION_SOURCE_CHANGED, &source, sizeof(int *));
+}
 
-        unsol = state ?
-                RIL_UNSOL_ENTER_EMERGENCY_CALLBACK_MODE : RIL_UNSOL_EXIT_EMERGENCY_CALLBACK_MODE;
+static void onEmergencyCallbackMode(char *line, const char *sms_pdu)
+{
+    char state = 0;
+    int unsol;
 
-        RIL_onUnsolicitedResponse(unsol, NULL, 0);
-        free(line);
-    } else if (strStartsWith(s, "+WPRL: ")) {
-        int version = -1;
-        line = p = strdup(s);
-        if (!line) {
-            LOGE("+WPRL: Unable to allocate memory");
-            return;
-        }
-        if (at_tok_start(&p) < 0) {
-            LOGE("invalid +WPRL response: %s", s);
-            free(line);
-            return;
-        }
-        if (at_tok_nextint(&p, &version) < 0) {
-            LOGE("invalid +WPRL response: %s", s);
-            free(line);
-            return;
-        }
-        
-        RIL_onUnsolicitedResponse(RIL_UNSOL_CDMA_PRL_CHANGED, &version, sizeof(version));
-        free(line);
-    } else if (strStartsWith(s, "+CFUN: 0")) {
-        setRadioState(RADIO_STATE_OFF);
-        v_cardState = 0;
+    if (at_tok_start(&line) < 0) return;
+    if (at_tok_nextbool(&line, &state) < 0) {
+        LOGE("invalid +WSOS response");
+        return;
     }
-    // -------------------------------------------------------------
-    //   modify by CYIT 20110806        ----- start -----
-    // -------------------------------------------------------------
-    else if ( strStartsWith( s, "^SSTPC:" ) )
-    {
-        char *stkProcmd = NULL;
-        char *cmdType = NULL;
-        int   skip;
 
-        line = p = strdup( s );
-        err = at_tok_start( &p );
-        if ( err < 0 )
-            goto error_SSTPC;
-        err = at_tok_nextstr( &p, &cmdType );
-        if ( err < 0 )
-            goto error_SSTPC;
-        err = at_tok_nextint( &p, &skip );
-        if ( err < 0 )
-            goto error_SSTPC;
-        err = at_tok_nextint( &p, &skip );
-        if ( err < 0 )
-            goto error_SSTPC;
-        err = at_tok_nextint( &p, &skip );
-        if ( err < 0 )
-            goto error_SSTPC;
-        err = at_tok_nextstr( &p, &stkProcmd );
-        if ( err < 0 )
-            goto error_SSTPC;
-        LOGD("ATparser stk/usat Procmd: %s", stkProcmd);
+    unsol = state ?
+            RIL_UNSOL_ENTER_EMERGENCY_CALLBACK_MODE : RIL_UNSOL_EXIT_EMERGENCY_CALLBACK_MODE;
 
-        if(strlen(cmdType) == 0x02 && (!memcmp(cmdType, "RF", 2)))
-        {
-            LOGD("ATparser stk/usat Procmd RIL_UNSOL_STK_EVENT_NOTIFY");
-            // refresh command not need to response TERMINAL_RESPONSE
-            RIL_onUnsolicitedResponse(RIL_UNSOL_STK_EVENT_NOTIFY, stkProcmd,sizeof(stkProcmd));
-        }
-        else
-        {
-            LOGD("ATparser stk/usat Procmd RIL_UNSOL_STK_PROACTIVE_COMMAND");
-            RIL_onUnsolicitedResponse(RIL_UNSOL_STK_PROACTIVE_COMMAND, stkProcmd, sizeof(stkProcmd));
-        }
-        free(line);
+    RIL_onUnsolicitedResponse(unsol, NULL, 0);
+}
+
+static void onPrlChanged(char *line, const char *sms_pdu)
+{
+    int version = -1;
 
+    if (at_tok_start(&line) < 0 || at_tok_nextint(&line, &version) < 0) {
+        LOGE("invalid +WPRL response");
         return;
+    }
 
-error_SSTPC: 
-        
-        LOGE("invalid SSTPC line: %s\n", s);
-        free(line);
+    RIL_onUnsolicitedResponse(RIL_UNSOL_CDMA_PRL_CHANGED, &version, sizeof(version));
+}
+
+static void onRadioOff(char *line, const char *sms_pdu)
+{
+    setRadioState(RADIO_STATE_OFF);
+    v_cardState = 0;
+}
+
+// modify by CYIT 20110806 //
+static void onStkProactiveCommand(char *line, const char *sms_pdu)
+{
+    char *stkProcmd = NULL;
+    char *cmdType = NULL;
+    int   skip;
+
+    if (at_tok_start( &line ) < 0
+            || at_tok_nextstr( &line, &cmdType ) < 0
+            || at_tok_nextint( &line, &skip ) < 0
+            || at_tok_nextint( &line, &skip ) < 0
+            || at_tok_nextint( &line, &skip ) < 0
+            || at_tok_nextstr( &line, &stkProcmd ) < 0) {
+        LOGE("invalid SSTPC line\n");
+        return;
     }
-    else if ( strStartsWith( s, "^SSTES:" ) )
+    LOGD("ATparser stk/usat Procmd: %s", stkProcmd);
+
+    if(strlen(cmdType) == 0x02 && (!memcmp(cmdType, "RF", 2)))
     {
-        // modify by CYIT 20111226 ----- start -----
-        int endType;
-        char *skip;
+        LOGD("ATparser stk/usat Procmd RIL_UNSOL_STK_EVENT_NOTIFY");
+        // refresh command not need to response TERMINAL_RESPONSE
+        RIL_onUnsolicitedResponse(RIL_UNSOL_STK_EVENT_NOTIFY, stkProcmd,sizeof(stkProcmd));
+    }
+    else
+    {
+        LOGD("ATparser stk/usat Procmd RIL_UNSOL_STK_PROACTIVE_COMMAND");
+        RIL_onUnsolicitedResponse(RIL_UNSOL_STK_PROACTIVE_COMMAND, stkProcmd, sizeof(stkProcmd));
+    }
+}
 
-        line = p = strdup(s);
-        if (!line) {
-            LOGE("^SSTES: Unable to allocate memory");
-            return;
-        }
-        if (at_tok_start(&p) < 0) goto sstes_error;
-        if (at_tok_nextstr(&p, &skip) < 0) goto sstes_error;
-        if (at_tok_nextstr(&p, &skip) < 0) goto sstes_error;
-        if (at_tok_nextstr(&p, &skip) < 0) goto sstes_error;
-        if (at_tok_nextint(&p, &endType) < 0) goto sstes_error;
+// modify by CYIT 20111226 //
+static void onStkSessionEnd(char *line, const char *sms_pdu)
+{
+    int endType;
+    char *skip;
 
-        RIL_onUnsolicitedResponse( RIL_UNSOL_STK_SESSION_END, &endType, sizeof(int *) );
-        free(line);
+    if (at_tok_start(&line) < 0
+            || at_tok_nextstr(&line, &skip) < 0
+            || at_tok_nextstr(&line, &skip) < 0
+            || at_tok_nextstr(&line, &skip) < 0
+            || at_tok_nextint(&line, &endType) < 0) {
+        LOGE("invalid ^SSTES response");
         return;
-sstes_error:
-        LOGE("invalid ^SSTES response: %s", line);
-        free(line);
-        // modify by CYIT 20111226 -----  end  -----
     }
-    else if ( strStartsWith( s, "^SSTRF:" ) )
-    {
-        RIL_SimRefreshResponse   *simRefresh = NULL;
-        int   mode;
-        int   fileNum = 0x00;
-        char *fileId = NULL;
-        
-        simRefresh = (RIL_SimRefreshResponse *)alloca(sizeof(RIL_SimRefreshResponse));
-        memset(simRefresh, 0x00, sizeof(RIL_SimRefreshResponse));
 
-        line = p = strdup( s );
-        err = at_tok_start( &p );
-        if(err < 0)
-            goto error_SSTRF;
+    RIL_onUnsolicitedResponse( RIL_UNSOL_STK_SESSION_END, &endType, sizeof(int *) );
+}
 
-        err = at_tok_nextint( &p, &mode );
-        if(err < 0)
-            goto error_SSTRF;
-        simRefresh->result = mode;
+/* value of hex digit c, -1 if it is none */
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-        err = at_tok_nextint( &p, &fileNum );
-        if(err < 0) LOGD("refresh file number = 0x00");
-        simRefresh->efIdNum = fileNum;
+static void onStkRefresh(char *line, const char *sms_pdu)
+{
+    RIL_SimRefreshResponse   simRefresh;
+    int   mode;
+    int   fileNum = 0x00;
+    char *fileId = NULL;
+    int   i, j;
 
-        if(fileNum)
-        {
-            simRefresh->ef_id = alloca(fileNum * sizeof(int));
-            memset(simRefresh->ef_id, 0x00, fileNum * sizeof(int));
+    memset(&simRefresh, 0x00, sizeof(RIL_SimRefreshResponse));
 
-            err = at_tok_nextstr( &p, &fileId );
-            if(err < 0 || ((fileNum * 4) != strlen(fileId)))
-                goto error_SSTRF;
+    if (at_tok_start( &line ) < 0 || at_tok_nextint( &line, &mode ) < 0) {
+        goto error;
+    }
+    simRefresh.result = mode;
 
-            char i = 0x00, pos = 0x00;
-            for(i = 0x00; i < fileNum; i++)
-            {
-                char charNum = 0x01;
-                unsigned short v_frsBits = 0x0000;
-                unsigned short v_SecBits = 0x0000;
-                unsigned short v_trdBits = 0x0000;
-                short v_fthBits = 0x0000;
-                while(charNum <= 0x04)
-                {
-                    unsigned short temp = fileId[pos];
-                    if(temp >= 0x30 && temp <= 0x39)
-                    {
-                        if((pos % 0x04) == 0x00)
-                        {
-                            v_frsBits = (((short)temp - 0x30) & 0x000F) << 12;
-                        }
-                        else if((pos % 0x04) == 0x01)
-                        {
-                            v_SecBits = (((short)temp - 0x30) & 0x000F) << 8;
-                        }
-                        else if((pos % 0x04) == 0x02)
-                        {
-                            v_trdBits = (((short)temp - 0x30) & 0x000F) << 4;
-                        }
-                        else if((pos % 0x04) == 0x03)
-                        {
-                            v_fthBits = (((short)temp - 0x30) & 0x000F);
-                        }
-                    }
-                    else if(temp >= 0x41 && temp <= 0x46)
-                    {
-                        if((pos % 0x04) == 0x00)
-                        {
-                            v_frsBits = (((short)temp - 0x37) & 0x000F) << 12;
-                        }
-                        else if((pos % 0x04) == 0x01)
-                        {
-                            v_SecBits = (((short)temp - 0x37) & 0x000F) << 8;
-                        }
-                        else if((pos % 0x04) == 0x02)
-                        {
-                            v_trdBits = (((short)temp - 0x37) & 0x000F) << 4;
-                        }
-                        else if((pos % 0x04) == 0x03)
-                        {
-                            v_fthBits = (((short)temp - 0x37) & 0x000F);
-                        }
-                    }
-                    else
-                    {
-                        LOGE("invalid SSTRF fileId[%d] value = %c", pos, (char)temp);
-                        goto error_SSTRF;
-                    }
+    if (at_tok_nextint( &line, &fileNum ) < 0) LOGD("refresh file number = 0x00");
+    simRefresh.efIdNum = fileNum;
 
-                    pos++;
-                    charNum++;
-                }
+    if(fileNum)
+    {
+        simRefresh.ef_id = alloca(fileNum * sizeof(int));
+        memset(simRefresh.ef_id, 0x00, fileNum * sizeof(int));
 
-                (simRefresh->ef_id)[i] = (int)(v_frsBits | v_SecBits | v_trdBits | v_fthBits);
-            }
-        }
-        
-        RIL_onUnsolicitedResponse( RIL_UNSOL_SIM_REFRESH, simRefresh, sizeof(RIL_SimRefreshResponse) );
-        free(line);
-        return;
-        
-error_SSTRF:
-        LOGE("invalid SSTRF line: %s\n", s);
-        free(line);
-    }
-    // -------------------------------------------------------------
-    //   modify by CYIT 20110806         -----  end  -----
-    // -------------------------------------------------------------
-    // -------------------------------------------------------------
-    //   modify by CYIT 20110819             ----- start -----
-    // -------------------------------------------------------------
-    else if ( strStartsWith( s, "+CUSD:" ) )
-    {
-        int err;
-        int m = 0, dcs = 0;
-        char *response[3];
-        static char mResponse[] = "0000";
-        static char dcsResponse[] = "0000";
-
-        line = strdup( s );
-        at_tok_start( &line );
-        err = at_tok_nextint( &line, &m );
-        if(err < 0)
-        {
-            LOGE("invalid +cusd reason = %d\n", m);
-            goto error_CUSD;
+        if (at_tok_nextstr( &line, &fileId ) < 0
+                || (fileNum * 4) != (int)strlen(fileId)) {
+            goto error;
         }
 
-        sprintf( mResponse, "%d", m );
-        response[0] = mResponse;
-        if ( at_tok_hasmore( &line ) )
-        {
-            err = at_tok_nextstr( &line, &( response[1] ) );
-            if(err < 0)
-            {
-                LOGE("invalid cusd str = %s\n", response[1]);
-                goto error_CUSD;
-            }
+        // 4 upper case hex digits per file id //
+        for (i = 0; i < fileNum; i++) {
+            int id = 0;
 
-            err = at_tok_nextint( &line, &dcs );
-            if(err < 0)
-            {
-                LOGE("invalid cusd dcs = %d\n", dcs);
-                goto error_CUSD;
+            for (j = 0; j < 4; j++) {
+                int v = hexDigit(fileId[i * 4 + j]);
+
+                if (v < 0) {
+                    LOGE("invalid SSTRF fileId[%d] value = %c", i * 4 + j, fileId[i * 4 + j]);
+                    goto error;
+                }
+                id = (id << 4) | v;
             }
-            sprintf( dcsResponse, "%d", dcs );
-            response[2] = dcsResponse;
+            (simRefresh.ef_id)[i] = id;
         }
-        else
-        {
-            response[1] = NULL;
+    }
 
-            dcs = 0xFF;
-            sprintf( dcsResponse, "%d", dcs );
-            response[2] = dcsResponse;
-        }
+    RIL_onUnsolicitedResponse( RIL_UNSOL_SIM_REFRESH, &simRefresh, sizeof(RIL_SimRefreshResponse) );
+    return;
 
-        RIL_onUnsolicitedResponse(RIL_UNSOL_ON_USSD, response, sizeof(response));
-        return;
+error:
+    LOGE("invalid SSTRF line\n");
+}
 
-error_CUSD:
-        free(line);
-    }
-    // -------------------------------------------------------------
-    //   modify by CYIT 20110819             -----  end  -----
-    // -------------------------------------------------------------
-    else if (strStartsWith(s, "^SINIT:")) {
-        char *inittype = NULL;
-        char type[] = "PHONEBOOK";
-        int initstate = 0;
+// modify by CYIT 20110819 //
+static void onUssd(char *line, const char *sms_pdu)
+{
+    int m = 0, dcs = 0;
+    char *response[3];
+    char mResponse[12];
+    char dcsResponse[12];
 
-        line = p = strdup(s);
-        err = at_tok_start(&p);
-        if (err < 0) goto error_sinit;
-        err = at_tok_nextstr(&p, &inittype);
-        if (err < 0) goto error_sinit;
-        err = at_tok_nextint(&p, &initstate);
-        if (err < 0) goto error_sinit;
+    at_tok_start( &line );
+    if (at_tok_nextint( &line, &m ) < 0)
+    {
+        LOGE("invalid +cusd reason = %d\n", m);
+        return;
+    }
 
-        if (strncmp(type, inittype, strlen(type)) == 0
-                && initstate == 2) { // notify phonebook init state to update FDN facility lock //
-            RIL_onUnsolicitedResponse(RIL_UNSOL_PB_INIT_OVER, NULL, 0);
+    snprintf( mResponse, sizeof(mResponse), "%d", m );
+    response[0] = mResponse;
+    if ( at_tok_hasmore( &line ) )
+    {
+        if (at_tok_nextstr( &line, &( response[1] ) ) < 0)
+        {
+            LOGE("invalid cusd str\n");
+            return;
         }
 
-error_sinit:
-        free(line);
+        if (at_tok_nextint( &line, &dcs ) < 0)
+        {
+            LOGE("invalid cusd dcs = %d\n", dcs);
+            return;
+        }
     }
-
-    else if (strStartsWith(s, "^SCKS:")) 
+    else
     {
-        int   simState = 0x00;
+        response[1] = NULL;
+        dcs = 0xFF;
+    }
+    snprintf( dcsResponse, sizeof(dcsResponse), "%d", dcs );
+    response[2] = dcsResponse;
 
-        line = p = strdup( s );
-        err = at_tok_start( &p );
-        if(err < 0) goto error_SCKS;
+    RIL_onUnsolicitedResponse(RIL_UNSOL_ON_USSD, response, sizeof(response));
+}
 
-        err = at_tok_nextint( &p, &simState );
-        if(err < 0) goto error_SCKS;
+static void onModuleInit(char *line, const char *sms_pdu)
+{
+    char *inittype = NULL;
+    char type[] = "PHONEBOOK";
+    int initstate = 0;
 
-        if(simState != 1)
-        {
-            RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_SIM_STATUS_CHANGED, NULL, 0);
-        }
+    if (at_tok_start(&line) < 0) return;
+    if (at_tok_nextstr(&line, &inittype) < 0) return;
+    if (at_tok_nextint(&line, &initstate) < 0) return;
 
-error_SCKS:
-        free(line);
+    if (strncmp(type, inittype, strlen(type)) == 0
+            && initstate == 2) { // notify phonebook init state to update FDN facility lock //
+        RIL_onUnsolicitedResponse(RIL_UNSOL_PB_INIT_OVER, NULL, 0);
     }
-    // modify by CYIT 20121009  ----- start -----
-    else if (strStartsWith(s, "^SPSL:")) 
+}
+
+static void onSimCardState(char *line, const char *sms_pdu)
+{
+    int   simState = 0x00;
+
+    if (at_tok_start( &line ) < 0) return;
+    if (at_tok_nextint( &line, &simState ) < 0) return;
+
+    if(simState != 1)
     {
-        int   networkNum = 0x00;
-        int   act;
-        char *longOper = NULL;
-        char *shortOper = NULL;
-        char *numOper = NULL;
-        int   i = 0x00;
+        RIL_onUnsolicitedResponse(RIL_UNSOL_RESPONSE_SIM_STATUS_CHANGED, NULL, 0);
+    }
+}
+
+// modify by CYIT 20121009 //
+static void onNetworkList(char *line, const char *sms_pdu)
+{
+    int   networkNum = 0x00;
+    int   act;
+    char *p = line;
+    int   i = 0x00;
 
-        line = p = strdup( s );
-        err = at_tok_start( &p );
-        if(err < 0) goto error_SPSL;
+    if (at_tok_start( &p ) < 0) goto error;
+    if (at_tok_nextint( &p, &networkNum ) < 0) goto error;
 
-        err = at_tok_nextint( &p, &networkNum );
-        if(err < 0) goto error_SPSL;
+    if(networkNum)
+    {
+        char *response[4 * networkNum];
 
-        if(networkNum)
+        for(i = 0x00; i < networkNum; i++)
         {
-            char *response[4 * networkNum];
 
-            for(i = 0x00; i < networkNum; i++)
-            {
+            for (; *p != '\0'; p++) {
+                if (*p == '"') break;
+            }
 
-                for (; *p != '\0'; p++) {
-                    if (*p == '"') break;
+            if (at_tok_nextstr( &p, &response[4 * i + 0] ) < 0 // long alpha oper
+                    || at_tok_nextstr( &p, &response[4 * i + 1] ) < 0 // short alpha oper
+                    || at_tok_nextstr( &p, &response[4 * i + 2] ) < 0) { // numeric alpha oper
+                for (i--; i >= 0; i--) {
+                    free(response[4 * i + 3]);
                 }
+                goto error;
+            }
 
-                err = at_tok_nextstr( &p, &response[4 * i + 0] ); // long alpha oper
-                if(err < 0) goto error_SPSL;
-
-                err = at_tok_nextstr( &p, &response[4 * i + 1] ); // short alpha oper
-                if(err < 0) goto error_SPSL;
-
-                err = at_tok_nextstr( &p, &response[4 * i + 2] ); // numeric alpha oper
-                if(err < 0) goto error_SPSL;
-
-                if ( at_tok_hasmore( &line ) )
+            if ( at_tok_hasmore( &line ) )
+            {
+                // access technology 0..7 //
+                if (at_tok_nextint( &p, &act ) < 0 || act < 0 || act > 7)
                 {
-                    err = at_tok_nextint( &p, &act ); // access technology
-                    if(err < 0) goto error_SPSL;
-
-                    if (0 == act) asprintf(&response[4 * i + 3], "%s", "0");
-                    else if (1 == act) asprintf(&response[4 * i + 3], "%s", "1");
-                    else if (2 == act) asprintf(&response[4 * i + 3], "%s", "2");
-                    else if (3 == act) asprintf(&response[4 * i + 3], "%s", "3");
-                    else if (4 == act) asprintf(&response[4 * i + 3], "%s", "4");
-                    else if (5 == act) asprintf(&response[4 * i + 3], "%s", "5");
-                    else if (6 == act) asprintf(&response[4 * i + 3], "%s", "6");
-                    else if (7 == act) asprintf(&response[4 * i + 3], "%s", "7");
-                    else
-                    {
-                        for ( ; i >= 0; i--) {
-                            free(response[4 * i + 3]);
-                        }
-                        goto error_SPSL;
+                    for (i--; i >= 0; i--) {
+                        free(response[4 * i + 3]);
                     }
+                    goto error;
                 }
-                else
-                {
-                
-                    asprintf(&response[4 * i + 3], "%s", "FF");
-                    
-                }
+                asprintf(&response[4 * i + 3], "%d", act);
             }
-
-            RIL_onUnsolicitedResponse( RIL_UNSOL_NETWORK_LIST, response, sizeof(char *) * 4 * networkNum );
-            for (i = 0; i < networkNum; i++) {
-                free(response[4 * i + 3]);
+            else
+            {
+                asprintf(&response[4 * i + 3], "%s", "FF");
             }
-            free(line);
-            return;
         }
 
-error_SPSL:
-        LOGE("invalid SPSL line: %s\n", s);
-        free(line);
+        RIL_onUnsolicitedResponse( RIL_UNSOL_NETWORK_LIST, response, sizeof(char *) * 4 * networkNum );
+        for (i = 0; i < networkNum; i++) {
+            free(response[4 * i + 3]);
+        }
+        return;
+    }
+
+error:
+    LOGE("invalid SPSL line\n");
+}
+
+static void registerUnsolHandlers(void)
+{
+    static int registered = 0;
+
+    if (registered) return;
+    registered = 1;
+
+    // call, SMS and network handlers share state with the request threads //
+    // or coalesce, they are queued; SIM and the rest only parse and report //
+    // on the reader. A queued call or SMS keeps the AP awake till handled //
+    at_urc_register("%CTZV:", onNitzTime, AT_URC_COPY, AT_URC_LANE_NET);
+    at_urc_register("^DSCI:", onCallStateIndication, AT_URC_WAKE | AT_URC_COPY, AT_URC_LANE_CALL);
+    at_urc_register("+CREG:", onNetworkRegistration, AT_URC_COALESCE | AT_URC_COPY, AT_URC_LANE_NET);
+    at_urc_register("+CGREG:", onDataRegistration, AT_URC_COALESCE | AT_URC_COPY, AT_URC_LANE_NET);
+    at_urc_register("+CMT:", onNewSms, AT_URC_WAKE | AT_URC_COPY, AT_URC_LANE_SMS);
+    at_urc_register("+CMTI:", onNewSmsOnSim, AT_URC_WAKE | AT_URC_COPY, AT_URC_LANE_SMS);
+    at_urc_register("+CDS:", onSmsStatusReport, AT_URC_WAKE | AT_URC_COPY, AT_URC_LANE_SMS);
+    // every +CGEV moves the PDP table, none may be dropped //
+    at_urc_register("+CGEV:", onPacketDomainEvent, AT_URC_COPY, AT_URC_LANE_NET);
+#ifdef WORKAROUND_FAKE_CGEV
+    at_urc_register("+CME ERROR: 150", onPacketDomainEvent, AT_URC_COALESCE | AT_URC_COPY, AT_URC_LANE_NET);
+#endif /* WORKAROUND_FAKE_CGEV */
+    at_urc_register("+CCSS: ", onSubscriptionSource, 0, AT_URC_LANE_ANY);
+    at_urc_register("+WSOS: ", onEmergencyCallbackMode, 0, AT_URC_LANE_ANY);
+    at_urc_register("+WPRL: ", onPrlChanged, 0, AT_URC_LANE_ANY);
+    at_urc_register("+CFUN: 0", onRadioOff, AT_URC_WAKE | AT_URC_COPY, AT_URC_LANE_NET);
+    at_urc_register("^SSTPC:", onStkProactiveCommand, 0, AT_URC_LANE_SIM);
+    at_urc_register("^SSTES:", onStkSessionEnd, 0, AT_URC_LANE_SIM);
+    at_urc_register("^SSTRF:", onStkRefresh, 0, AT_URC_LANE_SIM);
+    at_urc_register("+CUSD:", onUssd, 0, AT_URC_LANE_SIM);
+    at_urc_register("^SINIT:", onModuleInit, 0, AT_URC_LANE_SIM);
+    at_urc_register("^SCKS:", onSimCardState, 0, AT_URC_LANE_SIM);
+    at_urc_register("^SPSL:", onNetworkList, AT_URC_COPY, AT_URC_LANE_NET);
+    at_urc_register("+CSQ:", onSignalStrength, AT_URC_COALESCE | AT_URC_COPY, AT_URC_LANE_NET);
+    at_urc_register("+CESQ:", onExtendedSignalStrength, AT_URC_COALESCE | AT_URC_COPY, AT_URC_LANE_NET);
+}
+
+/**
+ * Called by atchannel when an unsolicited line appears
+ * This is called on atchannel's reader thread. AT commands may
+ * not be issued here, the handlers run later on a URC worker
+ */
+static void onUnsolicited (const char *s, const char *sms_pdu)
+{
+    LOGD("URC: %s", s);
+
+    /* Ignore unsolicited responses until we're initialized.
+     * This is OK because the RIL library will poll for initial state
+     */
+    if ( sState == RADIO_STATE_UNAVAILABLE )
+    {
+        LOGD("radio unavailable ignored URC");
+        return;
     }
-    // modify by CYIT 20121009  -----  end  -----
+
+    // the line is ours until we return, see ATUnsolHandler //
+    at_urc_dispatch((char *)s, sms_pdu);
 }
 
 /* Called on command or reader thread */
@@ -7767,6 +7894,55 @@ static void usage(char *s)
 #endif
 }
 
+// mux and its channels show up shortly after rild, poll instead of sleep(5) //
+#define MUX_OPEN_POLL_MSEC  100
+#define MUX_OPEN_LOG_EVERY  50
+
+#ifdef GSM_MUX_CHANNEL
+/**
+ * Opens mux channel j (0 based) named by property gsm0710mux.channel<j+1>
+ * in raw mode. Returns fd, or -1 if the device is not there yet.
+ */
+static int openMuxChannel(int j, int verbose)
+{
+    char s_muxChannelDevice[PROPERTY_VALUE_MAX] = {0};
+    char property[32];
+    struct termios  ios;
+    int fd;
+
+    snprintf(property, sizeof(property), "gsm0710mux.channel%d", (j + 1));
+    property_get(property, s_muxChannelDevice, "");
+
+    fd = open (s_muxChannelDevice, O_RDWR);
+    if (fd < 0) {
+        if (verbose) {
+            LOGE ("open MUX device %s: %s ERROR: %d, retrying..."
+                    , property, s_muxChannelDevice, errno);
+        }
+        return -1;
+    }
+
+    tcgetattr( fd, &ios );
+
+    ios.c_lflag = 0;  /* disable ECHO, ICANON, etc... */
+    ios.c_oflag &= ~OCRNL;
+    ios.c_iflag &= ~ICRNL;
+    ios.c_cflag &= ~PARENB;
+    ios.c_cflag &= ~CSTOPB;
+    ios.c_cflag &= ~CSIZE;
+    ios.c_cflag |= CS8;
+    ios.c_iflag &= ~(INLCR | ICRNL | IGNCR);
+    ios.c_oflag &= ~(ONLCR | OCRNL);
+    ios.c_lflag &= ~ (ICANON | ECHO | ECHOE | ISIG);
+    ios.c_iflag &= ~ (IXON | IXOFF | IXANY); //open soft flow control
+    tcsetattr( fd, TCSANOW, &ios );
+
+    LOGI ("open MUX device %s: %s fd = %d", property, s_muxChannelDevice, fd);
+
+    return fd;
+}
+#endif /* GSM_MUX_CHANNEL */
+
 static void *
 mainLoop(void *param)
 {
@@ -7774,6 +7950,7 @@ mainLoop(void *param)
     int ret;
     int fds[2];
     int i = 0;
+    int openRetries = 0;
 
     LOGE("== entering mainLoop()");
     at_set_on_reader_closed(onATReaderClosed);
@@ -7808,9 +7985,11 @@ mainLoop(void *param)
                                             SOCK_STREAM );
             } else if (s_device_path != NULL) {
 #ifdef GSM_MUX_CHANNEL	//这个打开的，所以设置fd= 0x00
-                char s_muxEnable[1];
+                char s_muxEnable[PROPERTY_VALUE_MAX];
                 property_get("gsm0710mux.muxing", s_muxEnable, "0");
-                LOGE ("open MUX device : s_muxEnable = %s\n", s_muxEnable);
+                if (openRetries % MUX_OPEN_LOG_EVERY == 0) {
+                    LOGE ("open MUX device : s_muxEnable = %s\n", s_muxEnable);
+                }
                 if(!memcmp( s_muxEnable, "1", 1)){
                     fd = 0x00;		//fd == 0x00
                 }else{
@@ -7855,8 +8034,11 @@ mainLoop(void *param)
             }
 
             if (fd < 0) {
-                LOGE("opening AT interface. retrying...");
-                sleep(10);
+                // mux comes up a few 100 ms after rild, poll it closely //
+                if (openRetries++ % MUX_OPEN_LOG_EVERY == 0) {
+                    LOGE("opening AT interface. retrying...");
+                }
+                usleep(MUX_OPEN_POLL_MSEC * 1000);
                 /* never returns */
             }
         }
@@ -7873,60 +8055,39 @@ mainLoop(void *param)
         s_closed = 0;
 #ifdef GSM_MUX_CHANNEL
         // initialize fd set //
-        memset(v_fds, 0x00, RIL_CHANNELS);
+        for (i = 0; i < RIL_CHANNELS; i++) {
+            v_fds[i] = -1;
+        }
         FD_ZERO(&readMuxs);
 
         int j;
+        int opened = 0;
 		/*
-		 * 带开10个RIL——CHANNEL，也就是虚拟的串口，
-		 * 打开失败时，会重试，知道打开位置
+		 * 打开10个RIL——CHANNEL，也就是虚拟的串口，
+		 * 每轮打开所有还没打开的，失败的隔100ms再试
 		 */
-        for (j = 0 ; j < RIL_CHANNELS; j++)
-        {
-            char  s_muxChannelDevice[7] = {0};
-
-            int size = sizeof("gsm0710mux.channelz");
-            if((j + 1) >= 10) size++;
-            char property[size];
-            snprintf(property, size, "gsm0710mux.channel%d", (j + 1));
-            LOGE ("openning MUX device: %s", property);
-            property_get(property, s_muxChannelDevice, "");
-            LOGE ("open MUX device %d: s_muxChannelDevice = %s", (j + 1), s_muxChannelDevice);
-
-            fd = open (s_muxChannelDevice, O_RDWR);
-
-            struct termios  ios;
-            tcgetattr( fd, &ios );
-
-            ios.c_lflag = 0;  /* disable ECHO, ICANON, etc... */
-            ios.c_oflag &= ~OCRNL;
-            ios.c_iflag &= ~ICRNL;
-            ios.c_cflag &= ~PARENB;
-            ios.c_cflag &= ~CSTOPB;
-            ios.c_cflag &= ~CSIZE;
-            ios.c_cflag |= CS8;
-            ios.c_iflag &= ~(INLCR | ICRNL | IGNCR);
-            ios.c_oflag &= ~(ONLCR | OCRNL);
-            ios.c_lflag &= ~ (ICANON | ECHO | ECHOE | ISIG);
-            ios.c_iflag &= ~ (IXON | IXOFF | IXANY); //open soft flow control
-            tcsetattr( fd, TCSANOW, &ios );
-
-            LOGE ("open MUX device : fd = %d", fd);
-            if(fd < 0){
-                LOGE ("open MUX device %s: %s ERROR: %d, retrying..."
-                        , property, s_muxChannelDevice, errno);
-                sleep(5);
-                j--;
-                continue;
+        openRetries = 0;
+        while (opened < RIL_CHANNELS) {
+            for (j = 0 ; j < RIL_CHANNELS; j++) {
+                if (v_fds[j] >= 0) continue;
+
+                fd = openMuxChannel(j, openRetries % MUX_OPEN_LOG_EVERY == 0);
+                if (fd < 0) continue;
+
+                v_fds[j] = fd;
+                opened++;
+                FD_SET(fd, &readMuxs);
+                if(fd >= nMuxfds){
+                    nMuxfds = fd + 1;
+                }
             }
 
-            v_fds[j] = fd;
-            //if(j > 0) 
-            FD_SET(fd, &readMuxs);
-            if(fd >= nMuxfds){
-                nMuxfds = fd + 1;
+            if (opened < RIL_CHANNELS) {
+                openRetries++;
+                usleep(MUX_OPEN_POLL_MSEC * 1000);
             }
         }
+        LOGI("open MUX device: all %d channels open after %d retries", RIL_CHANNELS, openRetries);
 #endif
         ret = at_open(fd, onUnsolicited);
 
@@ -7963,6 +8124,8 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc, char **a
     pthread_attr_t attr;
 
     s_rilenv = env;
+    registerUnsolHandlers();
+    initPdpList();
 
     while ( -1 != (opt = getopt(argc, argv, "p:d:s:c:"))) {
         switch (opt) {
@@ -8187,66 +8350,39 @@ static void requestSetCurNetMode( void * data , size_t datalen , RIL_Token t )
 
 static void requestGetTDFreq( void * data, size_t datalen, RIL_Token t )
 {
-    int Result = 0, err = 0;
-    int dstlen = 0;
-    unsigned char * srcbinary = NULL;
-    unsigned char * dstbinary = NULL;
-    unsigned short fc = ( unsigned short )E_ATCMD_LOCKFREQ_READ;
+    int err = 0;
     ATResponse * p_response = NULL;
+    ATEgFrame frame;
     int response[9] = { 0 };
+    unsigned int i, num;
 
-    srcbinary = ( unsigned char * )( &fc );
-    err = HandleBinaryStr( 
-        "AT*", 
-        srcbinary, M_EGFC_LEN, 
-        &dstbinary, &dstlen );
-    LOGD( "dstlen = %d", dstlen );
-    if ( err == 0 || dstbinary == NULL || dstlen == 0 ) goto error;
-    
-    err = at_send_egcmd_singleline(dstbinary, dstlen, M_EGPREFIX, &p_response);
-    free( dstbinary );
-
-    if ( err < 0 || p_response->success == 0 )
+    err = at_send_egcmd_binary( E_ATCMD_LOCKFREQ_READ, NULL, 0, M_EGPREFIX, &p_response );
+    if ( err < 0 || p_response->success == 0 || at_eg_frame( p_response, &frame ) < 0 )
     {
         goto error;
     }
-    else
-    {
-        int i = 0;
-        int prefixlen = 0;
-        char * line = p_response->p_intermediates->line;
-        unsigned short num = 0;
-        unsigned short frq = 0;
-
-        prefixlen = M_EGPREFIX_LEN + M_EGFC_LEN + M_EGDATA_LEN;
-        fc = *(( unsigned short * )( line + M_EGPREFIX_LEN ));
-        
-        if ( fc != E_ATCMD_LOCKFREQ_READ )
-        {
-            LOGE( "Unmatching function code: %d." , fc);
-            goto error;
-        }
-
-        // Get FreqNum //
-        num = *(( unsigned short * )( line + prefixlen));
 
-        if( num > 9 )
-        {
-            LOGE( "num error: %d." , num);
-            goto error;
-        }
+    if ( frame.fc != E_ATCMD_LOCKFREQ_READ )
+    {
+        LOGE( "Unmatching function code: %d." , frame.fc);
+        goto error;
+    }
 
-        // Get 9 * FreqInfo //
-        for ( i = 0; i < num; i++ )
-        {
-            frq = *(( unsigned short * )( line + prefixlen + 2 + i * 2 ));
-            response[i] = frq;
-        }
+    // Get FreqNum //
+    num = at_eg_u16( &frame, 0 );
+    if ( num > 9 || 2 + num * 2 > frame.len )
+    {
+        LOGE( "num error: %d." , num);
+        goto error;
+    }
 
-        RIL_onRequestComplete( t, RIL_E_SUCCESS, 
-            response, num * sizeof( int ));
+    // Get 9 * FreqInfo //
+    for ( i = 0; i < num; i++ )
+    {
+        response[i] = at_eg_u16( &frame, 2 + i * 2 );
     }
-    
+
+    RIL_onRequestComplete( t, RIL_E_SUCCESS, response, num * sizeof( int ));
     at_response_free( p_response );
 
     return;
@@ -8260,43 +8396,29 @@ static void requestSetTDFreq( void * data, size_t datalen, RIL_Token t )
 {
     int err = 0;
     int i = 0;
-    int dstlen = 0;
 
-    // FC + FreqNum + FreqInfo //
-    unsigned short src[11];
-    unsigned char * srcbinary = NULL;
-    unsigned char * dstbinary = NULL;
+    // FreqNum + FreqInfo //
+    unsigned short src[10];
     ATResponse * p_response = NULL;
 
     if ( data )
     {
-        memset( src, 0xFFFF, sizeof( src ));
+        memset( src, 0xFF, sizeof( src ));
 
-        // FC //
-        src[0] = ( unsigned short )E_ATCMD_LOCKFREQ_SET;
-    
         // FreqNum //
         LOGD( "datalen = %d", datalen );
-        src[1] = datalen / sizeof( int );
+        src[0] = datalen / sizeof( int );
 
-        if ( src[1] > 9 ) goto error;
+        if ( src[0] > 9 ) goto error;
 
         // FreqInfo //
-        for ( ; i < src[1]; i++ )
+        for ( ; i < src[0]; i++ )
         {
-            src[i + 2] = (( int * )data )[i];
+            src[i + 1] = (( int * )data )[i];
         }
-        srcbinary = ( unsigned char * )src;
 
-        err = HandleBinaryStr( 
-            "AT*", 
-            srcbinary, sizeof( src ), 
-            &dstbinary, &dstlen );
-        LOGD( "dstlen = %d", dstlen );
-        if ( err == 0 || dstbinary == NULL || dstlen== 0 ) goto error;
-            
-        err = at_send_egcmd( dstbinary, dstlen, &p_response );
-        free( dstbinary );
+        err = at_send_egcmd_binary( E_ATCMD_LOCKFREQ_SET, src, sizeof( src ), NULL, &p_response );
+        at_cache_invalidate(AT_CACHE_EV_CONFIG);
         if ( err < 0 || p_response->success == 0 ) goto error;
     }
     else 
@@ -9025,7 +9147,7 @@ static void requestSetPdpActive( void * data , size_t datalen , RIL_Token t )
     int tempint = 0;
     int ttyfd = -1;
     char *pdpport = NULL, *ipaddr = NULL;
-    char *devpath = NULL;
+    ATNetConfig netcfg;
     ATResponse * p_response = NULL;
 
     if (data && datalen == 2 * sizeof(int))
@@ -9093,6 +9215,13 @@ static void requestSetPdpActive( void * data , size_t datalen , RIL_Token t )
         goto error;
     }
 
+    // no type nor address here, the next data call list reads them //
+    if (state == 1) {
+        at_pdp_invalidate("+CGACT=1");
+    } else {
+        at_pdp_deactivated(pdpid);
+    }
+
     if (isMainPdp(pdpid)) {
 
         // Active //
@@ -9135,26 +9264,8 @@ static void requestSetPdpActive( void * data , size_t datalen , RIL_Token t )
             // Set IP and turn it on //
 
 #ifdef USE_RAWIP
-#ifdef GSM_MUX_CHANNEL
-            devpath = malloc(PROPERTY_VALUE_MAX);
-            memset(devpath, 0, PROPERTY_VALUE_MAX);
-            property_get(s_Ttys[pdpid - 1].ttyPath, devpath, "");
-            if (!strcmp(devpath, "")) {
-                LOGE("get %s's device path failed", s_Ttys[pdpid - 1].ttyPath);
-                free(devpath);
-                goto error2;
-            }
-            LOGD("device path is %s", devpath);
-#else
-            devpath = s_Ttys[pdpid - 1].ttyPath;
-#endif
-
-            ttyfd = open(devpath, O_RDWR | O_NOCTTY | O_NONBLOCK);
-#ifdef GSM_MUX_CHANNEL
-            free(devpath);
-#endif
+            ttyfd = openPdpTty(pdpid);
             if (ttyfd < 0) {
-                LOGE("open failed, errno is %s", strerror(errno));
                 goto error2;
             }
             s_Ttys[pdpid - 1].ttyFd = ttyfd;
@@ -9165,16 +9276,16 @@ static void requestSetPdpActive( void * data , size_t datalen , RIL_Token t )
             }
 #endif
 
-            ifc_init();
-            if (ifc_up(pdpport)
-                    || ifc_set_addr(pdpport, inet_addr(ipaddr)))
+            memset(&netcfg, 0, sizeof(netcfg));
+            netcfg.ifname = pdpport;
+            netcfg.address = ipaddr;
+            at_net_config_defaults(&netcfg);
+            if (at_net_configure(&netcfg) < 0)
             {
                 LOGE( "Set IP failed." );
-                ifc_close();
                 goto error2;
             }
-            ifc_close();
-            s_PSCtl[pdpid - 1].m_Used = 1; 
+            setPdpUsed(pdpid, 1);
         } 
         
         // deactive //
@@ -9191,7 +9302,7 @@ static void requestSetPdpActive( void * data , size_t datalen , RIL_Token t )
                 goto error;
             }
 #endif
-            s_PSCtl[pdpid - 1].m_Used = 0;
+            setPdpUsed(pdpid, 0);
         }
     }
 
@@ -9204,10 +9315,6 @@ end:
 
 error2:
 
-#ifdef GSM_MUX_CHANNEL
-    free(devpath);
-#endif
-
     // Deactive pdp //
     at_response_free( p_response );
     p_response = NULL;
@@ -9376,6 +9483,11 @@ static void requestSet2ndPdpContext(void * data , size_t datalen , RIL_Token t)
         goto error;
     }
 
+    // never a data call slot from now on, AT+CGDCONT would overwrite it //
+    pthread_mutex_lock(&s_pdpMutex);
+    s_2ndPdp |= 1u << cid;
+    pthread_mutex_unlock(&s_pdpMutex);
+
     RIL_onRequestComplete(t, RIL_E_SUCCESS, NULL, 0);
     at_response_free(p_response);
 
@@ -10089,6 +10201,9 @@ static void requestSetVersionCtrl( void * data, size_t datalen, RIL_Token t )
         free( dstbinary );
 
         if ( err < 0 || p_response->success == 0 ) goto error;
+
+        // the version read of getVersionInfo() is kept until now //
+        at_cache_invalidate(AT_CACHE_EV_CONFIG);
     }
     else 
     {
@@ -10124,61 +10239,41 @@ error:
 static void requestgetCellInfoList( void * data , size_t datalen , RIL_Token t )
 {
     int err;
-    int dstlen = 0;
     ATResponse *p_response = NULL;
     RIL_CELL_Info response;
-    unsigned char * srcbinary = NULL;
-    unsigned char * dstbinary = NULL;
-    unsigned short fc = ( unsigned short )E_ATCMD_CELLINFO_READ;
-
-    srcbinary = ( unsigned char * )( &fc );
-
-    err = HandleBinaryStr( "AT*", srcbinary, M_EGFC_LEN, &dstbinary, &dstlen );
-    LOGD( "dstlen = %d", dstlen );
-    if ( err == 0 || dstbinary == NULL || dstlen == 0 ) goto error;
-    
-    err = at_send_egcmd_singleline(dstbinary, dstlen, M_EGPREFIX, &p_response);
-    free( dstbinary );
+    ATEgFrame frame;
 
-    if ( err < 0 || p_response->success == 0 )
+    err = at_send_egcmd_binary( E_ATCMD_CELLINFO_READ, NULL, 0, M_EGPREFIX, &p_response );
+    if ( err < 0 || p_response->success == 0 || at_eg_frame( p_response, &frame ) < 0 )
     {
         goto error;
     }
-    else
-    {
-        int prefixlen = 0;
-        char * line = p_response->p_intermediates->line;
-
-        prefixlen = M_EGPREFIX_LEN + M_EGFC_LEN + M_EGDATA_LEN;
-        fc = *(( unsigned short * )( line + M_EGPREFIX_LEN ));
-        
-        if ( fc != E_ATCMD_CELLINFO_READ )
-        {
-            LOGE( "Unmatching function code: %d." , fc);
-            goto error;
-        }
 
-        response.cellfreq = *(( unsigned short * )( line + prefixlen ));
-        response.cellid = *(( unsigned char * )( line + prefixlen + 2 ));
-        response.cellrscp = *(( unsigned char * )( line + prefixlen + 3 ));
-        response.tdcellnum = *(( unsigned short * )( line + prefixlen + 4 ));
-        response.tdcell1freq = *(( unsigned short * )( line + prefixlen + 6 ));
-        response.tdcell1id = *(( unsigned char * )( line + prefixlen + 8 ));
-        response.tdcell1rscp = *(( unsigned char * )( line + prefixlen + 9 ));
-        response.tdcell2freq = *(( unsigned short * )( line + prefixlen + 10 ));
-        response.tdcell2id = *(( unsigned char * )( line + prefixlen + 12 ));
-        response.tdcell2rscp = *(( unsigned char * )( line + prefixlen + 13 ));
-        response.gsmcellnum = *(( unsigned short * )( line + prefixlen + 14 ));
-        response.gsmcell1freq = *(( unsigned short * )( line + prefixlen + 16 ));
-        response.gsmcell1id = *(( unsigned char * )( line + prefixlen + 18 ));
-        response.gsmcell1rscp = *(( unsigned char * )( line + prefixlen + 19 ));
-        response.gsmcell2freq = *(( unsigned short * )( line + prefixlen + 20 ));
-        response.gsmcell2id = *(( unsigned char * )( line + prefixlen + 22 ));
-        response.gsmcell2rscp = *(( unsigned char * )( line + prefixlen + 23 ));
-
-        RIL_onRequestComplete( t, RIL_E_SUCCESS, &response, sizeof (RIL_CELL_Info));
+    if ( frame.fc != E_ATCMD_CELLINFO_READ || frame.len < 24 )
+    {
+        LOGE( "Unmatching function code: %d, length %d." , frame.fc, frame.len);
+        goto error;
     }
-    
+
+    response.cellfreq = at_eg_u16( &frame, 0 );
+    response.cellid = at_eg_u8( &frame, 2 );
+    response.cellrscp = at_eg_u8( &frame, 3 );
+    response.tdcellnum = at_eg_u16( &frame, 4 );
+    response.tdcell1freq = at_eg_u16( &frame, 6 );
+    response.tdcell1id = at_eg_u8( &frame, 8 );
+    response.tdcell1rscp = at_eg_u8( &frame, 9 );
+    response.tdcell2freq = at_eg_u16( &frame, 10 );
+    response.tdcell2id = at_eg_u8( &frame, 12 );
+    response.tdcell2rscp = at_eg_u8( &frame, 13 );
+    response.gsmcellnum = at_eg_u16( &frame, 14 );
+    response.gsmcell1freq = at_eg_u16( &frame, 16 );
+    response.gsmcell1id = at_eg_u8( &frame, 18 );
+    response.gsmcell1rscp = at_eg_u8( &frame, 19 );
+    response.gsmcell2freq = at_eg_u16( &frame, 20 );
+    response.gsmcell2id = at_eg_u8( &frame, 22 );
+    response.gsmcell2rscp = at_eg_u8( &frame, 23 );
+
+    RIL_onRequestComplete( t, RIL_E_SUCCESS, &response, sizeof (RIL_CELL_Info));
     at_response_free( p_response );
 
     return;
@@ -10830,12 +10925,13 @@ error:
 /*====================================================================
 
     FUNCTION: Turn source to binary array which be posted 
-    to COM.
+    to COM, see at_eg_encode(). New code should call
+    at_send_egcmd_binary() instead.
     RETURN VALUE: = 0 failed; > 0 successful.
     
     PARAMETER       IN/OUT      INFO
     -------------   ---------   -------------------------------------
-    prefixstr       in          The prefix string of at command.
+    prefixstr       in          The prefix string of at command, "AT*".
     srcbinary       in          The source binary array not include 
                                 '\r' in the end, include function code 
                                 in the begin and the order of bytes 
@@ -10851,22 +10947,16 @@ static unsigned char HandleBinaryStr(
     unsigned char *srcbinary, unsigned int srclen, 
     unsigned char **dstbinary, unsigned int *dstlen )
 {
-    int num = 0;
-    int len = 0;
-    int prefixlen = 0;
-    unsigned char *p = NULL;
-    T_CRPos *p_crpos = NULL, *p2 = NULL;
-    
-    if ( !prefixstr )
+    unsigned short fc;
+    unsigned int size;
+    int len;
+
+    if ( !prefixstr || strcmp( prefixstr, "AT*" ) )
     {
         return 0;
     }
-    else
-    {
-        prefixlen = strlen( prefixstr );
-    }
 
-    if ( !srcbinary || !srclen )
+    if ( !srcbinary || srclen < M_EGFC_LEN )
     {
         return 0;
     }
@@ -10876,95 +10966,26 @@ static unsigned char HandleBinaryStr(
         return 0;
     }
 
-    p_crpos = ( T_CRPos * )malloc( sizeof( T_CRPos ) );
-    p_crpos->m_pos = -1;
-    p_crpos->m_pnext = NULL;
-
-    LOGD( "begin to get <cr>, srclen = %d", srclen );
-    GetCROfBinaryStr( srcbinary, srclen, &num, p_crpos );
-    LOGD( "end get <cr> num = %d", num );
-
     // "AT*" + number of <crpos> + <crpos> + srclen //
-    len = prefixlen + 1 + num + srclen;
-    *dstlen = len;
-    *dstbinary = ( unsigned char * )malloc( len );
-    memset( *dstbinary, 0, len );
-
-    p = *dstbinary;
-    memcpy( p, prefixstr, prefixlen );
-    p += prefixlen;
-    *p++ = num;
-
-    if ( num )
-    {
-        p2 = p_crpos;
-        do
-        {
-            *p++ = p_crpos->m_pos;
-            p_crpos = p_crpos->m_pnext;
-            free( p2 );
-            p2 = p_crpos;
-        } while ( p2 );
-    }
-    else
-    {
-        free( p_crpos);
-    }
-
-    memcpy( p, srcbinary, srclen );
-
-    return 1;
-}
-
-/*====================================================================
-
-    FUNCTION: Find the postion of '\r' in the source binary array.
-    RETURN VALUE: void.
-    
-    PARAMETER       IN/OUT      INFO
-    -------------   ---------   -------------------------------------
-    srcbinary       in          The source binary array not include 
-                                '\r' in the end, include function code 
-                                in the begin.
-    srclen          in          The size of <srcbinary>.
-    crnum           out         The number of '\r' in source binary array.
-    crpos           out         The position of '\r'.
-    
- ====================================================================*/
-static void GetCROfBinaryStr( 
-    unsigned char *srcbinary, int srclen, 
-    int *crnum, T_CRPos *crpos )
-{
-    int i = 1;
-    int num = 0;
-    unsigned char *p_binary = srcbinary;
-    T_CRPos *p_crpos = crpos;
-
-    for ( ; i <= srclen; i++, p_binary++ )
+    size = 4 + srclen + srclen;
+    *dstbinary = ( unsigned char * )malloc( size );
+    if ( *dstbinary == NULL )
     {
-        if ( *p_binary == 0x0D )
-        {
-            *p_binary = 0x0C;
-
-            if ( num > 0 )
-            {
-                p_crpos->m_pnext = ( T_CRPos * )malloc( sizeof( T_CRPos ) );
-                p_crpos = p_crpos->m_pnext;
-                p_crpos->m_pnext = NULL;
-            }
-
-            p_crpos->m_pos = i + 0x0D;
-            num++;
-        }
+        return 0;
     }
 
-    if ( num == 0x0D )
+    memcpy( &fc, srcbinary, M_EGFC_LEN );
+    len = at_eg_encode( fc, srcbinary + M_EGFC_LEN, srclen - M_EGFC_LEN,
+            *dstbinary, size );
+    if ( len < 0 )
     {
-        num = 0xFB;
+        free( *dstbinary );
+        *dstbinary = NULL;
+        return 0;
     }
-    *crnum = num;
+    *dstlen = len;
 
-    return;
+    return 1;
 }
 
 /*======================================================
@@ -11053,52 +11074,114 @@ static int HexStrToByteArray( char *Sour, unsigned int SourLen,
     return 1;
 }
 
+static void initPdpList(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int i;
+
+    property_get(PDP_PROP_COUNT, value, "");
+    s_pdpNum = value[0] != '\0' ? atoi(value) : PDP_DEF_COUNT;
+    if (s_pdpNum < 1) s_pdpNum = 1;
+    if (s_pdpNum > PDPID_MAX) s_pdpNum = PDPID_MAX;
+
+    s_PSCtl = calloc(s_pdpNum, sizeof(RIL_PS_Ctl));
+#ifdef USE_RAWIP
+    s_Ttys = calloc(s_pdpNum, sizeof(RIL_PS_Tty));
+    if (s_PSCtl == NULL || s_Ttys == NULL) {
+#else
+    if (s_PSCtl == NULL) {
+#endif
+        LOGE("no memory for %d PDP", s_pdpNum);
+        s_pdpNum = 0;
+        return;
+    }
+
+    for (i = 0; i < s_pdpNum; i++) {
+        s_PSCtl[i].m_PID = i + 1;
+#ifdef PDP_PORT_FORMAT
+        snprintf(s_PSCtl[i].m_Port, sizeof(s_PSCtl[i].m_Port), PDP_PORT_FORMAT, i);
+#endif
+#ifdef USE_RAWIP
+        snprintf(s_Ttys[i].ttyPath, sizeof(s_Ttys[i].ttyPath), PDP_TTY_FORMAT,
+                PDP_TTY_BASE + i * PDP_TTY_STEP);
+        s_Ttys[i].ttyFd = -1;
+#endif
+    }
+
+    LOGI("%d PDP, %s first", s_pdpNum, s_PSCtl[0].m_Port);
+}
+
 static void resetPdpList()
 {
     int pdpnum = 0;
 
-    while (pdpnum < M_MAXNUM_PDP) {
-        s_PSCtl[pdpnum].m_Used = 0;
+    pthread_mutex_lock(&s_pdpMutex);
+    while (pdpnum < s_pdpNum) {
+        // a setup still running keeps its slot //
+        if (s_PSCtl[pdpnum].m_Used == 1) s_PSCtl[pdpnum].m_Used = 0;
         pdpnum++;
     }
+    pthread_mutex_unlock(&s_pdpMutex);
 
     return;
 }
 
 static char * getPdpPort(char * PdpID)
+{
+    int pdpid = atoi(PdpID);
+
+    if (!isMainPdp(pdpid)) return NULL;
+
+    return s_PSCtl[pdpid - 1].m_Port;
+}
+
+/* finds an unused PDP and marks it being set up, 0 when all are used */
+static int claimPdp(void)
 {
     int pdpnum = 0;
+    int pdpid = 0;
 
-    while (pdpnum < M_MAXNUM_PDP) {
-        if (atoi(PdpID) == s_PSCtl[pdpnum].m_PID) {
-            return s_PSCtl[pdpnum].m_Port;
+    pthread_mutex_lock(&s_pdpMutex);
+    while (pdpnum < s_pdpNum) {
+        if (0 == s_PSCtl[pdpnum].m_Used
+                && !(s_2ndPdp & (1u << s_PSCtl[pdpnum].m_PID))) {
+            s_PSCtl[pdpnum].m_Used = 2;
+            pdpid = s_PSCtl[pdpnum].m_PID;
+            break;
         }
 
         pdpnum++;
     }
+    pthread_mutex_unlock(&s_pdpMutex);
 
-    return NULL;
+    return pdpid;
 }
 
-static int getUnUsedPdp()
+static void setPdpUsed(int pdpid, int used)
 {
-    int pdpnum = 0;
+    if (!isMainPdp(pdpid)) return;
 
-    while (pdpnum < M_MAXNUM_PDP) {
-        if (0 == s_PSCtl[pdpnum].m_Used) {
-            return s_PSCtl[pdpnum].m_PID;
-        }
+    pthread_mutex_lock(&s_pdpMutex);
+    s_PSCtl[pdpid - 1].m_Used = used;
+    pthread_mutex_unlock(&s_pdpMutex);
+}
 
-        pdpnum++;
-    }
+/* follows the modem state, a slot being set up is left alone */
+static void refreshPdpUsed(int pdpid, int used)
+{
+    if (!isMainPdp(pdpid)) return;
 
-    return 0;
+    pthread_mutex_lock(&s_pdpMutex);
+    if (s_PSCtl[pdpid - 1].m_Used != 2) s_PSCtl[pdpid - 1].m_Used = used;
+    pthread_mutex_unlock(&s_pdpMutex);
 }
 
+/* a slot cid not taken by a secondary context, s_2ndPdp only grows */
 inline static int isMainPdp(int pdpid)
 {
     return ((pdpid >= MAINPDPID_MIN 
-     && pdpid <= MAINPDPID_MAX) ? 1 : 0);
+     && pdpid <= s_pdpNum
+     && !(s_2ndPdp & (1u << pdpid))) ? 1 : 0);
 }
 
 static void requestGetIMEISV( void * data , size_t datalen , RIL_Token t )
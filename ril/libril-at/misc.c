@@ -16,6 +16,8 @@
 ** limitations under the License.
 */
 
+#include <ctype.h>
+
 /** returns 1 if line starts with prefix, 0 if it does not */
 int strStartsWith(const char *line, const char *prefix)
 {
@@ -28,3 +30,46 @@ int strStartsWith(const char *line, const char *prefix)
     return *prefix == '\0';
 }
 
+void atCommandKey(const char *command, char *key, int size)
+{
+    const char *p = command;
+    int n = 0;
+
+    if ((p[0] == 'A' || p[0] == 'a') && (p[1] == 'T' || p[1] == 't')) p += 2;
+
+    if (*p == '&') key[n++] = *p++;
+    if (isalpha((unsigned char)*p)) {
+        key[n++] = toupper((unsigned char)*p);
+        key[n] = '\0';
+        return;
+    }
+
+    while (*p != '\0' && *p != '=' && *p != '?' && *p != ';'
+            && !isspace((unsigned char)*p) && n < size - 3) {
+        key[n++] = toupper((unsigned char)*p++);
+    }
+    if (p[0] == '=' && p[1] == '?') {
+        key[n++] = '=';
+        key[n++] = '?';
+    } else if (p[0] == '=' || p[0] == '?') {
+        key[n++] = p[0];
+    }
+    // bare "AT", an empty key would read as a free slot //
+    if (n == 0) {
+        key[n++] = 'A';
+        key[n++] = 'T';
+    }
+    key[n] = '\0';
+}
+
+void atUnsolKey(const char *line, char *key, int size)
+{
+    int n = 0;
+
+    while (line[n] != '\0' && line[n] != ':' && line[n] != '\r'
+            && line[n] != '\n' && n < size - 1) {
+        key[n] = line[n];
+        n++;
+    }
+    key[n] = '\0';
+}
@@ -18,3 +18,14 @@
 
 /** returns 1 if line starts with prefix, 0 if it does not */
 int strStartsWith(const char *line, const char *prefix);
+
+/**
+ * Writes the statistics key of an AT command line into key[size].
+ * Basic commands keep their letter only (ATD123; -> "D"), extended
+ * ones keep name and form (AT+COPS=?, AT+COPS?, AT+COPS=1 -> "+COPS=").
+ * A bare AT gets "AT", the key is never empty.
+ */
+void atCommandKey(const char *command, char *key, int size);
+
+/** same for an unsolicited line, the part before ':' ("+CREG: 1" -> "+CREG") */
+void atUnsolKey(const char *line, char *key, int size);
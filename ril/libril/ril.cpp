@@ -136,6 +136,7 @@ typedef struct RequestInfo {
     int client_id;      // 0 or 1 corresponding to each of RIL.java clients
     Parcel parcel;      // save the parcel from RILJ
     void * userParam;   // save the userParam in timeReq, may be NULL
+    long long queuedUs; // monotonic time appended to pending list
 } RequestInfo;
 
 typedef struct UserCallbackInfo {
@@ -231,6 +232,17 @@ static char rild[6] = {0};
 
 extern "C" pthread_key_t CID;
 
+// queue time of the request each channel is dispatching, see RIL_getRequestQueuedUs() //
+static long long s_dispatchQueuedUs[RIL_CHANNELS] = {0};
+
+// request each channel is dispatching, only compared: answered, it is freed //
+static RequestInfo *s_dispatching[RIL_CHANNELS] = {NULL};
+static int32_t s_dispatchingReq[RIL_CHANNELS] = {0};
+static int s_dispatchingClient[RIL_CHANNELS] = {0};
+
+// debug port handler registered by the vendor RIL, see RIL_registerDebugDumper() //
+static void (*s_debugDumper)(int fd, int argc, char **argv) = NULL;
+
 /*******************************************************************/
 
 static void dispatchVoid (Parcel& p, RequestInfo *pRI);
@@ -416,6 +428,13 @@ void   nullParcelReleaseFunction (const uint8_t* data, size_t dataSize,
     // do nothing -- the data reference lives longer than the Parcel object
 }
 
+static long long monotonicUs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
 /**
  * To be called from dispatch thread
  * Issue a single local request, ensuring that the response
@@ -435,6 +454,7 @@ issueLocalRequest(int request, void *data, int len, int client_id) {
     pRI->pCI = &(s_commands[request]);
     pRI->client_id = client_id;
     pRI->parcel.setData((uint8_t*)data, len);
+    pRI->queuedUs = monotonicUs();
 
     ret = pthread_mutex_lock(&s_pendingRequestsMutex[cid]);
     assert (ret == 0);
@@ -456,6 +476,50 @@ issueLocalRequest(int request, void *data, int len, int client_id) {
     assert (ret == 0);
 }
 
+static int
+isNetworkScan(int32_t request) {
+    return request == RIL_REQUEST_QUERY_AVAILABLE_NETWORKS
+            || request == RIL_REQUEST_QUERY_NETWORKS_WITH_TYPE;
+}
+
+/**
+ * network selections are queued behind a running network scan on the
+ * same channel, the scan is cancelled rather than waited for
+ */
+static int
+preemptsScan(int32_t request, RequestInfo *running, int cid) {
+    if (running != s_dispatching[cid] || running->local
+            || s_callbacks[running->client_id].onCancel == NULL) {
+        return 0;
+    }
+    if (!isNetworkScan(running->pCI->requestNumber)) {
+        return 0;
+    }
+
+    return request == RIL_REQUEST_SET_NETWORK_SELECTION_AUTOMATIC
+            || request == RIL_REQUEST_SET_NETWORK_SELECTION_MANUAL;
+}
+
+/**
+ * a scan answered from the vendor RIL's kept list goes on refreshing it
+ * on its channel; any other request queued there stops the refresh,
+ * the vendor RIL instance of the scan is told with onCancel(NULL)
+ */
+static int
+preemptsRefresh(int32_t request, int cid) {
+    RequestInfo *p_cur;
+
+    if (!isNetworkScan(s_dispatchingReq[cid]) || isNetworkScan(request)) {
+        return 0;
+    }
+    // still queued, the scan has not answered yet //
+    for (p_cur = s_pendingRequests[cid]; p_cur != NULL; p_cur = p_cur->p_next) {
+        if (p_cur == s_dispatching[cid]) return 0;
+    }
+
+    return 1;
+}
+
 static int
 processCommandBuffer(void *buffer, size_t buflen, int client_id) {
     status_t status;
@@ -497,6 +561,7 @@ processCommandBuffer(void *buffer, size_t buflen, int client_id) {
     }
     
     pRI->p_next = NULL;
+    pRI->queuedUs = monotonicUs();
     cid = pRI->pCI->cid - 1;
 
     // append request to tail of pending list //
@@ -504,9 +569,21 @@ processCommandBuffer(void *buffer, size_t buflen, int client_id) {
     assert (ret == 0);
     LOGD("[DISPATCH]: append request %s token(%04d) to pending list(%d)", 
             requestToString(pRI->pCI->requestNumber), pRI->token, cid);
+    if (preemptsRefresh(request, cid)
+            && s_callbacks[s_dispatchingClient[cid]].onCancel != NULL) {
+        LOGD("[DISPATCH]: %s stops the network scan refresh", requestToString(request));
+        s_callbacks[s_dispatchingClient[cid]].onCancel(NULL);
+    }
     if (!s_pendingRequests[cid]) {
         s_pendingRequests[cid] = pRI;
     } else {
+        if (preemptsScan(request, s_pendingRequests[cid], cid)) {
+            // a selection made while the scan runs, the scan result is moot //
+            LOGD("[DISPATCH]: %s cancels %s",
+                    requestToString(request),
+                    requestToString(s_pendingRequests[cid]->pCI->requestNumber));
+            s_callbacks[s_pendingRequests[cid]->client_id].onCancel(s_pendingRequests[cid]);
+        }
         s_pending_tail[cid]->p_next = pRI;
     }
     s_pending_tail[cid] = pRI;
@@ -3121,6 +3198,12 @@ static void onCommandsSocketClosed() {
             ) {
             p_cur->cancelled = 1;
         }
+        // nobody waits for the one running any more //
+        p_cur = s_pendingRequests[i];
+        if (p_cur != NULL && !p_cur->local
+                && s_callbacks[p_cur->client_id].onCancel != NULL) {
+            s_callbacks[p_cur->client_id].onCancel(p_cur);
+        }
         ret = pthread_mutex_unlock(&s_pendingRequestsMutex[i]);
         assert (ret == 0);
     }
@@ -3444,6 +3527,12 @@ static void debugCallback (int fd, short flags, void *param) {
             issueLocalRequest(RIL_REQUEST_HANGUP, &hangupData,
                               sizeof(hangupData), client_id);
             break;
+        case 11:
+            LOGI("Debug port: Dump vendor RIL statistics");
+            if (s_debugDumper != NULL) {
+                s_debugDumper(acceptFD, number - 1, args + 1);
+            }
+            break;
         default:
             LOGE ("Invalid request");
             break;
@@ -3507,6 +3596,7 @@ static void userTimerCallback(int fd, short flags, void *param)
     }
 
     pRI->p_next = NULL;
+    pRI->queuedUs = monotonicUs();
     cid = pRI->pCI->cid - 1;
     
     // append timeReq to pending list //
@@ -3585,6 +3675,12 @@ static void * requestLoop(void * param)
 
             LOGD("[REQ%d]: dispatch requests %s token(%04d)", 
                     cid, requestToString(reqnum), token);
+            s_dispatchQueuedUs[cid] = s_pendingRequests[cid]->queuedUs;
+            pthread_mutex_lock(&s_pendingRequestsMutex[cid]);
+            s_dispatching[cid] = s_pendingRequests[cid];
+            s_dispatchingReq[cid] = reqnum;
+            s_dispatchingClient[cid] = s_pendingRequests[cid]->client_id;
+            pthread_mutex_unlock(&s_pendingRequestsMutex[cid]);
             // local request like debugReq and timeReq //
             if (s_pendingRequests[cid]->local == 1) {
                 if (token == 0xFFFFFFFF) {
@@ -3598,6 +3694,10 @@ static void * requestLoop(void * param)
                 s_pendingRequests[cid]->pCI->dispatchFunction(
                         s_pendingRequests[cid]->parcel, s_pendingRequests[cid]);
             }
+            pthread_mutex_lock(&s_pendingRequestsMutex[cid]);
+            s_dispatching[cid] = NULL;
+            s_dispatchingReq[cid] = 0;
+            pthread_mutex_unlock(&s_pendingRequestsMutex[cid]);
             LOGD("[REQ%d]: dispatch requests %s token(%04d) over", 
                     cid, requestToString(reqnum), token);
         }
@@ -3692,6 +3792,29 @@ RIL_startEventLoop(void) {
 	}
 }
 
+/**
+ * Monotonic time in usec at which the request being dispatched on
+ * channel cid (0 based) was appended to the pending list.
+ * Lets the vendor RIL measure how long a request waited for its channel.
+ */
+extern "C" long long
+RIL_getRequestQueuedUs(int cid) {
+    if (cid < 0 || cid >= RIL_CHANNELS) {
+        return 0;
+    }
+    return s_dispatchQueuedUs[cid];
+}
+
+/**
+ * Registers the handler of debug port option 11. It is called on the
+ * event loop thread with the accepted socket and the remaining args,
+ * and writes its text report to fd.
+ */
+extern "C" void
+RIL_registerDebugDumper(void (*dumper)(int fd, int argc, char **argv)) {
+    s_debugDumper = dumper;
+}
+
 // Used for testing purpose only.
 extern "C" void RIL_setcallbacks (const RIL_RadioFunctions *callbacks, int client_id) {
     memcpy(&s_callbacks[client_id], callbacks, sizeof (RIL_RadioFunctions));
@@ -34,6 +34,7 @@ enum options {
     DIAL_CALL,
     ANSWER_CALL,
     END_CALL,
+    DUMP_STATS,
 };
 
 
@@ -49,7 +50,8 @@ static void print_usage() {
            7 - DEACTIVE_PDP, \n\
            8 number - DIAL_CALL number, \n\
            9 - ANSWER_CALL, \n\
-           10 - END_CALL \n");
+           10 - END_CALL, \n\
+           11 [reset] - DUMP_STATS of AT channels, reset after dump \n");
 }
 
 static int error_check(int argc, char * argv[]) {
@@ -57,7 +59,9 @@ static int error_check(int argc, char * argv[]) {
         return -1;
     }
     const int option = atoi(argv[1]);
-    if (option < 0 || option > 10) {
+    if (option < 0 || option > 11) {
+        return 0;
+    } else if (option == DUMP_STATS && (argc == 2 || argc == 3)) {
         return 0;
     } else if ((option == DIAL_CALL || option == SETUP_PDP) && argc == 3) {
         return 0;
@@ -67,9 +71,11 @@ static int error_check(int argc, char * argv[]) {
     return -1;
 }
 
-static int get_number_args(char *argv[]) {
+static int get_number_args(int argc, char *argv[]) {
     const int option = atoi(argv[1]);
-    if (option != DIAL_CALL && option != SETUP_PDP) {
+    if (option == DUMP_STATS) {
+        return argc - 1;
+    } else if (option != DIAL_CALL && option != SETUP_PDP) {
         return 1;
     } else {
         return 2;
@@ -94,7 +100,7 @@ int main(int argc, char *argv[])
         exit(-1);
     }
 
-    num_socket_args = get_number_args(argv);
+    num_socket_args = get_number_args(argc, argv);
     int ret = send(fd, (const void *)&num_socket_args, sizeof(int), 0);
     if(ret != sizeof(int)) {
         perror ("Socket write error when sending num args");
@@ -119,6 +125,14 @@ int main(int argc, char *argv[])
         }
     }
 
+    // rild answers this one with a text report, then closes //
+    if (atoi(argv[1]) == DUMP_STATS) {
+        char buf[1024];
+        while ((ret = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            fwrite(buf, 1, ret, stdout);
+        }
+    }
+
     close(fd);
     return 0;
 }